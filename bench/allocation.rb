@@ -0,0 +1,50 @@
+# Measures the objects and heap allocated while walking every cursor of a large translation unit, along with the
+# types, locations, extents and tokens reached from them.
+#
+#   ruby -Ilib bench/allocation.rb [source_file] [compiler args...]
+#
+# Without a source file, a synthetic source with many declarations and statements is generated.
+
+require 'benchmark'
+require 'objspace'
+require 'tempfile'
+require 'clang/clang'
+
+source = ARGV.shift
+unless source
+  file = Tempfile.new(['allocation', '.c'])
+  2000.times do |i|
+    file.puts "struct s#{i} { int a; float b; char *c; };"
+    file.puts "static int f#{i}(struct s#{i} *p, int x) { if (x > #{i}) return p->a + x; return (int) p->b; }"
+  end
+  file.flush
+  source = file.path
+end
+
+index = Clang::Index.create
+unit = Clang::TranslationUnit.parse(index, source, ARGV)
+
+def measure(label)
+  GC.start
+  GC.disable
+  before = GC.stat
+  count = 0
+  time = Benchmark.realtime { count = yield }
+  after = GC.stat
+  GC.enable
+
+  objects = after[:total_allocated_objects] - before[:total_allocated_objects]
+  malloc = after[:malloc_increase_bytes] - before[:malloc_increase_bytes]
+  printf("%-22s %9d values %10d objects %12d malloc bytes %10.0f objects/s %8.1f bytes/value\n",
+         label, count, objects, malloc, objects / time, malloc.to_f / [count, 1].max)
+end
+
+cursor = unit.cursor
+measure('Cursor') { n = 0; cursor.each_descendant { n += 1 }; n }
+measure('Cursor#type') { n = 0; cursor.each_descendant { |c| c.type; n += 1 }; n }
+measure('Cursor#location') { n = 0; cursor.each_descendant { |c| c.location; n += 1 }; n }
+measure('Cursor#extent') { n = 0; cursor.each_descendant { |c| c.extent; n += 1 }; n }
+measure('Token') { unit.tokenize(cursor.extent).count }
+
+sample = [cursor, cursor.type, cursor.location, cursor.extent, unit.tokenize(cursor.extent).first].compact
+sample.each { |value| printf("%-22s %d bytes\n", "#{value.class} size", ObjectSpace.memsize_of(value)) }
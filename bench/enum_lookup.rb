@@ -0,0 +1,35 @@
+# Measures enum lookups over every cursor of a large translation unit.
+#
+#   ruby -Ilib bench/enum_lookup.rb [source_file] [compiler args...]
+#
+# Without a source file, a synthetic source with many declarations and statements is generated.
+
+require 'benchmark'
+require 'tempfile'
+require 'clang/clang'
+
+source = ARGV.shift
+unless source
+  file = Tempfile.new(['enum_lookup', '.c'])
+  2000.times do |i|
+    file.puts "struct s#{i} { int a; float b; char *c; };"
+    file.puts "static int f#{i}(struct s#{i} *p, int x) { if (x > #{i}) return p->a + x; return (int) p->b; }"
+  end
+  file.flush
+  source = file.path
+end
+
+index = Clang::Index.create
+unit = Clang::TranslationUnit.parse(index, source, ARGV)
+
+cursors = []
+unit.cursor.each_descendant { |cursor| cursors << cursor }
+tokens = unit.tokenize(unit.cursor.extent).to_a
+puts "#{cursors.size} cursors, #{tokens.size} tokens"
+
+Benchmark.bm(22) do |x|
+  x.report('Cursor#kind') { 5.times { cursors.each(&:kind) } }
+  x.report('Token#kind') { 5.times { tokens.each(&:kind) } }
+  x.report('CursorKind#symbol') { 5.times { cursors.size.times { |i| Clang::CursorKind.symbol(i % 300) } } }
+  x.report('default_options') { 100_000.times { Clang::TranslationUnit.default_options } }
+end
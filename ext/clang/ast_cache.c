@@ -0,0 +1,671 @@
+#include "clang.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "CXASTDEPS 1\n"
+#define CACHE_FNV_OFFSET 0xcbf29ce484222325ULL
+#define CACHE_FNV_PRIME 0x100000001b3ULL
+
+// Temporary files older than this were left behind by a process that died while writing them
+#define CACHE_STALE_TMP 3600
+
+// Entries are content-addressed: "<key>.deps" lists the dependencies of the source with the modification time and
+// size they were parsed with, and "<key>-<deps>.ast" is the AST for that exact state, so it never changes once written.
+typedef struct
+{
+    VALUE index;
+    VALUE directory;
+    unsigned long long max_bytes;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long stores;
+    unsigned long long evictions;
+    unsigned int counter;
+} rb_ast_cache;
+
+typedef struct
+{
+    rb_strtab paths;
+    int64_t *mtimes;
+    uint32_t capa;
+    int failed;
+} cache_deps;
+
+// A file of the cache, with the key of the entry it belongs to and the time that entry was last used
+typedef struct
+{
+    char *name;
+    off_t size;
+    time_t mtime;
+    uint64_t key;
+    time_t used;
+} cache_entry;
+
+static void cache_mark(void *data)
+{
+    rb_ast_cache *cache = data;
+    rb_gc_mark(cache->index);
+    rb_gc_mark(cache->directory);
+}
+
+static const rb_data_type_t cache_type = {
+    "Clang::ASTCache",
+    {cache_mark, RUBY_TYPED_DEFAULT_FREE, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_ast_cache *cache_ptr(VALUE self)
+{
+    rb_ast_cache *cache = rb_check_typeddata(self, &cache_type);
+    if (NIL_P(cache->directory))
+        rb_raise(rb_eRuntimeError, "AST cache is not initialized");
+    return cache;
+}
+
+static uint64_t cache_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * CACHE_FNV_PRIME;
+    return hash;
+}
+
+static uint64_t cache_hash_str(uint64_t hash, const char *str)
+{
+    return cache_hash(hash, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+static uint64_t cache_hash_dep(uint64_t hash, const char *path, long long mtime, long long size)
+{
+    hash = cache_hash_str(hash, path);
+    hash = cache_hash(hash, &mtime, sizeof(mtime));
+    return cache_hash(hash, &size, sizeof(size));
+}
+
+// Everything that determines the AST besides the files on disk, including the version of Clang that writes it
+static uint64_t cache_key(VALUE source, VALUE args, VALUE unsaved, unsigned int options)
+{
+    CXString version = clang_getClangVersion();
+    uint64_t hash = cache_hash_str(CACHE_FNV_OFFSET, clang_getCString(version));
+    clang_disposeString(version);
+
+    hash = cache_hash_str(hash, NIL_P(source) ? NULL : StringValueCStr(source));
+    hash = cache_hash(hash, &options, sizeof(options));
+
+    long n = RTEST(args) ? rb_array_len(args) : 0;
+    hash = cache_hash(hash, &n, sizeof(n));
+    for (long i = 0; i < n; i++)
+    {
+        VALUE arg = rb_ary_entry(args, i);
+        hash = cache_hash_str(hash, StringValueCStr(arg));
+    }
+
+    unsaved = rb_unsaved_ary(unsaved);
+    n = rb_array_len(unsaved);
+    for (long i = 0; i < n; i++)
+    {
+        VALUE file = rb_ary_entry(unsaved, i);
+        rb_assert_type(file, rb_cCXUnsavedFile);
+        struct CXUnsavedFile *f = DATA_PTR(file);
+        hash = cache_hash_str(hash, f->Filename);
+        hash = cache_hash(hash, &f->Length, sizeof(f->Length));
+        if (f->Contents)
+            hash = cache_hash(hash, f->Contents, f->Length);
+    }
+    return hash;
+}
+
+static VALUE cache_manifest_path(const rb_ast_cache *cache, uint64_t key)
+{
+    return rb_sprintf("%" PRIsVALUE "/%016llx.deps", cache->directory, (unsigned long long) key);
+}
+
+static VALUE cache_ast_path(const rb_ast_cache *cache, uint64_t key, uint64_t deps)
+{
+    return rb_sprintf("%" PRIsVALUE "/%016llx-%016llx.ast", cache->directory, (unsigned long long) key,
+                      (unsigned long long) deps);
+}
+
+static VALUE cache_tmp_path(rb_ast_cache *cache, VALUE path)
+{
+    return rb_sprintf("%" PRIsVALUE ".%d.%u.tmp", path, (int) getpid(), cache->counter++);
+}
+
+// Returns the path of the AST a manifest points to, or nil when it cannot be read. Unless checked, this is the path even
+// when dependencies have changed since it was written, otherwise nil is returned for those too.
+static VALUE cache_manifest_ast(const rb_ast_cache *cache, uint64_t key, int check)
+{
+    VALUE manifest = cache_manifest_path(cache, key);
+    FILE *io = fopen(StringValueCStr(manifest), "r");
+    if (!io)
+        return Qnil;
+
+    char *line = NULL;
+    size_t capa = 0;
+    ssize_t len = getline(&line, &capa, io);
+    uint64_t hash = key;
+    int valid = len > 0 && strcmp(line, CACHE_MAGIC) == 0;
+
+    while (valid && (len = getline(&line, &capa, io)) > 0)
+    {
+        if (line[len - 1] == '\n')
+            line[len - 1] = '\0';
+
+        long long mtime, size;
+        int offset = 0;
+        struct stat st;
+        if (sscanf(line, "%lld %lld %n", &mtime, &size, &offset) != 2 || !offset)
+            valid = 0;
+        else
+        {
+            const char *path = line + offset;
+            if (check)
+                valid = stat(path, &st) == 0 && (long long) st.st_mtime == mtime && (long long) st.st_size == size;
+            hash = cache_hash_dep(hash, path, mtime, size);
+        }
+    }
+
+    free(line);
+    fclose(io);
+    return valid ? cache_ast_path(cache, key, hash) : Qnil;
+}
+
+// Returns the path of the AST for the current state of the dependencies, or nil when any of them has changed
+static VALUE cache_lookup(const rb_ast_cache *cache, uint64_t key)
+{
+    return cache_manifest_ast(cache, key, 1);
+}
+
+static void cache_inclusion(CXFile file, CXSourceLocation *stack, unsigned int depth, CXClientData data)
+{
+    cache_deps *deps = data;
+    if (deps->failed)
+        return;
+
+    CXString name = clang_getFileName(file);
+    const char *path = clang_getCString(name);
+    unsigned int id;
+    if (!path || !*path || strchr(path, '\n') || !rb_strtab_intern(&deps->paths, path, strlen(path), &id))
+        deps->failed = 1;
+    clang_disposeString(name);
+
+    if (deps->failed)
+        return;
+    if (id >= deps->capa)
+    {
+        uint32_t capa = deps->capa ? deps->capa * 2 : 64;
+        int64_t *mtimes = realloc(deps->mtimes, sizeof(int64_t) * capa);
+        if (!mtimes)
+        {
+            deps->failed = 1;
+            return;
+        }
+        deps->mtimes = mtimes;
+        deps->capa = capa;
+    }
+    deps->mtimes[id] = (int64_t) clang_getFileTime(file);
+}
+
+static int cache_write(const char *path, VALUE str)
+{
+    FILE *io = fopen(path, "wb");
+    if (!io)
+        return 0;
+
+    size_t len = RSTRING_LEN(str);
+    int written = fwrite(RSTRING_PTR(str), 1, len, io) == len;
+    return (fclose(io) == 0) & written;
+}
+
+// Units are saved and loaded through libclang directly, so that only its own failures are told apart from exceptions
+// such as interrupts, which always propagate
+typedef struct
+{
+    VALUE unit;
+    CXTranslationUnit tu;
+    const char *path;
+    int result;
+} cache_save_call;
+
+static void *cache_save_nogvl(void *data)
+{
+    cache_save_call *call = data;
+    call->result = clang_saveTranslationUnit(call->tu, call->path, CXSaveTranslationUnit_None);
+    return NULL;
+}
+
+static VALUE cache_save_run(VALUE data)
+{
+    cache_save_call *call = (cache_save_call *) data;
+    call->tu = rb_tu_lock_exclusive(call->unit);
+    rb_thread_call_without_gvl(cache_save_nogvl, call, NULL, NULL);
+    return Qnil;
+}
+
+static VALUE cache_save_done(VALUE data)
+{
+    cache_save_call *call = (cache_save_call *) data;
+    if (call->tu)
+        rb_tu_unlock(call->unit);
+    return Qnil;
+}
+
+static VALUE cache_save_unit(VALUE data)
+{
+    return rb_ensure(cache_save_run, data, cache_save_done, data);
+}
+
+typedef struct
+{
+    CXIndex index;
+    const char *path;
+    CXTranslationUnit unit;
+    enum CXErrorCode result;
+} cache_load_call;
+
+static void *cache_load_nogvl(void *data)
+{
+    cache_load_call *call = data;
+    call->result = clang_createTranslationUnit2(call->index, call->path, &call->unit);
+    return NULL;
+}
+
+// Returns the unit loaded from an AST, or nil when libclang cannot read it
+static VALUE cache_load_unit(const rb_ast_cache *cache, VALUE ast)
+{
+    cache_load_call call = {DATA_PTR(cache->index), StringValueCStr(ast)};
+
+    // Interrupts are only checked once the loaded unit is owned by an object, so that raising cannot leak it
+    rb_thread_call_without_gvl2(cache_load_nogvl, &call, NULL, NULL);
+    VALUE unit = call.result == CXError_Success && call.unit ? rb_tu_wrap(rb_cCXTranslationUnit, call.unit, cache->index)
+                                                              : Qnil;
+    RB_GC_GUARD(ast);
+    rb_thread_check_ints();
+    return unit;
+}
+
+// Both files are written beside their destination and renamed over it, which concurrent readers only see whole
+static int cache_publish(VALUE tmp, VALUE path)
+{
+    if (rename(StringValueCStr(tmp), StringValueCStr(path)) == 0)
+        return 1;
+    unlink(RSTRING_PTR(tmp));
+    return 0;
+}
+
+static void cache_prune_to(rb_ast_cache *cache, unsigned long long limit, unsigned long long *evicted);
+
+static int cache_store(rb_ast_cache *cache, uint64_t key, VALUE unit)
+{
+    // Every file the source includes, itself among them, is a dependency
+    cache_deps deps = {0};
+    if (!rb_strtab_init(&deps.paths))
+        rb_memerror();
+    clang_getInclusions(rb_tu_unit(unit), cache_inclusion, &deps);
+
+    VALUE manifest = rb_str_new_cstr(CACHE_MAGIC);
+    uint64_t hash = key;
+    for (unsigned int id = 1; !deps.failed && id < deps.paths.count; id++)
+    {
+        const char *path = rb_strtab_get(&deps.paths, id, NULL);
+        struct stat st;
+        if (stat(path, &st) != 0 || (int64_t) st.st_mtime != deps.mtimes[id])
+        {
+            deps.failed = 1;
+            break;
+        }
+
+        long long mtime = deps.mtimes[id], size = st.st_size;
+        rb_str_catf(manifest, "%lld %lld %s\n", mtime, size, path);
+        hash = cache_hash_dep(hash, path, mtime, size);
+    }
+
+    int stored = !deps.failed && deps.paths.count > 1;
+    rb_strtab_free(&deps.paths);
+    free(deps.mtimes);
+    if (!stored)
+        return 0;
+
+    // A unit that cannot be saved, for instance because of errors, is still returned, only without being cached
+    VALUE ast = cache_ast_path(cache, key, hash);
+    VALUE tmp = cache_tmp_path(cache, ast);
+    cache_save_call call = {unit, NULL, StringValueCStr(tmp), CXSaveError_Unknown};
+    int state;
+    rb_protect(cache_save_unit, (VALUE) &call, &state);
+    if (state || call.result != CXSaveError_None)
+    {
+        unlink(RSTRING_PTR(tmp));
+        if (state)
+            rb_jump_tag(state);
+        return 0;
+    }
+    if (!cache_publish(tmp, ast))
+        return 0;
+
+    // The AST of the manifest this one replaces can never be looked up again, so it is removed rather than left to prune
+    VALUE path = cache_manifest_path(cache, key);
+    VALUE previous = cache_manifest_ast(cache, key, 0);
+    tmp = cache_tmp_path(cache, path);
+    if (!cache_write(StringValueCStr(tmp), manifest))
+    {
+        unlink(RSTRING_PTR(tmp));
+        return 0;
+    }
+    if (!cache_publish(tmp, path))
+        return 0;
+    if (!NIL_P(previous) && !RTEST(rb_str_equal(previous, ast)))
+        unlink(RSTRING_PTR(previous));
+
+    cache->stores++;
+    if (cache->max_bytes)
+        cache_prune_to(cache, cache->max_bytes, &cache->evictions);
+    return 1;
+}
+
+static int cache_suffix(const char *name, const char *suffix)
+{
+    size_t len = strlen(name), n = strlen(suffix);
+    return len > n && strcmp(name + len - n, suffix) == 0;
+}
+
+static int cache_key_compare(const void *a, const void *b)
+{
+    const cache_entry *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static int cache_use_compare(const void *a, const void *b)
+{
+    const cache_entry *x = a, *y = b;
+    if (x->used != y->used)
+        return x->used < y->used ? -1 : 1;
+    return cache_key_compare(a, b);
+}
+
+static void cache_entries_free(cache_entry *entries, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+}
+
+// Lists the files of the cache with their total size, deleting temporary files that were abandoned
+static cache_entry *cache_scan(const rb_ast_cache *cache, size_t *count, unsigned long long *total)
+{
+    const char *directory = RSTRING_PTR(cache->directory);
+    DIR *dir = opendir(directory);
+    if (!dir)
+        rb_sys_fail(directory);
+
+    cache_entry *entries = NULL;
+    size_t capa = 0;
+    time_t now = time(NULL);
+    struct dirent *e;
+    *count = 0;
+    *total = 0;
+
+    while ((e = readdir(dir)))
+    {
+        int tmp = cache_suffix(e->d_name, ".tmp");
+        if (!tmp && !cache_suffix(e->d_name, ".ast") && !cache_suffix(e->d_name, ".deps"))
+            continue;
+
+        char path[PATH_MAX];
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", directory, e->d_name) >= (int) sizeof(path) || stat(path, &st) != 0)
+            continue;
+
+        if (tmp)
+        {
+            if (now - st.st_mtime > CACHE_STALE_TMP)
+                unlink(path);
+            continue;
+        }
+
+        if (*count == capa)
+        {
+            capa = capa ? capa * 2 : 64;
+            cache_entry *grown = realloc(entries, sizeof(cache_entry) * capa);
+            if (!grown)
+            {
+                closedir(dir);
+                cache_entries_free(entries, *count);
+                rb_memerror();
+            }
+            entries = grown;
+        }
+
+        cache_entry *entry = &entries[*count];
+        if (!(entry->name = strdup(path)))
+        {
+            closedir(dir);
+            cache_entries_free(entries, *count);
+            rb_memerror();
+        }
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtime;
+        entry->key = strtoull(e->d_name, NULL, 16);
+        entry->used = st.st_mtime;
+        *total += (unsigned long long) st.st_size;
+        (*count)++;
+    }
+
+    closedir(dir);
+    return entries;
+}
+
+// Hits touch the manifest and the AST they load, and an entry was last used when the newest of its files was written
+// or touched. Entries are removed whole, least recently used first, so that a manifest is never left without its AST.
+static void cache_prune_to(rb_ast_cache *cache, unsigned long long limit, unsigned long long *evicted)
+{
+    size_t count;
+    unsigned long long total;
+    cache_entry *entries = cache_scan(cache, &count, &total);
+
+    qsort(entries, count, sizeof(cache_entry), cache_key_compare);
+    for (size_t i = 0, j; i < count; i = j)
+    {
+        time_t used = entries[i].mtime;
+        for (j = i + 1; j < count && entries[j].key == entries[i].key; j++)
+            used = entries[j].mtime > used ? entries[j].mtime : used;
+        while (i < j)
+            entries[i++].used = used;
+    }
+
+    qsort(entries, count, sizeof(cache_entry), cache_use_compare);
+    for (size_t i = 0, j; i < count && total > limit; i = j)
+    {
+        for (j = i; j < count && entries[j].key == entries[i].key; j++)
+        {
+            if (unlink(entries[j].name) == 0 || errno == ENOENT)
+                total -= (unsigned long long) entries[j].size;
+        }
+        if (evicted)
+            (*evicted)++;
+    }
+
+    cache_entries_free(entries, count);
+}
+
+static VALUE cache_alloc(VALUE klass)
+{
+    rb_ast_cache *cache;
+    VALUE obj = TypedData_Make_Struct(klass, rb_ast_cache, &cache_type, cache);
+    cache->index = Qnil;
+    cache->directory = Qnil;
+    return obj;
+}
+
+static void cache_set_max_bytes(rb_ast_cache *cache, VALUE max_bytes)
+{
+    if (max_bytes == Qundef || NIL_P(max_bytes))
+    {
+        cache->max_bytes = 0;
+        return;
+    }
+
+    long long n = NUM2LL(max_bytes);
+    if (n <= 0)
+        rb_raise(rb_eArgError, "max_bytes must be greater than 0");
+    cache->max_bytes = (unsigned long long) n;
+}
+
+static VALUE cache_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE index, directory, kwargs;
+    rb_scan_args(argc, argv, "2:", &index, &directory, &kwargs);
+    rb_assert_type(index, rb_cCXIndex);
+
+    ID keys[1] = {rb_intern("max_bytes")};
+    VALUE max_bytes;
+    rb_get_kwargs(kwargs, keys, 0, 1, &max_bytes);
+
+    rb_ast_cache *cache = rb_check_typeddata(self, &cache_type);
+    cache_set_max_bytes(cache, max_bytes);
+
+    directory = rb_str_new_frozen(rb_get_path(directory));
+    if (mkdir(StringValueCStr(directory), 0777) != 0 && errno != EEXIST)
+        rb_sys_fail_str(directory);
+
+    RB_OBJ_WRITE(self, &cache->index, index);
+    RB_OBJ_WRITE(self, &cache->directory, directory);
+    return self;
+}
+
+static VALUE cache_fetch(int argc, VALUE *argv, VALUE self)
+{
+    VALUE source, args, unsaved, opts;
+    rb_scan_args(argc, argv, "12*", &source, &args, &unsaved, &opts);
+
+    rb_ast_cache *cache = cache_ptr(self);
+    unsigned int mask = rb_enum_mask(rb_TranslationUnitFlags, opts);
+    uint64_t key = cache_key(source, args, unsaved, mask);
+
+    VALUE ast = cache_lookup(cache, key);
+    if (!NIL_P(ast))
+    {
+        VALUE unit = cache_load_unit(cache, ast);
+        if (!NIL_P(unit))
+        {
+            utimes(RSTRING_PTR(ast), NULL);
+            utimes(RSTRING_PTR(cache_manifest_path(cache, key)), NULL);
+            cache->hits++;
+            return unit;
+        }
+
+        // An AST that cannot be read, for instance one that was truncated on disk, is parsed again and replaced
+        unlink(RSTRING_PTR(ast));
+    }
+
+    cache->misses++;
+    VALUE params = rb_ary_new_from_args(4, cache->index, source, args, unsaved);
+    rb_ary_concat(params, opts);
+    VALUE unit = rb_funcallv(rb_cCXTranslationUnit, rb_intern("parse"), (int) RARRAY_LEN(params),
+                             RARRAY_CONST_PTR(params));
+    cache_store(cache, key, unit);
+
+    RB_GC_GUARD(params);
+    return unit;
+}
+
+static VALUE cache_is_cached(int argc, VALUE *argv, VALUE self)
+{
+    VALUE source, args, unsaved, opts;
+    rb_scan_args(argc, argv, "12*", &source, &args, &unsaved, &opts);
+
+    rb_ast_cache *cache = cache_ptr(self);
+    uint64_t key = cache_key(source, args, unsaved, rb_enum_mask(rb_TranslationUnitFlags, opts));
+    VALUE ast = cache_lookup(cache, key);
+    return RB_BOOL(!NIL_P(ast) && access(RSTRING_PTR(ast), R_OK) == 0);
+}
+
+static VALUE cache_prune(int argc, VALUE *argv, VALUE self)
+{
+    rb_ast_cache *cache = cache_ptr(self);
+    unsigned long long limit = cache->max_bytes;
+    if (rb_check_arity(argc, 0, 1) && !NIL_P(argv[0]))
+    {
+        long long n = NUM2LL(argv[0]);
+        limit = n < 0 ? 0 : (unsigned long long) n;
+    }
+    else if (!limit)
+        return INT2FIX(0);
+
+    unsigned long long evicted = 0;
+    cache_prune_to(cache, limit, &evicted);
+    cache->evictions += evicted;
+    return ULL2NUM(evicted);
+}
+
+static VALUE cache_clear(VALUE self)
+{
+    cache_prune_to(cache_ptr(self), 0, NULL);
+    return self;
+}
+
+static VALUE cache_bytesize(VALUE self)
+{
+    size_t count;
+    unsigned long long total;
+    cache_entries_free(cache_scan(cache_ptr(self), &count, &total), count);
+    return ULL2NUM(total);
+}
+
+static VALUE cache_stats(VALUE self)
+{
+    rb_ast_cache *cache = cache_ptr(self);
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, STR2SYM("hits"), ULL2NUM(cache->hits));
+    rb_hash_aset(hash, STR2SYM("misses"), ULL2NUM(cache->misses));
+    rb_hash_aset(hash, STR2SYM("stores"), ULL2NUM(cache->stores));
+    rb_hash_aset(hash, STR2SYM("evictions"), ULL2NUM(cache->evictions));
+    return hash;
+}
+
+static VALUE cache_index(VALUE self)
+{
+    return cache_ptr(self)->index;
+}
+
+static VALUE cache_directory(VALUE self)
+{
+    return cache_ptr(self)->directory;
+}
+
+static VALUE cache_max_bytes(VALUE self)
+{
+    rb_ast_cache *cache = cache_ptr(self);
+    return cache->max_bytes ? ULL2NUM(cache->max_bytes) : Qnil;
+}
+
+static VALUE cache_set_max_bytes_m(VALUE self, VALUE max_bytes)
+{
+    cache_set_max_bytes(cache_ptr(self), max_bytes);
+    return max_bytes;
+}
+
+void Init_clang_ast_cache(void)
+{
+    rb_define_alloc_func(rb_cCXASTCache, cache_alloc);
+    rb_define_methodm1(rb_cCXASTCache, "initialize", cache_initialize, -1);
+    rb_define_method0(rb_cCXASTCache, "index", cache_index, 0);
+    rb_define_method0(rb_cCXASTCache, "directory", cache_directory, 0);
+    rb_define_method0(rb_cCXASTCache, "max_bytes", cache_max_bytes, 0);
+    rb_define_method1(rb_cCXASTCache, "max_bytes=", cache_set_max_bytes_m, 1);
+    rb_define_methodm1(rb_cCXASTCache, "fetch", cache_fetch, -1);
+    rb_define_methodm1(rb_cCXASTCache, "cached?", cache_is_cached, -1);
+    rb_define_methodm1(rb_cCXASTCache, "prune", cache_prune, -1);
+    rb_define_method0(rb_cCXASTCache, "clear", cache_clear, 0);
+    rb_define_method0(rb_cCXASTCache, "bytesize", cache_bytesize, 0);
+    rb_define_method0(rb_cCXASTCache, "stats", cache_stats, 0);
+}
@@ -0,0 +1,374 @@
+#include "clang.h"
+#include <stdint.h>
+#include <ruby/thread.h>
+
+#define AST_NO_PARENT UINT32_MAX
+
+enum
+{
+    AST_KIND,
+    AST_PARENT,
+    AST_FILE,
+    AST_LINE,
+    AST_COLUMN,
+    AST_OFFSET,
+    AST_SPELLING,
+    AST_USR,
+    AST_NUM_COLUMNS
+};
+
+static const char *ast_column_names[AST_NUM_COLUMNS] = {"kind",   "parent", "file",     "line",
+                                                        "column", "offset", "spelling", "usr"};
+
+// One row per cursor, stored column-wise so that each column can be exported as a single buffer
+typedef struct
+{
+    uint32_t rows;
+    uint32_t capa;
+    uint32_t *columns[AST_NUM_COLUMNS];
+    rb_strtab files;
+    rb_strtab strings;
+    CXTranslationUnit unit;
+    int usr;
+    int failed;
+    CXFile last_file;
+    uint32_t last_file_id;
+} rb_ast_table;
+
+typedef struct
+{
+    rb_ast_table *table;
+    uint32_t parent;
+} ast_visit;
+
+static void ast_table_free(void *data)
+{
+    rb_ast_table *table = data;
+    for (int i = 0; i < AST_NUM_COLUMNS; i++)
+        free(table->columns[i]);
+    rb_strtab_free(&table->files);
+    rb_strtab_free(&table->strings);
+    xfree(table);
+}
+
+static size_t ast_table_memsize(const void *data)
+{
+    const rb_ast_table *table = data;
+    size_t size = sizeof(rb_ast_table) + sizeof(uint32_t) * AST_NUM_COLUMNS * table->capa;
+    return size + rb_strtab_memsize(&table->files) + rb_strtab_memsize(&table->strings);
+}
+
+static const rb_data_type_t ast_table_type = {
+    "Clang::ASTTable",
+    {NULL, ast_table_free, ast_table_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static int ast_intern(rb_strtab *tab, CXString str, uint32_t *id)
+{
+    const char *cstr = clang_getCString(str);
+    unsigned int value = 0;
+    int result = !cstr || rb_strtab_intern(tab, cstr, strlen(cstr), &value);
+    clang_disposeString(str);
+    *id = value;
+    return result;
+}
+
+static int ast_grow(rb_ast_table *table)
+{
+    uint32_t capa = table->capa ? table->capa * 2 : 1024;
+    for (int i = 0; i < AST_NUM_COLUMNS; i++)
+    {
+        uint32_t *column = realloc(table->columns[i], sizeof(uint32_t) * capa);
+        if (!column)
+            return 0;
+        table->columns[i] = column;
+    }
+    table->capa = capa;
+    return 1;
+}
+
+static int ast_append(rb_ast_table *table, CXCursor cursor, uint32_t parent, uint32_t *row)
+{
+    if (table->rows == table->capa && !ast_grow(table))
+        return 0;
+
+    uint32_t i = table->rows;
+    unsigned int line, column, offset;
+    CXFile file;
+    clang_getFileLocation(clang_getCursorLocation(cursor), &file, &line, &column, &offset);
+
+    // Consecutive cursors are almost always in the same file, so the last lookup is reused
+    if (!file)
+    {
+        table->columns[AST_FILE][i] = 0;
+    }
+    else if (file == table->last_file)
+    {
+        table->columns[AST_FILE][i] = table->last_file_id;
+    }
+    else
+    {
+        if (!ast_intern(&table->files, clang_getFileName(file), &table->columns[AST_FILE][i]))
+            return 0;
+        table->last_file = file;
+        table->last_file_id = table->columns[AST_FILE][i];
+    }
+
+    table->columns[AST_KIND][i] = cursor.kind;
+    table->columns[AST_PARENT][i] = parent;
+    table->columns[AST_LINE][i] = line;
+    table->columns[AST_COLUMN][i] = column;
+    table->columns[AST_OFFSET][i] = offset;
+    if (!ast_intern(&table->strings, clang_getCursorSpelling(cursor), &table->columns[AST_SPELLING][i]))
+        return 0;
+
+    table->columns[AST_USR][i] = 0;
+    if (table->usr && clang_isDeclaration(cursor.kind) &&
+        !ast_intern(&table->strings, clang_getCursorUSR(cursor), &table->columns[AST_USR][i]))
+        return 0;
+
+    *row = table->rows++;
+    return 1;
+}
+
+static enum CXChildVisitResult ast_visitor(CXCursor cursor, CXCursor parent, CXClientData data)
+{
+    ast_visit *visit = data;
+    ast_visit child = {visit->table, 0};
+
+    if (visit->table->rows == AST_NO_PARENT || !ast_append(visit->table, cursor, visit->parent, &child.parent))
+    {
+        visit->table->failed = 1;
+        return CXChildVisit_Break;
+    }
+
+    // Children are visited with their own parent row, rather than looking up the parent cursor of each node
+    clang_visitChildren(cursor, ast_visitor, &child);
+    return visit->table->failed ? CXChildVisit_Break : CXChildVisit_Continue;
+}
+
+static void *ast_build_nogvl(void *data)
+{
+    rb_ast_table *table = data;
+    ast_visit visit = {table, AST_NO_PARENT};
+    clang_visitChildren(clang_getTranslationUnitCursor(table->unit), ast_visitor, &visit);
+    return NULL;
+}
+
+static rb_ast_table *ast_table_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &ast_table_type);
+}
+
+static uint32_t ast_row(rb_ast_table *table, VALUE index)
+{
+    long i = NUM2LONG(index);
+    if (i < 0)
+        i += table->rows;
+    if (i < 0 || i >= table->rows)
+        rb_raise(rb_eIndexError, "row %ld out of range", NUM2LONG(index));
+    return (uint32_t) i;
+}
+
+static int ast_column_index(VALUE name)
+{
+    if (!SYMBOL_P(name))
+        rb_raise(rb_eTypeError, "%s is not a Symbol", CLASS_NAME(name));
+
+    ID id = SYM2ID(name);
+    for (int i = 0; i < AST_NUM_COLUMNS; i++)
+    {
+        if (id == rb_intern(ast_column_names[i]))
+            return i;
+    }
+    rb_raise(rb_eArgError, "unknown column %" PRIsVALUE, name);
+    return -1;
+}
+
+static VALUE ast_value(rb_ast_table *table, int column, uint32_t row)
+{
+    uint32_t value = table->columns[column][row];
+    switch (column)
+    {
+        case AST_KIND:
+            return rb_enum_symbol(rb_CursorKind, value);
+        case AST_PARENT:
+            return value == AST_NO_PARENT ? Qnil : UINT2NUM(value);
+        case AST_FILE:
+            return rb_strtab_str(&table->files, value);
+        case AST_SPELLING:
+        case AST_USR:
+            return rb_strtab_str(&table->strings, value);
+        default:
+            return UINT2NUM(value);
+    }
+}
+
+static VALUE tu_ast_table(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[1] = {rb_intern("usr")};
+    VALUE usr;
+    rb_get_kwargs(kwargs, keys, 0, 1, &usr);
+
+    rb_ast_table *table = ZALLOC(rb_ast_table);
+    VALUE obj = TypedData_Wrap_Struct(rb_cCXASTTable, &ast_table_type, table);
+
+    table->usr = usr == Qundef || RTEST(usr);
+    table->unit = rb_tu_unit(self);
+    if (!rb_strtab_init(&table->files) || !rb_strtab_init(&table->strings))
+        rb_memerror();
+
+    // Nothing in the traversal touches Ruby, so the whole pass runs without the GVL
+    rb_tu_without_gvl(self, ast_build_nogvl, table, NULL, NULL);
+    RB_GC_GUARD(self);
+
+    if (table->failed)
+        rb_memerror();
+    return obj;
+}
+
+static VALUE ast_size(VALUE self)
+{
+    return UINT2NUM(ast_table_ptr(self)->rows);
+}
+
+static VALUE ast_files(VALUE self)
+{
+    return rb_strtab_ary(&ast_table_ptr(self)->files);
+}
+
+static VALUE ast_strings(VALUE self)
+{
+    return rb_strtab_ary(&ast_table_ptr(self)->strings);
+}
+
+static VALUE ast_row_hash(rb_ast_table *table, uint32_t row)
+{
+    VALUE hash = rb_hash_new();
+    for (int i = 0; i < AST_NUM_COLUMNS; i++)
+        rb_hash_aset(hash, STR2SYM(ast_column_names[i]), ast_value(table, i, row));
+    return hash;
+}
+
+static VALUE ast_get(VALUE self, VALUE index)
+{
+    rb_ast_table *table = ast_table_ptr(self);
+    return ast_row_hash(table, ast_row(table, index));
+}
+
+static VALUE ast_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    rb_ast_table *table = ast_table_ptr(self);
+    for (uint32_t i = 0; i < table->rows; i++)
+        rb_yield(ast_row_hash(table, i));
+
+    return self;
+}
+
+static VALUE ast_column(VALUE self, VALUE name)
+{
+    rb_ast_table *table = ast_table_ptr(self);
+    int column = ast_column_index(name);
+
+    VALUE ary = rb_ary_new_capa(table->rows);
+    for (uint32_t i = 0; i < table->rows; i++)
+        rb_ary_store(ary, i, ast_value(table, column, i));
+    return ary;
+}
+
+static VALUE ast_pack(VALUE self, VALUE name)
+{
+    rb_ast_table *table = ast_table_ptr(self);
+    int column = ast_column_index(name);
+    return rb_str_new((const char *) table->columns[column], sizeof(uint32_t) * table->rows);
+}
+
+static VALUE ast_where(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[3] = {rb_intern("kind"), rb_intern("file"), rb_intern("parent")};
+    VALUE values[3];
+    rb_get_kwargs(kwargs, keys, 0, 3, values);
+
+    rb_ast_table *table = ast_table_ptr(self);
+    VALUE kinds = values[0] == Qundef || NIL_P(values[0]) ? Qnil : rb_Array(values[0]);
+    VALUE files = values[1] == Qundef || NIL_P(values[1]) ? Qnil : rb_Array(values[1]);
+    long num_kinds = NIL_P(kinds) ? 0 : rb_array_len(kinds);
+    long num_files = NIL_P(files) ? 0 : rb_array_len(files);
+
+    VALUE kind_buffer, file_buffer;
+    uint32_t *kind_values = ALLOCV_N(uint32_t, kind_buffer, num_kinds > 0 ? num_kinds : 1);
+    for (long i = 0; i < num_kinds; i++)
+        kind_values[i] = rb_enum_value(rb_CursorKind, rb_ary_entry(kinds, i));
+
+    // A file that was never interned cannot match any row
+    uint32_t *file_values = ALLOCV_N(uint32_t, file_buffer, num_files > 0 ? num_files : 1);
+    long num_file_ids = 0;
+    for (long i = 0; i < num_files; i++)
+    {
+        VALUE file = rb_ary_entry(files, i);
+        unsigned int id;
+        if (rb_strtab_find(&table->files, StringValuePtr(file), RSTRING_LEN(file), &id))
+            file_values[num_file_ids++] = id;
+    }
+
+    int filter_parent = values[2] != Qundef;
+    uint32_t parent = filter_parent && !NIL_P(values[2]) ? NUM2UINT(values[2]) : AST_NO_PARENT;
+
+    VALUE ary = rb_ary_new();
+    for (uint32_t row = 0; row < table->rows; row++)
+    {
+        if (filter_parent && table->columns[AST_PARENT][row] != parent)
+            continue;
+
+        if (num_kinds)
+        {
+            long k = 0;
+            while (k < num_kinds && kind_values[k] != table->columns[AST_KIND][row])
+                k++;
+            if (k == num_kinds)
+                continue;
+        }
+
+        if (!NIL_P(files))
+        {
+            long f = 0;
+            while (f < num_file_ids && file_values[f] != table->columns[AST_FILE][row])
+                f++;
+            if (f == num_file_ids)
+                continue;
+        }
+
+        rb_ary_push(ary, UINT2NUM(row));
+    }
+
+    ALLOCV_END(kind_buffer);
+    ALLOCV_END(file_buffer);
+    return ary;
+}
+
+void Init_clang_ast_table(void)
+{
+    rb_define_methodm1(rb_cCXTranslationUnit, "ast_table", tu_ast_table, -1);
+
+    rb_undef_alloc_func(rb_cCXASTTable);
+    rb_include_module(rb_cCXASTTable, rb_mEnumerable);
+    rb_define_method0(rb_cCXASTTable, "size", ast_size, 0);
+    rb_define_method0(rb_cCXASTTable, "files", ast_files, 0);
+    rb_define_method0(rb_cCXASTTable, "strings", ast_strings, 0);
+    rb_define_method1(rb_cCXASTTable, "[]", ast_get, 1);
+    rb_define_method0(rb_cCXASTTable, "each", ast_each, 0);
+    rb_define_method1(rb_cCXASTTable, "column", ast_column, 1);
+    rb_define_method1(rb_cCXASTTable, "pack", ast_pack, 1);
+    rb_define_methodm1(rb_cCXASTTable, "where", ast_where, -1);
+    rb_define_alias(rb_cCXASTTable, "length", "size");
+}
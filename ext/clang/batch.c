@@ -0,0 +1,301 @@
+#include "clang.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <ruby/thread.h>
+
+typedef struct
+{
+    rb_tu_args args;
+    CXTranslationUnit unit;
+    int result;
+    int worker;
+} batch_job;
+
+typedef struct batch batch;
+
+typedef struct
+{
+    batch *owner;
+    int id;
+    pthread_t thread;
+    CXIndex index;
+} batch_worker;
+
+struct batch
+{
+    rb_tu_batch params;
+    rb_tu_args *inputs;
+    batch_job *jobs;
+    long next;
+    long *completed;
+    long num_completed;
+    long num_yielded;
+    int cancelled;
+    int interrupted;
+    int num_workers;
+    batch_worker *workers;
+    VALUE indices;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void *batch_work(void *data)
+{
+    batch_worker *worker = data;
+    batch *b = worker->owner;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&b->lock);
+        long i = b->cancelled ? b->params.count : b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->params.count)
+            break;
+
+        // Concurrent parses within a single index are not supported by libclang, so each worker creates its own
+        batch_job *job = &b->jobs[i];
+        if (!worker->index)
+        {
+            worker->index = clang_createIndex(b->params.exclude_pch, b->params.display);
+            clang_CXIndex_setGlobalOptions(worker->index, b->params.global_options);
+        }
+        CXIndex index = worker->index;
+
+        rb_tu_args *a = &job->args;
+        struct CXUnsavedFile *files = b->params.unsaved.files;
+        unsigned int num_files = b->params.unsaved.num_files;
+        const char *const *argv = (const char *const *) a->argv;
+
+        if (b->params.full_argv)
+            job->result = clang_parseTranslationUnit2FullArgv(index, a->source, argv, a->argc, files, num_files,
+                                                              b->params.options, &job->unit);
+        else
+            job->result = clang_parseTranslationUnit2(index, a->source, argv, a->argc, files, num_files,
+                                                      b->params.options, &job->unit);
+        job->worker = worker->id;
+
+        pthread_mutex_lock(&b->lock);
+        b->completed[b->num_completed++] = i;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->lock);
+    }
+
+    return NULL;
+}
+
+static void *batch_wait(void *data)
+{
+    batch *b = data;
+    pthread_mutex_lock(&b->lock);
+    while (!b->interrupted && b->num_completed == b->num_yielded)
+        pthread_cond_wait(&b->cond, &b->lock);
+    b->interrupted = 0;
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+static void batch_interrupt(void *data)
+{
+    batch *b = data;
+    pthread_mutex_lock(&b->lock);
+    b->interrupted = 1;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void *batch_join(void *data)
+{
+    batch *b = data;
+    for (int i = 0; i < b->num_workers; i++)
+        pthread_join(b->workers[i].thread, NULL);
+    return NULL;
+}
+
+static VALUE batch_index(batch *b, int worker)
+{
+    // Translation units keep their index alive, so a worker's index is handed to Ruby with its first unit
+    VALUE index = rb_ary_entry(b->indices, worker);
+    if (NIL_P(index))
+    {
+        index = rb_index_wrap(b->workers[worker].index);
+        rb_ary_store(b->indices, worker, index);
+    }
+    return index;
+}
+
+static VALUE batch_each(VALUE data)
+{
+    batch *b = (batch *) data;
+
+    while (b->num_yielded < b->params.count)
+    {
+        pthread_mutex_lock(&b->lock);
+        long available = b->num_completed;
+        pthread_mutex_unlock(&b->lock);
+
+        if (available == b->num_yielded)
+        {
+            rb_thread_call_without_gvl(batch_wait, b, batch_interrupt, b);
+            rb_thread_check_ints();
+            continue;
+        }
+
+        while (b->num_yielded < available)
+        {
+            long i = b->completed[b->num_yielded++];
+            batch_job *job = &b->jobs[i];
+            VALUE result;
+
+            if (job->result == CXError_Success && job->unit)
+            {
+                result = rb_tu_wrap(b->params.klass, job->unit, batch_index(b, job->worker));
+                job->unit = NULL;
+            }
+            else
+            {
+                result = rb_tu_error(job->result == CXError_Success ? CXError_Failure : job->result);
+            }
+
+            rb_yield_values(2, rb_ary_entry(b->params.keys, i), result);
+        }
+    }
+
+    return Qnil;
+}
+
+static VALUE batch_ensure(VALUE data)
+{
+    batch *b = (batch *) data;
+
+    pthread_mutex_lock(&b->lock);
+    b->cancelled = 1;
+    pthread_mutex_unlock(&b->lock);
+    rb_thread_call_without_gvl(batch_join, b, NULL, NULL);
+
+    // Anything not yet handed to Ruby is still owned by the batch
+    for (long i = 0; i < b->params.count; i++)
+    {
+        if (b->jobs[i].unit)
+            clang_disposeTranslationUnit(b->jobs[i].unit);
+        rb_tu_args_free(&b->jobs[i].args);
+    }
+    for (int i = 0; i < b->num_workers; i++)
+    {
+        if (b->workers[i].index && NIL_P(rb_ary_entry(b->indices, i)))
+            clang_disposeIndex(b->workers[i].index);
+    }
+
+    rb_tu_args_free(&b->params.unsaved);
+    pthread_cond_destroy(&b->cond);
+    pthread_mutex_destroy(&b->lock);
+    xfree(b->inputs);
+    xfree(b->workers);
+    xfree(b->completed);
+    xfree(b->jobs);
+    return Qnil;
+}
+
+int rb_tu_batch_threads(VALUE threads)
+{
+    if (!NIL_P(threads))
+    {
+        int n = NUM2INT(threads);
+        if (n < 1)
+            rb_raise(rb_eArgError, "thread count must be greater than 0");
+        return n;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+void rb_tu_batch_run(rb_tu_batch *params, rb_tu_args *jobs)
+{
+    // Takes ownership of the jobs and the shared unsaved files, which are released once the batch completes
+    batch b;
+    memset(&b, 0, sizeof(batch));
+    b.params = *params;
+    b.inputs = jobs;
+    b.indices = rb_ary_new();
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.cond, NULL);
+
+    b.jobs = ZALLOC_N(batch_job, params->count);
+    for (long i = 0; i < params->count; i++)
+        b.jobs[i].args = jobs[i];
+    b.completed = ALLOC_N(long, params->count);
+
+    int threads = params->threads < params->count ? params->threads : (int) params->count;
+    b.workers = ZALLOC_N(batch_worker, threads);
+    for (int i = 0; i < threads; i++)
+    {
+        b.workers[i].owner = &b;
+        b.workers[i].id = i;
+        if (pthread_create(&b.workers[i].thread, NULL, batch_work, &b.workers[i]) != 0)
+            break;
+        b.num_workers++;
+    }
+
+    if (b.num_workers == 0 && params->count > 0)
+    {
+        batch_ensure((VALUE) &b);
+        rb_raise(rb_eThreadError, "failed to create worker threads");
+    }
+
+    rb_ensure(batch_each, (VALUE) &b, batch_ensure, (VALUE) &b);
+    RB_GC_GUARD(b.indices);
+}
+
+static VALUE tu_parse_all(int argc, VALUE *argv, VALUE klass)
+{
+    RETURN_ENUMERATOR_KW(klass, argc, argv, rb_keyword_given_p());
+
+    VALUE index, sources, args, unsaved, opts, kwargs;
+    rb_scan_args(argc, argv, "22*:", &index, &sources, &args, &unsaved, &opts, &kwargs);
+
+    rb_assert_type(index, rb_cCXIndex);
+    sources = rb_ary_dup(rb_Array(sources));
+
+    ID keys[1] = {rb_intern("threads")};
+    VALUE threads;
+    rb_get_kwargs(kwargs, keys, 0, 1, &threads);
+
+    rb_tu_batch params;
+    memset(&params, 0, sizeof(rb_tu_batch));
+    params.klass = klass;
+    rb_index_batch_params(index, &params);
+    params.keys = sources;
+    params.count = rb_array_len(sources);
+    params.options = rb_enum_mask(rb_TranslationUnitFlags, opts);
+    params.threads = rb_tu_batch_threads(threads == Qundef ? Qnil : threads);
+
+    for (long i = 0; i < params.count; i++)
+    {
+        VALUE source = rb_ary_entry(sources, i);
+        StringValueCStr(source);
+    }
+
+    rb_tu_args common;
+    rb_tu_args_init(&common, Qnil, args, Qnil);
+    rb_tu_args_init(&params.unsaved, Qnil, Qnil, unsaved);
+
+    rb_tu_args *jobs = ZALLOC_N(rb_tu_args, params.count);
+    for (long i = 0; i < params.count; i++)
+    {
+        VALUE source = rb_ary_entry(sources, i);
+        jobs[i].source = rb_tu_strdup(StringValueCStr(source));
+        jobs[i].argv = ALLOC_N(char *, common.argc);
+        for (; jobs[i].argc < common.argc; jobs[i].argc++)
+            jobs[i].argv[jobs[i].argc] = rb_tu_strdup(common.argv[jobs[i].argc]);
+    }
+    rb_tu_args_free(&common);
+
+    rb_tu_batch_run(&params, jobs);
+    RB_GC_GUARD(index);
+    return Qnil;
+}
+
+void Init_clang_batch(void)
+{
+    rb_define_singleton_methodm1(rb_cCXTranslationUnit, "parse_all", tu_parse_all, -1);
+}
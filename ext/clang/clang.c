@@ -8,19 +8,81 @@
         return Data_Wrap_Struct(klass, NULL, RUBY_DEFAULT_FREE, obj);                                                  \
     }
 
+// Wrappers of values that are only valid while their translation unit is, which is marked to keep it alive. These are
+// created in great numbers while walking a tree, so where Ruby supports it, the record is embedded in the object itself
+// rather than allocated separately.
+#define DEPENDENT_MARK(name, record)                                                                                   \
+    static void name##_mark(void *data)                                                                                \
+    {                                                                                                                  \
+        rb_gc_mark(((record *) data)->unit);                                                                           \
+    }
+
+#define DEPENDENT_WRAP(name, record, type, class_name)                                                                 \
+    static const rb_data_type_t name##_type = {                                                                        \
+        class_name,                                                                                                    \
+        {name##_mark, RUBY_TYPED_DEFAULT_FREE, NULL},                                                                  \
+        NULL,                                                                                                          \
+        NULL,                                                                                                          \
+        RUBY_TYPED_FREE_IMMEDIATELY | RB_CLANG_EMBEDDABLE};                                                            \
+                                                                                                                       \
+    VALUE rb_##name##_wrap(VALUE klass, type value, VALUE unit)                                                        \
+    {                                                                                                                  \
+        record *obj;                                                                                                   \
+        VALUE self = TypedData_Make_Struct(klass, record, &name##_type, obj);                                          \
+        obj->value = value;                                                                                            \
+        obj->unit = unit;                                                                                              \
+        return self;                                                                                                   \
+    }                                                                                                                  \
+                                                                                                                       \
+    record *rb_##name##_record(VALUE obj)                                                                              \
+    {                                                                                                                  \
+        return RTYPEDDATA_GET_DATA(obj);                                                                               \
+    }                                                                                                                  \
+                                                                                                                       \
+    type *rb_##name##_ptr(VALUE obj)                                                                                   \
+    {                                                                                                                  \
+        record *data = rb_##name##_record(obj);                                                                        \
+        rb_tu_check(data->unit);                                                                                       \
+        return &data->value;                                                                                           \
+    }                                                                                                                  \
+                                                                                                                       \
+    VALUE rb_##name##_unit(VALUE obj)                                                                                  \
+    {                                                                                                                  \
+        return rb_##name##_record(obj)->unit;                                                                          \
+    }                                                                                                                  \
+                                                                                                                       \
+    static VALUE alloc_##name(VALUE klass)                                                                             \
+    {                                                                                                                  \
+        type value;                                                                                                    \
+        memset(&value, 0, sizeof(type));                                                                               \
+        return rb_##name##_wrap(klass, value, Qnil);                                                                   \
+    }
+
+#define DEPENDENT_RECORD(name, record, type, class_name)                                                               \
+    DEPENDENT_MARK(name, record)                                                                                       \
+    DEPENDENT_WRAP(name, record, type, class_name)
+
+// Locations also keep the values they have been decoded to
+static void location_mark(void *data)
+{
+    rb_location *location = data;
+    rb_gc_mark(location->unit);
+    rb_gc_mark(location->decoded);
+}
+
 static VALUE alloc_null(VALUE klass)
 {
     return Data_Wrap_Struct(klass, NULL, RUBY_NEVER_FREE, NULL);
 }
 
-ALLOC_RECORD(unsaved_file, struct CXUnsavedFile);
-ALLOC_RECORD(source_location, CXSourceLocation);
-ALLOC_RECORD(source_range, CXSourceRange);
-ALLOC_RECORD(cursor, CXCursor);
 ALLOC_RECORD(platform_availability, CXPlatformAvailability);
-ALLOC_RECORD(type, CXType);
-ALLOC_RECORD(token, CXToken);
 ALLOC_RECORD(completion_result, CXCompletionResult);
+DEPENDENT_WRAP(location, rb_location, CXSourceLocation, "Clang::SourceLocation");
+DEPENDENT_RECORD(range, rb_range, CXSourceRange, "Clang::SourceRange");
+DEPENDENT_RECORD(cursor, rb_cursor, CXCursor, "Clang::Cursor");
+DEPENDENT_RECORD(type, rb_cxtype, CXType, "Clang::Type");
+DEPENDENT_RECORD(file, rb_file, CXFile, "Clang::File");
+DEPENDENT_RECORD(comment, rb_comment, CXComment, "Clang::Comment");
 
 VALUE rb_mClang;
 VALUE rb_cCXUnsavedFile;
@@ -31,6 +93,7 @@ VALUE rb_cCXTargetInfo;
 VALUE rb_cCXTranslationUnit;
 VALUE rb_cCXFile;
 VALUE rb_cCXSourceLocation;
+VALUE rb_cCXDecodedLocation;
 VALUE rb_cCXSourceRange;
 VALUE rb_cCXDiagnostic;
 VALUE rb_cCXDiagnosticSet;
@@ -45,6 +108,22 @@ VALUE rb_cCXCompletionString;
 VALUE rb_cCXCompletionResult;
 VALUE rb_cCXCodeCompleteResults;
 VALUE rb_cCXRemapping;
+VALUE rb_cCXCompilationDatabase;
+VALUE rb_cCXASTTable;
+VALUE rb_cCXFuture;
+VALUE rb_cCXCompletionMatches;
+VALUE rb_cCXSemanticTokens;
+VALUE rb_cCXIndexAction;
+VALUE rb_cCXIndexResult;
+VALUE rb_cCXSymbolIndex;
+VALUE rb_cCXASTCache;
+VALUE rb_cCXUnitPool;
+VALUE rb_cCXPreamble;
+VALUE rb_cCXIncludeGraph;
+VALUE rb_cCXDiagnosticTable;
+VALUE rb_cCXDiagnosticAggregator;
+VALUE rb_cCXFileBuffer;
+VALUE rb_cCXUnsavedFileSet;
 
 void Init_clang_enums(void);
 void Init_clang_source_location(void);
@@ -61,6 +140,22 @@ void Init_clang_remapping(void);
 void Init_clang_file(void);
 void Init_clang_module(void);
 void Init_clang_completion(void);
+void Init_clang_batch(void);
+void Init_clang_compilation_database(void);
+void Init_clang_ast_table(void);
+void Init_clang_future(void);
+void Init_clang_completion_filter(void);
+void Init_clang_semantic_tokens(void);
+void Init_clang_index_action(void);
+void Init_clang_symbol_index(void);
+void Init_clang_ast_cache(void);
+void Init_clang_unit_pool(void);
+void Init_clang_preamble(void);
+void Init_clang_include_graph(void);
+void Init_clang_diagnostic_table(void);
+void Init_clang_diagnostic_aggregator(void);
+void Init_clang_file_buffer(void);
+void Init_clang_unsaved_file_set(void);
 
 static VALUE clang_version(VALUE clang)
 {
@@ -159,6 +254,7 @@ void Init_clang(void)
     rb_cCXTargetInfo = rb_define_class_under(rb_mClang, "TargetInfo", rb_cObject);
     rb_cCXTranslationUnit = rb_define_class_under(rb_mClang, "TranslationUnit", rb_cObject);
     rb_cCXFile = rb_define_class_under(rb_mClang, "File", rb_cObject);
+    rb_cCXComment = rb_define_class_under(rb_mClang, "Comment", rb_cObject);
     rb_cCXSourceLocation = rb_define_class_under(rb_mClang, "SourceLocation", rb_cObject);
     rb_cCXSourceRange = rb_define_class_under(rb_mClang, "SourceRange", rb_cObject);
     rb_cCXDiagnostic = rb_define_class_under(rb_mClang, "Diagnostic", rb_cObject);
@@ -174,25 +270,38 @@ void Init_clang(void)
     rb_cCXCompletionResult = rb_define_class_under(rb_mClang, "CompletionResult", rb_cObject);
     rb_cCXCodeCompleteResults = rb_define_class_under(rb_mClang, "CodeCompleteResults", rb_cObject);
     rb_cCXRemapping = rb_define_class_under(rb_mClang, "Remapping", rb_cObject);
+    rb_cCXCompilationDatabase = rb_define_class_under(rb_mClang, "CompilationDatabase", rb_cObject);
+    rb_cCXASTTable = rb_define_class_under(rb_mClang, "ASTTable", rb_cObject);
+    rb_cCXFuture = rb_define_class_under(rb_mClang, "Future", rb_cObject);
+    rb_cCXCompletionMatches = rb_define_class_under(rb_mClang, "CompletionMatches", rb_cObject);
+    rb_cCXSemanticTokens = rb_define_class_under(rb_mClang, "SemanticTokens", rb_cObject);
+    rb_cCXIndexAction = rb_define_class_under(rb_mClang, "IndexAction", rb_cObject);
+    rb_cCXIndexResult = rb_define_class_under(rb_mClang, "IndexResult", rb_cObject);
+    rb_cCXSymbolIndex = rb_define_class_under(rb_mClang, "SymbolIndex", rb_cObject);
+    rb_cCXASTCache = rb_define_class_under(rb_mClang, "ASTCache", rb_cObject);
+    rb_cCXUnitPool = rb_define_class_under(rb_mClang, "UnitPool", rb_cObject);
+    rb_cCXPreamble = rb_define_class_under(rb_mClang, "Preamble", rb_cObject);
+    rb_cCXIncludeGraph = rb_define_class_under(rb_mClang, "IncludeGraph", rb_cObject);
+    rb_cCXDiagnosticTable = rb_define_class_under(rb_mClang, "DiagnosticTable", rb_cObject);
+    rb_cCXDiagnosticAggregator = rb_define_class_under(rb_mClang, "DiagnosticAggregator", rb_cObject);
+    rb_cCXFileBuffer = rb_define_class_under(rb_mClang, "FileBuffer", rb_cObject);
+    rb_cCXUnsavedFileSet = rb_define_class_under(rb_mClang, "UnsavedFileSet", rb_cObject);
 
     rb_define_alloc_func(rb_cCXVirtualFileOverlay, alloc_null);
     rb_define_alloc_func(rb_cCXModuleMapDescriptor, alloc_null);
-    rb_define_alloc_func(rb_cCXIndex, alloc_null);
     rb_define_alloc_func(rb_cCXTargetInfo, alloc_null);
-    rb_define_alloc_func(rb_cCXTranslationUnit, alloc_null);
-    rb_define_alloc_func(rb_cCXDiagnostic, alloc_null);
-    rb_define_alloc_func(rb_cCXDiagnosticSet, alloc_null);
     rb_define_alloc_func(rb_cCXPrintingPolicy, alloc_null);
     rb_define_alloc_func(rb_cCXModule, alloc_null);
     rb_define_alloc_func(rb_cCXCompletionString, alloc_null);
     rb_define_alloc_func(rb_cCXRemapping, alloc_null);
-    rb_define_alloc_func(rb_cCXUnsavedFile, alloc_unsaved_file);
-    rb_define_alloc_func(rb_cCXSourceLocation, alloc_source_location);
-    rb_define_alloc_func(rb_cCXSourceRange, alloc_source_range);
+    rb_define_alloc_func(rb_cCXCompilationDatabase, alloc_null);
+    rb_define_alloc_func(rb_cCXSourceLocation, alloc_location);
+    rb_define_alloc_func(rb_cCXSourceRange, alloc_range);
     rb_define_alloc_func(rb_cCXCursor, alloc_cursor);
     rb_define_alloc_func(rb_cCXPlatformAvailability, alloc_platform_availability);
     rb_define_alloc_func(rb_cCXType, alloc_type);
-    rb_define_alloc_func(rb_cCXToken, alloc_token);
+    rb_define_alloc_func(rb_cCXFile, alloc_file);
+    rb_define_alloc_func(rb_cCXComment, alloc_comment);
     rb_define_alloc_func(rb_cCXCompletionResult, alloc_completion_result);
 
     rb_define_methodm1(rb_cCXVirtualFileOverlay, "initialize", virtual_file_initialize, -1);
@@ -218,4 +327,20 @@ void Init_clang(void)
     Init_clang_file();
     Init_clang_module();
     Init_clang_completion();
+    Init_clang_batch();
+    Init_clang_compilation_database();
+    Init_clang_ast_table();
+    Init_clang_future();
+    Init_clang_completion_filter();
+    Init_clang_semantic_tokens();
+    Init_clang_index_action();
+    Init_clang_symbol_index();
+    Init_clang_ast_cache();
+    Init_clang_unit_pool();
+    Init_clang_preamble();
+    Init_clang_include_graph();
+    Init_clang_diagnostic_table();
+    Init_clang_diagnostic_aggregator();
+    Init_clang_file_buffer();
+    Init_clang_unsaved_file_set();
 }
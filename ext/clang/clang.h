@@ -2,7 +2,10 @@
 #define RB_CLANG_H 1
 
 #include <ruby.h>
+#include <ruby/version.h>
+#include <ruby/thread.h>
 #include <clang-c/Index.h>
+#include <clang-c/Documentation.h>
 
 #define NUM2FLT(v) ((float) NUM2DBL(v))
 #define RB_BOOL(expr) ((expr) ? Qtrue : Qfalse)
@@ -11,6 +14,15 @@
 #define CLASS_NAME(obj) rb_class2name(CLASS_OF(obj))
 #define STR2SYM(str) ID2SYM(rb_intern(str))
 
+// Small records can be stored within the object that wraps them since Ruby 3.3, where the data of an embedded object
+// must be retrieved with RTYPEDDATA_GET_DATA rather than DATA_PTR
+#if RUBY_API_VERSION_CODE >= 30300
+#define RB_CLANG_EMBEDDABLE RUBY_TYPED_EMBEDDABLE
+#else
+#define RB_CLANG_EMBEDDABLE 0
+#define RTYPEDDATA_GET_DATA(obj) RTYPEDDATA_DATA(obj)
+#endif
+
 extern VALUE rb_mClang;
 extern VALUE rb_cEnum;
 
@@ -47,6 +59,9 @@ extern VALUE rb_CodeCompleteFlags;
 extern VALUE rb_CompletionContext;
 extern VALUE rb_VisitorResult;
 extern VALUE rb_Result;
+extern VALUE rb_IndexOptFlags;
+extern VALUE rb_IdxEntityKind;
+extern VALUE rb_IdxEntityLanguage;
 
 extern VALUE rb_cCXComment;
 extern VALUE rb_cCXUnsavedFile;
@@ -57,6 +72,7 @@ extern VALUE rb_cCXTargetInfo;
 extern VALUE rb_cCXTranslationUnit;
 extern VALUE rb_cCXFile;
 extern VALUE rb_cCXSourceLocation;
+extern VALUE rb_cCXDecodedLocation;
 extern VALUE rb_cCXSourceRange;
 extern VALUE rb_cCXDiagnostic;
 extern VALUE rb_cCXDiagnosticSet;
@@ -72,12 +88,267 @@ extern VALUE rb_cCXCompletionString;
 extern VALUE rb_cCXCompletionResult;
 extern VALUE rb_cCXCodeCompleteResults;
 extern VALUE rb_cCXRemapping;
+extern VALUE rb_cCXCompilationDatabase;
+extern VALUE rb_cCXASTTable;
+extern VALUE rb_cCXFuture;
+extern VALUE rb_cCXCompletionMatches;
+extern VALUE rb_cCXSemanticTokens;
+extern VALUE rb_cCXIndexAction;
+extern VALUE rb_cCXIndexResult;
+extern VALUE rb_cCXSymbolIndex;
+extern VALUE rb_cCXASTCache;
+extern VALUE rb_cCXUnitPool;
+extern VALUE rb_cCXPreamble;
+extern VALUE rb_cCXIncludeGraph;
+extern VALUE rb_cCXDiagnosticTable;
+extern VALUE rb_cCXDiagnosticAggregator;
+extern VALUE rb_cCXFileBuffer;
+extern VALUE rb_cCXUnsavedFileSet;
+
+typedef struct rb_tu_worker rb_tu_worker;
+
+// Native state of a TranslationUnit, with the heap usage last reported to the GC, the thread running its
+// asynchronous requests once one has been made, and a count of the reparses and suspensions that released the
+// memory of its source files. A unit is locked by the Ruby thread that uses it without the GVL or while yielding from
+// a traversal, which other threads wait for. The owner may lock it again, and a dispose it requests while holding the
+// lock is deferred until the lock is released.
+typedef struct
+{
+    CXTranslationUnit unit;
+    size_t memsize;
+    rb_tu_worker *worker;
+    unsigned long generation;
+    VALUE lock;
+    VALUE owner;
+    int depth;
+    int disposing;
+} rb_tu;
+
+// Values that point into a translation unit, along with the unit that keeps them valid (nil when not known)
+typedef struct
+{
+    CXCursor value;
+    VALUE unit;
+} rb_cursor;
+
+typedef struct
+{
+    CXType value;
+    VALUE unit;
+} rb_cxtype;
+
+typedef struct
+{
+    CXSourceLocation value;
+    VALUE unit;
+    VALUE decoded;
+} rb_location;
+
+typedef struct
+{
+    CXSourceRange value;
+    VALUE unit;
+} rb_range;
+
+typedef struct
+{
+    CXFile value;
+    VALUE unit;
+} rb_file;
+
+typedef struct
+{
+    CXComment value;
+    VALUE unit;
+} rb_comment;
+
+typedef struct
+{
+    unsigned int count;
+    CXToken *tokens;
+    VALUE unit;
+} rb_tokenset;
+
+// A set of diagnostics, with the unit or diagnostic that owns it (nil for a set loaded from a file, which is released
+// along with the object) and the unit its diagnostics point into
+typedef struct
+{
+    CXDiagnosticSet set;
+    VALUE owner;
+    VALUE unit;
+} rb_dset;
+
+// A diagnostic, with the set, unit or completion results that own it, and the unit its locations point into. Only
+// a diagnostic that libclang allocated for the caller is disposed along with the object.
+typedef struct
+{
+    CXDiagnostic value;
+    VALUE owner;
+    VALUE unit;
+    int owned;
+} rb_diagnostic;
+
+// The contents of an UnsavedFile, either a frozen String, which neither moves nor changes for the lifetime of the
+// object, or a read-only mapping of a file. A mapping does not move either, but it is not a snapshot: it shows later
+// writes to the file, and reading past the end of a file that has been truncated raises SIGBUS.
+typedef struct
+{
+    struct CXUnsavedFile file;
+    VALUE filename;
+    VALUE contents;
+    void *map;
+    size_t map_size;
+} rb_unsaved;
+
+// A reusable array of unsaved files, marshalled once and passed to libclang as is
+typedef struct
+{
+    struct CXUnsavedFile *files;
+    unsigned int count;
+    VALUE entries;
+} rb_unsaved_set;
+
+extern const rb_data_type_t rb_tu_type;
+extern const rb_data_type_t rb_index_type;
+extern const rb_data_type_t rb_dset_type;
+extern const rb_data_type_t rb_results_type;
+extern const rb_data_type_t rb_unsaved_type;
+extern const rb_data_type_t rb_unsaved_set_type;
+
+// Native copies of the inputs to a parse, so that libclang can be invoked without holding the GVL. Unsaved contents
+// are not copied, as they cannot change, and are kept alive by the owner, which is either a copy of the array they
+// were given in or an UnsavedFileSet, whose files are used as is.
+typedef struct
+{
+    char *source;
+    int argc;
+    char **argv;
+    unsigned int num_files;
+    struct CXUnsavedFile *files;
+    VALUE owner;
+    int shared_files;
+} rb_tu_args;
+
+// A set of translation units parsed on a pool of native threads
+typedef struct
+{
+    VALUE klass;
+    VALUE keys;
+    long count;
+    int exclude_pch;
+    int display;
+    unsigned int global_options;
+    int threads;
+    int full_argv;
+    unsigned int options;
+    rb_tu_args unsaved;
+} rb_tu_batch;
+
+// Interned strings identified by a dense id, where id 0 is always the empty string
+typedef struct rb_strtab_entry rb_strtab_entry;
+typedef struct
+{
+    rb_strtab_entry *head;
+    rb_strtab_entry **entries;
+    unsigned int count;
+    unsigned int capa;
+} rb_strtab;
 
 unsigned int rb_enum_mask(VALUE enumeration, VALUE symbol_array);
 unsigned int rb_enum_value(VALUE enumeration, VALUE symbol);
 VALUE rb_enum_unmask(VALUE enumeration, unsigned int mask);
 VALUE rb_enum_symbol(VALUE enumeration, unsigned int value);
 
+char *rb_tu_strndup(const char *str, size_t len);
+void rb_tu_args_init(rb_tu_args *args, VALUE source, VALUE command_args, VALUE unsaved);
+void rb_tu_args_free(rb_tu_args *args);
+VALUE rb_unsaved_ary(VALUE unsaved);
+VALUE rb_tu_error(int code);
+VALUE rb_tu_wrap(VALUE klass, CXTranslationUnit unit, VALUE index);
+VALUE rb_tu_borrow(CXTranslationUnit unit);
+CXTranslationUnit rb_tu_unit(VALUE tu);
+void rb_tu_update_memsize(VALUE tu);
+void rb_tu_invalidate(VALUE tu);
+unsigned long rb_tu_generation(VALUE tu);
+void rb_tu_set_memsize(VALUE tu, size_t size);
+size_t rb_tu_native_memsize(CXTranslationUnit unit);
+void rb_tu_worker_wait(rb_tu_worker *worker);
+int rb_tu_worker_busy(rb_tu_worker *worker);
+void rb_tu_worker_hold(rb_tu_worker *worker, int held);
+void rb_tu_worker_release(rb_tu_worker *worker, CXTranslationUnit unit);
+void rb_tu_check(VALUE tu);
+CXTranslationUnit rb_tu_lock(VALUE tu);
+CXTranslationUnit rb_tu_lock_exclusive(VALUE tu);
+VALUE rb_tu_unlock(VALUE tu);
+VALUE rb_tu_locked(VALUE tu, VALUE (*func)(VALUE), VALUE arg);
+void rb_tu_without_gvl(VALUE tu, void *(*func)(void *), void *data, rb_unblock_function_t *ubf, void *ubf_data);
+int rb_tu_batch_threads(VALUE threads);
+void rb_tu_batch_run(rb_tu_batch *params, rb_tu_args *jobs);
+VALUE rb_index_wrap(CXIndex index);
+void rb_index_batch_params(VALUE index, rb_tu_batch *params);
+VALUE rb_dset_wrap(CXDiagnosticSet set, VALUE owner, VALUE unit);
+VALUE rb_dset_unit(VALUE dset);
+CXDiagnosticSet rb_dset_ptr(VALUE dset);
+VALUE rb_diagnostic_wrap(CXDiagnostic diagnostic, VALUE owner, VALUE unit, int owned);
+VALUE rb_results_wrap(CXCodeCompleteResults *results);
+VALUE rb_file_buffer_wrap(VALUE unit, CXFile file);
+VALUE rb_file_buffer_slice(VALUE buffer, size_t start, size_t size);
+
+VALUE rb_cursor_wrap(VALUE klass, CXCursor cursor, VALUE unit);
+CXCursor *rb_cursor_ptr(VALUE cursor);
+rb_cursor *rb_cursor_record(VALUE cursor);
+VALUE rb_cursor_unit(VALUE cursor);
+VALUE rb_type_wrap(VALUE klass, CXType type, VALUE unit);
+CXType *rb_type_ptr(VALUE type);
+rb_cxtype *rb_type_record(VALUE type);
+VALUE rb_type_unit(VALUE type);
+VALUE rb_location_wrap(VALUE klass, CXSourceLocation location, VALUE unit);
+CXSourceLocation *rb_location_ptr(VALUE location);
+rb_location *rb_location_record(VALUE location);
+VALUE rb_location_unit(VALUE location);
+VALUE rb_range_wrap(VALUE klass, CXSourceRange range, VALUE unit);
+CXSourceRange *rb_range_ptr(VALUE range);
+rb_range *rb_range_record(VALUE range);
+VALUE rb_range_unit(VALUE range);
+VALUE rb_file_wrap(VALUE klass, CXFile file, VALUE unit);
+CXFile *rb_file_ptr(VALUE file);
+rb_file *rb_file_record(VALUE file);
+VALUE rb_file_unit(VALUE file);
+VALUE rb_comment_wrap(VALUE klass, CXComment comment, VALUE unit);
+CXComment *rb_comment_ptr(VALUE comment);
+rb_comment *rb_comment_record(VALUE comment);
+VALUE rb_comment_unit(VALUE comment);
+
+int rb_strtab_init(rb_strtab *tab);
+void rb_strtab_free(rb_strtab *tab);
+int rb_strtab_find(rb_strtab *tab, const char *str, size_t len, unsigned int *id);
+int rb_strtab_intern(rb_strtab *tab, const char *str, size_t len, unsigned int *id);
+const char *rb_strtab_get(const rb_strtab *tab, unsigned int id, size_t *len);
+size_t rb_strtab_memsize(const rb_strtab *tab);
+VALUE rb_strtab_str(const rb_strtab *tab, unsigned int id);
+VALUE rb_strtab_ary(const rb_strtab *tab);
+
+static inline char *rb_tu_strdup(const char *str)
+{
+    return rb_tu_strndup(str, strlen(str));
+}
+
+static inline int rb_tu_is_disposed(VALUE tu)
+{
+    if (NIL_P(tu))
+        return 0;
+    const rb_tu *data = RTYPEDDATA_DATA(tu);
+    return !data->unit || data->disposing;
+}
+
+static inline int rb_tu_is_locked(VALUE tu)
+{
+    if (NIL_P(tu))
+        return 0;
+    const rb_tu *data = RTYPEDDATA_DATA(tu);
+    return !NIL_P(data->owner);
+}
+
 static inline VALUE CXString2Ruby(CXString str)
 {
     const char *cstr = clang_getCString(str);
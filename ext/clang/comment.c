@@ -4,7 +4,7 @@
 VALUE enum_allocate(VALUE klass);
 void enum_field(VALUE enumeration, const char *name, unsigned int value);
 
-#define COMMENT(v) (*(CXComment*) DATA_PTR(v))
+#define COMMENT(v) (*rb_comment_ptr(v))
 #define COMMENT_SUBCLASS(klass, name) klass = rb_define_class_under(rb_cCXComment, name, rb_cCXComment)
 
 #define cText                 comment_classes[CXComment_Text]
@@ -27,35 +27,21 @@ VALUE rb_cCXComment;
 VALUE render_kind;
 static VALUE comment_classes[COMMENT_LAST + 1];
 
-static VALUE wrap_comment(CXComment *comment)
+static VALUE wrap_comment(CXComment comment, VALUE unit)
 {
-    if (!comment)
-        return Qnil;
-
     VALUE klass;
-    enum CXCommentKind kind = clang_Comment_getKind(*comment);
+    enum CXCommentKind kind = clang_Comment_getKind(comment);
     if (kind < COMMENT_FIRST)
-    {
-        xfree(comment);
         return Qnil;
-    }
 
     klass = (kind > COMMENT_LAST) ? rb_cCXComment : comment_classes[kind];
-    return Data_Wrap_Struct(klass, NULL, RUBY_DEFAULT_FREE, comment);     
-}
-
-static VALUE comment_alloc(VALUE klass)
-{
-    CXComment *comment = ALLOC(CXComment);
-    memset(comment, 0, sizeof(CXComment));
-    return Data_Wrap_Struct(klass, NULL, RUBY_DEFAULT_FREE, comment);
+    return rb_comment_wrap(klass, comment, unit);
 }
 
 static VALUE cursor_comment(VALUE self)
 {
-    CXComment *comment = ALLOC(CXComment);
-    *comment = clang_Cursor_getParsedComment(*(CXCursor*) DATA_PTR(self));
-    return wrap_comment(comment);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return wrap_comment(clang_Cursor_getParsedComment(*cursor), rb_cursor_unit(self));
 }
 
 static VALUE comment_has_children(VALUE self)
@@ -76,9 +62,8 @@ static VALUE comment_children(VALUE self)
 
     for (unsigned i = 0; i < n; i++)
     {
-        CXComment *child = ALLOC(CXComment);
-        *child = clang_Comment_getChild(comment, i);
-        rb_ary_store(ary, i, wrap_comment(child));
+        CXComment child = clang_Comment_getChild(comment, i);
+        rb_ary_store(ary, i, wrap_comment(child, rb_comment_unit(self)));
     }
     return ary;
 }
@@ -92,9 +77,8 @@ static VALUE comment_each_child(VALUE self)
 
     for (unsigned i = 0; i < n; i++)
     {
-        CXComment *child = ALLOC(CXComment);
-        *child = clang_Comment_getChild(comment, i);
-        rb_yield(wrap_comment(child));
+        CXComment child = clang_Comment_getChild(comment, i);
+        rb_yield(wrap_comment(child, rb_comment_unit(self)));
     }
     return self;
 }
@@ -316,9 +300,8 @@ static VALUE block_command_each_arg(VALUE self)
 
 static VALUE block_command_paragraph(VALUE self)
 {
-    CXComment *para = ALLOC(CXComment);
-    *para = clang_BlockCommandComment_getParagraph(COMMENT(self));
-    return wrap_comment(para);
+    CXComment para = clang_BlockCommandComment_getParagraph(COMMENT(self));
+    return wrap_comment(para, rb_comment_unit(self));
 }
 
 static VALUE block_command_text(VALUE self)
@@ -391,7 +374,7 @@ static VALUE tparam_command_text(VALUE self)
     if (kind == CXComment_Null)
         return rb_call_super(0, NULL);
 
-    VALUE comment = Data_Wrap_Struct(comment_classes[kind], NULL, RUBY_NEVER_FREE, &child);
+    VALUE comment = rb_comment_wrap(comment_classes[kind], child, rb_comment_unit(self));
     return rb_funcall(comment, rb_intern("to_s"), 0);
 }
 
@@ -442,18 +425,19 @@ static VALUE paragraph_text(VALUE self)
 
 static VALUE comment_translation_unit(VALUE self)
 {
-    CXTranslationUnit *unit = ALLOC(CXTranslationUnit);
-    *unit = COMMENT(self).TranslationUnit;
-    return Data_Wrap_Struct(rb_cCXTranslationUnit, NULL, RUBY_NEVER_FREE, unit);
+    VALUE unit = rb_comment_unit(self);
+    if (!NIL_P(unit))
+    {
+        rb_tu_check(unit);
+        return unit;
+    }
+    return rb_tu_borrow(COMMENT(self).TranslationUnit);
 }
 
 void Init_clang_comment(void)
 {
     rb_define_method0(rb_cCXCursor, "comment", cursor_comment, 0);
 
-    rb_cCXComment = rb_define_class_under(rb_mClang, "Comment", rb_cObject);
-    rb_define_alloc_func(rb_cCXComment, comment_alloc);
-
     rb_include_module(rb_cCXComment, rb_mEnumerable);
     rb_define_method0(rb_cCXComment, "child_count", comment_child_count, 0);
     rb_define_method0(rb_cCXComment, "children", comment_children, 0);
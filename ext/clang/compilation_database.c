@@ -0,0 +1,311 @@
+#include "clang.h"
+#include <clang-c/CXCompilationDatabase.h>
+#include <ruby/thread.h>
+
+typedef struct
+{
+    const char *directory;
+    CXCompilationDatabase database;
+    CXCompilationDatabase_Error error;
+} cdb_load;
+
+static void cdb_free(void *data)
+{
+    if (data)
+        clang_CompilationDatabase_dispose(data);
+}
+
+static void *cdb_load_nogvl(void *data)
+{
+    cdb_load *load = data;
+    load->database = clang_CompilationDatabase_fromDirectory(load->directory, &load->error);
+    return NULL;
+}
+
+static VALUE cdb_initialize(VALUE self, VALUE directory)
+{
+    if (DATA_PTR(self))
+        rb_raise(rb_eRuntimeError, "compilation database already initialized");
+
+    // The path is read without the GVL, so it must be a copy no other thread can change meanwhile
+    directory = rb_str_new_frozen(StringValue(directory));
+    cdb_load load;
+    load.directory = StringValueCStr(directory);
+    load.database = NULL;
+    load.error = CXCompilationDatabase_NoError;
+
+    // Reading compile_commands.json is pure I/O and parsing, so other threads may run meanwhile
+    rb_thread_call_without_gvl(cdb_load_nogvl, &load, NULL, NULL);
+    RB_GC_GUARD(directory);
+
+    if (load.error != CXCompilationDatabase_NoError || !load.database)
+    {
+        if (load.database)
+            clang_CompilationDatabase_dispose(load.database);
+        rb_raise(rb_eLoadError, "failed to load compilation database from %s", StringValueCStr(directory));
+    }
+
+    RDATA(self)->data = load.database;
+    RDATA(self)->dfree = cdb_free;
+    return self;
+}
+
+static CXCompilationDatabase cdb_ptr(VALUE self)
+{
+    CXCompilationDatabase database = DATA_PTR(self);
+    if (!database)
+        rb_raise(rb_eRuntimeError, "compilation database is not initialized");
+    return database;
+}
+
+static CXCompileCommands cdb_commands_for(VALUE self, VALUE filename)
+{
+    if (NIL_P(filename))
+        return clang_CompilationDatabase_getAllCompileCommands(cdb_ptr(self));
+    return clang_CompilationDatabase_getCompileCommands(cdb_ptr(self), StringValueCStr(filename));
+}
+
+static VALUE cdb_command_arguments(CXCompileCommand cmd)
+{
+    unsigned int n = clang_CompileCommand_getNumArgs(cmd);
+    VALUE ary = rb_ary_new_capa(n);
+    for (unsigned int i = 0; i < n; i++)
+        rb_ary_store(ary, i, RUBYSTR(clang_CompileCommand_getArg(cmd, i)));
+    return ary;
+}
+
+static VALUE cdb_command_path(CXCompileCommand cmd)
+{
+    CXString dir = clang_CompileCommand_getDirectory(cmd);
+    CXString file = clang_CompileCommand_getFilename(cmd);
+    const char *filename = clang_getCString(file), *directory = clang_getCString(dir);
+    if (!filename)
+        filename = "";
+
+    VALUE path;
+    if (filename[0] == '/' || !directory || !directory[0])
+        path = rb_str_new_cstr(filename);
+    else
+        path = rb_sprintf("%s/%s", directory, filename);
+
+    clang_disposeString(dir);
+    clang_disposeString(file);
+    return path;
+}
+
+static VALUE cdb_size(VALUE self)
+{
+    CXCompileCommands cmds = clang_CompilationDatabase_getAllCompileCommands(cdb_ptr(self));
+    unsigned int n = clang_CompileCommands_getSize(cmds);
+    clang_CompileCommands_dispose(cmds);
+    return UINT2NUM(n);
+}
+
+static VALUE cdb_commands(int argc, VALUE *argv, VALUE self)
+{
+    VALUE filename;
+    rb_scan_args(argc, argv, "01", &filename);
+
+    CXCompileCommands cmds = cdb_commands_for(self, filename);
+    unsigned int n = clang_CompileCommands_getSize(cmds);
+    VALUE ary = rb_ary_new_capa(n);
+
+    VALUE directory = STR2SYM("directory");
+    VALUE file = STR2SYM("filename");
+    VALUE arguments = STR2SYM("arguments");
+    for (unsigned int i = 0; i < n; i++)
+    {
+        CXCompileCommand cmd = clang_CompileCommands_getCommand(cmds, i);
+        VALUE hash = rb_hash_new();
+        rb_hash_aset(hash, directory, RUBYSTR(clang_CompileCommand_getDirectory(cmd)));
+        rb_hash_aset(hash, file, RUBYSTR(clang_CompileCommand_getFilename(cmd)));
+        rb_hash_aset(hash, arguments, cdb_command_arguments(cmd));
+        rb_ary_store(ary, i, hash);
+    }
+
+    clang_CompileCommands_dispose(cmds);
+    return ary;
+}
+
+static VALUE cdb_directories(int argc, VALUE *argv, VALUE self)
+{
+    VALUE filename;
+    rb_scan_args(argc, argv, "01", &filename);
+
+    CXCompileCommands cmds = cdb_commands_for(self, filename);
+    unsigned int n = clang_CompileCommands_getSize(cmds);
+    VALUE ary = rb_ary_new_capa(n);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        CXCompileCommand cmd = clang_CompileCommands_getCommand(cmds, i);
+        rb_ary_store(ary, i, RUBYSTR(clang_CompileCommand_getDirectory(cmd)));
+    }
+
+    clang_CompileCommands_dispose(cmds);
+    return ary;
+}
+
+static VALUE cdb_filenames(VALUE self)
+{
+    CXCompileCommands cmds = clang_CompilationDatabase_getAllCompileCommands(cdb_ptr(self));
+    unsigned int n = clang_CompileCommands_getSize(cmds);
+    VALUE ary = rb_ary_new_capa(n);
+    for (unsigned int i = 0; i < n; i++)
+        rb_ary_store(ary, i, cdb_command_path(clang_CompileCommands_getCommand(cmds, i)));
+
+    clang_CompileCommands_dispose(cmds);
+    return ary;
+}
+
+static VALUE cdb_arguments(int argc, VALUE *argv, VALUE self)
+{
+    VALUE filename;
+    rb_scan_args(argc, argv, "01", &filename);
+
+    CXCompileCommands cmds = cdb_commands_for(self, filename);
+    unsigned int n = clang_CompileCommands_getSize(cmds);
+    VALUE ary = rb_ary_new_capa(n);
+    for (unsigned int i = 0; i < n; i++)
+        rb_ary_store(ary, i, cdb_command_arguments(clang_CompileCommands_getCommand(cmds, i)));
+
+    clang_CompileCommands_dispose(cmds);
+    return ary;
+}
+
+static void cdb_job_args(CXCompileCommand cmd, rb_tu_args *args)
+{
+    // The source file is part of the command line, and relative paths within it resolve against the directory, which
+    // is passed right after the compiler however many arguments follow
+    unsigned int n = clang_CompileCommand_getNumArgs(cmd);
+    args->argv = ALLOC_N(char *, n + 1);
+
+    CXString dir = clang_CompileCommand_getDirectory(cmd);
+    const char *directory = clang_getCString(dir);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        CXString arg = clang_CompileCommand_getArg(cmd, i);
+        args->argv[args->argc++] = rb_tu_strdup(clang_getCString(arg));
+        clang_disposeString(arg);
+
+        if (i == 0 && directory && directory[0])
+        {
+            size_t len = strlen(directory);
+            char *opt = ALLOC_N(char, len + 20);
+            memcpy(opt, "-working-directory=", 19);
+            memcpy(opt + 19, directory, len + 1);
+            args->argv[args->argc++] = opt;
+        }
+    }
+    clang_disposeString(dir);
+}
+
+// The jobs of a project, which are released should collecting them raise, and handed to the batch otherwise
+typedef struct
+{
+    VALUE self;
+    VALUE files;
+    rb_tu_batch *params;
+    rb_tu_args *jobs;
+    CXCompileCommands cmds;
+    int collected;
+} cdb_jobs;
+
+static VALUE cdb_jobs_collect(VALUE data)
+{
+    cdb_jobs *state = (cdb_jobs *) data;
+    rb_tu_batch *params = state->params;
+    long capa = 0, num_files = RARRAY_LEN(state->files);
+
+    for (long i = 0; i < num_files; i++)
+    {
+        state->cmds = cdb_commands_for(state->self, rb_ary_entry(state->files, i));
+        unsigned int n = clang_CompileCommands_getSize(state->cmds);
+        if (params->count + n > capa)
+        {
+            long prev = capa;
+            capa = params->count + n;
+            REALLOC_N(state->jobs, rb_tu_args, capa);
+            memset(state->jobs + prev, 0, sizeof(rb_tu_args) * (capa - prev));
+        }
+
+        for (unsigned int j = 0; j < n; j++)
+        {
+            CXCompileCommand cmd = clang_CompileCommands_getCommand(state->cmds, j);
+            rb_ary_push(params->keys, cdb_command_path(cmd));
+            cdb_job_args(cmd, &state->jobs[params->count++]);
+        }
+        clang_CompileCommands_dispose(state->cmds);
+        state->cmds = NULL;
+    }
+
+    state->collected = 1;
+    return Qnil;
+}
+
+static VALUE cdb_jobs_release(VALUE data)
+{
+    cdb_jobs *state = (cdb_jobs *) data;
+    if (state->cmds)
+        clang_CompileCommands_dispose(state->cmds);
+    if (!state->collected)
+    {
+        for (long i = 0; i < state->params->count; i++)
+            rb_tu_args_free(&state->jobs[i]);
+        xfree(state->jobs);
+    }
+    return Qnil;
+}
+
+static VALUE cdb_parse_project(int argc, VALUE *argv, VALUE self)
+{
+    RETURN_ENUMERATOR_KW(self, argc, argv, rb_keyword_given_p());
+
+    VALUE opts, kwargs;
+    rb_scan_args(argc, argv, "*:", &opts, &kwargs);
+
+    ID keys[4] = {rb_intern("files"), rb_intern("threads"), rb_intern("exclude_pch"), rb_intern("display")};
+    VALUE values[4];
+    rb_get_kwargs(kwargs, keys, 0, 4, values);
+    for (int i = 0; i < 4; i++)
+    {
+        if (values[i] == Qundef)
+            values[i] = Qnil;
+    }
+
+    rb_tu_batch params;
+    memset(&params, 0, sizeof(rb_tu_batch));
+    params.klass = rb_cCXTranslationUnit;
+    params.full_argv = 1;
+    params.exclude_pch = RTEST(values[2]);
+    params.display = RTEST(values[3]);
+    params.options = rb_enum_mask(rb_TranslationUnitFlags, opts);
+    params.threads = rb_tu_batch_threads(values[1]);
+    params.keys = rb_ary_new();
+
+    // Each worker creates its own index, as a single index would serialize the workers against each other
+    VALUE files = NIL_P(values[0]) ? rb_ary_new_from_args(1, Qnil) : rb_Array(values[0]);
+    long num_files = rb_array_len(files);
+    for (long i = 0; i < num_files; i++)
+    {
+        VALUE file = rb_ary_entry(files, i);
+        if (!NIL_P(file))
+            StringValueCStr(file);
+    }
+
+    cdb_jobs state = {self, files, &params, NULL, NULL, 0};
+    rb_ensure(cdb_jobs_collect, (VALUE) &state, cdb_jobs_release, (VALUE) &state);
+    rb_tu_batch_run(&params, state.jobs);
+    RB_GC_GUARD(files);
+    return self;
+}
+
+void Init_clang_compilation_database(void)
+{
+    rb_define_method1(rb_cCXCompilationDatabase, "initialize", cdb_initialize, 1);
+    rb_define_method0(rb_cCXCompilationDatabase, "size", cdb_size, 0);
+    rb_define_methodm1(rb_cCXCompilationDatabase, "commands", cdb_commands, -1);
+    rb_define_methodm1(rb_cCXCompilationDatabase, "directories", cdb_directories, -1);
+    rb_define_method0(rb_cCXCompilationDatabase, "filenames", cdb_filenames, 0);
+    rb_define_methodm1(rb_cCXCompilationDatabase, "arguments", cdb_arguments, -1);
+    rb_define_methodm1(rb_cCXCompilationDatabase, "parse_project", cdb_parse_project, -1);
+}
@@ -9,7 +9,7 @@ static VALUE result_kind(VALUE self)
 static VALUE result_completion(VALUE self)
 {
     CXCompletionResult *result = DATA_PTR(self);
-    return Data_Wrap_Struct(rb_cCXCompletionString, NULL, RUBY_NEVER_FREE, result);
+    return Data_Wrap_Struct(rb_cCXCompletionString, NULL, RUBY_NEVER_FREE, result->CompletionString);
 }
 
 static VALUE compstr_brief_comment(VALUE self)
@@ -123,9 +123,44 @@ static VALUE compstr_each_chunk(VALUE self)
     return self;
 }
 
+// Completion strings live in an allocator owned by the results, which libclang does not report the size of
+#define COMPLETION_ESTIMATED_SIZE 256
+
+static size_t results_native_memsize(const CXCodeCompleteResults *results)
+{
+    return results->NumResults * (sizeof(CXCompletionResult) + COMPLETION_ESTIMATED_SIZE);
+}
+
+static void results_free(void *data)
+{
+    if (!data)
+        return;
+
+    rb_gc_adjust_memory_usage(-(ssize_t) results_native_memsize(data));
+    clang_disposeCodeCompleteResults(data);
+}
+
+static size_t results_memsize(const void *data)
+{
+    return data ? sizeof(CXCodeCompleteResults) + results_native_memsize(data) : 0;
+}
+
+const rb_data_type_t rb_results_type = {
+    "Clang::CodeCompleteResults",
+    {NULL, results_free, results_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
 static VALUE results_alloc(VALUE klass)
 {
-    return Data_Wrap_Struct(klass, NULL, RUBY_NEVER_FREE, NULL);
+    return TypedData_Wrap_Struct(klass, &rb_results_type, NULL);
+}
+
+VALUE rb_results_wrap(CXCodeCompleteResults *results)
+{
+    rb_gc_adjust_memory_usage((ssize_t) results_native_memsize(results));
+    return TypedData_Wrap_Struct(rb_cCXCodeCompleteResults, &rb_results_type, results);
 }
 
 static VALUE results_fixit_count(VALUE self, VALUE index)
@@ -144,10 +179,10 @@ static VALUE results_each_fixit(VALUE self, VALUE index)
 
     for (unsigned int i = 0; i < n; i++)
     {
-        CXSourceRange range, *value = ALLOC(CXSourceRange);
+        CXSourceRange range;
         CXString str = clang_getCompletionFixIt(results, completion_index, i, &range);
 
-        VALUE args = rb_ary_new_from_args(2, RUBYSTR(str), Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, value));
+        VALUE args = rb_ary_new_from_args(2, RUBYSTR(str), rb_range_wrap(rb_cCXSourceRange, range, Qnil));
         rb_yield(args);
     }
 
@@ -216,7 +251,7 @@ static VALUE results_each_diagnostic(VALUE self)
         CXDiagnostic diagnostic = clang_codeCompleteGetDiagnostic(results, i);
         if (!diagnostic)
             continue;
-        rb_yield(Data_Wrap_Struct(rb_cCXDiagnostic, NULL, clang_disposeDiagnostic, diagnostic));
+        rb_yield(rb_diagnostic_wrap(diagnostic, self, Qnil, 1));
     }
 
     return self;
@@ -225,7 +260,7 @@ static VALUE results_each_diagnostic(VALUE self)
 static VALUE results_contexts(VALUE self)
 {
     CXCodeCompleteResults *results = DATA_PTR(self);
-    rb_enum_unmask(rb_CompletionContext, clang_codeCompleteGetContexts(results));
+    return rb_enum_unmask(rb_CompletionContext, clang_codeCompleteGetContexts(results));
 }
 
 static VALUE results_container(VALUE self)
@@ -262,6 +297,7 @@ void Init_clang_completion(void)
     rb_define_method0(rb_cCXCompletionString, "each_chunk", compstr_each_chunk, 0);
 
     // CXCodeCompleteResults
+    rb_define_alloc_func(rb_cCXCodeCompleteResults, results_alloc);
     rb_define_singleton_method0(rb_cCXCodeCompleteResults, "default_options", results_default_options, 0);
     rb_include_module(rb_cCXCodeCompleteResults, rb_mEnumerable);
     rb_define_method1(rb_cCXCodeCompleteResults, "fixit_count", results_fixit_count, 1);
@@ -0,0 +1,331 @@
+#include "clang.h"
+#include <ctype.h>
+#include <stdint.h>
+
+// A candidate that matched the prefix, with the typed text owned by the allocator of the results
+typedef struct
+{
+    CXCompletionResult result;
+    unsigned int index;
+    unsigned int priority;
+    int64_t score;
+    const char *text;
+    size_t len;
+} completion_match;
+
+// Every candidate matching the prefix is kept, best first, so that a longer prefix only needs to rescore these
+typedef struct
+{
+    VALUE results;
+    VALUE prefix;
+    unsigned int count;
+    unsigned int limit;
+    completion_match *matches;
+} rb_completion_matches;
+
+static void matches_mark(void *data)
+{
+    rb_completion_matches *m = data;
+    rb_gc_mark(m->results);
+    rb_gc_mark(m->prefix);
+}
+
+static void matches_free(void *data)
+{
+    rb_completion_matches *m = data;
+    xfree(m->matches);
+    xfree(m);
+}
+
+static size_t matches_memsize(const void *data)
+{
+    const rb_completion_matches *m = data;
+    return sizeof(rb_completion_matches) + sizeof(completion_match) * m->count;
+}
+
+static const rb_data_type_t matches_type = {
+    "Clang::CompletionMatches",
+    {matches_mark, matches_free, matches_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static int is_boundary(const char *text, size_t i)
+{
+    if (i == 0)
+        return 1;
+
+    unsigned char prev = text[i - 1], c = text[i];
+    return prev == '_' || (islower(prev) && isupper(c)) || (!isalnum(prev) && isalnum(c));
+}
+
+// Scores a case-insensitive subsequence match of the pattern within the text, or returns -1 if it does not match.
+// Characters that continue a run, start a word, or match the case exactly score higher, and a prefix match highest.
+// Every other score is at least zero, the empty pattern matching any text with a score of zero.
+static int fuzzy_score(const char *pattern, size_t plen, const char *text, size_t tlen)
+{
+    int score = 0, run = 0;
+    size_t t = 0;
+
+    for (size_t p = 0; p < plen; p++, t++)
+    {
+        int c = tolower((unsigned char) pattern[p]);
+        for (; t < tlen && tolower((unsigned char) text[t]) != c; t++)
+            run = 0;
+        if (t == tlen)
+            return -1;
+
+        score += 1 + run * 4;
+        if (is_boundary(text, t))
+            score += 8;
+        if (pattern[p] == text[t])
+            score += 1;
+        if (t == p)
+            score += 4;
+        run++;
+    }
+    return score;
+}
+
+static const char *typed_text(CXCompletionString str, size_t *len)
+{
+    unsigned int n = clang_getNumCompletionChunks(str);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (clang_getCompletionChunkKind(str, i) != CXCompletionChunk_TypedText)
+            continue;
+
+        // Chunk text refers into the allocator of the results rather than being copied
+        CXString text = clang_getCompletionChunkText(str, i);
+        const char *cstr = clang_getCString(text);
+        clang_disposeString(text);
+        if (cstr)
+        {
+            *len = strlen(cstr);
+            return cstr;
+        }
+    }
+    return NULL;
+}
+
+// Ranks a match on a separate key that may go negative, as shorter candidates and better priorities are preferred
+// among otherwise equal matches. Returns 0 if the prefix does not match the typed text at all.
+static int match_score(completion_match *match, const char *prefix, size_t len)
+{
+    int score = fuzzy_score(prefix, len, match->text, match->len);
+    if (score < 0)
+        return 0;
+
+    // Without a prefix, every result matches and they are simply ordered by priority
+    if (!len)
+    {
+        match->score = -(int64_t) match->priority;
+        return 1;
+    }
+
+    size_t extra = match->len - len;
+    match->score = ((int64_t) score * 8 - (int64_t) (extra < 32 ? extra : 32)) * 4 - (int64_t) match->priority;
+    return 1;
+}
+
+static int match_compare(const void *a, const void *b)
+{
+    const completion_match *x = a, *y = b;
+    if (x->score != y->score)
+        return x->score > y->score ? -1 : 1;
+    if (x->priority != y->priority)
+        return x->priority < y->priority ? -1 : 1;
+
+    int cmp = strcmp(x->text, y->text);
+    if (cmp)
+        return cmp;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static unsigned int matches_limit(VALUE limit, unsigned int count)
+{
+    if (limit == Qundef || NIL_P(limit))
+        return count;
+
+    long n = NUM2LONG(limit);
+    if (n < 0)
+        rb_raise(rb_eArgError, "limit cannot be negative");
+    return (unsigned long) n < count ? (unsigned int) n : count;
+}
+
+static rb_completion_matches *matches_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &matches_type);
+}
+
+static VALUE matches_create(VALUE results, const rb_completion_matches *source, VALUE prefix, VALUE limit)
+{
+    CXCodeCompleteResults *cx = rb_check_typeddata(results, &rb_results_type);
+    if (!cx)
+        rb_raise(rb_eRuntimeError, "code completion results are not initialized");
+    StringValue(prefix);
+    prefix = rb_str_new_frozen(prefix);
+    const char *pattern = RSTRING_PTR(prefix);
+    size_t len = RSTRING_LEN(prefix);
+
+    rb_completion_matches *m;
+    VALUE obj = TypedData_Make_Struct(rb_cCXCompletionMatches, rb_completion_matches, &matches_type, m);
+    m->results = results;
+    m->prefix = prefix;
+
+    unsigned int capa = source ? source->count : cx->NumResults;
+    m->matches = ALLOC_N(completion_match, capa ? capa : 1);
+
+    if (source)
+    {
+        for (unsigned int i = 0; i < source->count; i++)
+        {
+            completion_match match = source->matches[i];
+            if (match_score(&match, pattern, len))
+                m->matches[m->count++] = match;
+        }
+    }
+    else
+    {
+        for (unsigned int i = 0; i < cx->NumResults; i++)
+        {
+            completion_match match = {cx->Results[i], i};
+            if (!(match.text = typed_text(match.result.CompletionString, &match.len)))
+                continue;
+
+            match.priority = clang_getCompletionPriority(match.result.CompletionString);
+            if (match_score(&match, pattern, len))
+                m->matches[m->count++] = match;
+        }
+    }
+
+    qsort(m->matches, m->count, sizeof(completion_match), match_compare);
+    m->limit = matches_limit(limit, m->count);
+    return obj;
+}
+
+static VALUE filter_limit(int argc, VALUE *argv, VALUE *prefix)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, "1:", prefix, &kwargs);
+
+    ID keys[1] = {rb_intern("limit")};
+    VALUE limit;
+    rb_get_kwargs(kwargs, keys, 0, 1, &limit);
+    return limit;
+}
+
+static VALUE results_filter(int argc, VALUE *argv, VALUE self)
+{
+    VALUE prefix;
+    VALUE limit = filter_limit(argc, argv, &prefix);
+    return matches_create(self, NULL, prefix, limit);
+}
+
+static VALUE matches_refine(int argc, VALUE *argv, VALUE self)
+{
+    VALUE prefix;
+    VALUE limit = filter_limit(argc, argv, &prefix);
+    rb_completion_matches *m = matches_ptr(self);
+    StringValue(prefix);
+
+    // A subsequence of the longer prefix is also one of this prefix, so only these candidates can still match
+    long len = RSTRING_LEN(m->prefix);
+    int narrows = RSTRING_LEN(prefix) >= len && memcmp(RSTRING_PTR(prefix), RSTRING_PTR(m->prefix), len) == 0;
+    return matches_create(m->results, narrows ? m : NULL, prefix, limit);
+}
+
+static VALUE matches_size(VALUE self)
+{
+    return UINT2NUM(matches_ptr(self)->limit);
+}
+
+static VALUE matches_total(VALUE self)
+{
+    return UINT2NUM(matches_ptr(self)->count);
+}
+
+static VALUE matches_prefix(VALUE self)
+{
+    return matches_ptr(self)->prefix;
+}
+
+static VALUE matches_results(VALUE self)
+{
+    return matches_ptr(self)->results;
+}
+
+static VALUE match_result(const completion_match *match)
+{
+    CXCompletionResult *result = ALLOC(CXCompletionResult);
+    *result = match->result;
+    return Data_Wrap_Struct(rb_cCXCompletionResult, NULL, RUBY_DEFAULT_FREE, result);
+}
+
+static VALUE matches_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    rb_completion_matches *m = matches_ptr(self);
+    for (unsigned int i = 0; i < m->limit; i++)
+        rb_yield(match_result(&m->matches[i]));
+
+    return self;
+}
+
+static VALUE matches_get(VALUE self, VALUE index)
+{
+    rb_completion_matches *m = matches_ptr(self);
+    long i = NUM2LONG(index);
+    if (i < 0)
+        i += m->limit;
+    if (i < 0 || i >= m->limit)
+        return Qnil;
+    return match_result(&m->matches[i]);
+}
+
+static VALUE matches_texts(VALUE self)
+{
+    rb_completion_matches *m = matches_ptr(self);
+    VALUE ary = rb_ary_new_capa(m->limit);
+    for (unsigned int i = 0; i < m->limit; i++)
+        rb_ary_store(ary, i, rb_utf8_str_new(m->matches[i].text, m->matches[i].len));
+    return ary;
+}
+
+static VALUE matches_indices(VALUE self)
+{
+    rb_completion_matches *m = matches_ptr(self);
+    VALUE ary = rb_ary_new_capa(m->limit);
+    for (unsigned int i = 0; i < m->limit; i++)
+        rb_ary_store(ary, i, UINT2NUM(m->matches[i].index));
+    return ary;
+}
+
+static VALUE matches_scores(VALUE self)
+{
+    rb_completion_matches *m = matches_ptr(self);
+    VALUE ary = rb_ary_new_capa(m->limit);
+    for (unsigned int i = 0; i < m->limit; i++)
+        rb_ary_store(ary, i, LL2NUM(m->matches[i].score));
+    return ary;
+}
+
+void Init_clang_completion_filter(void)
+{
+    rb_define_methodm1(rb_cCXCodeCompleteResults, "filter", results_filter, -1);
+
+    rb_undef_alloc_func(rb_cCXCompletionMatches);
+    rb_include_module(rb_cCXCompletionMatches, rb_mEnumerable);
+    rb_define_methodm1(rb_cCXCompletionMatches, "refine", matches_refine, -1);
+    rb_define_method0(rb_cCXCompletionMatches, "size", matches_size, 0);
+    rb_define_method0(rb_cCXCompletionMatches, "total", matches_total, 0);
+    rb_define_method0(rb_cCXCompletionMatches, "prefix", matches_prefix, 0);
+    rb_define_method0(rb_cCXCompletionMatches, "results", matches_results, 0);
+    rb_define_method0(rb_cCXCompletionMatches, "each", matches_each, 0);
+    rb_define_method1(rb_cCXCompletionMatches, "[]", matches_get, 1);
+    rb_define_method0(rb_cCXCompletionMatches, "texts", matches_texts, 0);
+    rb_define_method0(rb_cCXCompletionMatches, "indices", matches_indices, 0);
+    rb_define_method0(rb_cCXCompletionMatches, "scores", matches_scores, 0);
+    rb_define_alias(rb_cCXCompletionMatches, "length", "size");
+}
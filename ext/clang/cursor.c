@@ -3,7 +3,7 @@
 #define CURSORKIND_GET_BOOL(name, func)                                                                                \
     static VALUE name(VALUE self)                                                                                      \
     {                                                                                                                  \
-        CXCursor *c = DATA_PTR(self);                                                                                  \
+        CXCursor *c = rb_cursor_ptr(self);                                                                                  \
         return RB_BOOL(func(c->kind));                                                                                 \
     }
 
@@ -16,6 +16,17 @@ CURSORKIND_GET_BOOL(cursor_is_translation_unit, clang_isTranslationUnit)
 CURSORKIND_GET_BOOL(cursor_is_preprocessing, clang_isPreprocessing)
 CURSORKIND_GET_BOOL(cursor_is_unexposed, clang_isUnexposed)
 
+// Cursors derived from another share its translation unit
+static inline VALUE cursor_derive(VALUE self, CXCursor cursor)
+{
+    return rb_cursor_wrap(CLASS_OF(self), cursor, rb_cursor_unit(self));
+}
+
+static inline VALUE cursor_type_wrap(VALUE self, CXType type)
+{
+    return type.kind == CXType_Invalid ? Qnil : rb_type_wrap(rb_cCXType, type, rb_cursor_unit(self));
+}
+
 static VALUE pa_platform(VALUE self)
 {
     CXPlatformAvailability *pa = DATA_PTR(self);
@@ -53,7 +64,7 @@ static VALUE pa_message(VALUE self)
 
 static VALUE cursor_display_name(VALUE self)
 {
-    return RUBYSTR(clang_getCursorDisplayName(*(CXCursor*)DATA_PTR(self)));
+    return RUBYSTR(clang_getCursorDisplayName(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_pretty_printed(VALUE self, VALUE policy)
@@ -69,19 +80,17 @@ static VALUE cursor_pretty_printed(VALUE self, VALUE policy)
         p = NULL;
     }
 
-    return RUBYSTR(clang_getCursorPrettyPrinted(*(CXCursor*)DATA_PTR(self), p));
+    return RUBYSTR(clang_getCursorPrettyPrinted(*rb_cursor_ptr(self), p));
 }
 
 static VALUE cursor_null(VALUE klass)
 {
-    CXCursor *cursor = ALLOC(CXCursor);
-    *cursor = clang_getNullCursor();
-    return Data_Wrap_Struct(klass, NULL, RUBY_DEFAULT_FREE, cursor);
+    return rb_cursor_wrap(klass, clang_getNullCursor(), Qnil);
 }
 
 static VALUE cursor_is_null(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return RB_BOOL(clang_Cursor_isNull(*c));
 }
 
@@ -90,40 +99,42 @@ static VALUE cursor_equal(VALUE self, VALUE other)
     if (CLASS_OF(self) != CLASS_OF(other))
         return Qfalse;
 
-    CXCursor *c1 = DATA_PTR(self), *c2 = DATA_PTR(other);
+    // Only the handles are compared, so a cursor of a disposed unit is still usable as a key
+    CXCursor *c1 = &rb_cursor_record(self)->value, *c2 = &rb_cursor_record(other)->value;
     return RB_BOOL(clang_equalCursors(*c1, *c2));
 }
 
 static VALUE cursor_hash(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = &rb_cursor_record(self)->value;
     return UINT2NUM(clang_hashCursor(*c));
 }
 
 static VALUE cursor_kind(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     enum CXCursorKind kind = clang_getCursorKind(*c);
     return rb_enum_symbol(rb_CursorKind, kind);
 }
 
 static VALUE cursor_has_attrs(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return RB_BOOL(clang_Cursor_hasAttrs(*c));
 }
 
 
 static enum CXChildVisitResult cursor_visitor(CXCursor cursor, CXCursor parent, CXClientData data)
 {
-    VALUE proc = *(VALUE *)data;
-    CXCursor *c = ALLOC(CXCursor), *p = ALLOC(CXCursor);
-    *c = cursor;
-    *p = parent;
+    VALUE proc = ((VALUE *)data)[0], unit = ((VALUE *)data)[1];
 
-    VALUE args = rb_ary_new_from_args(2, Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, c),
-                                      Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, p));
+    VALUE args = rb_ary_new_from_args(2, rb_cursor_wrap(rb_cCXCursor, cursor, unit),
+                                      rb_cursor_wrap(rb_cCXCursor, parent, unit));
     VALUE result = rb_proc_call(proc, args);
+
+    // The block may have disposed of the unit that is being traversed
+    if (rb_tu_is_disposed(unit))
+        return CXChildVisit_Break;
     return SYMBOL_P(result) ? rb_enum_value(rb_ChildVisitResult, result) : CXChildVisit_Break;
 }
 
@@ -132,7 +143,7 @@ static VALUE cursor_is_declaration(int argc, VALUE *argv, VALUE self)
     VALUE valid;
     rb_scan_args(argc, argv, "01", &valid);
 
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     unsigned result = clang_isDeclaration(c->kind);
 
     if (RTEST(valid))
@@ -141,90 +152,332 @@ static VALUE cursor_is_declaration(int argc, VALUE *argv, VALUE self)
     return RB_BOOL(result);
 }
 
+static VALUE cursor_visit_run(VALUE data)
+{
+    VALUE *context = (VALUE *) data;
+    clang_visitChildren(*rb_cursor_ptr(context[2]), cursor_visitor, context);
+    return Qnil;
+}
+
 static VALUE cursor_visit_children(VALUE self)
 {
     rb_need_block();
-    VALUE proc = rb_block_proc();
-    CXCursor *c = DATA_PTR(self);
-    clang_visitChildren(*c, cursor_visitor, &proc);
+
+    // The unit is locked while the block runs, so that no other thread can change it under the traversal
+    VALUE context[3] = {rb_block_proc(), rb_cursor_unit(self), self};
+    rb_tu_locked(context[1], cursor_visit_run, (VALUE) context);
     return self;
 }
 
+// Gathers descendants into a native buffer, for each_descendant, children and descendants alike, so that they are only
+// wrapped once the traversal has returned and no block can unwind through libclang
+typedef struct
+{
+    unsigned long *kinds;
+    unsigned int max_kind;
+    CXFile *files;
+    long num_files;
+    int main_file_only;
+    int system_headers;
+    int depth;
+    int max_depth;
+    CXCursor *cursors;
+    VALUE unit;
+    long count;
+    long capa;
+    int failed;
+} cursor_collector;
+
+#define KIND_BITS (8 * sizeof(unsigned long))
+#define KIND_BIT_TEST(set, kind) ((set)[(kind) / KIND_BITS] & (1UL << ((kind) % KIND_BITS)))
+
+enum
+{
+    COLLECT_MATCH,
+    COLLECT_SKIP,
+    COLLECT_PRUNE
+};
+
+static int collect_location(cursor_collector *collector, CXCursor cursor)
+{
+    if (!collector->num_files && !collector->main_file_only && collector->system_headers)
+        return COLLECT_MATCH;
+
+    // Declarations outside the main file or within system headers do not enclose anything else, so neither are visited
+    CXSourceLocation loc = clang_getCursorLocation(cursor);
+    if (collector->main_file_only && !clang_Location_isFromMainFile(loc))
+        return COLLECT_PRUNE;
+    if (!collector->system_headers && clang_Location_isInSystemHeader(loc))
+        return COLLECT_PRUNE;
+    if (!collector->num_files)
+        return COLLECT_MATCH;
+
+    CXFile file;
+    clang_getFileLocation(loc, &file, NULL, NULL, NULL);
+    for (long i = 0; i < collector->num_files; i++)
+    {
+        if (clang_File_isEqual(file, collector->files[i]))
+            return COLLECT_MATCH;
+    }
+
+    // A file may be included within a declaration of another, such as a namespace or `extern "C"` block, so the
+    // descendants of a cursor in a file that is not searched are still visited
+    return COLLECT_SKIP;
+}
+
+static enum CXChildVisitResult collect_visitor(CXCursor cursor, CXCursor parent, CXClientData data)
+{
+    cursor_collector *collector = data;
+
+    int location = collect_location(collector, cursor);
+    if (location == COLLECT_PRUNE)
+        return CXChildVisit_Continue;
+
+    unsigned int kind = cursor.kind;
+    if (location == COLLECT_MATCH &&
+        (!collector->kinds || (kind <= collector->max_kind && KIND_BIT_TEST(collector->kinds, kind))))
+    {
+        if (collector->count == collector->capa)
+        {
+            // Allocation failure is reported once the traversal has returned, rather than raised from within it
+            long capa = collector->capa ? collector->capa * 2 : 64;
+            CXCursor *cursors = realloc(collector->cursors, sizeof(CXCursor) * capa);
+            if (!cursors)
+            {
+                collector->failed = 1;
+                return CXChildVisit_Break;
+            }
+            collector->cursors = cursors;
+            collector->capa = capa;
+        }
+        collector->cursors[collector->count++] = cursor;
+    }
+
+    // Without a limit, libclang recurses on its own, otherwise each level is visited separately to track the depth
+    if (!collector->max_depth)
+        return CXChildVisit_Recurse;
+    if (collector->depth + 1 < collector->max_depth)
+    {
+        collector->depth++;
+        clang_visitChildren(cursor, collect_visitor, collector);
+        collector->depth--;
+        if (collector->failed)
+            return CXChildVisit_Break;
+    }
+    return CXChildVisit_Continue;
+}
+
+static VALUE collect_yield(VALUE data)
+{
+    cursor_collector *collector = (cursor_collector *) data;
+    for (long i = 0; i < collector->count; i++)
+        rb_yield(rb_cursor_wrap(rb_cCXCursor, collector->cursors[i], collector->unit));
+    return Qnil;
+}
+
+static VALUE collect_wrap(VALUE data)
+{
+    cursor_collector *collector = (cursor_collector *) data;
+    VALUE ary = rb_ary_new_capa(collector->count);
+    for (long i = 0; i < collector->count; i++)
+        rb_ary_push(ary, rb_cursor_wrap(rb_cCXCursor, collector->cursors[i], collector->unit));
+    return ary;
+}
+
+static VALUE collect_free(VALUE data)
+{
+    free(((cursor_collector *) data)->cursors);
+    return Qnil;
+}
+
+static void collector_init(cursor_collector *collector, VALUE self)
+{
+    memset(collector, 0, sizeof(cursor_collector));
+    collector->unit = rb_cursor_unit(self);
+    collector->system_headers = 1;
+}
+
+static VALUE cursor_collect_run(VALUE self, cursor_collector *collector, VALUE (*func)(VALUE))
+{
+    clang_visitChildren(*rb_cursor_ptr(self), collect_visitor, collector);
+    if (collector->failed)
+    {
+        collect_free((VALUE) collector);
+        rb_memerror();
+    }
+    return rb_ensure(func, (VALUE) collector, collect_free, (VALUE) collector);
+}
+
+static VALUE cursor_each_descendant(int argc, VALUE *argv, VALUE self)
+{
+    RETURN_ENUMERATOR_KW(self, argc, argv, rb_keyword_given_p());
+
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[4] = {rb_intern("kinds"), rb_intern("files"), rb_intern("main_file_only"), rb_intern("system_headers")};
+    VALUE values[4];
+    rb_get_kwargs(kwargs, keys, 0, 4, values);
+
+    CXCursor *c = rb_cursor_ptr(self);
+    cursor_collector collector;
+    collector_init(&collector, self);
+    collector.main_file_only = values[2] != Qundef && RTEST(values[2]);
+    collector.system_headers = values[3] == Qundef || RTEST(values[3]);
+
+    // Filters are sized from the arguments, so they go in temporary buffers rather than on the stack
+    VALUE kinds = values[0] == Qundef || NIL_P(values[0]) ? Qnil : rb_Array(values[0]);
+    VALUE files = values[1] == Qundef || NIL_P(values[1]) ? Qnil : rb_Array(values[1]);
+    long num_kinds = NIL_P(kinds) ? 0 : rb_array_len(kinds);
+    long num_files = NIL_P(files) ? 0 : rb_array_len(files);
+
+    VALUE kind_buffer, bits_buffer = 0, file_buffer;
+    unsigned int *kind_values = ALLOCV_N(unsigned int, kind_buffer, num_kinds > 0 ? num_kinds : 1);
+    for (long i = 0; i < num_kinds; i++)
+    {
+        kind_values[i] = rb_enum_value(rb_CursorKind, rb_ary_entry(kinds, i));
+        if (kind_values[i] > collector.max_kind)
+            collector.max_kind = kind_values[i];
+    }
+
+    if (!NIL_P(kinds))
+    {
+        long words = collector.max_kind / KIND_BITS + 1;
+        collector.kinds = ALLOCV_N(unsigned long, bits_buffer, words);
+        memset(collector.kinds, 0, sizeof(unsigned long) * words);
+        for (long i = 0; i < num_kinds; i++)
+            collector.kinds[kind_values[i] / KIND_BITS] |= 1UL << (kind_values[i] % KIND_BITS);
+    }
+    ALLOCV_END(kind_buffer);
+
+    // A file that is not part of the translation unit can never match, but still restricts the search
+    CXTranslationUnit unit = clang_Cursor_getTranslationUnit(*c);
+    collector.files = ALLOCV_N(CXFile, file_buffer, num_files > 0 ? num_files : 1);
+    for (long i = 0; i < num_files; i++)
+    {
+        VALUE file = rb_ary_entry(files, i);
+        CXFile value;
+        if (rb_obj_is_kind_of(file, rb_cCXFile) == Qtrue)
+            value = *rb_file_ptr(file);
+        else
+            value = unit ? clang_getFile(unit, StringValueCStr(file)) : NULL;
+        if (value)
+            collector.files[collector.num_files++] = value;
+    }
+
+    if (NIL_P(files) || collector.num_files)
+        cursor_collect_run(self, &collector, collect_yield);
+
+    ALLOCV_END(bits_buffer);
+    ALLOCV_END(file_buffer);
+    return self;
+}
+
+static VALUE cursor_collect(VALUE self, int max_depth)
+{
+    cursor_collector collector;
+    collector_init(&collector, self);
+    collector.max_depth = max_depth;
+    return cursor_collect_run(self, &collector, collect_wrap);
+}
+
+static VALUE cursor_children(VALUE self)
+{
+    return cursor_collect(self, 1);
+}
+
+static VALUE cursor_descendants(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[1] = {rb_intern("depth")};
+    VALUE depth;
+    rb_get_kwargs(kwargs, keys, 0, 1, &depth);
+
+    int max_depth = 0;
+    if (depth != Qundef && !NIL_P(depth))
+    {
+        max_depth = NUM2INT(depth);
+        if (max_depth < 1)
+            rb_raise(rb_eArgError, "depth must be greater than 0");
+    }
+    return cursor_collect(self, max_depth);
+}
+
 static VALUE cursor_spelling(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self);
+    CXCursor *cursor = rb_cursor_ptr(self);
     CXString str = clang_getCursorSpelling(*cursor);
     return RUBYSTR(str);
 }
 
 static VALUE cursor_linkage(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int value = clang_getCursorLinkage(*c);
     return rb_enum_symbol(rb_LinkageKind, value);
 }
 
 static VALUE cursor_visibility(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int value = clang_getCursorVisibility(*c);
     return rb_enum_symbol(rb_VisibilityKind, value);
 }
 
 static VALUE cursor_availability(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int value = clang_getCursorAvailability(*c);
     return rb_enum_symbol(rb_AvailabilityKind, value);
 }
 
 static VALUE cursor_language(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int value = clang_getCursorLanguage(*c);
     return rb_enum_symbol(rb_LanguageKind, value);
 }
 
 static VALUE cursor_translation_unit(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    VALUE owner = rb_cursor_unit(self);
+    if (!NIL_P(owner))
+        return owner;
+
+    CXCursor *c = rb_cursor_ptr(self);
     CXTranslationUnit unit = clang_Cursor_getTranslationUnit(*c);
-    return unit ? Data_Wrap_Struct(rb_cCXTranslationUnit, NULL, RUBY_NEVER_FREE, unit) : Qnil;
+    return unit ? rb_tu_borrow(unit) : Qnil;
 }
 
 static VALUE cursor_semantic_parent(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self), *parent = ALLOC(CXCursor);
-    *parent = clang_getCursorSemanticParent(*c);
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, parent);
+    CXCursor *c = rb_cursor_ptr(self);
+    return cursor_derive(self, clang_getCursorSemanticParent(*c));
 }
 
 static VALUE cursor_lexical_parent(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self), *parent = ALLOC(CXCursor);
-    *parent = clang_getCursorLexicalParent(*c);
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, parent);
+    CXCursor *c = rb_cursor_ptr(self);
+    return cursor_derive(self, clang_getCursorLexicalParent(*c));
 }
 
 static VALUE cursor_location(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self);
-    CXSourceLocation *loc = ALLOC(CXSourceLocation);
-    *loc = clang_getCursorLocation(*cursor);
-    return Data_Wrap_Struct(rb_cCXSourceLocation, NULL, RUBY_DEFAULT_FREE, loc);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return rb_location_wrap(rb_cCXSourceLocation, clang_getCursorLocation(*cursor), rb_cursor_unit(self));
 }
 
 static VALUE cursor_extent(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self);
-    CXSourceRange *range = ALLOC(CXSourceRange);
-    *range = clang_getCursorExtent(*cursor);
-    return Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return rb_range_wrap(rb_cCXSourceRange, clang_getCursorExtent(*cursor), rb_cursor_unit(self));
 }
 
 static VALUE cursor_tls_kind(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self);
+    CXCursor *cursor = rb_cursor_ptr(self);
     int kind = clang_getCursorTLSKind(*cursor);
     return rb_enum_symbol(rb_TLSKind, kind);
 }
@@ -234,24 +487,25 @@ static VALUE cursor_initialize(VALUE self, VALUE translation_unit, VALUE locatio
     rb_assert_type(translation_unit, rb_cCXTranslationUnit);
     rb_assert_type(location, rb_cCXSourceLocation);
 
-    CXTranslationUnit unit = DATA_PTR(translation_unit);
-    CXSourceLocation *loc = DATA_PTR(location);
+    CXTranslationUnit unit = rb_tu_unit(translation_unit);
+    CXSourceLocation *loc = rb_location_ptr(location);
 
-    CXCursor cursor = clang_getCursor(unit, *loc);
-    memcpy(DATA_PTR(self), &cursor, sizeof(CXCursor));
+    rb_cursor *cursor = rb_cursor_record(self);
+    cursor->value = clang_getCursor(unit, *loc);
+    cursor->unit = translation_unit;
     return self;
 }
 
 static VALUE cursor_included_file(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     CXFile file = clang_getIncludedFile(*c);
-    return file ? Data_Wrap_Struct(rb_cCXFile, NULL, RUBY_NEVER_FREE, file) : Qnil;
+    return file ? rb_file_wrap(rb_cCXFile, file, rb_cursor_unit(self)) : Qnil;
 }
 
 static VALUE cursor_overrides(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     CXCursor *cursors;
     unsigned int count;
 
@@ -260,11 +514,7 @@ static VALUE cursor_overrides(VALUE self)
     if (count && cursors)
     {
         for (unsigned i = 0; i < count; i++)
-        {
-            CXCursor *cursor = ALLOC(CXCursor);
-            *cursor = cursors[i];
-            rb_ary_store(ary, i, Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, cursor));
-        }
+            rb_ary_store(ary, i, cursor_derive(self, cursors[i]));
         clang_disposeOverriddenCursors(cursors);
     }
     return ary;
@@ -272,86 +522,43 @@ static VALUE cursor_overrides(VALUE self)
 
 static VALUE cursor_type(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self);
-    CXType *type = ALLOC(CXType);
-
-    *type = clang_getCursorType(*cursor);
-    if (type->kind == CXType_Invalid)
-    {
-        xfree(type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return cursor_type_wrap(self, clang_getCursorType(*cursor));
 }
 
 static VALUE cursor_underlying_type(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self); 
-    CXType *type = ALLOC(CXType);
-    *type = clang_getTypedefDeclUnderlyingType(*cursor);
-    if (type->kind == CXType_Invalid)
-    {
-        xfree(type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return cursor_type_wrap(self, clang_getTypedefDeclUnderlyingType(*cursor));
 }
 
 static VALUE cursor_enum_int_type(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self); 
-    CXType *type = ALLOC(CXType);
-    *type = clang_getEnumDeclIntegerType(*cursor);
-    if (type->kind == CXType_Invalid)
-    {
-        xfree(type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return cursor_type_wrap(self, clang_getEnumDeclIntegerType(*cursor));
 }
 
 static VALUE cursor_result_type(VALUE self)
 {
-    CXType *type = ALLOC(CXType);
-    CXCursor *c = DATA_PTR(self);
-    *type = clang_getCursorResultType(*c);
-    if (type->kind == CXType_Invalid)
-    {
-        xfree(type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type);
+    CXCursor *c = rb_cursor_ptr(self);
+    return cursor_type_wrap(self, clang_getCursorResultType(*c));
 }
 
 static VALUE cursor_receiver_type(VALUE self)
 {
-    CXType *type = ALLOC(CXType);
-    *type = clang_Cursor_getReceiverType(*(CXCursor*)DATA_PTR(self));
-    if (type->kind == CXType_Invalid)
-    {
-        xfree(type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type);
+    return cursor_type_wrap(self, clang_Cursor_getReceiverType(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_ib_outlet_type(VALUE self)
 {
-    CXType *type = ALLOC(CXType);
-    *type = clang_getIBOutletCollectionType(*(CXCursor*)DATA_PTR(self));
-    if (type->kind == CXType_Invalid)
-    {
-        xfree(type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type);
+    return cursor_type_wrap(self, clang_getIBOutletCollectionType(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_enum_value(int argc, VALUE *argv, VALUE self)
 {
     VALUE unsigned_value;
     rb_scan_args(argc, argv, "01", &unsigned_value);
-    CXCursor *cursor = DATA_PTR(self);
+    CXCursor *cursor = rb_cursor_ptr(self);
 
     if (RTEST(unsigned_value))
         return ULL2NUM(clang_getEnumConstantDeclUnsignedValue(*cursor));
@@ -361,31 +568,27 @@ static VALUE cursor_enum_value(int argc, VALUE *argv, VALUE self)
 
 static VALUE cursor_bit_width(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int w = clang_getFieldDeclBitWidth(*c);
     return INT2NUM(w);
 }
 
 static VALUE cursor_arg_count(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return INT2NUM(clang_Cursor_getNumArguments(*c));
 }
 
 static VALUE cursor_args(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int n = clang_Cursor_getNumArguments(*c);
     if (n <= 0)
         return rb_ary_new_capa(0);
 
     VALUE ary = rb_ary_new_capa(n);
     for (int i = 0; i < n; i++)
-    {
-        CXCursor *arg = ALLOC(CXCursor);
-        *arg = clang_Cursor_getArgument(*c, i);
-        rb_ary_store(ary, i, Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, arg));
-    }
+        rb_ary_store(ary, i, cursor_derive(self, clang_Cursor_getArgument(*c, i)));
 
     return ary;
 }
@@ -393,15 +596,11 @@ static VALUE cursor_args(VALUE self)
 static VALUE cursor_each_arg(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     int n = clang_Cursor_getNumArguments(*c);
 
     for (int i = 0; i < n; i++)
-    {
-        CXCursor *arg = ALLOC(CXCursor);
-        *arg = clang_Cursor_getArgument(*c, i);
-        rb_yield(Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, arg));
-    }
+        rb_yield(cursor_derive(self, clang_Cursor_getArgument(*c, i)));
 
     return self;
 }
@@ -409,126 +608,119 @@ static VALUE cursor_each_arg(VALUE self)
 static VALUE cursor_each_overload(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
-    CXCursor c = *(CXCursor*) DATA_PTR(self);
+    CXCursor c = *rb_cursor_ptr(self);
 
     unsigned int n = clang_getNumOverloadedDecls(c);
     for (unsigned i = 0; i < n; i++)
-    {
-        CXCursor *cursor = ALLOC(CXCursor);
-        *cursor = clang_getOverloadedDecl(c, i);
-        rb_yield(Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, cursor));
-    }
+        rb_yield(cursor_derive(self, clang_getOverloadedDecl(c, i)));
 
     return self;
 }
 
 static VALUE cursor_is_macro_func(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return RB_BOOL(clang_Cursor_isMacroFunctionLike(*c));
 }
 
 static VALUE cursor_is_macro_builtin(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return RB_BOOL(clang_Cursor_isMacroBuiltin(*c));
 }
 
 static VALUE cursor_field_offset(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return LL2NUM(clang_Cursor_getOffsetOfField(*c));
 }
 
 static VALUE cursor_is_anonymous(VALUE self)
 {
-    CXCursor c = *(CXCursor*) DATA_PTR(self);
+    CXCursor c = *rb_cursor_ptr(self);
     return RB_BOOL(clang_Cursor_isAnonymous(c) || clang_Cursor_isAnonymousRecordDecl(c));
 }
 
 static VALUE cursor_is_inline(VALUE self)
 {
-    CXCursor c = *(CXCursor*) DATA_PTR(self);
+    CXCursor c = *rb_cursor_ptr(self);
     return RB_BOOL(clang_Cursor_isFunctionInlined(c) || clang_Cursor_isInlineNamespace(c));
 }
 
 static VALUE cursor_definition(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self), *def = ALLOC(CXCursor);
-    *def = clang_getCursorDefinition(*c);
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, def);
+    CXCursor *c = rb_cursor_ptr(self);
+    return cursor_derive(self, clang_getCursorDefinition(*c));
 }
 
 static VALUE cursor_is_definition(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self);
+    CXCursor *c = rb_cursor_ptr(self);
     return RB_BOOL(clang_isCursorDefinition(*c));
 }
 
 static VALUE cursor_raw_comment(VALUE self)
 {
-    CXString str = clang_Cursor_getRawCommentText(*(CXCursor*)DATA_PTR(self));
+    CXString str = clang_Cursor_getRawCommentText(*rb_cursor_ptr(self));
     return RUBYSTR(str);
 }
 
 static VALUE cursor_brief_comment(VALUE self)
 {
-    CXString str = clang_Cursor_getBriefCommentText(*(CXCursor*)DATA_PTR(self));
+    CXString str = clang_Cursor_getBriefCommentText(*rb_cursor_ptr(self));
     return RUBYSTR(str);
 }
 
 static VALUE cursor_comment_range(VALUE self)
 {
-    CXSourceRange *range = ALLOC(CXSourceRange);
-    *range = clang_Cursor_getCommentRange(*(CXCursor*)DATA_PTR(self));
-    return Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range);
+    CXSourceRange range = clang_Cursor_getCommentRange(*rb_cursor_ptr(self));
+    return rb_range_wrap(rb_cCXSourceRange, range, rb_cursor_unit(self));
 }
 
 static VALUE cursor_is_bitfield(VALUE self)
 {
-    return RB_BOOL(clang_Cursor_isBitField(*(CXCursor*)DATA_PTR(self)));
+    return RB_BOOL(clang_Cursor_isBitField(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_is_virtual_base(VALUE self)
 {
-    return RB_BOOL(clang_isVirtualBase(*(CXCursor*)DATA_PTR(self)));
+    return RB_BOOL(clang_isVirtualBase(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_canonical(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self), *canonical = ALLOC(CXCursor);
-    *canonical = clang_getCanonicalCursor(*cursor);
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, canonical);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return cursor_derive(self, clang_getCanonicalCursor(*cursor));
 }
 
 static VALUE cursor_is_dynamic_call(VALUE self)
 {
-    return RB_BOOL(clang_Cursor_isDynamicCall(*(CXCursor*)DATA_PTR(self)));
+    return RB_BOOL(clang_Cursor_isDynamicCall(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_is_variadic(VALUE self)
 {
-    return RB_BOOL(clang_Cursor_isVariadic(*(CXCursor*)DATA_PTR(self)));
+    return RB_BOOL(clang_Cursor_isVariadic(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_mangling(VALUE self)
 {
-    return RUBYSTR(clang_Cursor_getMangling(*(CXCursor*)DATA_PTR(self)));
+    return RUBYSTR(clang_Cursor_getMangling(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_cxx_manglings(VALUE self)
 {
-    return RUBYSTRSET(clang_Cursor_getCXXManglings(*(CXCursor*)DATA_PTR(self)));
+    return RUBYSTRSET(clang_Cursor_getCXXManglings(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_obj_c_manglings(VALUE self)
 {
-    return RUBYSTRSET(clang_Cursor_getObjCManglings(*(CXCursor*)DATA_PTR(self)));
+    return RUBYSTRSET(clang_Cursor_getObjCManglings(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_module(VALUE self)
 {
-    CXModule mod = clang_Cursor_getModule(*(CXCursor*)DATA_PTR(self));
+    CXModule mod = clang_Cursor_getModule(*rb_cursor_ptr(self));
 
     if (!mod)
         return Qnil;
@@ -540,7 +732,7 @@ static VALUE cursor_module(VALUE self)
 
 static VALUE cursor_platform_availability(VALUE self)
 {
-    CXCursor cursor = *(CXCursor*)DATA_PTR(self);
+    CXCursor cursor = *rb_cursor_ptr(self);
 
     int always_deprecated, always_unavailable;
     CXString deprecated_message, unavailable_message;
@@ -572,7 +764,7 @@ static VALUE cursor_each_template_arg(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
 
-    CXCursor cursor = *(CXCursor*)DATA_PTR(self);
+    CXCursor cursor = *rb_cursor_ptr(self);
     int count = clang_Cursor_getNumTemplateArguments(cursor);
 
     if (count < 1)
@@ -580,14 +772,13 @@ static VALUE cursor_each_template_arg(VALUE self)
 
     for (unsigned i = 0; i < count; i++)
     {
-        CXType *type = ALLOC(CXType);
-        *type = clang_Cursor_getTemplateArgumentType(cursor, i);
+        CXType type = clang_Cursor_getTemplateArgumentType(cursor, i);
         enum CXTemplateArgumentKind kind = clang_Cursor_getTemplateArgumentKind(cursor, i);
         VALUE value = Qnil;
 
         if (kind == CXTemplateArgumentKind_Integral)
         {
-            switch (type->kind)
+            switch (type.kind)
             {
                 CXType_UInt:
                 CXType_ULong:
@@ -609,7 +800,7 @@ static VALUE cursor_each_template_arg(VALUE self)
 
         VALUE args = rb_ary_new_from_args(4,
             INT2NUM(i),
-            Data_Wrap_Struct(rb_cCXType, NULL, RUBY_DEFAULT_FREE, type),
+            rb_type_wrap(rb_cCXType, type, rb_cursor_unit(self)),
             rb_enum_symbol(rb_TemplateArgumentKind, kind),
             value
         );
@@ -622,7 +813,7 @@ static VALUE cursor_each_template_arg(VALUE self)
 
 static VALUE cursor_exception_type(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self);
+    CXCursor *cursor = rb_cursor_ptr(self);
     enum CXCursor_ExceptionSpecificationKind kind = clang_getCursorExceptionSpecificationType(*cursor);
     if (kind < 0)
         return STR2SYM("invalid");
@@ -631,20 +822,19 @@ static VALUE cursor_exception_type(VALUE self)
 
 static VALUE cursor_referenced(VALUE self)
 {
-    CXCursor *cursor = DATA_PTR(self), *referenced = ALLOC(CXCursor);
-    *referenced = clang_getCursorReferenced(*cursor);
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, referenced);
+    CXCursor *cursor = rb_cursor_ptr(self);
+    return cursor_derive(self, clang_getCursorReferenced(*cursor));
 }
 
 static VALUE cursor_completion_string(VALUE self)
 {
-    CXCompletionString str = clang_getCursorCompletionString(*(CXCursor*)DATA_PTR(self));
+    CXCompletionString str = clang_getCursorCompletionString(*rb_cursor_ptr(self));
     return str ? Data_Wrap_Struct(rb_cCXCompletionString, NULL, RUBY_NEVER_FREE, str) : Qnil;
 }
 
 static VALUE cursor_eval(VALUE self)
 {
-    CXEvalResult result = clang_Cursor_Evaluate(*(CXCursor*)DATA_PTR(self));
+    CXEvalResult result = clang_Cursor_Evaluate(*rb_cursor_ptr(self));
     CXEvalResultKind kind = clang_EvalResult_getKind(result);
     
     VALUE value;
@@ -686,28 +876,22 @@ static VALUE cursor_eval(VALUE self)
 
 static enum CXVisitorResult cursor_reference_visitor(void *context, CXCursor cursor, CXSourceRange range)
 {
-    VALUE proc = *(VALUE*)context;
-    CXCursor *c = ALLOC(CXCursor);
-    CXSourceRange *r = ALLOC(CXSourceRange);
-
-    *c = cursor;
-    *r = range;
+    VALUE proc = ((VALUE*)context)[0], unit = ((VALUE*)context)[1];
     VALUE args = rb_ary_new_from_args(2, 
-        Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, c),
-        Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, r)
+        rb_cursor_wrap(rb_cCXCursor, cursor, unit),
+        rb_range_wrap(rb_cCXSourceRange, range, unit)
     );
 
     VALUE result = rb_proc_call(proc, args);
+    if (rb_tu_is_disposed(unit))
+        return CXVisit_Break;
     return (result == STR2SYM("continue")) ? CXVisit_Continue : CXVisit_Break;
 }
 
-static VALUE cursor_find_references(int argc, VALUE *argv, VALUE self)
+static VALUE cursor_find_references_run(VALUE data)
 {
-    rb_need_block();
-    VALUE source_file;
-    rb_scan_args(argc, argv, "01", &source_file);
-
-    CXCursor cursor = *(CXCursor*)DATA_PTR(self);
+    VALUE *context = (VALUE *) data, source_file = context[3];
+    CXCursor cursor = *rb_cursor_ptr(context[2]);
     CXFile file;
     if (NIL_P(source_file))
     {
@@ -716,26 +900,35 @@ static VALUE cursor_find_references(int argc, VALUE *argv, VALUE self)
     }
     else
     {
-        rb_assert_type(source_file, rb_cCXFile);
-        file = DATA_PTR(file);
+        file = *rb_file_ptr(source_file);
     }
 
-    VALUE proc = rb_block_proc();
-    CXCursorAndRangeVisitor visitor = { &proc, cursor_reference_visitor };
-
+    CXCursorAndRangeVisitor visitor = { context, cursor_reference_visitor };
     clang_findReferencesInFile(cursor, file, visitor);
     return Qnil;
 }
 
+static VALUE cursor_find_references(int argc, VALUE *argv, VALUE self)
+{
+    rb_need_block();
+    VALUE source_file;
+    rb_scan_args(argc, argv, "01", &source_file);
+    if (!NIL_P(source_file))
+        rb_assert_type(source_file, rb_cCXFile);
+
+    VALUE context[4] = {rb_block_proc(), rb_cursor_unit(self), self, source_file};
+    return rb_tu_locked(context[1], cursor_find_references_run, (VALUE) context);
+}
+
 static VALUE cursor_storage_class(VALUE self)
 {
-    enum CX_StorageClass sc = clang_Cursor_getStorageClass(*(CXCursor*)DATA_PTR(self));
+    enum CX_StorageClass sc = clang_Cursor_getStorageClass(*rb_cursor_ptr(self));
     return rb_enum_symbol(rb_StorageClass, sc);
 }
 
 static VALUE cursor_is_external(VALUE self)
 {
-    return RB_BOOL(clang_Cursor_isExternalSymbol(*(CXCursor*)DATA_PTR(self), NULL, NULL, NULL));
+    return RB_BOOL(clang_Cursor_isExternalSymbol(*rb_cursor_ptr(self), NULL, NULL, NULL));
 }
 
 static VALUE cursor_external_info(VALUE self)
@@ -743,7 +936,7 @@ static VALUE cursor_external_info(VALUE self)
     CXString language, defined_in;
     unsigned int generated;
 
-    unsigned external = clang_Cursor_isExternalSymbol(*(CXCursor*)DATA_PTR(self), &language, &defined_in, &generated);
+    unsigned external = clang_Cursor_isExternalSymbol(*rb_cursor_ptr(self), &language, &defined_in, &generated);
     if (!external)
         return Qnil;
     
@@ -757,34 +950,34 @@ static VALUE cursor_external_info(VALUE self)
 
 static VALUE cursor_obj_c_getter(VALUE self)
 {
-    return RUBYSTR(clang_Cursor_getObjCPropertyGetterName(*(CXCursor*)DATA_PTR(self)));
+    return RUBYSTR(clang_Cursor_getObjCPropertyGetterName(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_obj_c_setter(VALUE self)
 {
-    return RUBYSTR(clang_Cursor_getObjCPropertySetterName(*(CXCursor*)DATA_PTR(self)));
+    return RUBYSTR(clang_Cursor_getObjCPropertySetterName(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_obj_c_qualifiers(VALUE self)
 {
-    CXObjCDeclQualifierKind kind = clang_Cursor_getObjCDeclQualifiers(*(CXCursor*)DATA_PTR(self));
+    CXObjCDeclQualifierKind kind = clang_Cursor_getObjCDeclQualifiers(*rb_cursor_ptr(self));
     return rb_enum_unmask(rb_ObjCDeclQualifierKind, kind);
 }
 
 static VALUE cursor_obj_c_selector_index(VALUE self)
 {
-    return INT2NUM(clang_Cursor_getObjCSelectorIndex(*(CXCursor*)DATA_PTR(self)));
+    return INT2NUM(clang_Cursor_getObjCSelectorIndex(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_obj_c_attributes(VALUE self)
 {
-    CXObjCPropertyAttrKind kind = clang_Cursor_getObjCPropertyAttributes(*(CXCursor*)DATA_PTR(self), 0);
+    CXObjCPropertyAttrKind kind = clang_Cursor_getObjCPropertyAttributes(*rb_cursor_ptr(self), 0);
     return rb_enum_unmask(rb_ObjCPropertyAttrKind, kind);
 }
 
 static VALUE cursor_obj_c_is_optional(VALUE self)
 {
-    return RB_BOOL(clang_Cursor_isObjCOptional(*(CXCursor*)DATA_PTR(self)));
+    return RB_BOOL(clang_Cursor_isObjCOptional(*rb_cursor_ptr(self)));
 }
 
 static VALUE cursor_default_policy(VALUE klass)
@@ -832,6 +1025,9 @@ void Init_clang_cursor(void)
     rb_define_method0(rb_cCXCursor, "extent", cursor_extent, 0);
     rb_define_method0(rb_cCXCursor, "kind", cursor_kind, 0);
     rb_define_method0(rb_cCXCursor, "visit_children", cursor_visit_children, 0);
+    rb_define_methodm1(rb_cCXCursor, "each_descendant", cursor_each_descendant, -1);
+    rb_define_method0(rb_cCXCursor, "children", cursor_children, 0);
+    rb_define_methodm1(rb_cCXCursor, "descendants", cursor_descendants, -1);
     rb_define_method0(rb_cCXCursor, "spelling", cursor_spelling, 0);
     rb_define_methodm1(rb_cCXCursor, "declaration?", cursor_is_declaration, -1);
     rb_define_method0(rb_cCXCursor, "reference?", cursor_is_reference, 0);
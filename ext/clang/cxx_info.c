@@ -3,7 +3,7 @@
 #define CXXINFO_GET_BOOL(name, func)                                                                                   \
     static VALUE name(VALUE self)                                                                                      \
     {                                                                                                                  \
-        return RB_BOOL(func(*(CXCursor *)DATA_PTR(self)));                                                             \
+        return RB_BOOL(func(*rb_cursor_ptr(self)));                                                             \
     }
 
 VALUE rb_cCXXInfo;
@@ -23,42 +23,42 @@ static VALUE cxx_virtual_method(int argc, VALUE *argv, VALUE self)
     VALUE pure;
     rb_scan_args(argc, argv, "01", &pure);
 
-    CXCursor cursor = *(CXCursor*)DATA_PTR(self);
+    CXCursor cursor = *rb_cursor_ptr(self);
     unsigned int result = RTEST(pure) ? clang_CXXMethod_isPureVirtual(cursor): clang_CXXMethod_isVirtual(cursor);
     return RB_BOOL(result);
 }
 
 static VALUE cxx_is_default(VALUE self)
 {
-    CXCursor c = *(CXCursor*)DATA_PTR(self);
+    CXCursor c = *rb_cursor_ptr(self);
     return RB_BOOL(clang_CXXMethod_isDefaulted(c) || clang_CXXConstructor_isDefaultConstructor(c));
 }
 
+// The info is a cursor record of its own, so it keeps the unit of the cursor it was created from
 static VALUE cxx_alloc(VALUE klass)
 {
-    CXCursor *c = ALLOC(CXCursor);
-    *c = clang_getNullCursor();
-    return Data_Wrap_Struct(rb_cCXXInfo, NULL, RUBY_DEFAULT_FREE, c);
+    return rb_cursor_wrap(klass, clang_getNullCursor(), Qnil);
 }
 
 static VALUE cxx_initialize(VALUE self, VALUE cursor)
 {
     rb_assert_type(cursor, rb_cCXCursor);
-    memcpy(DATA_PTR(self), DATA_PTR(cursor), sizeof(CXCursor));
+    rb_cursor *info = rb_cursor_record(self);
+    info->value = *rb_cursor_ptr(cursor);
+    info->unit = rb_cursor_unit(cursor);
     return self;
 }
 
 static VALUE cxx_template_kind(VALUE self)
 {
-    enum CXCursorKind kind = clang_getTemplateCursorKind(*(CXCursor*)DATA_PTR(self));
+    enum CXCursorKind kind = clang_getTemplateCursorKind(*rb_cursor_ptr(self));
     return rb_enum_symbol(rb_CursorKind, kind);
 }
 
 static VALUE cxx_spec_template(VALUE self)
 {
-    CXCursor *c = DATA_PTR(self), *s = ALLOC(CXCursor);
-    *s = clang_getSpecializedCursorTemplate(*c);
-    return Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, s);
+    CXCursor *c = rb_cursor_ptr(self);
+    return rb_cursor_wrap(rb_cCXCursor, clang_getSpecializedCursorTemplate(*c), rb_cursor_unit(self));
 }
 
 static VALUE cxx_reference_range(int argc, VALUE *argv, VALUE self)
@@ -66,25 +66,24 @@ static VALUE cxx_reference_range(int argc, VALUE *argv, VALUE self)
     VALUE index, flags;
     rb_scan_args(argc, argv, "1*", &index, &flags);
 
-    CXCursor *c = DATA_PTR(self);
-    CXSourceRange *range = ALLOC(CXSourceRange);
+    CXCursor *c = rb_cursor_ptr(self);
     unsigned int i = UINT2NUM(index);
     unsigned int mask = rb_enum_mask(rb_NameRefFlags, flags);
     
-    *range = clang_getCursorReferenceNameRange(*c, mask, i);
-    return Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range);
+    CXSourceRange range = clang_getCursorReferenceNameRange(*c, mask, i);
+    return rb_range_wrap(rb_cCXSourceRange, range, rb_cursor_unit(self));
 }
 
 static VALUE cxx_access_specifier(VALUE self)
 {
-    enum CX_CXXAccessSpecifier spec = clang_getCXXAccessSpecifier(*(CXCursor*)DATA_PTR(self));
+    enum CX_CXXAccessSpecifier spec = clang_getCXXAccessSpecifier(*rb_cursor_ptr(self));
     return rb_enum_symbol(rb_CXXAccessSpecifier, spec);
 }
 
 static VALUE usr_from_cursor(VALUE usr, VALUE cursor)
 {
     rb_assert_type(cursor, rb_cCXCursor);
-    CXString str = clang_getCursorUSR(*(CXCursor*)DATA_PTR(cursor));
+    CXString str = clang_getCursorUSR(*rb_cursor_ptr(cursor));
     return RUBYSTR(str);
 }
 
@@ -1,46 +1,161 @@
 #include "clang.h"
 
-void clang_dset_free(void *data)
+static void dset_mark(void *data)
 {
-    if (data)
-        clang_disposeDiagnosticSet(data);
+    rb_dset *dset = data;
+    rb_gc_mark(dset->owner);
+    rb_gc_mark(dset->unit);
 }
 
-void clang_diagnostic_free(void *data)
+static void dset_free(void *data)
 {
-    if (data)
-        clang_disposeDiagnostic(data);
+    rb_dset *dset = data;
+    if (dset->set && NIL_P(dset->owner))
+        clang_disposeDiagnosticSet(dset->set);
+    xfree(dset);
+}
+
+// libclang has no memory statistics for diagnostics, so each is estimated with its message, ranges and fix-its
+#define DIAGNOSTIC_ESTIMATED_SIZE 512
+
+// Only a set loaded from a file is counted. One that belongs to a translation unit is already part of its resource
+// usage, and one that belongs to a diagnostic is part of the set that diagnostic came from.
+static size_t dset_memsize(const void *data)
+{
+    const rb_dset *dset = data;
+    size_t size = sizeof(rb_dset);
+    if (dset->set && NIL_P(dset->owner))
+        size += clang_getNumDiagnosticsInSet(dset->set) * DIAGNOSTIC_ESTIMATED_SIZE;
+    return size;
+}
+
+const rb_data_type_t rb_dset_type = {
+    "Clang::DiagnosticSet",
+    {dset_mark, dset_free, dset_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static VALUE dset_alloc(VALUE klass)
+{
+    rb_dset *dset;
+    VALUE self = TypedData_Make_Struct(klass, rb_dset, &rb_dset_type, dset);
+    dset->owner = Qnil;
+    dset->unit = Qnil;
+    return self;
+}
+
+VALUE rb_dset_wrap(CXDiagnosticSet set, VALUE owner, VALUE unit)
+{
+    VALUE self = dset_alloc(rb_cCXDiagnosticSet);
+    rb_dset *dset = RTYPEDDATA_DATA(self);
+    dset->set = set;
+    dset->owner = owner;
+    dset->unit = unit;
+    return self;
+}
+
+VALUE rb_dset_unit(VALUE self)
+{
+    rb_dset *dset = rb_check_typeddata(self, &rb_dset_type);
+    return dset->unit;
+}
+
+CXDiagnosticSet rb_dset_ptr(VALUE self)
+{
+    rb_dset *dset = rb_check_typeddata(self, &rb_dset_type);
+    rb_tu_check(dset->unit);
+    return dset->set;
+}
+
+static void diagnostic_mark(void *data)
+{
+    rb_diagnostic *diag = data;
+    rb_gc_mark(diag->owner);
+    rb_gc_mark(diag->unit);
+}
+
+static void diagnostic_free(void *data)
+{
+    rb_diagnostic *diag = data;
+    if (diag->value && diag->owned)
+        clang_disposeDiagnostic(diag->value);
+    xfree(diag);
+}
+
+static const rb_data_type_t diagnostic_type = {
+    "Clang::Diagnostic",
+    {diagnostic_mark, diagnostic_free, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static VALUE diagnostic_alloc(VALUE klass)
+{
+    rb_diagnostic *diag;
+    VALUE self = TypedData_Make_Struct(klass, rb_diagnostic, &diagnostic_type, diag);
+    diag->owner = Qnil;
+    diag->unit = Qnil;
+    return self;
+}
+
+VALUE rb_diagnostic_wrap(CXDiagnostic diagnostic, VALUE owner, VALUE unit, int owned)
+{
+    VALUE self = diagnostic_alloc(rb_cCXDiagnostic);
+    rb_diagnostic *diag = RTYPEDDATA_DATA(self);
+    diag->value = diagnostic;
+    diag->owner = owner;
+    diag->unit = unit;
+    diag->owned = owned;
+    return self;
+}
+
+static rb_diagnostic *diagnostic_record(VALUE self)
+{
+    rb_diagnostic *diag = rb_check_typeddata(self, &diagnostic_type);
+    rb_tu_check(diag->unit);
+    return diag;
+}
+
+static CXDiagnostic diagnostic_ptr(VALUE self)
+{
+    return diagnostic_record(self)->value;
+}
+
+static VALUE diagnostic_unit(VALUE self)
+{
+    return diagnostic_record(self)->unit;
 }
 
 static VALUE dset_each(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
 
-    CXDiagnosticSet set = DATA_PTR(self);
+    CXDiagnosticSet set = rb_dset_ptr(self);
     unsigned int n = clang_getNumDiagnosticsInSet(set);
 
     for (unsigned i = 0; i < n; i++)
     {
         CXDiagnostic d = clang_getDiagnosticInSet(set, i);
-        rb_yield(Data_Wrap_Struct(rb_cCXDiagnostic, NULL, clang_diagnostic_free, d));
+        rb_yield(rb_diagnostic_wrap(d, self, rb_dset_unit(self), 0));
     }
     return self;
 }
 
 static VALUE dset_get(VALUE self, VALUE index)
 {
-    CXDiagnosticSet set = DATA_PTR(self);
+    CXDiagnosticSet set = rb_dset_ptr(self);
     unsigned int n = clang_getNumDiagnosticsInSet(set), i = NUM2UINT(index);
     if (i >= n)
         return Qnil;
     
     CXDiagnostic d = clang_getDiagnosticInSet(set, i);
-    return Data_Wrap_Struct(rb_cCXDiagnostic, NULL, clang_diagnostic_free, d);
+    return rb_diagnostic_wrap(d, self, rb_dset_unit(self), 0);
 }
 
 static VALUE dset_size(VALUE self)
 {
-    CXDiagnosticSet set = DATA_PTR(self);
+    CXDiagnosticSet set = rb_dset_ptr(self);
     unsigned int n = clang_getNumDiagnosticsInSet(set);
     return UINT2NUM(n);
 }
@@ -59,19 +174,21 @@ static VALUE dset_load(VALUE klass, VALUE path)
         rb_raise(rb_eRuntimeError, "%s", err_message);
     }
 
-    return Data_Wrap_Struct(klass, NULL, clang_dset_free, set);
+    VALUE self = dset_alloc(klass);
+    ((rb_dset *) RTYPEDDATA_DATA(self))->set = set;
+    return self;
 }
 
 static VALUE diagnostic_children(VALUE self)
 {
-    CXDiagnostic d = DATA_PTR(self);
-    CXDiagnosticSet set = clang_getChildDiagnostics(d);
-    return set ? Data_Wrap_Struct(rb_cCXDiagnosticSet, NULL, RUBY_NEVER_FREE, set) : Qnil;
+    rb_diagnostic *diag = diagnostic_record(self);
+    CXDiagnosticSet set = clang_getChildDiagnostics(diag->value);
+    return set ? rb_dset_wrap(set, self, diag->unit) : Qnil;
 }
 
 static VALUE diagnostic_format(VALUE self, VALUE options)
 {
-    CXDiagnostic d = DATA_PTR(self);
+    CXDiagnostic d = diagnostic_ptr(self);
     unsigned int mask = rb_enum_mask(rb_DiagnosticDisplayOptions, options);
     clang_formatDiagnostic(d, mask);
     return UINT2NUM(mask);
@@ -79,7 +196,7 @@ static VALUE diagnostic_format(VALUE self, VALUE options)
 
 static VALUE diagnostic_severity(VALUE self)
 {
-    CXDiagnostic d = DATA_PTR(self);
+    CXDiagnostic d = diagnostic_ptr(self);
     return rb_enum_symbol(rb_DiagnosticSeverity, clang_getDiagnosticSeverity(d));
 }
 
@@ -91,14 +208,13 @@ static VALUE diagnostic_default_format(VALUE klass)
 
 static VALUE diagnostic_location(VALUE self)
 {
-    CXSourceLocation *loc = ALLOC(CXSourceLocation);
-    *loc = clang_getDiagnosticLocation(DATA_PTR(self));
-    return Data_Wrap_Struct(rb_cCXSourceLocation, NULL, RUBY_DEFAULT_FREE, loc);
+    CXSourceLocation loc = clang_getDiagnosticLocation(diagnostic_ptr(self));
+    return rb_location_wrap(rb_cCXSourceLocation, loc, diagnostic_unit(self));
 }
 
 static VALUE diagnostic_spelling(VALUE self)
 {
-    CXString str = clang_getDiagnosticSpelling(DATA_PTR(self));
+    CXString str = clang_getDiagnosticSpelling(diagnostic_ptr(self));
     return RUBYSTR(str);
 }
 
@@ -108,7 +224,7 @@ static VALUE diagnostic_option_str(int argc, VALUE *argv, VALUE self)
     rb_scan_args(argc, argv, "01", &disable);
 
     CXString enable_str, disable_str;
-    enable_str = clang_getDiagnosticOption(DATA_PTR(self), &disable_str);
+    enable_str = clang_getDiagnosticOption(diagnostic_ptr(self), &disable_str);
     const char *str = clang_getCString(RTEST(disable) ? enable_str : disable_str);
     VALUE rb = rb_str_new_cstr(str);
 
@@ -119,33 +235,29 @@ static VALUE diagnostic_option_str(int argc, VALUE *argv, VALUE self)
 
 static VALUE diagnostic_category(VALUE self)
 {
-    unsigned int n = clang_getDiagnosticCategory(DATA_PTR(self));
+    unsigned int n = clang_getDiagnosticCategory(diagnostic_ptr(self));
     return UINT2NUM(n);
 }
 
 static VALUE diagnostic_category_name(VALUE self)
 {
-    CXString str = clang_getDiagnosticCategoryText(DATA_PTR(self));
+    CXString str = clang_getDiagnosticCategoryText(diagnostic_ptr(self));
     return RUBYSTR(str);
 }
 
 static VALUE diagnostic_range_count(VALUE self)
 {
-    return UINT2NUM(clang_getDiagnosticNumRanges(DATA_PTR(self)));
+    return UINT2NUM(clang_getDiagnosticNumRanges(diagnostic_ptr(self)));
 }
 
 static VALUE diagnostic_ranges(VALUE self)
 {
-    CXDiagnostic d = DATA_PTR(self);
+    CXDiagnostic d = diagnostic_ptr(self);
     unsigned int n = clang_getDiagnosticNumRanges(d);
 
     VALUE ary = rb_ary_new_capa(n);
     for (unsigned i = 0; i < n; i++)
-    {
-        CXSourceRange *range = ALLOC(CXSourceRange);
-        *range = clang_getDiagnosticRange(d, i);
-        rb_ary_store(ary, i, Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range));
-    }
+        rb_ary_store(ary, i, rb_range_wrap(rb_cCXSourceRange, clang_getDiagnosticRange(d, i), diagnostic_unit(self)));
     return ary;
 }
 
@@ -153,34 +265,30 @@ static VALUE diagnostic_each_range(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
 
-    CXDiagnostic d = DATA_PTR(self);
+    CXDiagnostic d = diagnostic_ptr(self);
     unsigned int n = clang_getDiagnosticNumRanges(d);
 
     for (unsigned i = 0; i < n; i++)
-    {
-        CXSourceRange *range = ALLOC(CXSourceRange);
-        *range = clang_getDiagnosticRange(d, i);
-        rb_yield(Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range));
-    }
+        rb_yield(rb_range_wrap(rb_cCXSourceRange, clang_getDiagnosticRange(d, i), diagnostic_unit(self)));
     return self; 
 }
 
 static VALUE diagnostic_fixit_count(VALUE self)
 {
-    return UINT2NUM(clang_getDiagnosticNumFixIts(DATA_PTR(self)));
+    return UINT2NUM(clang_getDiagnosticNumFixIts(diagnostic_ptr(self)));
 }
 
 static VALUE diagnostic_fixits(VALUE self)
 {
-    CXDiagnostic d = DATA_PTR(self);
+    CXDiagnostic d = diagnostic_ptr(self);
     unsigned int n = clang_getDiagnosticNumFixIts(d);
     VALUE ary = rb_ary_new_capa(n);
 
     for (unsigned i = 0; i < n; i++)
     {
-        CXSourceRange *range = ALLOC(CXSourceRange);
-        CXString s = clang_getDiagnosticFixIt(d, i, range);
-        VALUE r = Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range);
+        CXSourceRange range;
+        CXString s = clang_getDiagnosticFixIt(d, i, &range);
+        VALUE r = rb_range_wrap(rb_cCXSourceRange, range, diagnostic_unit(self));
         rb_ary_store(ary, i, rb_ary_new_from_args(2, RUBYSTR(s), r));
     }
 
@@ -190,14 +298,14 @@ static VALUE diagnostic_fixits(VALUE self)
 static VALUE diagnostic_each_fixit(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
-    CXDiagnostic d = DATA_PTR(self);
+    CXDiagnostic d = diagnostic_ptr(self);
     unsigned int n = clang_getDiagnosticNumFixIts(d);
 
     for (unsigned i = 0; i < n; i++)
     {
-        CXSourceRange *range = ALLOC(CXSourceRange);
-        CXString s = clang_getDiagnosticFixIt(d, i, range);
-        VALUE r = Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range);
+        CXSourceRange range;
+        CXString s = clang_getDiagnosticFixIt(d, i, &range);
+        VALUE r = rb_range_wrap(rb_cCXSourceRange, range, diagnostic_unit(self));
         rb_yield(rb_ary_new_from_args(2, RUBYSTR(s), r));
     }
 
@@ -206,6 +314,8 @@ static VALUE diagnostic_each_fixit(VALUE self)
 
 void Init_clang_diagnostic(void)
 {
+    rb_define_alloc_func(rb_cCXDiagnosticSet, dset_alloc);
+    rb_define_alloc_func(rb_cCXDiagnostic, diagnostic_alloc);
     rb_include_module(rb_cCXDiagnosticSet, rb_mEnumerable);
     rb_define_singleton_method1(rb_cCXDiagnosticSet, "load", dset_load, 1);
     rb_define_method1(rb_cCXDiagnosticSet, "[]", dset_get, 1);
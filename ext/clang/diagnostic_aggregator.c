@@ -0,0 +1,471 @@
+#include "clang.h"
+#include "uthash.h"
+#include <stdint.h>
+#include <ruby/thread.h>
+
+#define AGG_NONE UINT32_MAX
+#define AGG_DEFAULT_MAX_UNIQUE 65536
+
+// Diagnostics are the same when they share a location, category and option. Those without an option, such as
+// errors, are also told apart by their text, as unrelated errors may be reported at the same location.
+typedef struct
+{
+    uint32_t file;
+    uint32_t offset;
+    uint32_t category;
+    uint32_t option;
+    uint32_t spelling;
+} agg_key;
+
+// The first occurrence of a unique diagnostic, and how often it has been seen since
+typedef struct
+{
+    agg_key key;
+    uint32_t severity;
+    uint32_t line;
+    uint32_t column;
+    uint32_t spelling;
+    uint32_t category_name;
+    uint32_t count;
+    uint32_t sources;
+    uint32_t last_source;
+    UT_hash_handle hh;
+} agg_record;
+
+typedef struct
+{
+    rb_strtab strings;
+    agg_record *table;
+    agg_record **records;
+    uint32_t count;
+    uint32_t capa;
+    uint32_t max_unique;
+    uint64_t total;
+    uint64_t dropped;
+    uint32_t num_sources;
+} rb_diag_aggregator;
+
+typedef struct
+{
+    uint32_t severity;
+    uint32_t file;
+    uint32_t line;
+    uint32_t column;
+    uint32_t offset;
+    uint32_t category;
+    uint32_t category_name;
+    uint32_t option;
+    uint32_t spelling;
+} agg_row;
+
+// The top-level diagnostics of one source, decoded without the GVL before being merged into the aggregator
+typedef struct
+{
+    CXTranslationUnit unit;
+    CXDiagnosticSet set;
+    int owned;
+    rb_strtab strings;
+    agg_row *rows;
+    uint32_t num_rows;
+    uint32_t capa_rows;
+    int failed;
+} agg_pass;
+
+static void agg_free(void *data)
+{
+    rb_diag_aggregator *agg = data;
+    HASH_CLEAR(hh, agg->table);
+    for (uint32_t i = 0; i < agg->count; i++)
+        free(agg->records[i]);
+    free(agg->records);
+    rb_strtab_free(&agg->strings);
+    xfree(agg);
+}
+
+static size_t agg_memsize(const void *data)
+{
+    const rb_diag_aggregator *agg = data;
+    size_t size = sizeof(rb_diag_aggregator) + rb_strtab_memsize(&agg->strings);
+    return size + sizeof(agg_record *) * agg->capa + sizeof(agg_record) * agg->count;
+}
+
+static const rb_data_type_t agg_type = {
+    "Clang::DiagnosticAggregator",
+    {NULL, agg_free, agg_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_diag_aggregator *agg_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &agg_type);
+}
+
+static uint32_t pass_intern(agg_pass *pass, CXString str)
+{
+    const char *cstr = clang_getCString(str);
+    unsigned int id = 0;
+    if (cstr && !rb_strtab_intern(&pass->strings, cstr, strlen(cstr), &id))
+        pass->failed = 1;
+    clang_disposeString(str);
+    return id;
+}
+
+static void pass_append(agg_pass *pass, CXDiagnostic d)
+{
+    if (pass->num_rows == pass->capa_rows)
+    {
+        uint32_t capa = pass->capa_rows ? pass->capa_rows * 2 : 64;
+        agg_row *rows = realloc(pass->rows, sizeof(agg_row) * capa);
+        if (!rows)
+        {
+            pass->failed = 1;
+            return;
+        }
+        pass->rows = rows;
+        pass->capa_rows = capa;
+    }
+
+    agg_row *row = &pass->rows[pass->num_rows++];
+    CXFile file;
+    unsigned int line, column, offset;
+    clang_getFileLocation(clang_getDiagnosticLocation(d), &file, &line, &column, &offset);
+    row->severity = clang_getDiagnosticSeverity(d);
+    row->file = file ? pass_intern(pass, clang_getFileName(file)) : 0;
+    row->line = line;
+    row->column = column;
+    row->offset = offset;
+    row->category = clang_getDiagnosticCategory(d);
+    row->category_name = pass_intern(pass, clang_getDiagnosticCategoryText(d));
+    row->option = pass_intern(pass, clang_getDiagnosticOption(d, NULL));
+    row->spelling = pass_intern(pass, clang_getDiagnosticSpelling(d));
+}
+
+static void *pass_nogvl(void *data)
+{
+    agg_pass *pass = data;
+    unsigned int n = pass->unit ? clang_getNumDiagnostics(pass->unit) : clang_getNumDiagnosticsInSet(pass->set);
+    for (unsigned int i = 0; i < n && !pass->failed; i++)
+    {
+        CXDiagnostic d = pass->unit ? clang_getDiagnostic(pass->unit, i) : clang_getDiagnosticInSet(pass->set, i);
+        pass_append(pass, d);
+        clang_disposeDiagnostic(d);
+    }
+    return NULL;
+}
+
+static VALUE pass_free(VALUE data)
+{
+    agg_pass *pass = (agg_pass *) data;
+    if (pass->owned && pass->set)
+        clang_disposeDiagnosticSet(pass->set);
+    rb_strtab_free(&pass->strings);
+    free(pass->rows);
+    return Qnil;
+}
+
+// Translates an id of the pass to one of the aggregator. Once the aggregator is full, no new strings are interned,
+// and a string it does not know yet can only belong to a diagnostic that will be dropped.
+static uint32_t agg_string(rb_diag_aggregator *agg, agg_pass *pass, uint32_t *ids, uint32_t id, int full)
+{
+    if (ids[id] != AGG_NONE)
+        return ids[id];
+
+    size_t len;
+    unsigned int value;
+    const char *str = rb_strtab_get(&pass->strings, id, &len);
+    if (full)
+    {
+        if (!rb_strtab_find(&agg->strings, str, len, &value))
+            return AGG_NONE;
+    }
+    else if (!rb_strtab_intern(&agg->strings, str, len, &value))
+        rb_memerror();
+
+    ids[id] = value;
+    return value;
+}
+
+static agg_record *agg_insert(rb_diag_aggregator *agg, const agg_key *key)
+{
+    if (agg->count == agg->capa)
+    {
+        uint32_t capa = agg->capa ? agg->capa * 2 : 64;
+        agg_record **records = realloc(agg->records, sizeof(agg_record *) * capa);
+        if (!records)
+            rb_memerror();
+        agg->records = records;
+        agg->capa = capa;
+    }
+
+    agg_record *record = calloc(1, sizeof(agg_record));
+    if (!record)
+        rb_memerror();
+    record->key = *key;
+    record->last_source = AGG_NONE;
+    agg->records[agg->count++] = record;
+    HASH_ADD(hh, agg->table, key, sizeof(agg_key), record);
+    return record;
+}
+
+typedef struct
+{
+    rb_diag_aggregator *agg;
+    agg_pass *pass;
+    VALUE unit;
+} agg_add_args;
+
+static VALUE agg_add_run(VALUE data)
+{
+    agg_add_args *args = (agg_add_args *) data;
+    rb_diag_aggregator *agg = args->agg;
+    agg_pass *pass = args->pass;
+
+    rb_tu_without_gvl(args->unit, pass_nogvl, pass, NULL, NULL);
+    if (pass->failed)
+        rb_memerror();
+
+    VALUE buffer;
+    uint32_t *ids = ALLOCV_N(uint32_t, buffer, pass->strings.count);
+    for (uint32_t i = 0; i < pass->strings.count; i++)
+        ids[i] = AGG_NONE;
+    ids[0] = 0;
+
+    uint32_t source = agg->num_sources++;
+    uint32_t added = 0;
+    for (uint32_t i = 0; i < pass->num_rows; i++)
+    {
+        const agg_row *row = &pass->rows[i];
+        int full = agg->count >= agg->max_unique;
+        agg->total++;
+
+        agg_key key;
+        memset(&key, 0, sizeof(agg_key));
+        key.file = agg_string(agg, pass, ids, row->file, full);
+        key.offset = row->offset;
+        key.category = row->category;
+        key.option = agg_string(agg, pass, ids, row->option, full);
+        key.spelling = key.option ? 0 : agg_string(agg, pass, ids, row->spelling, full);
+
+        agg_record *record = NULL;
+        if (key.file != AGG_NONE && key.option != AGG_NONE && key.spelling != AGG_NONE)
+            HASH_FIND(hh, agg->table, &key, sizeof(agg_key), record);
+
+        if (!record)
+        {
+            if (full)
+            {
+                agg->dropped++;
+                continue;
+            }
+            record = agg_insert(agg, &key);
+            record->line = row->line;
+            record->column = row->column;
+            record->spelling = agg_string(agg, pass, ids, row->spelling, 0);
+            record->category_name = agg_string(agg, pass, ids, row->category_name, 0);
+            added++;
+        }
+
+        // The same header may be compiled with different flags, so the most severe occurrence is reported
+        if (row->severity > record->severity)
+            record->severity = row->severity;
+        record->count++;
+        if (record->last_source != source)
+        {
+            record->last_source = source;
+            record->sources++;
+        }
+    }
+
+    ALLOCV_END(buffer);
+    return UINT2NUM(added);
+}
+
+static CXDiagnosticSet agg_load(VALUE path)
+{
+    enum CXLoadDiag_Error err;
+    CXString message;
+
+    CXDiagnosticSet set = clang_loadDiagnostics(StringValueCStr(path), &err, &message);
+    if (err == CXLoadDiag_None)
+    {
+        clang_disposeString(message);
+        return set;
+    }
+
+    VALUE str = RUBYSTR(message);
+    rb_raise(rb_eIOError, "%" PRIsVALUE, str);
+    return NULL;
+}
+
+static VALUE agg_add(VALUE self, VALUE source)
+{
+    rb_diag_aggregator *agg = agg_ptr(self);
+
+    agg_pass pass = {0};
+    VALUE unit = Qnil;
+    if (rb_typeddata_is_kind_of(source, &rb_tu_type))
+    {
+        pass.unit = rb_tu_unit(source);
+        unit = source;
+    }
+    else if (RB_TYPE_P(source, T_STRING) || rb_respond_to(source, rb_intern("to_path")))
+    {
+        pass.set = agg_load(rb_get_path(source));
+        pass.owned = 1;
+    }
+    else
+    {
+        pass.set = rb_dset_ptr(source);
+        unit = rb_dset_unit(source);
+        if (!pass.set)
+            rb_raise(rb_eRuntimeError, "diagnostic set is not initialized");
+    }
+
+    if (!rb_strtab_init(&pass.strings))
+    {
+        pass_free((VALUE) &pass);
+        rb_memerror();
+    }
+
+    agg_add_args args = {agg, &pass, unit};
+    VALUE added = rb_ensure(agg_add_run, (VALUE) &args, pass_free, (VALUE) &pass);
+    RB_GC_GUARD(source);
+    return added;
+}
+
+static VALUE agg_record_hash(rb_diag_aggregator *agg, const agg_record *record)
+{
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, STR2SYM("severity"), rb_enum_symbol(rb_DiagnosticSeverity, record->severity));
+    rb_hash_aset(hash, STR2SYM("file"), rb_strtab_str(&agg->strings, record->key.file));
+    rb_hash_aset(hash, STR2SYM("line"), UINT2NUM(record->line));
+    rb_hash_aset(hash, STR2SYM("column"), UINT2NUM(record->column));
+    rb_hash_aset(hash, STR2SYM("offset"), UINT2NUM(record->key.offset));
+    rb_hash_aset(hash, STR2SYM("spelling"), rb_strtab_str(&agg->strings, record->spelling));
+    rb_hash_aset(hash, STR2SYM("category"), UINT2NUM(record->key.category));
+    rb_hash_aset(hash, STR2SYM("category_name"), rb_strtab_str(&agg->strings, record->category_name));
+    rb_hash_aset(hash, STR2SYM("option"), rb_strtab_str(&agg->strings, record->key.option));
+    rb_hash_aset(hash, STR2SYM("count"), UINT2NUM(record->count));
+    rb_hash_aset(hash, STR2SYM("sources"), UINT2NUM(record->sources));
+    return hash;
+}
+
+static VALUE agg_get(VALUE self, VALUE index)
+{
+    rb_diag_aggregator *agg = agg_ptr(self);
+    long i = NUM2LONG(index);
+    if (i < 0)
+        i += agg->count;
+    if (i < 0 || i >= agg->count)
+        return Qnil;
+    return agg_record_hash(agg, agg->records[i]);
+}
+
+static VALUE agg_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    rb_diag_aggregator *agg = agg_ptr(self);
+    for (uint32_t i = 0; i < agg->count; i++)
+        rb_yield(agg_record_hash(agg, agg->records[i]));
+
+    return self;
+}
+
+static VALUE agg_size(VALUE self)
+{
+    return UINT2NUM(agg_ptr(self)->count);
+}
+
+static VALUE agg_total(VALUE self)
+{
+    return ULL2NUM(agg_ptr(self)->total);
+}
+
+static VALUE agg_dropped(VALUE self)
+{
+    return ULL2NUM(agg_ptr(self)->dropped);
+}
+
+static VALUE agg_sources(VALUE self)
+{
+    return UINT2NUM(agg_ptr(self)->num_sources);
+}
+
+static VALUE agg_max_unique(VALUE self)
+{
+    return UINT2NUM(agg_ptr(self)->max_unique);
+}
+
+static VALUE agg_full_p(VALUE self)
+{
+    rb_diag_aggregator *agg = agg_ptr(self);
+    return RB_BOOL(agg->count >= agg->max_unique);
+}
+
+static VALUE agg_clear(VALUE self)
+{
+    rb_diag_aggregator *agg = agg_ptr(self);
+    rb_strtab strings;
+    if (!rb_strtab_init(&strings))
+        rb_memerror();
+
+    HASH_CLEAR(hh, agg->table);
+    for (uint32_t i = 0; i < agg->count; i++)
+        free(agg->records[i]);
+    rb_strtab_free(&agg->strings);
+    agg->strings = strings;
+    agg->count = 0;
+    agg->total = 0;
+    agg->dropped = 0;
+    agg->num_sources = 0;
+    return self;
+}
+
+static VALUE agg_alloc(VALUE klass)
+{
+    rb_diag_aggregator *agg = ZALLOC(rb_diag_aggregator);
+    VALUE obj = TypedData_Wrap_Struct(klass, &agg_type, agg);
+    if (!rb_strtab_init(&agg->strings))
+        rb_memerror();
+    agg->max_unique = AGG_DEFAULT_MAX_UNIQUE;
+    return obj;
+}
+
+static VALUE agg_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[1] = {rb_intern("max_unique")};
+    VALUE max_unique;
+    rb_get_kwargs(kwargs, keys, 0, 1, &max_unique);
+
+    if (max_unique != Qundef)
+    {
+        long n = NUM2LONG(max_unique);
+        if (n <= 0 || n >= AGG_NONE)
+            rb_raise(rb_eArgError, "max_unique must be between 1 and %u", AGG_NONE - 1);
+        agg_ptr(self)->max_unique = (uint32_t) n;
+    }
+    return self;
+}
+
+void Init_clang_diagnostic_aggregator(void)
+{
+    rb_define_alloc_func(rb_cCXDiagnosticAggregator, agg_alloc);
+    rb_include_module(rb_cCXDiagnosticAggregator, rb_mEnumerable);
+    rb_define_methodm1(rb_cCXDiagnosticAggregator, "initialize", agg_initialize, -1);
+    rb_define_method1(rb_cCXDiagnosticAggregator, "add", agg_add, 1);
+    rb_define_method1(rb_cCXDiagnosticAggregator, "[]", agg_get, 1);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "each", agg_each, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "size", agg_size, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "total", agg_total, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "dropped", agg_dropped, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "sources", agg_sources, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "max_unique", agg_max_unique, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "full?", agg_full_p, 0);
+    rb_define_method0(rb_cCXDiagnosticAggregator, "clear", agg_clear, 0);
+    rb_define_alias(rb_cCXDiagnosticAggregator, "length", "size");
+}
@@ -0,0 +1,443 @@
+#include "clang.h"
+#include <stdint.h>
+#include <ruby/thread.h>
+
+#define DIAG_NO_PARENT UINT32_MAX
+
+enum
+{
+    DIAG_SEVERITY,
+    DIAG_PARENT,
+    DIAG_FILE,
+    DIAG_LINE,
+    DIAG_COLUMN,
+    DIAG_OFFSET,
+    DIAG_SPELLING,
+    DIAG_CATEGORY,
+    DIAG_CATEGORY_NAME,
+    DIAG_OPTION,
+    DIAG_DISABLE_OPTION,
+    DIAG_NUM_COLUMNS
+};
+
+static const char *diag_column_names[DIAG_NUM_COLUMNS] = {
+    "severity", "parent",   "file",          "line",   "column",        "offset",
+    "spelling", "category", "category_name", "option", "disable_option"};
+
+// A source range of a diagnostic, or the range a fix-it replaces, with the row of the diagnostic it belongs to
+typedef struct
+{
+    uint32_t row;
+    uint32_t file;
+    uint32_t start_line;
+    uint32_t start_column;
+    uint32_t start_offset;
+    uint32_t end_line;
+    uint32_t end_column;
+    uint32_t end_offset;
+    uint32_t replacement;
+} diag_range;
+
+// One row per diagnostic, children following their parent, stored column-wise like an ASTTable
+typedef struct
+{
+    uint32_t rows;
+    uint32_t capa;
+    uint32_t *columns[DIAG_NUM_COLUMNS];
+    uint32_t *range_first;
+    uint32_t *fixit_first;
+    diag_range *ranges;
+    uint32_t num_ranges;
+    uint32_t capa_ranges;
+    diag_range *fixits;
+    uint32_t num_fixits;
+    uint32_t capa_fixits;
+    rb_strtab files;
+    rb_strtab strings;
+    CXTranslationUnit unit;
+    CXDiagnosticSet set;
+    int failed;
+} rb_diag_table;
+
+static void diag_table_free(void *data)
+{
+    rb_diag_table *table = data;
+    for (int i = 0; i < DIAG_NUM_COLUMNS; i++)
+        free(table->columns[i]);
+    free(table->range_first);
+    free(table->fixit_first);
+    free(table->ranges);
+    free(table->fixits);
+    rb_strtab_free(&table->files);
+    rb_strtab_free(&table->strings);
+    xfree(table);
+}
+
+static size_t diag_table_memsize(const void *data)
+{
+    const rb_diag_table *table = data;
+    size_t size = sizeof(rb_diag_table) + sizeof(uint32_t) * (DIAG_NUM_COLUMNS + 2) * table->capa;
+    size += sizeof(diag_range) * (table->capa_ranges + table->capa_fixits);
+    return size + rb_strtab_memsize(&table->files) + rb_strtab_memsize(&table->strings);
+}
+
+static const rb_data_type_t diag_table_type = {
+    "Clang::DiagnosticTable",
+    {NULL, diag_table_free, diag_table_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static int diag_intern(rb_diag_table *table, rb_strtab *tab, CXString str, uint32_t *id)
+{
+    const char *cstr = clang_getCString(str);
+    unsigned int value = 0;
+    int result = !cstr || rb_strtab_intern(tab, cstr, strlen(cstr), &value);
+    clang_disposeString(str);
+    *id = value;
+    if (!result)
+        table->failed = 1;
+    return result;
+}
+
+static int diag_grow(rb_diag_table *table)
+{
+    uint32_t capa = table->capa ? table->capa * 2 : 256;
+    for (int i = 0; i < DIAG_NUM_COLUMNS + 2; i++)
+    {
+        uint32_t **column = i < DIAG_NUM_COLUMNS ? &table->columns[i] : i == DIAG_NUM_COLUMNS ? &table->range_first
+                                                                                                : &table->fixit_first;
+        uint32_t *grown = realloc(*column, sizeof(uint32_t) * capa);
+        if (!grown)
+            return 0;
+        *column = grown;
+    }
+    table->capa = capa;
+    return 1;
+}
+
+static CXFile diag_location(CXSourceLocation location, uint32_t *line, uint32_t *column, uint32_t *offset)
+{
+    CXFile file;
+    unsigned int l, c, o;
+    clang_getFileLocation(location, &file, &l, &c, &o);
+    *line = l;
+    *column = c;
+    *offset = o;
+    return file;
+}
+
+static uint32_t diag_file(rb_diag_table *table, CXFile file)
+{
+    uint32_t id = 0;
+    if (file)
+        diag_intern(table, &table->files, clang_getFileName(file), &id);
+    return id;
+}
+
+static diag_range *diag_push_range(rb_diag_table *table, diag_range **ranges, uint32_t *count, uint32_t *capa,
+                                   uint32_t row, CXSourceRange range)
+{
+    if (*count == *capa)
+    {
+        uint32_t n = *capa ? *capa * 2 : 64;
+        diag_range *grown = realloc(*ranges, sizeof(diag_range) * n);
+        if (!grown)
+        {
+            table->failed = 1;
+            return NULL;
+        }
+        *ranges = grown;
+        *capa = n;
+    }
+
+    diag_range *r = &(*ranges)[(*count)++];
+    r->row = row;
+    r->replacement = 0;
+    CXFile file = diag_location(clang_getRangeStart(range), &r->start_line, &r->start_column, &r->start_offset);
+    diag_location(clang_getRangeEnd(range), &r->end_line, &r->end_column, &r->end_offset);
+    r->file = diag_file(table, file);
+    return r;
+}
+
+static void diag_append(rb_diag_table *table, CXDiagnostic d, uint32_t parent)
+{
+    if (table->failed || (table->rows == table->capa && !diag_grow(table)))
+    {
+        table->failed = 1;
+        return;
+    }
+
+    uint32_t row = table->rows++;
+    uint32_t **c = table->columns;
+    c[DIAG_SEVERITY][row] = clang_getDiagnosticSeverity(d);
+    c[DIAG_PARENT][row] = parent;
+    CXFile file = diag_location(clang_getDiagnosticLocation(d), &c[DIAG_LINE][row], &c[DIAG_COLUMN][row],
+                                &c[DIAG_OFFSET][row]);
+    c[DIAG_FILE][row] = diag_file(table, file);
+    c[DIAG_CATEGORY][row] = clang_getDiagnosticCategory(d);
+    diag_intern(table, &table->strings, clang_getDiagnosticSpelling(d), &c[DIAG_SPELLING][row]);
+    diag_intern(table, &table->strings, clang_getDiagnosticCategoryText(d), &c[DIAG_CATEGORY_NAME][row]);
+
+    CXString disable;
+    diag_intern(table, &table->strings, clang_getDiagnosticOption(d, &disable), &c[DIAG_OPTION][row]);
+    diag_intern(table, &table->strings, disable, &c[DIAG_DISABLE_OPTION][row]);
+
+    table->range_first[row] = table->num_ranges;
+    unsigned int n = clang_getDiagnosticNumRanges(d);
+    for (unsigned int i = 0; i < n && !table->failed; i++)
+        diag_push_range(table, &table->ranges, &table->num_ranges, &table->capa_ranges, row,
+                        clang_getDiagnosticRange(d, i));
+
+    table->fixit_first[row] = table->num_fixits;
+    n = clang_getDiagnosticNumFixIts(d);
+    for (unsigned int i = 0; i < n && !table->failed; i++)
+    {
+        CXSourceRange range;
+        CXString replacement = clang_getDiagnosticFixIt(d, i, &range);
+        diag_range *r = diag_push_range(table, &table->fixits, &table->num_fixits, &table->capa_fixits, row, range);
+        if (r)
+            diag_intern(table, &table->strings, replacement, &r->replacement);
+        else
+            clang_disposeString(replacement);
+    }
+
+    // Child diagnostics, such as notes, belong to their parent and are not disposed separately
+    CXDiagnosticSet children = clang_getChildDiagnostics(d);
+    n = children ? clang_getNumDiagnosticsInSet(children) : 0;
+    for (unsigned int i = 0; i < n && !table->failed; i++)
+        diag_append(table, clang_getDiagnosticInSet(children, i), row);
+}
+
+static void *diag_build_nogvl(void *data)
+{
+    rb_diag_table *table = data;
+    unsigned int n = table->unit ? clang_getNumDiagnostics(table->unit) : clang_getNumDiagnosticsInSet(table->set);
+    for (unsigned int i = 0; i < n && !table->failed; i++)
+    {
+        CXDiagnostic d = table->unit ? clang_getDiagnostic(table->unit, i) : clang_getDiagnosticInSet(table->set, i);
+        diag_append(table, d, DIAG_NO_PARENT);
+        clang_disposeDiagnostic(d);
+    }
+    return NULL;
+}
+
+static VALUE diag_table_build(VALUE tu, CXTranslationUnit unit, CXDiagnosticSet set)
+{
+    rb_diag_table *table = ZALLOC(rb_diag_table);
+    VALUE obj = TypedData_Wrap_Struct(rb_cCXDiagnosticTable, &diag_table_type, table);
+    table->unit = unit;
+    table->set = set;
+    if (!rb_strtab_init(&table->files) || !rb_strtab_init(&table->strings))
+        rb_memerror();
+
+    // Nothing in the pass touches Ruby, so every diagnostic is decoded without the GVL
+    rb_tu_without_gvl(tu, diag_build_nogvl, table, NULL, NULL);
+    table->unit = NULL;
+    table->set = NULL;
+
+    if (table->failed)
+        rb_memerror();
+    return obj;
+}
+
+static VALUE tu_diagnostics_table(VALUE self)
+{
+    VALUE table = diag_table_build(self, rb_tu_unit(self), NULL);
+    RB_GC_GUARD(self);
+    return table;
+}
+
+static VALUE dset_to_records(VALUE self)
+{
+    CXDiagnosticSet set = rb_dset_ptr(self);
+    if (!set)
+        rb_raise(rb_eRuntimeError, "diagnostic set is not initialized");
+
+    VALUE table = diag_table_build(rb_dset_unit(self), NULL, set);
+    RB_GC_GUARD(self);
+    return table;
+}
+
+static rb_diag_table *diag_table_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &diag_table_type);
+}
+
+static uint32_t diag_row(rb_diag_table *table, VALUE index)
+{
+    long i = NUM2LONG(index);
+    if (i < 0)
+        i += table->rows;
+    if (i < 0 || i >= table->rows)
+        rb_raise(rb_eIndexError, "row %ld out of range", NUM2LONG(index));
+    return (uint32_t) i;
+}
+
+static int diag_column_index(VALUE name)
+{
+    if (!SYMBOL_P(name))
+        rb_raise(rb_eTypeError, "%s is not a Symbol", CLASS_NAME(name));
+
+    ID id = SYM2ID(name);
+    for (int i = 0; i < DIAG_NUM_COLUMNS; i++)
+    {
+        if (id == rb_intern(diag_column_names[i]))
+            return i;
+    }
+    rb_raise(rb_eArgError, "unknown column %" PRIsVALUE, name);
+    return -1;
+}
+
+static VALUE diag_value(rb_diag_table *table, int column, uint32_t row)
+{
+    uint32_t value = table->columns[column][row];
+    switch (column)
+    {
+        case DIAG_SEVERITY:
+            return rb_enum_symbol(rb_DiagnosticSeverity, value);
+        case DIAG_PARENT:
+            return value == DIAG_NO_PARENT ? Qnil : UINT2NUM(value);
+        case DIAG_FILE:
+            return rb_strtab_str(&table->files, value);
+        case DIAG_SPELLING:
+        case DIAG_CATEGORY_NAME:
+        case DIAG_OPTION:
+        case DIAG_DISABLE_OPTION:
+            return rb_strtab_str(&table->strings, value);
+        default:
+            return UINT2NUM(value);
+    }
+}
+
+static VALUE diag_range_hash(rb_diag_table *table, const diag_range *r, int fixit)
+{
+    VALUE hash = rb_hash_new();
+    if (fixit)
+        rb_hash_aset(hash, STR2SYM("replacement"), rb_strtab_str(&table->strings, r->replacement));
+    rb_hash_aset(hash, STR2SYM("file"), rb_strtab_str(&table->files, r->file));
+    rb_hash_aset(hash, STR2SYM("start_line"), UINT2NUM(r->start_line));
+    rb_hash_aset(hash, STR2SYM("start_column"), UINT2NUM(r->start_column));
+    rb_hash_aset(hash, STR2SYM("start_offset"), UINT2NUM(r->start_offset));
+    rb_hash_aset(hash, STR2SYM("end_line"), UINT2NUM(r->end_line));
+    rb_hash_aset(hash, STR2SYM("end_column"), UINT2NUM(r->end_column));
+    rb_hash_aset(hash, STR2SYM("end_offset"), UINT2NUM(r->end_offset));
+    return hash;
+}
+
+static VALUE diag_row_ranges(rb_diag_table *table, uint32_t row, int fixit)
+{
+    const diag_range *ranges = fixit ? table->fixits : table->ranges;
+    uint32_t first = fixit ? table->fixit_first[row] : table->range_first[row];
+    uint32_t count = fixit ? table->num_fixits : table->num_ranges;
+
+    VALUE ary = rb_ary_new();
+    for (uint32_t i = first; i < count && ranges[i].row == row; i++)
+        rb_ary_push(ary, diag_range_hash(table, &ranges[i], fixit));
+    return ary;
+}
+
+static VALUE diag_row_hash(rb_diag_table *table, uint32_t row)
+{
+    VALUE hash = rb_hash_new();
+    for (int i = 0; i < DIAG_NUM_COLUMNS; i++)
+        rb_hash_aset(hash, STR2SYM(diag_column_names[i]), diag_value(table, i, row));
+    rb_hash_aset(hash, STR2SYM("ranges"), diag_row_ranges(table, row, 0));
+    rb_hash_aset(hash, STR2SYM("fixits"), diag_row_ranges(table, row, 1));
+    return hash;
+}
+
+static VALUE diag_size(VALUE self)
+{
+    return UINT2NUM(diag_table_ptr(self)->rows);
+}
+
+static VALUE diag_files(VALUE self)
+{
+    return rb_strtab_ary(&diag_table_ptr(self)->files);
+}
+
+static VALUE diag_strings(VALUE self)
+{
+    return rb_strtab_ary(&diag_table_ptr(self)->strings);
+}
+
+static VALUE diag_get(VALUE self, VALUE index)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    return diag_row_hash(table, diag_row(table, index));
+}
+
+static VALUE diag_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    rb_diag_table *table = diag_table_ptr(self);
+    for (uint32_t i = 0; i < table->rows; i++)
+        rb_yield(diag_row_hash(table, i));
+
+    return self;
+}
+
+static VALUE diag_column(VALUE self, VALUE name)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    int column = diag_column_index(name);
+
+    VALUE ary = rb_ary_new_capa(table->rows);
+    for (uint32_t i = 0; i < table->rows; i++)
+        rb_ary_store(ary, i, diag_value(table, column, i));
+    return ary;
+}
+
+static VALUE diag_pack(VALUE self, VALUE name)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    int column = diag_column_index(name);
+    return rb_str_new((const char *) table->columns[column], sizeof(uint32_t) * table->rows);
+}
+
+static VALUE diag_pack_ranges(VALUE self)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    return rb_str_new((const char *) table->ranges, sizeof(diag_range) * table->num_ranges);
+}
+
+static VALUE diag_pack_fixits(VALUE self)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    return rb_str_new((const char *) table->fixits, sizeof(diag_range) * table->num_fixits);
+}
+
+static VALUE diag_ranges(VALUE self, VALUE index)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    return diag_row_ranges(table, diag_row(table, index), 0);
+}
+
+static VALUE diag_fixits(VALUE self, VALUE index)
+{
+    rb_diag_table *table = diag_table_ptr(self);
+    return diag_row_ranges(table, diag_row(table, index), 1);
+}
+
+void Init_clang_diagnostic_table(void)
+{
+    rb_define_method0(rb_cCXTranslationUnit, "diagnostics_table", tu_diagnostics_table, 0);
+    rb_define_method0(rb_cCXDiagnosticSet, "to_records", dset_to_records, 0);
+
+    rb_undef_alloc_func(rb_cCXDiagnosticTable);
+    rb_include_module(rb_cCXDiagnosticTable, rb_mEnumerable);
+    rb_define_method0(rb_cCXDiagnosticTable, "size", diag_size, 0);
+    rb_define_method0(rb_cCXDiagnosticTable, "files", diag_files, 0);
+    rb_define_method0(rb_cCXDiagnosticTable, "strings", diag_strings, 0);
+    rb_define_method1(rb_cCXDiagnosticTable, "[]", diag_get, 1);
+    rb_define_method0(rb_cCXDiagnosticTable, "each", diag_each, 0);
+    rb_define_method1(rb_cCXDiagnosticTable, "column", diag_column, 1);
+    rb_define_method1(rb_cCXDiagnosticTable, "pack", diag_pack, 1);
+    rb_define_method1(rb_cCXDiagnosticTable, "ranges", diag_ranges, 1);
+    rb_define_method1(rb_cCXDiagnosticTable, "fixits", diag_fixits, 1);
+    rb_define_method0(rb_cCXDiagnosticTable, "pack_ranges", diag_pack_ranges, 0);
+    rb_define_method0(rb_cCXDiagnosticTable, "pack_fixits", diag_pack_fixits, 0);
+    rb_define_alias(rb_cCXDiagnosticTable, "length", "size");
+}
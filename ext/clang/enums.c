@@ -35,31 +35,61 @@ VALUE rb_CodeCompleteFlags;
 VALUE rb_CompletionContext;
 VALUE rb_VisitorResult;
 VALUE rb_Result;
+VALUE rb_IndexOptFlags;
+VALUE rb_IdxEntityKind;
+VALUE rb_IdxEntityLanguage;
 
 typedef struct 
 {
     VALUE sym;
     unsigned int value;
     UT_hash_handle hh;
+    UT_hash_handle hv;
 } rb_enum;
 
+// Values below this are resolved through a dense array, larger ones (i.e. high flag bits) through a hash
+#define ENUM_DENSE_MAX 4096
+// Upper bound on the number of decoded masks cached per enumeration
+#define ENUM_MASK_CACHE_MAX 1024
+
+typedef struct
+{
+    rb_enum *head;
+    rb_enum *by_value;
+    VALUE *symbols;
+    unsigned int num_symbols;
+    VALUE masks;
+} rb_enum_table;
+
+static void enum_mark(void *data)
+{
+    rb_enum_table *table = data;
+    rb_gc_mark(table->masks);
+}
+
 static void enum_free(void *data)
 {
-    rb_enum *e, *temp, *head = data;
-    HASH_ITER(hh, head, e, temp)
+    rb_enum_table *table = data;
+    rb_enum *e, *temp;
+    HASH_CLEAR(hv, table->by_value);
+    HASH_ITER(hh, table->head, e, temp)
     {
-        HASH_DEL(head, e);
+        HASH_DELETE(hh, table->head, e);
         xfree(e);
     }
+    xfree(table->symbols);
+    xfree(table);
 }
 
 VALUE enum_allocate(VALUE klass)
 {
-    
-    return Data_Wrap_Struct(klass, NULL, enum_free, NULL);
+    rb_enum_table *table = ALLOC(rb_enum_table);
+    memset(table, 0, sizeof(rb_enum_table));
+    table->masks = Qnil;
+    return Data_Wrap_Struct(klass, enum_mark, enum_free, table);
 }
 
-static VALUE enum_create(VALUE *value, const char *name)
+static void enum_create(VALUE *value, const char *name)
 {
     *value = enum_allocate(rb_cEnum);
     rb_define_const(rb_mClang, name, *value);
@@ -67,19 +97,39 @@ static VALUE enum_create(VALUE *value, const char *name)
 
 void enum_field(VALUE enumeration, const char *name, unsigned int value)
 {
-    rb_enum *field = ALLOC(rb_enum);
+    rb_enum_table *table = DATA_PTR(enumeration);
+    rb_enum *field = ALLOC(rb_enum), *existing;
     field->sym = STR2SYM(name);
     field->value = value;
+    HASH_ADD(hh, table->head, sym, sizeof(VALUE), field);
 
-    rb_enum **e = (rb_enum**) &RDATA(enumeration)->data;
-    HASH_ADD(hh, *e, sym, sizeof(VALUE), field);
+    // Aliased values keep resolving to the first name they were defined with
+    if (value < ENUM_DENSE_MAX)
+    {
+        if (value >= table->num_symbols)
+        {
+            unsigned int n = table->num_symbols;
+            REALLOC_N(table->symbols, VALUE, value + 1);
+            for (; n <= value; n++)
+                table->symbols[n] = Qundef;
+            table->num_symbols = value + 1;
+        }
+        if (table->symbols[value] == Qundef)
+            table->symbols[value] = field->sym;
+    }
+    else
+    {
+        HASH_FIND(hv, table->by_value, &value, sizeof(unsigned int), existing);
+        if (!existing)
+            HASH_ADD(hv, table->by_value, value, sizeof(unsigned int), field);
+    }
 }
 
 static VALUE enum_each(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
 
-    rb_enum *e, *temp, *head = DATA_PTR(self);
+    rb_enum *e, *temp, *head = ((rb_enum_table *) DATA_PTR(self))->head;
     HASH_ITER(hh, head, e, temp)
     {
         rb_yield(rb_ary_new_from_args(2, e->sym, INT2NUM(e->value)));
@@ -90,13 +140,13 @@ static VALUE enum_each(VALUE self)
 
 static VALUE enum_count(VALUE self)
 {
-    rb_enum *head = DATA_PTR(self);
+    rb_enum *head = ((rb_enum_table *) DATA_PTR(self))->head;
     return UINT2NUM(HASH_COUNT(head));
 }
 
 static VALUE enum_names(VALUE self)
 {
-    rb_enum *e, *temp, *head = DATA_PTR(self);
+    rb_enum *e, *temp, *head = ((rb_enum_table *) DATA_PTR(self))->head;
     unsigned int count = HASH_COUNT(head);
     VALUE ary = rb_ary_new_capa(count);
 
@@ -110,7 +160,7 @@ static VALUE enum_names(VALUE self)
 
 static VALUE enum_fields(VALUE self)
 {
-    rb_enum *e, *temp, *head = DATA_PTR(self);
+    rb_enum *e, *temp, *head = ((rb_enum_table *) DATA_PTR(self))->head;
     unsigned int count = HASH_COUNT(head);
     VALUE ary = rb_ary_new_capa(count);
 
@@ -125,7 +175,7 @@ static VALUE enum_fields(VALUE self)
 static VALUE enum_to_hash(VALUE self)
 {
     VALUE hash = rb_hash_new();
-    rb_enum *e, *temp, *head = DATA_PTR(self);
+    rb_enum *e, *temp, *head = ((rb_enum_table *) DATA_PTR(self))->head;
     
     HASH_ITER(hh, head, e, temp)
     {
@@ -151,7 +201,7 @@ unsigned int rb_enum_mask(VALUE enumeration, VALUE symbols)
 {
     long len = rb_array_len(symbols);
     unsigned int mask = 0;
-    rb_enum *e, *head = DATA_PTR(enumeration);
+    rb_enum *e, *head = ((rb_enum_table *) DATA_PTR(enumeration))->head;
     VALUE sym;
 
     for (long i = 0; i < len; i++)
@@ -170,34 +220,49 @@ unsigned int rb_enum_mask(VALUE enumeration, VALUE symbols)
 
 VALUE rb_enum_symbol(VALUE enumeration, unsigned int value)
 {
-    rb_enum *e, *temp, *head = DATA_PTR(enumeration);
-    HASH_ITER(hh, head, e, temp)
+    rb_enum_table *table = DATA_PTR(enumeration);
+    if (value < table->num_symbols)
     {
-        if (e->value == value)
-            return e->sym;
+        VALUE sym = table->symbols[value];
+        return sym == Qundef ? UINT2NUM(value) : sym;
     }
-    return UINT2NUM(value);
+
+    rb_enum *e;
+    HASH_FIND(hv, table->by_value, &value, sizeof(unsigned int), e);
+    return e ? e->sym : UINT2NUM(value);
 }
 
 unsigned int rb_enum_value(VALUE enumeration, VALUE symbol)
 {
     if (!SYMBOL_P(symbol))
         return 0;
-    rb_enum *e, *head = DATA_PTR(enumeration);
+    rb_enum *e, *head = ((rb_enum_table *) DATA_PTR(enumeration))->head;
     HASH_FIND(hh, head, &symbol, sizeof(VALUE), e);
     return e ? e->value : 0;
 }
 
 VALUE rb_enum_unmask(VALUE enumeration, unsigned int mask)
 {
-    VALUE ary = rb_ary_new();
-    rb_enum *e, *temp, *head = DATA_PTR(enumeration);
-    HASH_ITER(hh, head, e, temp)
+    rb_enum_table *table = DATA_PTR(enumeration);
+    VALUE key = UINT2NUM(mask);
+    if (NIL_P(table->masks))
+        table->masks = rb_hash_new();
+
+    VALUE ary = rb_hash_lookup2(table->masks, key, Qundef);
+    if (ary != Qundef)
+        return ary;
+
+    ary = rb_ary_new();
+    rb_enum *e, *temp;
+    HASH_ITER(hh, table->head, e, temp)
     {
         if ((e->value & mask) != 0)
             rb_ary_push(ary, e->sym);
     }
+    rb_obj_freeze(ary);
 
+    if (RHASH_SIZE(table->masks) < ENUM_MASK_CACHE_MAX)
+        rb_hash_aset(table->masks, key, ary);
     return ary;
 }
 
@@ -213,7 +278,7 @@ static VALUE enum_unmask(VALUE self, VALUE value)
         return rb_ary_new_capa(0);
 
     unsigned int mask = NUM2UINT(value);
-    return rb_enum_mask(self, mask);
+    return rb_enum_unmask(self, mask);
 }
 
 static VALUE enum_symbol(VALUE self, VALUE value)
@@ -230,7 +295,7 @@ static VALUE enum_method_missing(int argc, VALUE *argv, VALUE self)
 {
     if (argc == 1 && SYMBOL_P(argv[0]))
     {
-        rb_enum *result, *head = DATA_PTR(self);    
+        rb_enum *result, *head = ((rb_enum_table *) DATA_PTR(self))->head;
         HASH_FIND(hh, head, &argv[0], sizeof(VALUE), result);
         if (result)
             return UINT2NUM(result->value);
@@ -986,4 +1051,52 @@ void Init_clang_enums(void)
     enum_field(rb_Result, "success", CXResult_Success);
     enum_field(rb_Result, "invalid", CXResult_Invalid);
     enum_field(rb_Result, "visit_break", CXResult_VisitBreak);
+
+    // CXIndexOptFlags
+    enum_create(&rb_IndexOptFlags, "IndexOptFlags");
+    enum_field(rb_IndexOptFlags, "none", CXIndexOpt_None);
+    enum_field(rb_IndexOptFlags, "suppress_redundant_refs", CXIndexOpt_SuppressRedundantRefs);
+    enum_field(rb_IndexOptFlags, "index_function_local_symbols", CXIndexOpt_IndexFunctionLocalSymbols);
+    enum_field(rb_IndexOptFlags, "index_implicit_template_instantiations", CXIndexOpt_IndexImplicitTemplateInstantiations);
+    enum_field(rb_IndexOptFlags, "suppress_warnings", CXIndexOpt_SuppressWarnings);
+    enum_field(rb_IndexOptFlags, "skip_parsed_bodies_in_session", CXIndexOpt_SkipParsedBodiesInSession);
+
+    // CXIdxEntityKind
+    enum_create(&rb_IdxEntityKind, "IdxEntityKind");
+    enum_field(rb_IdxEntityKind, "unexposed", CXIdxEntity_Unexposed);
+    enum_field(rb_IdxEntityKind, "typedef", CXIdxEntity_Typedef);
+    enum_field(rb_IdxEntityKind, "function", CXIdxEntity_Function);
+    enum_field(rb_IdxEntityKind, "variable", CXIdxEntity_Variable);
+    enum_field(rb_IdxEntityKind, "field", CXIdxEntity_Field);
+    enum_field(rb_IdxEntityKind, "enum_constant", CXIdxEntity_EnumConstant);
+    enum_field(rb_IdxEntityKind, "obj_c_class", CXIdxEntity_ObjCClass);
+    enum_field(rb_IdxEntityKind, "obj_c_protocol", CXIdxEntity_ObjCProtocol);
+    enum_field(rb_IdxEntityKind, "obj_c_category", CXIdxEntity_ObjCCategory);
+    enum_field(rb_IdxEntityKind, "obj_c_instance_method", CXIdxEntity_ObjCInstanceMethod);
+    enum_field(rb_IdxEntityKind, "obj_c_class_method", CXIdxEntity_ObjCClassMethod);
+    enum_field(rb_IdxEntityKind, "obj_c_property", CXIdxEntity_ObjCProperty);
+    enum_field(rb_IdxEntityKind, "obj_c_ivar", CXIdxEntity_ObjCIvar);
+    enum_field(rb_IdxEntityKind, "enum", CXIdxEntity_Enum);
+    enum_field(rb_IdxEntityKind, "struct", CXIdxEntity_Struct);
+    enum_field(rb_IdxEntityKind, "union", CXIdxEntity_Union);
+    enum_field(rb_IdxEntityKind, "cxx_class", CXIdxEntity_CXXClass);
+    enum_field(rb_IdxEntityKind, "cxx_namespace", CXIdxEntity_CXXNamespace);
+    enum_field(rb_IdxEntityKind, "cxx_namespace_alias", CXIdxEntity_CXXNamespaceAlias);
+    enum_field(rb_IdxEntityKind, "cxx_static_variable", CXIdxEntity_CXXStaticVariable);
+    enum_field(rb_IdxEntityKind, "cxx_static_method", CXIdxEntity_CXXStaticMethod);
+    enum_field(rb_IdxEntityKind, "cxx_instance_method", CXIdxEntity_CXXInstanceMethod);
+    enum_field(rb_IdxEntityKind, "cxx_constructor", CXIdxEntity_CXXConstructor);
+    enum_field(rb_IdxEntityKind, "cxx_destructor", CXIdxEntity_CXXDestructor);
+    enum_field(rb_IdxEntityKind, "cxx_conversion_function", CXIdxEntity_CXXConversionFunction);
+    enum_field(rb_IdxEntityKind, "cxx_type_alias", CXIdxEntity_CXXTypeAlias);
+    enum_field(rb_IdxEntityKind, "cxx_interface", CXIdxEntity_CXXInterface);
+    enum_field(rb_IdxEntityKind, "cxx_concept", CXIdxEntity_CXXConcept);
+
+    // CXIdxEntityLanguage
+    enum_create(&rb_IdxEntityLanguage, "IdxEntityLanguage");
+    enum_field(rb_IdxEntityLanguage, "none", CXIdxEntityLang_None);
+    enum_field(rb_IdxEntityLanguage, "c", CXIdxEntityLang_C);
+    enum_field(rb_IdxEntityLanguage, "obj_c", CXIdxEntityLang_ObjC);
+    enum_field(rb_IdxEntityLanguage, "cxx", CXIdxEntityLang_CXX);
+    enum_field(rb_IdxEntityLanguage, "swift", CXIdxEntityLang_Swift);
 }
\ No newline at end of file
@@ -1,14 +1,13 @@
 #include "clang.h"
-
-
-static VALUE file_alloc(VALUE klass)
-{
-    return Data_Wrap_Struct(klass, NULL, RUBY_NEVER_FREE, NULL);
-}
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static VALUE file_time(VALUE self)
 {
-    time_t t = clang_getFileTime(DATA_PTR(self));
+    time_t t = clang_getFileTime(*rb_file_ptr(self));
     return rb_time_new(t, 0);
 }
 
@@ -17,18 +16,18 @@ static VALUE file_equal(VALUE self, VALUE other)
     if (CLASS_OF(self) != CLASS_OF(other))
         return Qfalse;
 
-    return RB_BOOL(clang_File_isEqual(DATA_PTR(self), DATA_PTR(other)));
+    return RB_BOOL(clang_File_isEqual(*rb_file_ptr(self), *rb_file_ptr(other)));
 }
 
 static VALUE file_include_guarded(VALUE self, VALUE unit)
 {
     rb_assert_type(unit, rb_cCXTranslationUnit);
-    return RB_BOOL(clang_isFileMultipleIncludeGuarded(DATA_PTR(unit), DATA_PTR(self)));
+    return RB_BOOL(clang_isFileMultipleIncludeGuarded(rb_tu_unit(unit), *rb_file_ptr(self)));
 }
 
 static VALUE file_name(VALUE self)
 {
-    CXString name = clang_getFileName(DATA_PTR(self));
+    CXString name = clang_getFileName(*rb_file_ptr(self));
     return RUBYSTR(name);
 }
 
@@ -37,17 +36,19 @@ static VALUE file_initialize(VALUE self, VALUE filename, VALUE translation_unit)
     rb_assert_type(translation_unit, rb_cCXTranslationUnit);
 
     const char *name = StringValueCStr(filename);
-    CXFile file = clang_getFile(DATA_PTR(translation_unit), name);
+    CXFile file = clang_getFile(rb_tu_unit(translation_unit), name);
     if (!file)
         rb_raise(rb_eLoadError, "failed to create File instance");
 
-    RDATA(self)->data = file;
+    rb_file *record = rb_file_record(self);
+    record->value = file;
+    record->unit = translation_unit;
     return self;
 }
 
 static VALUE file_real_name(VALUE self)
 {
-    return RUBYSTR(clang_File_tryGetRealPathName(DATA_PTR(self)));
+    return RUBYSTR(clang_File_tryGetRealPathName(*rb_file_ptr(self)));
 }
 
 static VALUE file_contents(VALUE self, VALUE translation_unit)
@@ -55,42 +56,163 @@ static VALUE file_contents(VALUE self, VALUE translation_unit)
     rb_assert_type(translation_unit, rb_cCXTranslationUnit);
 
     size_t size;
-    const char *str = clang_getFileContents(DATA_PTR(translation_unit), DATA_PTR(self), &size);
+    const char *str = clang_getFileContents(rb_tu_unit(translation_unit), *rb_file_ptr(self), &size);
     return rb_str_new(str, size);
 }
 
-static VALUE unsaved_initialize(VALUE self, VALUE filename, VALUE contents)
+static void unsaved_mark(void *data)
 {
-    struct CXUnsavedFile *file = DATA_PTR(self);
+    // Pinned, as libclang is given pointers into both strings
+    rb_unsaved *unsaved = data;
+    rb_gc_mark(unsaved->filename);
+    rb_gc_mark(unsaved->contents);
+}
+
+static void unsaved_free(void *data)
+{
+    rb_unsaved *unsaved = data;
+    if (unsaved->map)
+        munmap(unsaved->map, unsaved->map_size);
+    xfree(unsaved);
+}
+
+static size_t unsaved_memsize(const void *data)
+{
+    return sizeof(rb_unsaved);
+}
+
+const rb_data_type_t rb_unsaved_type = {
+    "Clang::UnsavedFile",
+    {unsaved_mark, unsaved_free, unsaved_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
 
+static VALUE unsaved_alloc(VALUE klass)
+{
+    rb_unsaved *unsaved;
+    VALUE obj = TypedData_Make_Struct(klass, rb_unsaved, &rb_unsaved_type, unsaved);
+    unsaved->filename = Qnil;
+    unsaved->contents = Qnil;
+    return obj;
+}
+
+static rb_unsaved *unsaved_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &rb_unsaved_type);
+}
+
+static void unsaved_set_filename(rb_unsaved *unsaved, VALUE self, VALUE filename)
+{
     if (NIL_P(filename))
         rb_raise(rb_eArgError, "filename cannot be nil");
-    file->Filename = StringValuePtr(filename);
 
-    ID id = rb_intern("@contents");
+    filename = rb_str_new_frozen(rb_get_path(filename));
+    unsaved->file.Filename = StringValueCStr(filename);
+    RB_OBJ_WRITE(self, &unsaved->filename, filename);
+}
+
+static VALUE unsaved_initialize(VALUE self, VALUE filename, VALUE contents)
+{
+    rb_unsaved *unsaved = unsaved_ptr(self);
+    if (unsaved->map || !NIL_P(unsaved->filename))
+        rb_raise(rb_eRuntimeError, "unsaved file is already initialized");
+    unsaved_set_filename(unsaved, self, filename);
 
     if (RTEST(contents))
     {
-        // Storing a copy ensures the string is not garbage collected and/or modified after initialization
-        VALUE str = rb_str_dup(contents);
-        rb_str_freeze(str);
-        rb_ivar_set(self, id, str);
-        file->Contents = StringValuePtr(str);
-        file->Length = RSTRING_LEN(str);
+        // A frozen string is used as is, any other is frozen without copying, while the original stays mutable
+        VALUE str = rb_str_new_frozen(StringValue(contents));
+        RB_OBJ_WRITE(self, &unsaved->contents, str);
+        unsaved->file.Contents = RSTRING_PTR(str);
+        unsaved->file.Length = RSTRING_LEN(str);
     }
     else
     {
-        rb_ivar_set(self, id, Qnil);
-        file->Contents = NULL;
-        file->Length = 0;
+        unsaved->file.Contents = NULL;
+        unsaved->file.Length = 0;
+    }
+
+    return self;
+}
+
+static VALUE unsaved_map(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE filename, path;
+    rb_scan_args(argc, argv, "11", &filename, &path);
+    path = rb_str_new_frozen(rb_get_path(NIL_P(path) ? filename : path));
+
+    VALUE self = unsaved_alloc(klass);
+    rb_unsaved *unsaved = unsaved_ptr(self);
+    unsaved_set_filename(unsaved, self, filename);
+
+    int fd = open(StringValueCStr(path), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        rb_sys_fail_str(path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int e = errno;
+        close(fd);
+        errno = e;
+        rb_sys_fail_str(path);
+    }
+
+    // An empty file cannot be mapped, and has empty contents instead. The mapping is not a copy, so the file must not be
+    // truncated while libclang may read it, which would fault the process rather than raise.
+    if (st.st_size > 0)
+    {
+        void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            int e = errno;
+            close(fd);
+            errno = e;
+            rb_sys_fail_str(path);
+        }
+        unsaved->map = map;
+        unsaved->map_size = (size_t) st.st_size;
     }
-    
+    close(fd);
+
+    unsaved->file.Contents = unsaved->map ? unsaved->map : "";
+    unsaved->file.Length = unsaved->map_size;
     return self;
 }
 
+static VALUE unsaved_filename(VALUE self)
+{
+    return unsaved_ptr(self)->filename;
+}
+
+static VALUE unsaved_contents(VALUE self)
+{
+    rb_unsaved *unsaved = unsaved_ptr(self);
+    if (!unsaved->map)
+        return unsaved->contents;
+    return rb_str_new(unsaved->map, (long) unsaved->map_size);
+}
+
+static VALUE unsaved_size(VALUE self)
+{
+    return ULONG2NUM(unsaved_ptr(self)->file.Length);
+}
+
+static VALUE unsaved_is_mapped(VALUE self)
+{
+    return RB_BOOL(unsaved_ptr(self)->map != NULL);
+}
+
 void Init_clang_file(void)
 {
+    rb_define_alloc_func(rb_cCXUnsavedFile, unsaved_alloc);
+    rb_define_singleton_methodm1(rb_cCXUnsavedFile, "map", unsaved_map, -1);
     rb_define_method2(rb_cCXUnsavedFile, "initialize", unsaved_initialize, 2);
+    rb_define_method0(rb_cCXUnsavedFile, "filename", unsaved_filename, 0);
+    rb_define_method0(rb_cCXUnsavedFile, "contents", unsaved_contents, 0);
+    rb_define_method0(rb_cCXUnsavedFile, "size", unsaved_size, 0);
+    rb_define_method0(rb_cCXUnsavedFile, "mapped?", unsaved_is_mapped, 0);
 
     rb_define_method2(rb_cCXFile, "initialize", file_initialize, 2);
     rb_define_method1(rb_cCXFile, "guarded?", file_include_guarded, 1);
@@ -0,0 +1,295 @@
+#include "clang.h"
+
+// A read-only view of the contents of a file, pointing into the memory libclang holds for its translation unit. The
+// memory is released when the unit is disposed, reparsed or suspended, after which the view can no longer be read.
+typedef struct
+{
+    const char *data;
+    size_t size;
+    size_t offset;
+    CXFile file;
+    VALUE unit;
+    unsigned long generation;
+} rb_file_buffer;
+
+static void buffer_mark(void *data)
+{
+    rb_gc_mark(((rb_file_buffer *) data)->unit);
+}
+
+static const rb_data_type_t buffer_type = {
+    "Clang::FileBuffer",
+    {buffer_mark, RUBY_TYPED_DEFAULT_FREE, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static int buffer_is_valid(const rb_file_buffer *buffer)
+{
+    return !rb_tu_is_disposed(buffer->unit) && rb_tu_generation(buffer->unit) == buffer->generation;
+}
+
+static rb_file_buffer *buffer_ptr(VALUE self)
+{
+    rb_file_buffer *buffer = rb_check_typeddata(self, &buffer_type);
+    rb_tu_check(buffer->unit);
+    if (rb_tu_generation(buffer->unit) != buffer->generation)
+        rb_raise(rb_eRuntimeError, "file buffer was released by a reparse of its translation unit");
+    return buffer;
+}
+
+static VALUE buffer_view(const rb_file_buffer *parent, size_t start, size_t size)
+{
+    rb_file_buffer *buffer;
+    VALUE obj = TypedData_Make_Struct(rb_cCXFileBuffer, rb_file_buffer, &buffer_type, buffer);
+    buffer->data = parent->data + start;
+    buffer->size = size;
+    buffer->offset = parent->offset + start;
+    buffer->file = parent->file;
+    buffer->unit = parent->unit;
+    buffer->generation = parent->generation;
+    return rb_obj_freeze(obj);
+}
+
+VALUE rb_file_buffer_wrap(VALUE unit, CXFile file)
+{
+    size_t size;
+    const char *data = clang_getFileContents(rb_tu_unit(unit), file, &size);
+    if (!data)
+        return Qnil;
+
+    rb_file_buffer contents = {data, size, 0, file, unit, rb_tu_generation(unit)};
+    return buffer_view(&contents, 0, size);
+}
+
+// Views part of a buffer that is known to be readable, with bounds the caller has already checked
+VALUE rb_file_buffer_slice(VALUE self, size_t start, size_t size)
+{
+    return buffer_view(rb_check_typeddata(self, &buffer_type), start, size);
+}
+
+static VALUE file_buffer(VALUE self, VALUE unit)
+{
+    rb_assert_type(unit, rb_cCXTranslationUnit);
+    return rb_file_buffer_wrap(unit, *rb_file_ptr(self));
+}
+
+typedef struct
+{
+    VALUE self;
+    int argc;
+    VALUE *argv;
+    VALUE (*read)(rb_file_buffer *buffer, int argc, VALUE *argv);
+} buffer_call;
+
+static VALUE buffer_read_run(VALUE data)
+{
+    buffer_call *call = (buffer_call *) data;
+    return call->read(buffer_ptr(call->self), call->argc, call->argv);
+}
+
+// Reads the contents with the unit locked, as converting the arguments may run Ruby code, or wait for another unit,
+// during which another thread could otherwise reparse or dispose the unit and release the memory being read
+static VALUE buffer_read(VALUE self, int argc, VALUE *argv, VALUE (*read)(rb_file_buffer *, int, VALUE *))
+{
+    rb_file_buffer *buffer = rb_check_typeddata(self, &buffer_type);
+    buffer_call call = {self, argc, argv, read};
+    return rb_tu_locked(buffer->unit, buffer_read_run, (VALUE) &call);
+}
+
+// Resolves the arguments of a slice to a start and length within the buffer, clamped to its end like String#byteslice
+static int buffer_bounds(rb_file_buffer *buffer, int argc, VALUE *argv, size_t *start, size_t *size)
+{
+    VALUE first, length;
+    rb_scan_args(argc, argv, "11", &first, &length);
+
+    long beg, len;
+    if (argc == 2)
+    {
+        beg = NUM2LONG(first);
+        len = NUM2LONG(length);
+        if (beg < 0)
+            beg += (long) buffer->size;
+        if (beg < 0 || len < 0 || (size_t) beg > buffer->size)
+            return 0;
+    }
+    else if (rb_obj_is_kind_of(first, rb_cCXSourceRange))
+    {
+        // Offsets of a source range are within the file, rather than the view, and only meaningful for the same file
+        CXSourceRange *range = rb_range_ptr(first);
+        CXFile start_file, end_file;
+        unsigned int a, b;
+        clang_getFileLocation(clang_getRangeStart(*range), &start_file, NULL, NULL, &a);
+        clang_getFileLocation(clang_getRangeEnd(*range), &end_file, NULL, NULL, &b);
+        if (!clang_File_isEqual(start_file, buffer->file) || !clang_File_isEqual(end_file, buffer->file))
+            return 0;
+        if (a < buffer->offset || a > buffer->offset + buffer->size || b < a)
+            return 0;
+        beg = (long) (a - buffer->offset);
+        len = (long) (b - a);
+    }
+    else
+    {
+        VALUE in_range = rb_range_beg_len(first, &beg, &len, (long) buffer->size, 0);
+        if (in_range == Qfalse)
+            rb_raise(rb_eTypeError, "%s is not a Range or SourceRange", CLASS_NAME(first));
+        if (NIL_P(in_range))
+            return 0;
+    }
+
+    *start = (size_t) beg;
+    *size = (size_t) len < buffer->size - *start ? (size_t) len : buffer->size - *start;
+    return 1;
+}
+
+static VALUE buffer_slice_read(rb_file_buffer *buffer, int argc, VALUE *argv)
+{
+    size_t start, size;
+    if (!buffer_bounds(buffer, argc, argv, &start, &size))
+        return Qnil;
+    return buffer_view(buffer, start, size);
+}
+
+static VALUE buffer_slice(int argc, VALUE *argv, VALUE self)
+{
+    return buffer_read(self, argc, argv, buffer_slice_read);
+}
+
+static VALUE buffer_byteslice_read(rb_file_buffer *buffer, int argc, VALUE *argv)
+{
+    size_t start, size;
+    if (!buffer_bounds(buffer, argc, argv, &start, &size))
+        return Qnil;
+    return rb_str_new(buffer->data + start, (long) size);
+}
+
+static VALUE buffer_byteslice(int argc, VALUE *argv, VALUE self)
+{
+    return buffer_read(self, argc, argv, buffer_byteslice_read);
+}
+
+static VALUE buffer_to_s_read(rb_file_buffer *buffer, int argc, VALUE *argv)
+{
+    return rb_str_new(buffer->data, (long) buffer->size);
+}
+
+static VALUE buffer_to_s(VALUE self)
+{
+    return buffer_read(self, 0, NULL, buffer_to_s_read);
+}
+
+static VALUE buffer_getbyte_read(rb_file_buffer *buffer, int argc, VALUE *argv)
+{
+    long i = NUM2LONG(argv[0]);
+    if (i < 0)
+        i += (long) buffer->size;
+    if (i < 0 || (size_t) i >= buffer->size)
+        return Qnil;
+    return INT2FIX((unsigned char) buffer->data[i]);
+}
+
+static VALUE buffer_getbyte(VALUE self, VALUE index)
+{
+    return buffer_read(self, 1, &index, buffer_getbyte_read);
+}
+
+static VALUE buffer_index_read(rb_file_buffer *buffer, int argc, VALUE *argv)
+{
+    VALUE str, offset;
+    rb_scan_args(argc, argv, "11", &str, &offset);
+    StringValue(str);
+
+    long start = NIL_P(offset) ? 0 : NUM2LONG(offset);
+    if (start < 0)
+        start += (long) buffer->size;
+    if (start < 0 || (size_t) start > buffer->size)
+        return Qnil;
+
+    const char *found = memmem(buffer->data + start, buffer->size - start, RSTRING_PTR(str), RSTRING_LEN(str));
+    return found ? LONG2NUM(found - buffer->data) : Qnil;
+}
+
+static VALUE buffer_index(int argc, VALUE *argv, VALUE self)
+{
+    return buffer_read(self, argc, argv, buffer_index_read);
+}
+
+static VALUE buffer_equal_read(rb_file_buffer *buffer, int argc, VALUE *argv)
+{
+    VALUE other = argv[0];
+    const char *data;
+    size_t size;
+
+    if (RB_TYPE_P(other, T_STRING))
+    {
+        data = RSTRING_PTR(other);
+        size = RSTRING_LEN(other);
+    }
+    else
+    {
+        // Held by the same lock when both views are of the same unit
+        rb_file_buffer *o = buffer_ptr(other);
+        data = o->data;
+        size = o->size;
+    }
+
+    return RB_BOOL(size == buffer->size && memcmp(data, buffer->data, size) == 0);
+}
+
+static VALUE buffer_equal(VALUE self, VALUE other)
+{
+    if (rb_typeddata_is_kind_of(other, &buffer_type))
+    {
+        // A view of another unit is copied first, rather than locking both units
+        rb_file_buffer *buffer = rb_check_typeddata(self, &buffer_type);
+        if (((rb_file_buffer *) RTYPEDDATA_DATA(other))->unit != buffer->unit)
+            other = buffer_to_s(other);
+    }
+    else if (!RB_TYPE_P(other, T_STRING))
+    {
+        return Qfalse;
+    }
+
+    return buffer_read(self, 1, &other, buffer_equal_read);
+}
+
+static VALUE buffer_size(VALUE self)
+{
+    return SIZET2NUM(((rb_file_buffer *) rb_check_typeddata(self, &buffer_type))->size);
+}
+
+static VALUE buffer_offset(VALUE self)
+{
+    return SIZET2NUM(((rb_file_buffer *) rb_check_typeddata(self, &buffer_type))->offset);
+}
+
+static VALUE buffer_unit(VALUE self)
+{
+    return ((rb_file_buffer *) rb_check_typeddata(self, &buffer_type))->unit;
+}
+
+static VALUE buffer_is_valid_p(VALUE self)
+{
+    return RB_BOOL(buffer_is_valid(rb_check_typeddata(self, &buffer_type)));
+}
+
+void Init_clang_file_buffer(void)
+{
+    rb_define_method1(rb_cCXFile, "buffer", file_buffer, 1);
+
+    rb_undef_alloc_func(rb_cCXFileBuffer);
+    rb_define_method0(rb_cCXFileBuffer, "size", buffer_size, 0);
+    rb_define_method0(rb_cCXFileBuffer, "offset", buffer_offset, 0);
+    rb_define_method0(rb_cCXFileBuffer, "translation_unit", buffer_unit, 0);
+    rb_define_method0(rb_cCXFileBuffer, "valid?", buffer_is_valid_p, 0);
+    rb_define_methodm1(rb_cCXFileBuffer, "slice", buffer_slice, -1);
+    rb_define_methodm1(rb_cCXFileBuffer, "byteslice", buffer_byteslice, -1);
+    rb_define_method1(rb_cCXFileBuffer, "getbyte", buffer_getbyte, 1);
+    rb_define_methodm1(rb_cCXFileBuffer, "index", buffer_index, -1);
+    rb_define_method0(rb_cCXFileBuffer, "to_s", buffer_to_s, 0);
+    rb_define_method1(rb_cCXFileBuffer, "==", buffer_equal, 1);
+    rb_define_alias(rb_cCXFileBuffer, "[]", "slice");
+    rb_define_alias(rb_cCXFileBuffer, "bytesize", "size");
+    rb_define_alias(rb_cCXFileBuffer, "length", "size");
+    rb_define_alias(rb_cCXFileBuffer, "to_str", "to_s");
+}
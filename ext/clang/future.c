@@ -0,0 +1,543 @@
+#include "clang.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <ruby/thread.h>
+
+enum
+{
+    JOB_REPARSE,
+    JOB_COMPLETE
+};
+
+enum
+{
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_CANCELLED
+};
+
+// A request shared between a future and the worker of its unit, released by whichever drops it last. As that may be
+// the worker thread, everything within it is allocated with malloc rather than the Ruby allocator.
+typedef struct future_job
+{
+    struct future_job *next;
+    int kind;
+    int state;
+    int refs;
+    int interrupted;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *path;
+    unsigned int line;
+    unsigned int column;
+    unsigned int options;
+    unsigned int num_files;
+    struct CXUnsavedFile *files;
+    int result;
+    CXCodeCompleteResults *results;
+    size_t memsize;
+} future_job;
+
+// Runs the requests of a single translation unit in order, as libclang does not allow a unit to be used concurrently.
+// None is started while a Ruby thread holds the lock of the unit.
+struct rb_tu_worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    CXTranslationUnit unit;
+    future_job *head;
+    future_job *tail;
+    int busy;
+    int held;
+    int released;
+    int interrupted;
+};
+
+typedef struct
+{
+    future_job *job;
+    VALUE unit;
+    VALUE value;
+    int resolved;
+} rb_future;
+
+static VALUE rb_eCXCancelledError;
+
+static void job_unref(future_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    int refs = --job->refs;
+    pthread_mutex_unlock(&job->lock);
+    if (refs)
+        return;
+
+    for (unsigned int i = 0; i < job->num_files; i++)
+    {
+        free((void *) job->files[i].Filename);
+        free((void *) job->files[i].Contents);
+    }
+    if (job->results)
+        clang_disposeCodeCompleteResults(job->results);
+    free(job->files);
+    free(job->path);
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+static void job_finish(future_job *job, int state)
+{
+    pthread_mutex_lock(&job->lock);
+    job->state = state;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static int job_cancel(future_job *job)
+{
+    pthread_mutex_lock(&job->lock);
+    int pending = job->state == JOB_PENDING;
+    if (pending)
+    {
+        job->state = JOB_CANCELLED;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return pending;
+}
+
+static void job_run(future_job *job, CXTranslationUnit unit)
+{
+    if (job->kind == JOB_REPARSE)
+        job->result = clang_reparseTranslationUnit(unit, job->num_files, job->files, job->options);
+    else
+        job->results = clang_codeCompleteAt(unit, job->path, job->line, job->column, job->files, job->num_files,
+                                            job->options);
+
+    // The heap usage is measured here, as the unit may already be busy with the next request once this is resolved
+    job->memsize = rb_tu_native_memsize(unit);
+}
+
+static void *worker_main(void *data)
+{
+    rb_tu_worker *w = data;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;)
+    {
+        while ((!w->head || w->held) && !w->released)
+            pthread_cond_wait(&w->cond, &w->lock);
+
+        future_job *job = w->head;
+        if (!job)
+            break;
+        w->head = job->next;
+        if (!w->head)
+            w->tail = NULL;
+        int released = w->released;
+        pthread_mutex_unlock(&w->lock);
+
+        // Requests that were cancelled or superseded while queued are dropped without being run
+        pthread_mutex_lock(&job->lock);
+        int run = job->state == JOB_PENDING && !released;
+        job->state = run ? JOB_RUNNING : JOB_CANCELLED;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+
+        if (run)
+        {
+            job_run(job, w->unit);
+            job_finish(job, JOB_DONE);
+        }
+        job_unref(job);
+
+        pthread_mutex_lock(&w->lock);
+        w->busy--;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    // Once released, the worker is the last owner of the unit
+    if (w->unit)
+        clang_disposeTranslationUnit(w->unit);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    return NULL;
+}
+
+static rb_tu_worker *worker_create(CXTranslationUnit unit, int held)
+{
+    rb_tu_worker *w = calloc(1, sizeof(rb_tu_worker));
+    if (!w)
+        rb_memerror();
+
+    w->unit = unit;
+    w->held = held;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0)
+    {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+        rb_raise(rb_eThreadError, "failed to create worker thread");
+    }
+    pthread_detach(w->thread);
+    return w;
+}
+
+static void worker_submit(rb_tu_worker *w, future_job *job)
+{
+    pthread_mutex_lock(&w->lock);
+
+    // A newer request supersedes any of the same kind that has not started yet
+    for (future_job *queued = w->head; queued; queued = queued->next)
+    {
+        if (queued->kind == job->kind)
+            job_cancel(queued);
+    }
+
+    job->refs++;
+    if (w->tail)
+        w->tail->next = job;
+    else
+        w->head = job;
+    w->tail = job;
+    w->busy++;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void rb_tu_worker_release(rb_tu_worker *w, CXTranslationUnit unit)
+{
+    pthread_mutex_lock(&w->lock);
+    for (future_job *queued = w->head; queued; queued = queued->next)
+        job_cancel(queued);
+    w->released = 1;
+    w->unit = unit;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int rb_tu_worker_busy(rb_tu_worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+    int busy = w->busy;
+    pthread_mutex_unlock(&w->lock);
+    return busy;
+}
+
+void rb_tu_worker_hold(rb_tu_worker *w, int held)
+{
+    pthread_mutex_lock(&w->lock);
+    w->held = held;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *worker_wait_nogvl(void *data)
+{
+    rb_tu_worker *w = data;
+    pthread_mutex_lock(&w->lock);
+    while (w->busy && !w->interrupted)
+        pthread_cond_wait(&w->cond, &w->lock);
+    w->interrupted = 0;
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void worker_wait_ubf(void *data)
+{
+    rb_tu_worker *w = data;
+    pthread_mutex_lock(&w->lock);
+    w->interrupted = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void rb_tu_worker_wait(rb_tu_worker *w)
+{
+    for (;;)
+    {
+        if (!rb_tu_worker_busy(w))
+            return;
+
+        rb_thread_call_without_gvl(worker_wait_nogvl, w, worker_wait_ubf, w);
+        rb_thread_check_ints();
+    }
+}
+
+static void future_mark(void *data)
+{
+    rb_future *f = data;
+    rb_gc_mark(f->unit);
+    rb_gc_mark(f->value);
+}
+
+static void future_free(void *data)
+{
+    // Nothing can observe the result of a request once its future is gone
+    rb_future *f = data;
+    if (f->job)
+    {
+        job_cancel(f->job);
+        job_unref(f->job);
+    }
+    xfree(f);
+}
+
+static size_t future_memsize(const void *data)
+{
+    return sizeof(rb_future) + sizeof(future_job);
+}
+
+static const rb_data_type_t future_type = {
+    "Clang::Future",
+    {future_mark, future_free, future_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static char *job_strndup(const char *str, size_t len)
+{
+    char *copy = malloc(len + 1);
+    if (copy)
+    {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+static VALUE future_submit(VALUE self, future_job *job, VALUE path, VALUE unsaved)
+{
+    // Waiting for the unit to be idle (as rb_tu_unit does) would serialize the caller with the worker
+    rb_tu *tu = rb_check_typeddata(self, &rb_tu_type);
+    if (RTYPEDDATA_TYPE(self) != &rb_tu_type)
+        rb_raise(rb_eRuntimeError, "cannot run requests on a translation unit that is owned elsewhere");
+    if (!tu->unit || tu->disposing)
+        rb_raise(rb_eRuntimeError, "translation unit has been disposed");
+
+    // Validated with Ruby's copy of the arguments, so that nothing may raise once native memory is owned
+    rb_tu_args args;
+    rb_tu_args_init(&args, path, Qnil, unsaved);
+
+    rb_future *f;
+    VALUE obj = TypedData_Make_Struct(rb_cCXFuture, rb_future, &future_type, f);
+    f->unit = self;
+    f->value = Qnil;
+
+    int failed = (f->job = malloc(sizeof(future_job))) == NULL;
+    if (!failed)
+    {
+        *f->job = *job;
+        f->job->refs = 1;
+        pthread_mutex_init(&f->job->lock, NULL);
+        pthread_cond_init(&f->job->cond, NULL);
+        if (args.source)
+            failed = !(f->job->path = job_strndup(args.source, strlen(args.source)));
+        if (!failed && args.num_files)
+            failed = !(f->job->files = calloc(args.num_files, sizeof(struct CXUnsavedFile)));
+    }
+
+    for (unsigned int i = 0; !failed && i < args.num_files; i++)
+    {
+        struct CXUnsavedFile *src = &args.files[i], *dst = &f->job->files[f->job->num_files++];
+        if (src->Filename && !(dst->Filename = job_strndup(src->Filename, strlen(src->Filename))))
+            failed = 1;
+        if (src->Contents && !(dst->Contents = job_strndup(src->Contents, src->Length)))
+            failed = 1;
+        dst->Length = src->Length;
+    }
+    rb_tu_args_free(&args);
+
+    if (failed)
+        rb_memerror();
+
+    if (!tu->worker)
+        tu->worker = worker_create(tu->unit, !NIL_P(tu->owner));
+    worker_submit(tu->worker, f->job);
+    return obj;
+}
+
+static VALUE tu_reparse_async(int argc, VALUE *argv, VALUE self)
+{
+    VALUE unsaved, options;
+    rb_scan_args(argc, argv, "01*", &unsaved, &options);
+
+    future_job job = {.kind = JOB_REPARSE, .options = rb_enum_mask(rb_ReparseFlags, options)};
+    VALUE future = future_submit(self, &job, Qnil, unsaved);
+    rb_tu_invalidate(self);
+    return future;
+}
+
+static VALUE tu_code_complete_async(int argc, VALUE *argv, VALUE self)
+{
+    VALUE filename, line, column, unsaved, options;
+    rb_scan_args(argc, argv, "4*", &filename, &line, &column, &unsaved, &options);
+
+    future_job job = {.kind = JOB_COMPLETE, .line = NUM2UINT(line), .column = NUM2UINT(column)};
+    if (NIL_P(options) || rb_array_len(options) == 0)
+        job.options = clang_defaultCodeCompleteOptions();
+    else
+        job.options = rb_enum_mask(rb_CodeCompleteFlags, options);
+
+    return future_submit(self, &job, filename, unsaved);
+}
+
+typedef struct
+{
+    future_job *job;
+    int timed;
+    struct timespec deadline;
+} future_wait;
+
+static void *future_wait_nogvl(void *data)
+{
+    future_wait *wait = data;
+    future_job *job = wait->job;
+
+    pthread_mutex_lock(&job->lock);
+    while (job->state < JOB_DONE && !job->interrupted)
+    {
+        if (!wait->timed)
+            pthread_cond_wait(&job->cond, &job->lock);
+        else if (pthread_cond_timedwait(&job->cond, &job->lock, &wait->deadline) == ETIMEDOUT)
+            break;
+    }
+    job->interrupted = 0;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static void future_wait_ubf(void *data)
+{
+    future_job *job = ((future_wait *) data)->job;
+    pthread_mutex_lock(&job->lock);
+    job->interrupted = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static int future_state(rb_future *f)
+{
+    pthread_mutex_lock(&f->job->lock);
+    int state = f->job->state;
+    pthread_mutex_unlock(&f->job->lock);
+    return state;
+}
+
+static double future_now(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+static int future_await(rb_future *f, VALUE timeout)
+{
+    // A request cannot start until the lock of its unit is released, which the calling thread would never do
+    rb_tu *tu = RTYPEDDATA_DATA(f->unit);
+    if (NIL_P(timeout) && tu->owner == rb_thread_current() && future_state(f) == JOB_PENDING)
+        rb_raise(rb_eRuntimeError, "request cannot run while its translation unit is in use");
+
+    future_wait wait = {f->job, !NIL_P(timeout)};
+    double deadline = wait.timed ? future_now() + NUM2DBL(timeout) : 0.0;
+    if (wait.timed)
+    {
+        wait.deadline.tv_sec = (time_t) deadline;
+        wait.deadline.tv_nsec = (long) ((deadline - floor(deadline)) * 1e9);
+    }
+
+    int state;
+    while ((state = future_state(f)) < JOB_DONE)
+    {
+        if (wait.timed && future_now() >= deadline)
+            break;
+        rb_thread_call_without_gvl(future_wait_nogvl, &wait, future_wait_ubf, &wait);
+        rb_thread_check_ints();
+    }
+    return state;
+}
+
+static VALUE future_wait_for(int argc, VALUE *argv, VALUE self)
+{
+    VALUE timeout;
+    rb_scan_args(argc, argv, "01", &timeout);
+
+    rb_future *f = rb_check_typeddata(self, &future_type);
+    return RB_BOOL(f->resolved || future_await(f, timeout) >= JOB_DONE);
+}
+
+static VALUE future_value(VALUE self)
+{
+    rb_future *f = rb_check_typeddata(self, &future_type);
+    if (f->resolved)
+        return f->value;
+
+    if (future_await(f, Qnil) == JOB_CANCELLED)
+        rb_raise(rb_eCXCancelledError, "request was superseded or cancelled");
+
+    // The results are taken over by the wrapper, which disposes of them with itself
+    future_job *job = f->job;
+    rb_tu_set_memsize(f->unit, job->memsize);
+    if (job->kind == JOB_REPARSE)
+    {
+        VALUE error = rb_tu_error(job->result);
+        if (!NIL_P(error))
+            rb_exc_raise(error);
+        f->value = f->unit;
+    }
+    else if (job->results)
+    {
+        f->value = rb_results_wrap(job->results);
+        job->results = NULL;
+    }
+
+    f->resolved = 1;
+    return f->value;
+}
+
+static VALUE future_is_ready(VALUE self)
+{
+    rb_future *f = rb_check_typeddata(self, &future_type);
+    return RB_BOOL(f->resolved || future_state(f) >= JOB_DONE);
+}
+
+static VALUE future_is_cancelled(VALUE self)
+{
+    rb_future *f = rb_check_typeddata(self, &future_type);
+    return RB_BOOL(future_state(f) == JOB_CANCELLED);
+}
+
+static VALUE future_cancel(VALUE self)
+{
+    rb_future *f = rb_check_typeddata(self, &future_type);
+    return RB_BOOL(job_cancel(f->job));
+}
+
+static VALUE future_unit(VALUE self)
+{
+    rb_future *f = rb_check_typeddata(self, &future_type);
+    return f->unit;
+}
+
+void Init_clang_future(void)
+{
+    rb_define_methodm1(rb_cCXTranslationUnit, "reparse_async", tu_reparse_async, -1);
+    rb_define_methodm1(rb_cCXTranslationUnit, "code_complete_async", tu_code_complete_async, -1);
+
+    rb_eCXCancelledError = rb_define_class_under(rb_cCXFuture, "CancelledError", rb_eStandardError);
+    rb_undef_alloc_func(rb_cCXFuture);
+    rb_define_method0(rb_cCXFuture, "value", future_value, 0);
+    rb_define_methodm1(rb_cCXFuture, "wait", future_wait_for, -1);
+    rb_define_method0(rb_cCXFuture, "ready?", future_is_ready, 0);
+    rb_define_method0(rb_cCXFuture, "cancelled?", future_is_cancelled, 0);
+    rb_define_method0(rb_cCXFuture, "cancel", future_cancel, 0);
+    rb_define_method0(rb_cCXFuture, "translation_unit", future_unit, 0);
+}
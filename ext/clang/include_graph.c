@@ -0,0 +1,658 @@
+#include "clang.h"
+#include "uthash.h"
+#include <stdint.h>
+#include <ruby/thread.h>
+
+#define GRAPH_NONE UINT32_MAX
+
+typedef struct
+{
+    uint32_t *ids;
+    uint32_t count;
+    uint32_t capa;
+} graph_list;
+
+// An edge is counted once for every unit that has it, and leaves the graph when the last of them drops it
+typedef struct
+{
+    uint64_t key;
+    uint32_t refs;
+    UT_hash_handle hh;
+} graph_edge;
+
+// The edges of one unit, as sorted distinct keys, released when the unit is added again or removed
+typedef struct
+{
+    uint64_t *keys;
+    uint32_t count;
+} graph_owned;
+
+// Files are nodes, identified by their interned path, with an edge from each file to every file it includes directly.
+// Edges are kept in both directions, so that the files affected by an edit are found by walking them backwards.
+typedef struct
+{
+    rb_strtab files;
+    graph_list *out;
+    graph_list *in;
+    uint32_t capa_nodes;
+    graph_edge *edges;
+    uint32_t num_edges;
+    rb_strtab units;
+    uint32_t *roots;
+    graph_owned *owned;
+    uint32_t capa_units;
+    uint32_t num_owned;
+} rb_include_graph;
+
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+} pass_edge;
+
+// The inclusions of one translation unit, collected without the GVL before being merged into the graph
+typedef struct
+{
+    CXTranslationUnit unit;
+    rb_strtab files;
+    pass_edge *edges;
+    uint32_t num_edges;
+    uint32_t capa_edges;
+    uint32_t root;
+    int failed;
+} graph_pass;
+
+static void graph_free(void *data)
+{
+    rb_include_graph *graph = data;
+    for (uint32_t i = 0; i < graph->files.count && i < graph->capa_nodes; i++)
+    {
+        free(graph->out[i].ids);
+        free(graph->in[i].ids);
+    }
+
+    graph_edge *e, *temp;
+    HASH_ITER(hh, graph->edges, e, temp)
+    {
+        HASH_DEL(graph->edges, e);
+        free(e);
+    }
+
+    for (uint32_t i = 0; i < graph->units.count && i < graph->capa_units; i++)
+        free(graph->owned[i].keys);
+
+    free(graph->out);
+    free(graph->in);
+    free(graph->roots);
+    free(graph->owned);
+    rb_strtab_free(&graph->files);
+    rb_strtab_free(&graph->units);
+    xfree(graph);
+}
+
+static size_t graph_memsize(const void *data)
+{
+    const rb_include_graph *graph = data;
+    size_t size = sizeof(rb_include_graph) + rb_strtab_memsize(&graph->files) + rb_strtab_memsize(&graph->units);
+    size += (sizeof(graph_list) * 2) * graph->capa_nodes + (sizeof(uint32_t) + sizeof(graph_owned)) * graph->capa_units;
+    size += (sizeof(graph_edge) + sizeof(uint32_t) * 2) * graph->num_edges + sizeof(uint64_t) * graph->num_owned;
+    return size;
+}
+
+static const rb_data_type_t graph_type = {
+    "Clang::IncludeGraph",
+    {NULL, graph_free, graph_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_include_graph *graph_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &graph_type);
+}
+
+static int list_push(graph_list *list, uint32_t id)
+{
+    if (list->count == list->capa)
+    {
+        uint32_t capa = list->capa ? list->capa * 2 : 4;
+        uint32_t *ids = realloc(list->ids, sizeof(uint32_t) * capa);
+        if (!ids)
+            return 0;
+        list->ids = ids;
+        list->capa = capa;
+    }
+    list->ids[list->count++] = id;
+    return 1;
+}
+
+static void list_remove(graph_list *list, uint32_t id)
+{
+    for (uint32_t i = 0; i < list->count; i++)
+    {
+        if (list->ids[i] == id)
+        {
+            list->ids[i] = list->ids[--list->count];
+            return;
+        }
+    }
+}
+
+static uint32_t pass_file(graph_pass *pass, CXFile file)
+{
+    CXString name = clang_getFileName(file);
+    const char *path = clang_getCString(name);
+    unsigned int id = GRAPH_NONE;
+    if (path && *path && !rb_strtab_intern(&pass->files, path, strlen(path), &id))
+        pass->failed = 1;
+    clang_disposeString(name);
+    return id;
+}
+
+static void pass_inclusion(CXFile file, CXSourceLocation *stack, unsigned int depth, CXClientData data)
+{
+    graph_pass *pass = data;
+    if (pass->failed)
+        return;
+
+    uint32_t to = pass_file(pass, file);
+    if (to == GRAPH_NONE)
+        return;
+    if (depth == 0)
+    {
+        pass->root = to;
+        return;
+    }
+
+    // The top of the stack is the #include directive, within the file that includes this one
+    CXFile includer;
+    clang_getFileLocation(stack[0], &includer, NULL, NULL, NULL);
+    uint32_t from = includer ? pass_file(pass, includer) : GRAPH_NONE;
+    if (from == GRAPH_NONE)
+        return;
+
+    if (pass->num_edges == pass->capa_edges)
+    {
+        uint32_t capa = pass->capa_edges ? pass->capa_edges * 2 : 64;
+        pass_edge *edges = realloc(pass->edges, sizeof(pass_edge) * capa);
+        if (!edges)
+        {
+            pass->failed = 1;
+            return;
+        }
+        pass->edges = edges;
+        pass->capa_edges = capa;
+    }
+    pass->edges[pass->num_edges].from = from;
+    pass->edges[pass->num_edges++].to = to;
+}
+
+static void *pass_nogvl(void *data)
+{
+    graph_pass *pass = data;
+    clang_getInclusions(pass->unit, pass_inclusion, pass);
+    return NULL;
+}
+
+static uint32_t graph_node(rb_include_graph *graph, const char *path, size_t len)
+{
+    unsigned int id;
+    if (!rb_strtab_intern(&graph->files, path, len, &id))
+        rb_memerror();
+
+    if (id >= graph->capa_nodes)
+    {
+        uint32_t capa = graph->capa_nodes ? graph->capa_nodes * 2 : 64;
+        graph_list *out = realloc(graph->out, sizeof(graph_list) * capa);
+        if (out)
+            graph->out = out;
+        graph_list *in = out ? realloc(graph->in, sizeof(graph_list) * capa) : NULL;
+        if (!in)
+            rb_memerror();
+        graph->in = in;
+
+        memset(graph->out + graph->capa_nodes, 0, sizeof(graph_list) * (capa - graph->capa_nodes));
+        memset(graph->in + graph->capa_nodes, 0, sizeof(graph_list) * (capa - graph->capa_nodes));
+        graph->capa_nodes = capa;
+    }
+    return id;
+}
+
+static int graph_acquire(rb_include_graph *graph, uint64_t key)
+{
+    graph_edge *edge;
+    HASH_FIND(hh, graph->edges, &key, sizeof(uint64_t), edge);
+    if (edge)
+    {
+        edge->refs++;
+        return 1;
+    }
+
+    uint32_t from = (uint32_t) (key >> 32), to = (uint32_t) key;
+    if (!(edge = malloc(sizeof(graph_edge))))
+        return 0;
+    if (!list_push(&graph->out[from], to))
+    {
+        free(edge);
+        return 0;
+    }
+    if (!list_push(&graph->in[to], from))
+    {
+        graph->out[from].count--;
+        free(edge);
+        return 0;
+    }
+    edge->key = key;
+    edge->refs = 1;
+    HASH_ADD(hh, graph->edges, key, sizeof(uint64_t), edge);
+    graph->num_edges++;
+    return 1;
+}
+
+static void graph_release(rb_include_graph *graph, const uint64_t *keys, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        graph_edge *edge;
+        HASH_FIND(hh, graph->edges, &keys[i], sizeof(uint64_t), edge);
+        if (!edge || --edge->refs)
+            continue;
+
+        uint32_t from = (uint32_t) (keys[i] >> 32), to = (uint32_t) keys[i];
+        list_remove(&graph->out[from], to);
+        list_remove(&graph->in[to], from);
+        HASH_DEL(graph->edges, edge);
+        free(edge);
+        graph->num_edges--;
+    }
+}
+
+static uint32_t graph_unit(rb_include_graph *graph, VALUE name)
+{
+    unsigned int id;
+    if (!rb_strtab_intern(&graph->units, RSTRING_PTR(name), RSTRING_LEN(name), &id))
+        rb_memerror();
+
+    if (id >= graph->capa_units)
+    {
+        uint32_t capa = graph->capa_units ? graph->capa_units * 2 : 64;
+        uint32_t *roots = realloc(graph->roots, sizeof(uint32_t) * capa);
+        if (roots)
+            graph->roots = roots;
+        graph_owned *owned = roots ? realloc(graph->owned, sizeof(graph_owned) * capa) : NULL;
+        if (!owned)
+            rb_memerror();
+        graph->owned = owned;
+
+        for (uint32_t i = graph->capa_units; i < capa; i++)
+            graph->roots[i] = GRAPH_NONE;
+        memset(graph->owned + graph->capa_units, 0, sizeof(graph_owned) * (capa - graph->capa_units));
+        graph->capa_units = capa;
+    }
+    return id;
+}
+
+// Takes the edges of a unit in place of those it had, acquiring the new ones first so shared edges are kept in place
+static void graph_set_unit(rb_include_graph *graph, uint32_t id, uint32_t root, uint64_t *keys, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!graph_acquire(graph, keys[i]))
+        {
+            graph_release(graph, keys, i);
+            free(keys);
+            rb_memerror();
+        }
+    }
+
+    graph_owned *owned = &graph->owned[id];
+    graph_release(graph, owned->keys, owned->count);
+    graph->num_owned += count - owned->count;
+    free(owned->keys);
+    owned->keys = keys;
+    owned->count = count;
+    graph->roots[id] = root;
+}
+
+static int key_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static VALUE graph_pass_free(VALUE data)
+{
+    graph_pass *pass = (graph_pass *) data;
+    rb_strtab_free(&pass->files);
+    free(pass->edges);
+    return Qnil;
+}
+
+typedef struct
+{
+    rb_include_graph *graph;
+    graph_pass *pass;
+    VALUE name;
+    VALUE unit;
+} graph_add_args;
+
+static VALUE graph_add_run(VALUE data)
+{
+    graph_add_args *args = (graph_add_args *) data;
+    graph_pass *pass = args->pass;
+    rb_include_graph *graph = args->graph;
+
+    rb_tu_without_gvl(args->unit, pass_nogvl, pass, NULL, NULL);
+    if (pass->failed)
+        rb_memerror();
+
+    // Ids of the pass are translated to those of the graph, which has every file of every unit added before
+    VALUE buffer;
+    uint32_t *ids = ALLOCV_N(uint32_t, buffer, pass->files.count);
+    for (uint32_t i = 0; i < pass->files.count; i++)
+    {
+        size_t len;
+        const char *path = rb_strtab_get(&pass->files, i, &len);
+        ids[i] = graph_node(graph, path, len);
+    }
+
+    uint32_t root = pass->root == GRAPH_NONE ? GRAPH_NONE : ids[pass->root];
+    if (root == GRAPH_NONE)
+    {
+        ALLOCV_END(buffer);
+        return Qfalse;
+    }
+    VALUE name = NIL_P(args->name) ? rb_strtab_str(&graph->files, root) : args->name;
+    uint32_t id = graph_unit(graph, name);
+
+    uint64_t *keys = malloc(sizeof(uint64_t) * (pass->num_edges ? pass->num_edges : 1));
+    if (!keys)
+        rb_memerror();
+    for (uint32_t i = 0; i < pass->num_edges; i++)
+        keys[i] = ((uint64_t) ids[pass->edges[i].from] << 32) | ids[pass->edges[i].to];
+    ALLOCV_END(buffer);
+
+    // A unit holds each of its edges once, however many times the inclusion was reported
+    uint32_t count = 0;
+    qsort(keys, pass->num_edges, sizeof(uint64_t), key_compare);
+    for (uint32_t i = 0; i < pass->num_edges; i++)
+    {
+        if (count == 0 || keys[count - 1] != keys[i])
+            keys[count++] = keys[i];
+    }
+
+    graph_set_unit(graph, id, root, keys, count);
+    return name;
+}
+
+static VALUE graph_add(int argc, VALUE *argv, VALUE self)
+{
+    VALUE unit, name;
+    rb_scan_args(argc, argv, "11", &unit, &name);
+    if (!NIL_P(name))
+        name = rb_str_new_frozen(StringValue(name));
+
+    graph_pass pass = {rb_tu_unit(unit)};
+    pass.root = GRAPH_NONE;
+    if (!rb_strtab_init(&pass.files))
+        rb_memerror();
+
+    graph_add_args args = {graph_ptr(self), &pass, name, unit};
+    VALUE result = rb_ensure(graph_add_run, (VALUE) &args, graph_pass_free, (VALUE) &pass);
+    RB_GC_GUARD(unit);
+    return result == Qfalse ? Qnil : result;
+}
+
+static uint32_t graph_unit_find(const rb_include_graph *graph, VALUE name)
+{
+    unsigned int id;
+    StringValue(name);
+    if (!rb_strtab_find((rb_strtab *) &graph->units, RSTRING_PTR(name), RSTRING_LEN(name), &id) || id == 0)
+        return GRAPH_NONE;
+    return graph->roots[id] == GRAPH_NONE ? GRAPH_NONE : id;
+}
+
+static VALUE graph_remove(VALUE self, VALUE name)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    uint32_t id = graph_unit_find(graph, name);
+    if (id == GRAPH_NONE)
+        return Qfalse;
+
+    graph_owned *owned = &graph->owned[id];
+    graph_release(graph, owned->keys, owned->count);
+    graph->num_owned -= owned->count;
+    free(owned->keys);
+    owned->keys = NULL;
+    owned->count = 0;
+    graph->roots[id] = GRAPH_NONE;
+    return Qtrue;
+}
+
+static uint32_t graph_find(const rb_include_graph *graph, VALUE path)
+{
+    unsigned int id;
+    StringValue(path);
+    if (!rb_strtab_find((rb_strtab *) &graph->files, RSTRING_PTR(path), RSTRING_LEN(path), &id) || id == 0)
+        return GRAPH_NONE;
+    return id;
+}
+
+// Visits every file reachable from the starting files, following edges in one direction, starting files included
+static uint8_t *graph_reach(const rb_include_graph *graph, const uint32_t *start, long count, int reverse)
+{
+    uint32_t n = graph->files.count;
+    uint8_t *visited = calloc(n ? n : 1, 1);
+    uint32_t *queue = malloc(sizeof(uint32_t) * (n ? n : 1));
+    if (!visited || !queue)
+    {
+        free(visited);
+        free(queue);
+        rb_memerror();
+    }
+
+    uint32_t head = 0, tail = 0;
+    for (long i = 0; i < count; i++)
+    {
+        if (start[i] != GRAPH_NONE && !visited[start[i]])
+        {
+            visited[start[i]] = 1;
+            queue[tail++] = start[i];
+        }
+    }
+
+    const graph_list *lists = reverse ? graph->in : graph->out;
+    while (head < tail)
+    {
+        const graph_list *list = &lists[queue[head++]];
+        for (uint32_t i = 0; i < list->count; i++)
+        {
+            if (!visited[list->ids[i]])
+            {
+                visited[list->ids[i]] = 1;
+                queue[tail++] = list->ids[i];
+            }
+        }
+    }
+
+    free(queue);
+    return visited;
+}
+
+static VALUE graph_neighbours(VALUE self, VALUE path, VALUE transitive, int reverse)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    uint32_t id = graph_find(graph, path);
+    VALUE ary = rb_ary_new();
+    if (id == GRAPH_NONE)
+        return ary;
+
+    if (!RTEST(transitive))
+    {
+        const graph_list *list = reverse ? &graph->in[id] : &graph->out[id];
+        for (uint32_t i = 0; i < list->count; i++)
+            rb_ary_push(ary, rb_strtab_str(&graph->files, list->ids[i]));
+        return ary;
+    }
+
+    uint8_t *visited = graph_reach(graph, &id, 1, reverse);
+    for (uint32_t i = 1; i < graph->files.count; i++)
+    {
+        if (visited[i] && i != id)
+            rb_ary_push(ary, rb_strtab_str(&graph->files, i));
+    }
+    free(visited);
+    return ary;
+}
+
+static VALUE graph_transitive(int argc, VALUE *argv)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, "1:", NULL, &kwargs);
+
+    ID keys[1] = {rb_intern("transitive")};
+    VALUE transitive;
+    rb_get_kwargs(kwargs, keys, 0, 1, &transitive);
+    return transitive == Qundef ? Qfalse : transitive;
+}
+
+static VALUE graph_includes(int argc, VALUE *argv, VALUE self)
+{
+    VALUE transitive = graph_transitive(argc, argv);
+    return graph_neighbours(self, argv[0], transitive, 0);
+}
+
+static VALUE graph_includers(int argc, VALUE *argv, VALUE self)
+{
+    VALUE transitive = graph_transitive(argc, argv);
+    return graph_neighbours(self, argv[0], transitive, 1);
+}
+
+static VALUE graph_affected_units(int argc, VALUE *argv, VALUE self)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    VALUE paths = rb_ary_new_from_values(argc, argv);
+    paths = rb_funcall(paths, rb_intern("flatten"), 0);
+
+    long count = RARRAY_LEN(paths);
+    VALUE buffer;
+    uint32_t *start = ALLOCV_N(uint32_t, buffer, count ? count : 1);
+    for (long i = 0; i < count; i++)
+        start[i] = graph_find(graph, rb_ary_entry(paths, i));
+
+    // A unit is affected when its main file is, or transitively includes, one of the files
+    uint8_t *visited = graph_reach(graph, start, count, 1);
+    ALLOCV_END(buffer);
+    VALUE ary = rb_ary_new();
+    for (uint32_t i = 1; i < graph->units.count; i++)
+    {
+        if (graph->roots[i] != GRAPH_NONE && visited[graph->roots[i]])
+            rb_ary_push(ary, rb_strtab_str(&graph->units, i));
+    }
+    free(visited);
+    return ary;
+}
+
+// Files stay interned once seen, but only those with an edge or that are the main file of a unit are in the graph
+static uint8_t *graph_linked(const rb_include_graph *graph)
+{
+    uint8_t *linked = calloc(graph->files.count, 1);
+    if (!linked)
+        rb_memerror();
+    for (uint32_t i = 1; i < graph->files.count; i++)
+        linked[i] = graph->out[i].count || graph->in[i].count;
+    for (uint32_t i = 1; i < graph->units.count; i++)
+    {
+        if (graph->roots[i] != GRAPH_NONE)
+            linked[graph->roots[i]] = 1;
+    }
+    return linked;
+}
+
+static VALUE graph_files(VALUE self)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    uint8_t *linked = graph_linked(graph);
+    VALUE ary = rb_ary_new();
+    for (uint32_t i = 1; i < graph->files.count; i++)
+    {
+        if (linked[i])
+            rb_ary_push(ary, rb_strtab_str(&graph->files, i));
+    }
+    free(linked);
+    return ary;
+}
+
+static VALUE graph_units(VALUE self)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    VALUE ary = rb_ary_new();
+    for (uint32_t i = 1; i < graph->units.count; i++)
+    {
+        if (graph->roots[i] != GRAPH_NONE)
+            rb_ary_push(ary, rb_strtab_str(&graph->units, i));
+    }
+    return ary;
+}
+
+static VALUE graph_unit_file(VALUE self, VALUE name)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    uint32_t id = graph_unit_find(graph, name);
+    return id == GRAPH_NONE ? Qnil : rb_strtab_str(&graph->files, graph->roots[id]);
+}
+
+static VALUE graph_edges(VALUE self)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    VALUE ary = rb_ary_new_capa(graph->num_edges);
+    for (uint32_t from = 1; from < graph->files.count; from++)
+    {
+        VALUE includer = rb_strtab_str(&graph->files, from);
+        for (uint32_t i = 0; i < graph->out[from].count; i++)
+            rb_ary_push(ary, rb_assoc_new(includer, rb_strtab_str(&graph->files, graph->out[from].ids[i])));
+    }
+    return ary;
+}
+
+static VALUE graph_size(VALUE self)
+{
+    rb_include_graph *graph = graph_ptr(self);
+    uint8_t *linked = graph_linked(graph);
+    uint32_t count = 0;
+    for (uint32_t i = 1; i < graph->files.count; i++)
+        count += linked[i];
+    free(linked);
+    return UINT2NUM(count);
+}
+
+static VALUE graph_edge_count(VALUE self)
+{
+    return UINT2NUM(graph_ptr(self)->num_edges);
+}
+
+static VALUE graph_alloc(VALUE klass)
+{
+    rb_include_graph *graph = ZALLOC(rb_include_graph);
+    VALUE obj = TypedData_Wrap_Struct(klass, &graph_type, graph);
+    if (!rb_strtab_init(&graph->files) || !rb_strtab_init(&graph->units))
+        rb_memerror();
+    graph_node(graph, "", 0);
+    return obj;
+}
+
+void Init_clang_include_graph(void)
+{
+    rb_define_alloc_func(rb_cCXIncludeGraph, graph_alloc);
+    rb_define_methodm1(rb_cCXIncludeGraph, "add", graph_add, -1);
+    rb_define_method1(rb_cCXIncludeGraph, "remove", graph_remove, 1);
+    rb_define_methodm1(rb_cCXIncludeGraph, "includes", graph_includes, -1);
+    rb_define_methodm1(rb_cCXIncludeGraph, "includers", graph_includers, -1);
+    rb_define_methodm1(rb_cCXIncludeGraph, "affected_units", graph_affected_units, -1);
+    rb_define_method0(rb_cCXIncludeGraph, "files", graph_files, 0);
+    rb_define_method0(rb_cCXIncludeGraph, "units", graph_units, 0);
+    rb_define_method1(rb_cCXIncludeGraph, "unit_file", graph_unit_file, 1);
+    rb_define_method0(rb_cCXIncludeGraph, "edges", graph_edges, 0);
+    rb_define_method0(rb_cCXIncludeGraph, "size", graph_size, 0);
+    rb_define_method0(rb_cCXIncludeGraph, "edge_count", graph_edge_count, 0);
+}
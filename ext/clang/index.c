@@ -1,11 +1,40 @@
 #include "clang.h"
 
+static ID id_exclude_pch;
+static ID id_display;
+
 static void index_free(void *data)
 {
     if (data)
         clang_disposeIndex(data);
 }
 
+// libclang reports no memory usage for an index itself, which is instead accounted by its translation units
+const rb_data_type_t rb_index_type = {
+    "Clang::Index",
+    {NULL, index_free, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static VALUE index_alloc(VALUE klass)
+{
+    return TypedData_Wrap_Struct(klass, &rb_index_type, NULL);
+}
+
+VALUE rb_index_wrap(CXIndex index)
+{
+    return TypedData_Wrap_Struct(rb_cCXIndex, &rb_index_type, index);
+}
+
+// libclang cannot report the flags an index was created with, so they are kept for creating indices just like it
+void rb_index_batch_params(VALUE index, rb_tu_batch *params)
+{
+    params->exclude_pch = RTEST(rb_attr_get(index, id_exclude_pch));
+    params->display = RTEST(rb_attr_get(index, id_display));
+    params->global_options = clang_CXIndex_getGlobalOptions(DATA_PTR(index));
+}
+
 static VALUE index_get_opts(VALUE self)
 {
     unsigned int mask = clang_CXIndex_getGlobalOptions(DATA_PTR(self));
@@ -46,15 +75,19 @@ static VALUE index_create(int argc, VALUE *argv, VALUE klass)
         clang_CXIndex_setGlobalOptions(idx, opts);
     }
 
+    VALUE index = TypedData_Wrap_Struct(klass, &rb_index_type, idx);
+    rb_ivar_set(index, id_exclude_pch, RB_BOOL(RTEST(exclude)));
+    rb_ivar_set(index, id_display, RB_BOOL(RTEST(display)));
+
     if (rb_block_given_p())
     {
-        VALUE index = Data_Wrap_Struct(klass, NULL, RUBY_NEVER_FREE, idx);
         rb_yield(index);
+        RTYPEDDATA_DATA(index) = NULL;
         clang_disposeIndex(idx);
         return Qnil;
     }
 
-    return Data_Wrap_Struct(klass, NULL, index_free, idx);
+    return index;
 }
 
 static VALUE index_emission_path(VALUE self, VALUE path)
@@ -66,8 +99,12 @@ static VALUE index_emission_path(VALUE self, VALUE path)
 
 void Init_clang_index(void)
 {
+    rb_define_alloc_func(rb_cCXIndex, index_alloc);
     rb_define_singleton_methodm1(rb_cCXIndex, "create", index_create, -1);
     rb_define_method0(rb_cCXIndex, "global_opts", index_get_opts, 0);
     rb_define_method1(rb_cCXIndex, "global_opts=", index_set_opts, 1);
     rb_define_method1(rb_cCXIndex, "emission_path", index_emission_path, 1);
+
+    id_exclude_pch = rb_intern("@exclude_pch");
+    id_display = rb_intern("@display");
 }
\ No newline at end of file
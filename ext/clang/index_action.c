@@ -0,0 +1,667 @@
+#include "clang.h"
+#include <stdint.h>
+#include <ruby/thread.h>
+
+#define INDEX_NONE UINT32_MAX
+
+enum
+{
+    INDEX_DEFINITION = 1 << 0,
+    INDEX_REDECLARATION = 1 << 1,
+    INDEX_IMPLICIT = 1 << 2
+};
+
+enum
+{
+    INCLUDE_ANGLED = 1 << 0,
+    INCLUDE_IMPORT = 1 << 1,
+    INCLUDE_MODULE = 1 << 2
+};
+
+typedef struct
+{
+    CXIndexAction action;
+    VALUE index;
+} rb_index_action;
+
+// One per distinct USR, with the declarations and references of it chained through their records
+typedef struct
+{
+    uint32_t usr;
+    uint32_t name;
+    uint32_t kind;
+    uint32_t lang;
+    uint32_t first[2];
+    uint32_t last[2];
+    uint32_t count[2];
+} index_entity;
+
+typedef struct
+{
+    uint32_t entity;
+    uint32_t container;
+    uint32_t file;
+    uint32_t line;
+    uint32_t column;
+    uint32_t offset;
+    uint32_t flags;
+    uint32_t next;
+} index_record;
+
+typedef struct
+{
+    uint32_t file;
+    uint32_t line;
+    uint32_t column;
+    uint32_t included;
+    uint32_t flags;
+} index_include;
+
+enum
+{
+    INDEX_DECLS,
+    INDEX_REFS
+};
+
+// Everything reported by the indexer, where strings (USRs, names and file names) are interned ids
+typedef struct
+{
+    rb_strtab strings;
+    uint32_t *entity_of;
+    uint32_t entity_of_capa;
+    index_entity *entities;
+    uint32_t num_entities;
+    uint32_t capa_entities;
+    index_record *records[2];
+    uint32_t num_records[2];
+    uint32_t capa_records[2];
+    index_include *includes;
+    uint32_t num_includes;
+    uint32_t capa_includes;
+    uint32_t main_file;
+} rb_index_result;
+
+typedef struct
+{
+    rb_index_result *result;
+    int failed;
+    volatile int interrupted;
+} index_context;
+
+typedef struct
+{
+    CXIndexAction action;
+    index_context *context;
+    unsigned int options;
+    unsigned int unit_options;
+    CXTranslationUnit unit;
+    rb_tu_args args;
+    int code;
+} index_call;
+
+static void action_mark(void *data)
+{
+    rb_index_action *action = data;
+    rb_gc_mark(action->index);
+}
+
+static void action_free(void *data)
+{
+    rb_index_action *action = data;
+    if (action->action)
+        clang_IndexAction_dispose(action->action);
+    xfree(action);
+}
+
+static const rb_data_type_t action_type = {
+    "Clang::IndexAction",
+    {action_mark, action_free, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static void result_free(void *data)
+{
+    rb_index_result *result = data;
+    rb_strtab_free(&result->strings);
+    free(result->entity_of);
+    free(result->entities);
+    free(result->records[INDEX_DECLS]);
+    free(result->records[INDEX_REFS]);
+    free(result->includes);
+    xfree(result);
+}
+
+static size_t result_memsize(const void *data)
+{
+    const rb_index_result *result = data;
+    return sizeof(rb_index_result) + rb_strtab_memsize(&result->strings) +
+           sizeof(uint32_t) * result->entity_of_capa + sizeof(index_entity) * result->capa_entities +
+           sizeof(index_record) * (result->capa_records[INDEX_DECLS] + result->capa_records[INDEX_REFS]) +
+           sizeof(index_include) * result->capa_includes;
+}
+
+static const rb_data_type_t result_type = {
+    "Clang::IndexResult",
+    {NULL, result_free, result_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+// Grows an array allocated with malloc, as records are appended without the GVL
+static int index_reserve(void **ptr, uint32_t *capa, uint32_t count, size_t size)
+{
+    if (count < *capa)
+        return 1;
+
+    uint32_t n = *capa ? *capa * 2 : 256;
+    void *grown = realloc(*ptr, size * n);
+    if (!grown)
+        return 0;
+    *ptr = grown;
+    *capa = n;
+    return 1;
+}
+
+static int index_intern(index_context *ctx, const char *str, uint32_t *id)
+{
+    unsigned int value = 0;
+    if (str && !rb_strtab_intern(&ctx->result->strings, str, strlen(str), &value))
+    {
+        ctx->failed = 1;
+        return 0;
+    }
+    *id = value;
+    return 1;
+}
+
+static uint32_t index_file(index_context *ctx, CXFile file)
+{
+    if (!file)
+        return 0;
+
+    uint32_t id = 0;
+    CXString name = clang_getFileName(file);
+    index_intern(ctx, clang_getCString(name), &id);
+    clang_disposeString(name);
+    return id;
+}
+
+// The client data of each file is its interned name, so that locations resolve without another lookup
+static CXIdxClientFile index_client_file(uint32_t id)
+{
+    return (CXIdxClientFile) (uintptr_t) (id + 1);
+}
+
+static void index_location(index_context *ctx, CXIdxLoc loc, index_record *record)
+{
+    CXIdxClientFile client;
+    CXFile file;
+    clang_indexLoc_getFileLocation(loc, &client, &file, &record->line, &record->column, &record->offset);
+    record->file = client ? (uint32_t) ((uintptr_t) client - 1) : index_file(ctx, file);
+}
+
+static uint32_t index_entity_of(index_context *ctx, const CXIdxEntityInfo *info)
+{
+    if (!info || !info->USR || !info->USR[0])
+        return INDEX_NONE;
+
+    // Entities already seen in this pass carry their index as client data
+    CXIdxClientEntity client = clang_index_getClientEntity(info);
+    if (client)
+        return (uint32_t) ((uintptr_t) client - 1);
+
+    rb_index_result *result = ctx->result;
+    uint32_t usr;
+    if (!index_intern(ctx, info->USR, &usr))
+        return INDEX_NONE;
+
+    while (usr >= result->entity_of_capa)
+    {
+        uint32_t capa = result->entity_of_capa;
+        if (!index_reserve((void **) &result->entity_of, &result->entity_of_capa, capa, sizeof(uint32_t)))
+        {
+            ctx->failed = 1;
+            return INDEX_NONE;
+        }
+        for (uint32_t i = capa; i < result->entity_of_capa; i++)
+            result->entity_of[i] = INDEX_NONE;
+    }
+
+    uint32_t id = result->entity_of[usr];
+    if (id == INDEX_NONE)
+    {
+        if (!index_reserve((void **) &result->entities, &result->capa_entities, result->num_entities,
+                           sizeof(index_entity)))
+        {
+            ctx->failed = 1;
+            return INDEX_NONE;
+        }
+
+        id = result->num_entities++;
+        index_entity *entity = &result->entities[id];
+        memset(entity, 0, sizeof(index_entity));
+        entity->usr = usr;
+        entity->kind = info->kind;
+        entity->lang = info->lang;
+        entity->first[INDEX_DECLS] = entity->first[INDEX_REFS] = INDEX_NONE;
+        entity->last[INDEX_DECLS] = entity->last[INDEX_REFS] = INDEX_NONE;
+        index_intern(ctx, info->name, &entity->name);
+        result->entity_of[usr] = id;
+    }
+
+    clang_index_setClientEntity(info, (CXIdxClientEntity) (uintptr_t) (id + 1));
+    return id;
+}
+
+static uint32_t index_container(const CXIdxContainerInfo *container)
+{
+    CXIdxClientContainer client = container ? clang_index_getClientContainer(container) : NULL;
+    return client ? (uint32_t) ((uintptr_t) client - 1) : INDEX_NONE;
+}
+
+static index_record *index_append(index_context *ctx, int which, uint32_t entity)
+{
+    rb_index_result *result = ctx->result;
+    if (!index_reserve((void **) &result->records[which], &result->capa_records[which], result->num_records[which],
+                       sizeof(index_record)))
+    {
+        ctx->failed = 1;
+        return NULL;
+    }
+
+    uint32_t id = result->num_records[which]++;
+    index_record *record = &result->records[which][id];
+    memset(record, 0, sizeof(index_record));
+    record->entity = entity;
+    record->next = INDEX_NONE;
+
+    index_entity *e = &result->entities[entity];
+    if (e->last[which] == INDEX_NONE)
+        e->first[which] = id;
+    else
+        result->records[which][e->last[which]].next = id;
+    e->last[which] = id;
+    e->count[which]++;
+    return record;
+}
+
+static int index_abort_query(CXClientData data, void *reserved)
+{
+    index_context *ctx = data;
+    return ctx->failed || ctx->interrupted;
+}
+
+static CXIdxClientFile index_entered_main_file(CXClientData data, CXFile file, void *reserved)
+{
+    index_context *ctx = data;
+    ctx->result->main_file = index_file(ctx, file);
+    return index_client_file(ctx->result->main_file);
+}
+
+static CXIdxClientFile index_included_file(CXClientData data, const CXIdxIncludedFileInfo *info)
+{
+    index_context *ctx = data;
+    rb_index_result *result = ctx->result;
+
+    uint32_t included = 0;
+    if (info->file)
+        included = index_file(ctx, info->file);
+    else
+        index_intern(ctx, info->filename, &included);
+
+    if (!index_reserve((void **) &result->includes, &result->capa_includes, result->num_includes,
+                       sizeof(index_include)))
+    {
+        ctx->failed = 1;
+        return NULL;
+    }
+
+    index_record where;
+    index_location(ctx, info->hashLoc, &where);
+    index_include *include = &result->includes[result->num_includes++];
+    include->file = where.file;
+    include->line = where.line;
+    include->column = where.column;
+    include->included = included;
+    include->flags = (info->isAngled ? INCLUDE_ANGLED : 0) | (info->isImport ? INCLUDE_IMPORT : 0) |
+                     (info->isModuleImport ? INCLUDE_MODULE : 0);
+    return index_client_file(included);
+}
+
+static void index_declaration(CXClientData data, const CXIdxDeclInfo *info)
+{
+    index_context *ctx = data;
+    uint32_t entity = index_entity_of(ctx, info->entityInfo);
+    if (entity == INDEX_NONE)
+        return;
+
+    // Declarations that contain others are tagged, so that their members resolve their container directly
+    if (info->declAsContainer)
+        clang_index_setClientContainer(info->declAsContainer, (CXIdxClientContainer) (uintptr_t) (entity + 1));
+
+    index_record *record = index_append(ctx, INDEX_DECLS, entity);
+    if (!record)
+        return;
+
+    index_location(ctx, info->loc, record);
+    record->container = index_container(info->semanticContainer);
+    record->flags = (info->isDefinition ? INDEX_DEFINITION : 0) | (info->isRedeclaration ? INDEX_REDECLARATION : 0) |
+                    (info->isImplicit ? INDEX_IMPLICIT : 0);
+}
+
+static void index_reference(CXClientData data, const CXIdxEntityRefInfo *info)
+{
+    index_context *ctx = data;
+    uint32_t entity = index_entity_of(ctx, info->referencedEntity);
+    if (entity == INDEX_NONE)
+        return;
+
+    index_record *record = index_append(ctx, INDEX_REFS, entity);
+    if (!record)
+        return;
+
+    index_location(ctx, info->loc, record);
+    record->container = index_container(info->container);
+    record->flags = info->kind == CXIdxEntityRef_Implicit ? INDEX_IMPLICIT : 0;
+}
+
+static IndexerCallbacks index_callbacks = {
+    index_abort_query, NULL, index_entered_main_file, index_included_file, NULL, NULL, index_declaration,
+    index_reference};
+
+static void *index_source_nogvl(void *data)
+{
+    index_call *call = data;
+    call->code =
+        clang_indexSourceFile(call->action, call->context, &index_callbacks, sizeof(IndexerCallbacks), call->options,
+                              call->args.source, (const char *const *) call->args.argv, call->args.argc,
+                              call->args.files, call->args.num_files, NULL, call->unit_options);
+    return NULL;
+}
+
+static void *index_unit_nogvl(void *data)
+{
+    index_call *call = data;
+    call->code = clang_indexTranslationUnit(call->action, call->context, &index_callbacks, sizeof(IndexerCallbacks),
+                                            call->options, call->unit);
+    return NULL;
+}
+
+static void index_ubf(void *data)
+{
+    index_call *call = data;
+    call->context->interrupted = 1;
+}
+
+static VALUE index_run(index_call *call, void *(*func)(void *), VALUE unit)
+{
+    rb_index_result *result;
+    VALUE obj = TypedData_Make_Struct(rb_cCXIndexResult, rb_index_result, &result_type, result);
+    index_context context = {result};
+    call->context = &context;
+
+    if (!rb_strtab_init(&result->strings))
+        rb_memerror();
+
+    // The indexer polls for cancellation between callbacks, so an interrupt stops it early
+    rb_tu_without_gvl(unit, func, call, index_ubf, call);
+    rb_thread_check_ints();
+
+    if (context.failed)
+        rb_memerror();
+    return obj;
+}
+
+static rb_index_action *action_ptr(VALUE self)
+{
+    rb_index_action *action = rb_check_typeddata(self, &action_type);
+    if (!action->action)
+        rb_raise(rb_eRuntimeError, "index action is not initialized");
+    return action;
+}
+
+static VALUE action_alloc(VALUE klass)
+{
+    rb_index_action *action;
+    VALUE obj = TypedData_Make_Struct(klass, rb_index_action, &action_type, action);
+    action->index = Qnil;
+    return obj;
+}
+
+static VALUE action_initialize(VALUE self, VALUE index)
+{
+    rb_assert_type(index, rb_cCXIndex);
+    if (!DATA_PTR(index))
+        rb_raise(rb_eArgError, "index has been disposed");
+
+    rb_index_action *action = rb_check_typeddata(self, &action_type);
+    if (action->action)
+        clang_IndexAction_dispose(action->action);
+
+    action->index = index;
+    action->action = clang_IndexAction_create(DATA_PTR(index));
+    return self;
+}
+
+static VALUE action_index(VALUE self)
+{
+    rb_index_action *action = rb_check_typeddata(self, &action_type);
+    return action->index;
+}
+
+static VALUE index_run_source(VALUE data)
+{
+    return index_run((index_call *) data, index_source_nogvl, Qnil);
+}
+
+static VALUE index_args_free(VALUE data)
+{
+    rb_tu_args_free(&((index_call *) data)->args);
+    return Qnil;
+}
+
+static VALUE action_index_source(int argc, VALUE *argv, VALUE self)
+{
+    VALUE source, args, unsaved, options, kwargs;
+    rb_scan_args(argc, argv, "12*:", &source, &args, &unsaved, &options, &kwargs);
+
+    ID keys[1] = {rb_intern("unit_options")};
+    VALUE unit_options;
+    rb_get_kwargs(kwargs, keys, 0, 1, &unit_options);
+
+    index_call call = {action_ptr(self)->action, NULL, rb_enum_mask(rb_IndexOptFlags, options)};
+    if (unit_options != Qundef && !NIL_P(unit_options))
+        call.unit_options = rb_enum_mask(rb_TranslationUnitFlags, rb_Array(unit_options));
+
+    rb_tu_args_init(&call.args, source, args, unsaved);
+    VALUE result = rb_ensure(index_run_source, (VALUE) &call, index_args_free, (VALUE) &call);
+    RB_GC_GUARD(self);
+
+    VALUE error = rb_tu_error(call.code);
+    if (!NIL_P(error))
+        rb_exc_raise(error);
+    return result;
+}
+
+static VALUE action_index_unit(int argc, VALUE *argv, VALUE self)
+{
+    VALUE unit, options;
+    rb_scan_args(argc, argv, "1*", &unit, &options);
+
+    index_call call = {action_ptr(self)->action, NULL, rb_enum_mask(rb_IndexOptFlags, options)};
+    call.unit = rb_tu_unit(unit);
+    VALUE result = index_run(&call, index_unit_nogvl, unit);
+    RB_GC_GUARD(self);
+    RB_GC_GUARD(unit);
+
+    if (call.code)
+        rb_raise(rb_eRuntimeError, "failed to index translation unit");
+    return result;
+}
+
+static rb_index_result *result_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &result_type);
+}
+
+static VALUE result_str(rb_index_result *result, uint32_t id)
+{
+    return rb_strtab_str(&result->strings, id);
+}
+
+static VALUE result_entity_hash(rb_index_result *result, uint32_t id)
+{
+    index_entity *entity = &result->entities[id];
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, STR2SYM("usr"), result_str(result, entity->usr));
+    rb_hash_aset(hash, STR2SYM("name"), result_str(result, entity->name));
+    rb_hash_aset(hash, STR2SYM("kind"), rb_enum_symbol(rb_IdxEntityKind, entity->kind));
+    rb_hash_aset(hash, STR2SYM("language"), rb_enum_symbol(rb_IdxEntityLanguage, entity->lang));
+    rb_hash_aset(hash, STR2SYM("declaration_count"), UINT2NUM(entity->count[INDEX_DECLS]));
+    rb_hash_aset(hash, STR2SYM("reference_count"), UINT2NUM(entity->count[INDEX_REFS]));
+    return hash;
+}
+
+static VALUE result_record_hash(rb_index_result *result, index_record *record, int which)
+{
+    VALUE hash = rb_hash_new();
+    uint32_t container = record->container;
+    rb_hash_aset(hash, STR2SYM("file"), result_str(result, record->file));
+    rb_hash_aset(hash, STR2SYM("line"), UINT2NUM(record->line));
+    rb_hash_aset(hash, STR2SYM("column"), UINT2NUM(record->column));
+    rb_hash_aset(hash, STR2SYM("offset"), UINT2NUM(record->offset));
+    rb_hash_aset(hash, STR2SYM("container"),
+                 container == INDEX_NONE ? Qnil : result_str(result, result->entities[container].usr));
+    if (which == INDEX_DECLS)
+    {
+        rb_hash_aset(hash, STR2SYM("definition"), RB_BOOL(record->flags & INDEX_DEFINITION));
+        rb_hash_aset(hash, STR2SYM("redeclaration"), RB_BOOL(record->flags & INDEX_REDECLARATION));
+    }
+    rb_hash_aset(hash, STR2SYM("implicit"), RB_BOOL(record->flags & INDEX_IMPLICIT));
+    return hash;
+}
+
+static uint32_t result_find(rb_index_result *result, VALUE usr)
+{
+    StringValue(usr);
+    unsigned int id;
+    if (!rb_strtab_find(&result->strings, RSTRING_PTR(usr), RSTRING_LEN(usr), &id) || id >= result->entity_of_capa)
+        return INDEX_NONE;
+    return result->entity_of[id];
+}
+
+static VALUE result_records(VALUE self, VALUE usr, int which)
+{
+    rb_index_result *result = result_ptr(self);
+    uint32_t id = result_find(result, usr);
+    if (id == INDEX_NONE)
+        return rb_ary_new();
+
+    index_entity *entity = &result->entities[id];
+    VALUE ary = rb_ary_new_capa(entity->count[which]);
+    for (uint32_t i = entity->first[which]; i != INDEX_NONE; i = result->records[which][i].next)
+        rb_ary_push(ary, result_record_hash(result, &result->records[which][i], which));
+    return ary;
+}
+
+static VALUE result_declarations(VALUE self, VALUE usr)
+{
+    return result_records(self, usr, INDEX_DECLS);
+}
+
+static VALUE result_references(VALUE self, VALUE usr)
+{
+    return result_records(self, usr, INDEX_REFS);
+}
+
+static VALUE result_entity(VALUE self, VALUE usr)
+{
+    rb_index_result *result = result_ptr(self);
+    uint32_t id = result_find(result, usr);
+    return id == INDEX_NONE ? Qnil : result_entity_hash(result, id);
+}
+
+static VALUE result_size(VALUE self)
+{
+    return UINT2NUM(result_ptr(self)->num_entities);
+}
+
+static VALUE result_declaration_count(VALUE self)
+{
+    return UINT2NUM(result_ptr(self)->num_records[INDEX_DECLS]);
+}
+
+static VALUE result_reference_count(VALUE self)
+{
+    return UINT2NUM(result_ptr(self)->num_records[INDEX_REFS]);
+}
+
+static VALUE result_usrs(VALUE self)
+{
+    rb_index_result *result = result_ptr(self);
+    VALUE ary = rb_ary_new_capa(result->num_entities);
+    for (uint32_t i = 0; i < result->num_entities; i++)
+        rb_ary_store(ary, i, result_str(result, result->entities[i].usr));
+    return ary;
+}
+
+static VALUE result_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    rb_index_result *result = result_ptr(self);
+    for (uint32_t i = 0; i < result->num_entities; i++)
+        rb_yield(result_entity_hash(result, i));
+    return self;
+}
+
+static VALUE result_includes(VALUE self)
+{
+    rb_index_result *result = result_ptr(self);
+    VALUE ary = rb_ary_new_capa(result->num_includes);
+    for (uint32_t i = 0; i < result->num_includes; i++)
+    {
+        index_include *include = &result->includes[i];
+        VALUE hash = rb_hash_new();
+        rb_hash_aset(hash, STR2SYM("file"), result_str(result, include->file));
+        rb_hash_aset(hash, STR2SYM("line"), UINT2NUM(include->line));
+        rb_hash_aset(hash, STR2SYM("column"), UINT2NUM(include->column));
+        rb_hash_aset(hash, STR2SYM("included"), result_str(result, include->included));
+        rb_hash_aset(hash, STR2SYM("angled"), RB_BOOL(include->flags & INCLUDE_ANGLED));
+        rb_hash_aset(hash, STR2SYM("import"), RB_BOOL(include->flags & INCLUDE_IMPORT));
+        rb_hash_aset(hash, STR2SYM("module"), RB_BOOL(include->flags & INCLUDE_MODULE));
+        rb_ary_store(ary, i, hash);
+    }
+    return ary;
+}
+
+static VALUE result_main_file(VALUE self)
+{
+    rb_index_result *result = result_ptr(self);
+    return result->main_file ? result_str(result, result->main_file) : Qnil;
+}
+
+void Init_clang_index_action(void)
+{
+    rb_define_alloc_func(rb_cCXIndexAction, action_alloc);
+    rb_define_method1(rb_cCXIndexAction, "initialize", action_initialize, 1);
+    rb_define_method0(rb_cCXIndexAction, "index", action_index, 0);
+    rb_define_methodm1(rb_cCXIndexAction, "index_source", action_index_source, -1);
+    rb_define_methodm1(rb_cCXIndexAction, "index_translation_unit", action_index_unit, -1);
+
+    rb_undef_alloc_func(rb_cCXIndexResult);
+    rb_include_module(rb_cCXIndexResult, rb_mEnumerable);
+    rb_define_method0(rb_cCXIndexResult, "size", result_size, 0);
+    rb_define_method0(rb_cCXIndexResult, "declaration_count", result_declaration_count, 0);
+    rb_define_method0(rb_cCXIndexResult, "reference_count", result_reference_count, 0);
+    rb_define_method0(rb_cCXIndexResult, "usrs", result_usrs, 0);
+    rb_define_method0(rb_cCXIndexResult, "each", result_each, 0);
+    rb_define_method1(rb_cCXIndexResult, "entity", result_entity, 1);
+    rb_define_method1(rb_cCXIndexResult, "declarations", result_declarations, 1);
+    rb_define_method1(rb_cCXIndexResult, "references", result_references, 1);
+    rb_define_method0(rb_cCXIndexResult, "includes", result_includes, 0);
+    rb_define_method0(rb_cCXIndexResult, "main_file", result_main_file, 0);
+    rb_define_alias(rb_cCXIndexResult, "length", "size");
+    rb_define_alias(rb_cCXIndexResult, "[]", "entity");
+}
@@ -7,7 +7,7 @@ static VALUE mod_initialize(VALUE self, VALUE translation_unit, VALUE file)
     rb_assert_type(translation_unit, rb_cCXTranslationUnit);
     rb_assert_type(file, rb_cCXFile);
 
-    CXModule mod = clang_getModuleForFile(DATA_PTR(translation_unit), DATA_PTR(file));
+    CXModule mod = clang_getModuleForFile(rb_tu_unit(translation_unit), *rb_file_ptr(file));
     if (!mod)
         rb_raise(rb_eLoadError, "failed to create Module instance");
 
@@ -40,7 +40,7 @@ static VALUE mod_is_system(VALUE self)
 static VALUE mod_ast_file(VALUE self)
 {
     CXFile file = clang_Module_getASTFile(DATA_PTR(self));
-    return file ? Data_Wrap_Struct(rb_cCXFile, NULL, RUBY_NEVER_FREE, file) : Qnil;
+    return file ? rb_file_wrap(rb_cCXFile, file, rb_ivar_get(self, id_unit)) : Qnil;
 }
 
 static VALUE mod_headers(VALUE self)
@@ -48,7 +48,7 @@ static VALUE mod_headers(VALUE self)
     VALUE unit = rb_ivar_get(self, id_unit);
     if (NIL_P(unit))
         rb_raise(rb_eRuntimeError, "undefined translation unit for Module");
-    CXTranslationUnit tu = DATA_PTR(unit);
+    CXTranslationUnit tu = rb_tu_unit(unit);
     CXModule mod = DATA_PTR(self);
     unsigned int n = clang_Module_getNumTopLevelHeaders(tu, mod);
 
@@ -56,7 +56,7 @@ static VALUE mod_headers(VALUE self)
     for (unsigned i = 0; i < n; i++)
     {
         CXFile file = clang_Module_getTopLevelHeader(tu, mod, i);
-        rb_ary_store(ary, i, Data_Wrap_Struct(rb_cCXFile, NULL, RUBY_NEVER_FREE, file));
+        rb_ary_store(ary, i, rb_file_wrap(rb_cCXFile, file, unit));
     }
     return ary;
 }
@@ -68,14 +68,14 @@ static VALUE mod_each_header(VALUE self)
     VALUE unit = rb_ivar_get(self, id_unit);
     if (NIL_P(unit))
         rb_raise(rb_eRuntimeError, "undefined translation unit for Module");
-    CXTranslationUnit tu = DATA_PTR(unit);
+    CXTranslationUnit tu = rb_tu_unit(unit);
     CXModule mod = DATA_PTR(self);
     unsigned int n = clang_Module_getNumTopLevelHeaders(tu, mod);
 
     for (unsigned i = 0; i < n; i++)
     {
         CXFile file = clang_Module_getTopLevelHeader(tu, mod, i);
-        rb_yield(Data_Wrap_Struct(rb_cCXFile, NULL, RUBY_NEVER_FREE, file));
+        rb_yield(rb_file_wrap(rb_cCXFile, file, unit));
     }
 
     return self;
@@ -86,7 +86,7 @@ static VALUE mod_header_count(VALUE self)
     VALUE unit = rb_ivar_get(self, id_unit);
     if (NIL_P(unit))
         rb_raise(rb_eRuntimeError, "undefined translation unit for Module");
-    return UINT2NUM(clang_Module_getNumTopLevelHeaders(DATA_PTR(unit), DATA_PTR(self)));
+    return UINT2NUM(clang_Module_getNumTopLevelHeaders(rb_tu_unit(unit), DATA_PTR(self)));
 }
 
 void Init_clang_module(void)
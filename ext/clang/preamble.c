@@ -0,0 +1,407 @@
+#include "clang.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A precompiled header built from the include directives that a group of sources start with
+typedef struct
+{
+    VALUE path;
+    VALUE includes;
+    VALUE dependencies;
+} rb_preamble;
+
+typedef struct
+{
+    CXTranslationUnit unit;
+    VALUE dependencies;
+    unsigned int unguarded;
+} preamble_build;
+
+static void preamble_mark(void *data)
+{
+    rb_preamble *preamble = data;
+    rb_gc_mark(preamble->path);
+    rb_gc_mark(preamble->includes);
+    rb_gc_mark(preamble->dependencies);
+}
+
+static const rb_data_type_t preamble_type = {
+    "Clang::Preamble",
+    {preamble_mark, RUBY_TYPED_DEFAULT_FREE, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_preamble *preamble_ptr(VALUE self)
+{
+    rb_preamble *preamble = rb_check_typeddata(self, &preamble_type);
+    if (NIL_P(preamble->path))
+        rb_raise(rb_eRuntimeError, "preamble is not initialized");
+    return preamble;
+}
+
+// Skips whitespace and comments between directives
+static const char *scan_space(const char *p, const char *end)
+{
+    while (p < end)
+    {
+        if (isspace((unsigned char) *p))
+            p++;
+        else if (p + 1 < end && p[0] == '/' && p[1] == '/')
+        {
+            while (p < end && *p != '\n')
+                p++;
+        }
+        else if (p + 1 < end && p[0] == '/' && p[1] == '*')
+        {
+            for (p += 2; p + 1 < end && !(p[0] == '*' && p[1] == '/');)
+                p++;
+            p = p + 1 < end ? p + 2 : end;
+        }
+        else
+            break;
+    }
+    return p;
+}
+
+// Collects the #include and #import directives at the top of a file, stopping at anything else
+static VALUE scan_includes(const char *p, size_t len)
+{
+    const char *end = p + len;
+    VALUE ary = rb_ary_new();
+
+    while ((p = scan_space(p, end)) < end && *p == '#')
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+
+        const char *q = p + 1;
+        while (q < eol && (*q == ' ' || *q == '\t'))
+            q++;
+        const char *word = q;
+        while (q < eol && isalpha((unsigned char) *q))
+            q++;
+
+        size_t n = q - word;
+        if (!(n == 7 && memcmp(word, "include", 7) == 0) && !(n == 6 && memcmp(word, "import", 6) == 0))
+            break;
+
+        while (q < eol && (*q == ' ' || *q == '\t'))
+            q++;
+        char close = q < eol ? (*q == '<' ? '>' : *q == '"' ? '"' : 0) : 0;
+        const char *stop = close ? memchr(q + 1, close, eol - q - 1) : NULL;
+        if (!stop)
+            break;
+
+        rb_ary_push(ary, rb_sprintf("#%.*s %.*s", (int) n, word, (int) (stop + 1 - q), q));
+        p = eol;
+    }
+    return ary;
+}
+
+static VALUE scan_file(VALUE source, VALUE unsaved)
+{
+    // An unsaved file takes the place of the file on disk, as it does when parsing
+    FilePathValue(source);
+    unsaved = rb_unsaved_ary(unsaved);
+    long n = rb_array_len(unsaved);
+    for (long i = 0; i < n; i++)
+    {
+        VALUE file = rb_ary_entry(unsaved, i);
+        rb_assert_type(file, rb_cCXUnsavedFile);
+        struct CXUnsavedFile *f = DATA_PTR(file);
+        if (f->Filename && f->Contents && strcmp(f->Filename, RSTRING_PTR(source)) == 0)
+            return scan_includes(f->Contents, f->Length);
+    }
+
+    VALUE text = rb_funcall(rb_cFile, rb_intern("binread"), 1, source);
+    return scan_includes(RSTRING_PTR(text), RSTRING_LEN(text));
+}
+
+static VALUE preamble_scan(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE source, unsaved;
+    rb_scan_args(argc, argv, "11", &source, &unsaved);
+    return scan_file(source, unsaved);
+}
+
+static long common_length(VALUE a, VALUE b)
+{
+    long n = RARRAY_LEN(a) < RARRAY_LEN(b) ? RARRAY_LEN(a) : RARRAY_LEN(b);
+    for (long i = 0; i < n; i++)
+    {
+        if (!rb_str_equal(rb_ary_entry(a, i), rb_ary_entry(b, i)))
+            return i;
+    }
+    return n;
+}
+
+static VALUE preamble_common(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE sources, unsaved;
+    rb_scan_args(argc, argv, "11", &sources, &unsaved);
+    Check_Type(sources, T_ARRAY);
+
+    VALUE common = Qnil;
+    for (long i = 0; i < RARRAY_LEN(sources); i++)
+    {
+        VALUE includes = scan_file(rb_ary_entry(sources, i), unsaved);
+        if (NIL_P(common))
+            common = includes;
+        else
+            rb_ary_resize(common, common_length(common, includes));
+    }
+    return NIL_P(common) ? rb_ary_new() : common;
+}
+
+static int arg_is_cxx(VALUE arg)
+{
+    const char *s = RSTRING_PTR(arg);
+    long len = RSTRING_LEN(arg);
+    int lang = (len > 5 && strncmp(s, "-std=", 5) == 0) || (len > 6 && strncmp(s, "--std=", 6) == 0) ||
+               (len > 11 && strncmp(s, "--language=", 11) == 0) || (len > 2 && strncmp(s, "-x", 2) == 0);
+    return lang && memmem(s, len, "++", 2) != NULL;
+}
+
+// The header is parsed as the language of the sources, which is taken from the arguments unless it is given
+static VALUE preamble_language(VALUE args, VALUE language)
+{
+    if (!NIL_P(language) && language != Qundef)
+        return rb_sprintf("%" PRIsVALUE "-header", rb_String(language));
+
+    for (long i = 0; RTEST(args) && i < rb_array_len(args); i++)
+    {
+        VALUE arg = rb_ary_entry(args, i);
+        StringValue(arg);
+        if (arg_is_cxx(arg))
+            return rb_str_new_cstr("c++-header");
+        if (RSTRING_LEN(arg) == 2 && memcmp(RSTRING_PTR(arg), "-x", 2) == 0 && i + 1 < rb_array_len(args))
+        {
+            VALUE next = rb_ary_entry(args, i + 1);
+            if (memmem(StringValuePtr(next), RSTRING_LEN(next), "++", 2))
+                return rb_str_new_cstr("c++-header");
+        }
+    }
+    return rb_str_new_cstr("c-header");
+}
+
+static void preamble_write_header(VALUE header, VALUE includes)
+{
+    VALUE text = rb_ary_join(includes, rb_str_new_cstr("\n"));
+    rb_str_cat_cstr(text, "\n");
+
+    FILE *io = fopen(StringValueCStr(header), "wb");
+    if (!io)
+        rb_sys_fail_str(header);
+    size_t len = RSTRING_LEN(text);
+    int written = fwrite(RSTRING_PTR(text), 1, len, io) == len;
+    if ((fclose(io) != 0) | !written)
+        rb_sys_fail_str(header);
+}
+
+static void preamble_inclusion(CXFile file, CXSourceLocation *stack, unsigned int depth, CXClientData data)
+{
+    preamble_build *build = data;
+    CXString name = clang_getFileName(file);
+    VALUE path = rb_str_new_cstr(clang_getCString(name) ? clang_getCString(name) : "");
+    clang_disposeString(name);
+    rb_ary_push(build->dependencies, rb_assoc_new(path, LL2NUM((long long) clang_getFileTime(file))));
+
+    // A header that is not include-guarded would be included again by the sources, so the prefix ends before it
+    if (depth == 1 && !clang_isFileMultipleIncludeGuarded(build->unit, file))
+    {
+        unsigned int line;
+        clang_getSpellingLocation(stack[0], NULL, &line, NULL, NULL);
+        if (line && line < build->unguarded)
+            build->unguarded = line;
+    }
+}
+
+static VALUE preamble_save(VALUE data)
+{
+    VALUE *argv = (VALUE *) data;
+    return rb_funcall(argv[0], rb_intern("save"), 1, argv[1]);
+}
+
+static VALUE preamble_dispose(VALUE unit)
+{
+    return rb_funcall(unit, rb_intern("dispose"), 0);
+}
+
+static VALUE preamble_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE index, path, includes, args, kwargs;
+    rb_scan_args(argc, argv, "31:", &index, &path, &includes, &args, &kwargs);
+    rb_assert_type(index, rb_cCXIndex);
+    Check_Type(includes, T_ARRAY);
+
+    ID keys[2] = {rb_intern("directory"), rb_intern("language")};
+    VALUE values[2];
+    rb_get_kwargs(kwargs, keys, 0, 2, values);
+
+    path = rb_str_new_frozen(rb_get_path(path));
+    includes = rb_ary_dup(includes);
+    for (long i = 0; i < RARRAY_LEN(includes); i++)
+    {
+        VALUE include = rb_ary_entry(includes, i);
+        rb_ary_store(includes, i, rb_str_new_frozen(StringValue(include)));
+    }
+
+    // Quoted includes resolve relative to the sources, not the generated header
+    VALUE params = rb_ary_new_from_args(2, rb_str_new_cstr("-x"), preamble_language(args, values[1]));
+    if (RTEST(args))
+        rb_ary_concat(params, rb_Array(args));
+    if (values[0] != Qundef && !NIL_P(values[0]))
+    {
+        rb_ary_push(params, rb_str_new_cstr("-iquote"));
+        rb_ary_push(params, rb_get_path(values[0]));
+    }
+
+    VALUE header = rb_str_plus(path, rb_str_new_cstr(".h"));
+    VALUE flags[2] = {STR2SYM("for_serialization"), STR2SYM("incomplete")};
+    preamble_build build;
+
+    for (;;)
+    {
+        if (RARRAY_LEN(includes) == 0)
+            rb_raise(rb_eArgError, "no include-guarded headers to precompile");
+
+        preamble_write_header(header, includes);
+        VALUE parse[6] = {index, header, params, Qnil, flags[0], flags[1]};
+        VALUE unit = rb_funcallv(rb_cCXTranslationUnit, rb_intern("parse"), 6, parse);
+
+        build.unit = rb_tu_unit(unit);
+        build.dependencies = rb_ary_new();
+        build.unguarded = UINT_MAX;
+        clang_getInclusions(build.unit, preamble_inclusion, &build);
+
+        if (build.unguarded != UINT_MAX)
+        {
+            preamble_dispose(unit);
+            rb_ary_resize(includes, build.unguarded - 1);
+            continue;
+        }
+
+        // Written beside the destination and renamed over it, so that sources never see a partial PCH
+        VALUE tmp = rb_sprintf("%" PRIsVALUE ".%d.tmp", path, (int) getpid());
+        VALUE save[2] = {unit, tmp};
+        rb_ensure(preamble_save, (VALUE) save, preamble_dispose, unit);
+        if (rename(StringValueCStr(tmp), RSTRING_PTR(path)) != 0)
+        {
+            int e = errno;
+            unlink(RSTRING_PTR(tmp));
+            rb_syserr_fail_str(e, path);
+        }
+        break;
+    }
+
+    rb_preamble *preamble = rb_check_typeddata(self, &preamble_type);
+    RB_OBJ_WRITE(self, &preamble->path, path);
+    RB_OBJ_WRITE(self, &preamble->includes, rb_ary_freeze(includes));
+    RB_OBJ_WRITE(self, &preamble->dependencies, rb_ary_freeze(build.dependencies));
+    return self;
+}
+
+static VALUE preamble_alloc(VALUE klass)
+{
+    rb_preamble *preamble;
+    VALUE obj = TypedData_Make_Struct(klass, rb_preamble, &preamble_type, preamble);
+    preamble->path = Qnil;
+    preamble->includes = Qnil;
+    preamble->dependencies = Qnil;
+    return obj;
+}
+
+static VALUE preamble_path(VALUE self)
+{
+    return preamble_ptr(self)->path;
+}
+
+static VALUE preamble_includes(VALUE self)
+{
+    return preamble_ptr(self)->includes;
+}
+
+static VALUE preamble_args(int argc, VALUE *argv, VALUE self)
+{
+    rb_preamble *preamble = preamble_ptr(self);
+    VALUE args = rb_check_arity(argc, 0, 1) && RTEST(argv[0]) ? rb_ary_dup(rb_Array(argv[0])) : rb_ary_new();
+    rb_ary_push(args, rb_str_new_cstr("-include-pch"));
+    rb_ary_push(args, rb_str_dup(preamble->path));
+    return args;
+}
+
+static int preamble_covers_includes(const rb_preamble *preamble, VALUE includes)
+{
+    return common_length(preamble->includes, includes) == RARRAY_LEN(preamble->includes);
+}
+
+static VALUE preamble_covers(int argc, VALUE *argv, VALUE self)
+{
+    VALUE source, unsaved;
+    rb_scan_args(argc, argv, "11", &source, &unsaved);
+    return RB_BOOL(preamble_covers_includes(preamble_ptr(self), scan_file(source, unsaved)));
+}
+
+static VALUE preamble_parse(int argc, VALUE *argv, VALUE self)
+{
+    VALUE index, source, args, unsaved, opts;
+    rb_scan_args(argc, argv, "22*", &index, &source, &args, &unsaved, &opts);
+
+    // A source that does not start with every header of the preamble is parsed on its own
+    rb_preamble *preamble = preamble_ptr(self);
+    if (preamble_covers_includes(preamble, scan_file(source, unsaved)))
+        args = preamble_args(1, &args, self);
+
+    VALUE params = rb_ary_new_from_args(4, index, source, args, unsaved);
+    rb_ary_concat(params, opts);
+    VALUE unit = rb_funcallv(rb_cCXTranslationUnit, rb_intern("parse"), (int) RARRAY_LEN(params),
+                             RARRAY_CONST_PTR(params));
+    RB_GC_GUARD(params);
+    return unit;
+}
+
+static VALUE preamble_is_stale(VALUE self)
+{
+    rb_preamble *preamble = preamble_ptr(self);
+    struct stat st;
+    if (stat(RSTRING_PTR(preamble->path), &st) != 0)
+        return Qtrue;
+
+    for (long i = 0; i < RARRAY_LEN(preamble->dependencies); i++)
+    {
+        VALUE dep = RARRAY_AREF(preamble->dependencies, i);
+        if (stat(RSTRING_PTR(RARRAY_AREF(dep, 0)), &st) != 0 || (long long) st.st_mtime != NUM2LL(RARRAY_AREF(dep, 1)))
+            return Qtrue;
+    }
+    return Qfalse;
+}
+
+static VALUE preamble_dependencies(VALUE self)
+{
+    rb_preamble *preamble = preamble_ptr(self);
+    VALUE ary = rb_ary_new_capa(RARRAY_LEN(preamble->dependencies));
+    for (long i = 0; i < RARRAY_LEN(preamble->dependencies); i++)
+        rb_ary_push(ary, RARRAY_AREF(RARRAY_AREF(preamble->dependencies, i), 0));
+    return ary;
+}
+
+void Init_clang_preamble(void)
+{
+    rb_define_alloc_func(rb_cCXPreamble, preamble_alloc);
+    rb_define_singleton_methodm1(rb_cCXPreamble, "scan", preamble_scan, -1);
+    rb_define_singleton_methodm1(rb_cCXPreamble, "common", preamble_common, -1);
+    rb_define_methodm1(rb_cCXPreamble, "initialize", preamble_initialize, -1);
+    rb_define_method0(rb_cCXPreamble, "path", preamble_path, 0);
+    rb_define_method0(rb_cCXPreamble, "includes", preamble_includes, 0);
+    rb_define_method0(rb_cCXPreamble, "dependencies", preamble_dependencies, 0);
+    rb_define_methodm1(rb_cCXPreamble, "args", preamble_args, -1);
+    rb_define_methodm1(rb_cCXPreamble, "covers?", preamble_covers, -1);
+    rb_define_methodm1(rb_cCXPreamble, "parse", preamble_parse, -1);
+    rb_define_method0(rb_cCXPreamble, "stale?", preamble_is_stale, 0);
+}
@@ -55,7 +55,7 @@ static VALUE indentation_set(VALUE self, VALUE value)
 static VALUE policy_initialize(VALUE self, VALUE cursor)
 {
     rb_assert_type(cursor, rb_cCXCursor);
-    RDATA(self)->data = clang_getCursorPrintingPolicy(*(CXCursor*)DATA_PTR(cursor));
+    RDATA(self)->data = clang_getCursorPrintingPolicy(*rb_cursor_ptr(cursor));
     RDATA(self)->dfree = clang_PrintingPolicy_dispose;
     return self;
 }
@@ -0,0 +1,436 @@
+#include "clang.h"
+#include <stdint.h>
+#include <ruby/thread.h>
+
+// The legend, in the order of the values emitted, following the standard types and modifiers of the LSP
+enum
+{
+    SEM_NONE = -1,
+    SEM_NAMESPACE,
+    SEM_TYPE,
+    SEM_CLASS,
+    SEM_ENUM,
+    SEM_INTERFACE,
+    SEM_STRUCT,
+    SEM_TYPE_PARAMETER,
+    SEM_PARAMETER,
+    SEM_VARIABLE,
+    SEM_PROPERTY,
+    SEM_ENUM_MEMBER,
+    SEM_FUNCTION,
+    SEM_METHOD,
+    SEM_MACRO,
+    SEM_KEYWORD,
+    SEM_COMMENT,
+    SEM_STRING,
+    SEM_NUMBER,
+    SEM_NUM_TYPES
+};
+
+enum
+{
+    SEM_DECLARATION = 1 << 0,
+    SEM_DEFINITION = 1 << 1,
+    SEM_READONLY = 1 << 2,
+    SEM_STATIC = 1 << 3,
+    SEM_DEPRECATED = 1 << 4,
+    SEM_ABSTRACT = 1 << 5,
+    SEM_DEFAULT_LIBRARY = 1 << 6,
+    SEM_NUM_MODIFIERS = 7
+};
+
+static const char *sem_type_names[SEM_NUM_TYPES] = {
+    "namespace", "type",     "class",    "enum",   "interface", "struct",  "typeParameter", "parameter", "variable",
+    "property",  "enumMember", "function", "method", "macro",   "keyword", "comment",       "string",    "number"};
+
+static const char *sem_modifier_names[SEM_NUM_MODIFIERS] = {
+    "declaration", "definition", "readonly", "static", "deprecated", "abstract", "defaultLibrary"};
+
+// Five integers per token, relative to the previous one, as sent in the `data` of a SemanticTokens response
+typedef struct
+{
+    uint32_t count;
+    uint32_t *data;
+} rb_semantic_tokens;
+
+// The position encodings of the LSP, in which columns and lengths are counted in bytes, UTF-16 code units or code points
+enum
+{
+    SEM_UTF8,
+    SEM_UTF16,
+    SEM_UTF32
+};
+
+typedef struct
+{
+    CXTranslationUnit unit;
+    CXToken *tokens;
+    unsigned int count;
+    int encoding;
+    CXCursor *cursors;
+    uint32_t *data;
+    uint32_t emitted;
+    CXFile file;
+    const char *contents;
+    size_t size;
+} semantic_pass;
+
+static void semantic_free(void *data)
+{
+    rb_semantic_tokens *sem = data;
+    free(sem->data);
+    xfree(sem);
+}
+
+static size_t semantic_memsize(const void *data)
+{
+    const rb_semantic_tokens *sem = data;
+    return sizeof(rb_semantic_tokens) + sizeof(uint32_t) * 5 * sem->count;
+}
+
+static const rb_data_type_t semantic_type = {
+    "Clang::SemanticTokens",
+    {NULL, semantic_free, semantic_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static int semantic_decl_type(CXCursor decl)
+{
+    switch (decl.kind)
+    {
+        case CXCursor_Namespace:
+        case CXCursor_NamespaceAlias:
+            return SEM_NAMESPACE;
+        case CXCursor_ClassDecl:
+        case CXCursor_ClassTemplate:
+        case CXCursor_ClassTemplatePartialSpecialization:
+        case CXCursor_ObjCInterfaceDecl:
+        case CXCursor_ObjCCategoryDecl:
+        case CXCursor_Constructor:
+        case CXCursor_Destructor:
+            return SEM_CLASS;
+        case CXCursor_StructDecl:
+        case CXCursor_UnionDecl:
+            return SEM_STRUCT;
+        case CXCursor_EnumDecl:
+            return SEM_ENUM;
+        case CXCursor_ObjCProtocolDecl:
+            return SEM_INTERFACE;
+        case CXCursor_TypedefDecl:
+        case CXCursor_TypeAliasDecl:
+        case CXCursor_TypeAliasTemplateDecl:
+            return SEM_TYPE;
+        case CXCursor_TemplateTypeParameter:
+        case CXCursor_NonTypeTemplateParameter:
+        case CXCursor_TemplateTemplateParameter:
+            return SEM_TYPE_PARAMETER;
+        case CXCursor_ParmDecl:
+            return SEM_PARAMETER;
+        case CXCursor_VarDecl:
+            return SEM_VARIABLE;
+        case CXCursor_FieldDecl:
+        case CXCursor_ObjCIvarDecl:
+        case CXCursor_ObjCPropertyDecl:
+            return SEM_PROPERTY;
+        case CXCursor_EnumConstantDecl:
+            return SEM_ENUM_MEMBER;
+        case CXCursor_FunctionDecl:
+        case CXCursor_FunctionTemplate:
+            return SEM_FUNCTION;
+        case CXCursor_CXXMethod:
+        case CXCursor_ConversionFunction:
+        case CXCursor_ObjCInstanceMethodDecl:
+        case CXCursor_ObjCClassMethodDecl:
+            return SEM_METHOD;
+        case CXCursor_MacroDefinition:
+            return SEM_MACRO;
+        default:
+            return SEM_NONE;
+    }
+}
+
+static unsigned int semantic_modifiers(CXCursor cursor, CXCursor decl, CXSourceLocation location, int type)
+{
+    unsigned int mods = 0;
+    if (clang_equalCursors(cursor, decl) && clang_equalLocations(clang_getCursorLocation(decl), location))
+    {
+        mods |= SEM_DECLARATION;
+        if (clang_isCursorDefinition(decl))
+            mods |= SEM_DEFINITION;
+    }
+
+    if (type == SEM_ENUM_MEMBER)
+        mods |= SEM_READONLY;
+    else if ((type == SEM_VARIABLE || type == SEM_PROPERTY || type == SEM_PARAMETER) &&
+             clang_isConstQualifiedType(clang_getCursorType(decl)))
+        mods |= SEM_READONLY;
+
+    if ((decl.kind == CXCursor_CXXMethod && clang_CXXMethod_isStatic(decl)) ||
+        (decl.kind == CXCursor_VarDecl && clang_Cursor_getStorageClass(decl) == CX_SC_Static))
+        mods |= SEM_STATIC;
+
+    if ((decl.kind == CXCursor_CXXMethod && clang_CXXMethod_isPureVirtual(decl)) ||
+        ((decl.kind == CXCursor_ClassDecl || decl.kind == CXCursor_StructDecl) && clang_CXXRecord_isAbstract(decl)))
+        mods |= SEM_ABSTRACT;
+
+    if (clang_getCursorAvailability(decl) == CXAvailability_Deprecated)
+        mods |= SEM_DEPRECATED;
+    if (clang_Location_isInSystemHeader(clang_getCursorLocation(decl)))
+        mods |= SEM_DEFAULT_LIBRARY;
+    return mods;
+}
+
+static int semantic_literal_type(CXTranslationUnit unit, CXToken token, CXCursor cursor)
+{
+    switch (cursor.kind)
+    {
+        case CXCursor_IntegerLiteral:
+        case CXCursor_FloatingLiteral:
+        case CXCursor_ImaginaryLiteral:
+            return SEM_NUMBER;
+        case CXCursor_StringLiteral:
+        case CXCursor_CharacterLiteral:
+        case CXCursor_ObjCStringLiteral:
+            return SEM_STRING;
+        default:
+            break;
+    }
+
+    // Literals outside of an expression, such as in a directive, are told apart by their spelling
+    CXString spelling = clang_getTokenSpelling(unit, token);
+    const char *str = clang_getCString(spelling);
+    int type = str && (str[0] == '.' || (str[0] >= '0' && str[0] <= '9')) ? SEM_NUMBER : SEM_STRING;
+    clang_disposeString(spelling);
+    return type;
+}
+
+static int semantic_classify(semantic_pass *pass, unsigned int i, unsigned int *mods)
+{
+    CXToken token = pass->tokens[i];
+    CXCursor cursor = pass->cursors[i];
+    *mods = 0;
+
+    switch (clang_getTokenKind(token))
+    {
+        case CXToken_Keyword:
+            return SEM_KEYWORD;
+        case CXToken_Comment:
+            return SEM_COMMENT;
+        case CXToken_Literal:
+            return semantic_literal_type(pass->unit, token, cursor);
+        case CXToken_Identifier:
+            break;
+        default:
+            return SEM_NONE;
+    }
+
+    // References are classified by what they refer to, declarations by themselves
+    CXCursor decl = cursor;
+    if (cursor.kind == CXCursor_MacroExpansion || clang_isReference(cursor.kind) || clang_isExpression(cursor.kind))
+        decl = clang_getCursorReferenced(cursor);
+    if (clang_Cursor_isNull(decl))
+        return SEM_NONE;
+
+    int type = semantic_decl_type(decl);
+    if (type != SEM_NONE)
+        *mods = semantic_modifiers(cursor, decl, clang_getTokenLocation(pass->unit, token), type);
+    return type;
+}
+
+// Counts the code units of UTF-8 text in the given encoding, where a sequence of four bytes is a surrogate pair in
+// UTF-16, and invalid bytes count as one unit each
+static uint32_t semantic_units(const char *text, size_t len, int encoding)
+{
+    if (encoding == SEM_UTF8)
+        return (uint32_t) len;
+
+    uint32_t units = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char) text[i];
+        if ((c & 0xC0) != 0x80)
+            units += (encoding == SEM_UTF16 && c >= 0xF0) ? 2 : 1;
+    }
+    return units;
+}
+
+// Converts the byte column and length of a token, using the contents of its file, which are looked up once per file
+static void semantic_encode(semantic_pass *pass, CXFile file, unsigned int start, unsigned int end, unsigned int *column,
+                            unsigned int *length)
+{
+    if (pass->encoding == SEM_UTF8)
+        return;
+
+    if (!pass->file || !clang_File_isEqual(file, pass->file))
+    {
+        pass->file = file;
+        pass->contents = clang_getFileContents(pass->unit, file, &pass->size);
+    }
+    if (!pass->contents || end > pass->size || *column > start)
+        return;
+
+    *length = semantic_units(pass->contents + start, end - start, pass->encoding);
+    *column = semantic_units(pass->contents + start - *column, *column, pass->encoding);
+}
+
+static void *semantic_pass_nogvl(void *data)
+{
+    semantic_pass *pass = data;
+    clang_annotateTokens(pass->unit, pass->tokens, pass->count, pass->cursors);
+
+    unsigned int prev_line = 0, prev_column = 0;
+    uint32_t *out = pass->data;
+    for (unsigned int i = 0; i < pass->count; i++)
+    {
+        unsigned int mods;
+        int type = semantic_classify(pass, i, &mods);
+        if (type == SEM_NONE)
+            continue;
+
+        CXSourceRange extent = clang_getTokenExtent(pass->unit, pass->tokens[i]);
+        CXFile file;
+        unsigned int line, column, start, end_line, end, length;
+        clang_getFileLocation(clang_getRangeStart(extent), &file, &line, &column, &start);
+        clang_getFileLocation(clang_getRangeEnd(extent), NULL, &end_line, NULL, &end);
+
+        // Tokens spanning lines, such as block comments, cannot be encoded without multiline token support
+        if (line != end_line || end <= start || line == 0 || column == 0)
+            continue;
+
+        line--;
+        column--;
+        length = end - start;
+        semantic_encode(pass, file, start, end, &column, &length);
+        *out++ = line - prev_line;
+        *out++ = line == prev_line ? column - prev_column : column;
+        *out++ = length;
+        *out++ = (uint32_t) type;
+        *out++ = mods;
+        prev_line = line;
+        prev_column = column;
+        pass->emitted++;
+    }
+    return NULL;
+}
+
+static rb_semantic_tokens *semantic_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &semantic_type);
+}
+
+static int semantic_encoding(VALUE kwargs)
+{
+    ID keys[1] = {rb_intern("encoding")};
+    VALUE encoding;
+    rb_get_kwargs(kwargs, keys, 0, 1, &encoding);
+    if (encoding == Qundef || encoding == STR2SYM("utf16"))
+        return SEM_UTF16;
+    if (encoding == STR2SYM("utf8"))
+        return SEM_UTF8;
+    if (encoding == STR2SYM("utf32"))
+        return SEM_UTF32;
+    rb_raise(rb_eArgError, "unknown position encoding %" PRIsVALUE, rb_inspect(encoding));
+}
+
+static VALUE tokenset_semantic_tokens(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+    int encoding = semantic_encoding(kwargs);
+
+    rb_tokenset *set = DATA_PTR(self);
+    semantic_pass pass = {rb_tu_unit(set->unit), set->tokens, set->count, encoding};
+
+    rb_semantic_tokens *sem;
+    VALUE obj = TypedData_Make_Struct(rb_cCXSemanticTokens, rb_semantic_tokens, &semantic_type, sem);
+
+    // The results are owned by the object and the cursors by the GC from the start, so neither leaks should the pass raise
+    if (!(sem->data = pass.data = malloc(sizeof(uint32_t) * 5 * (set->count ? set->count : 1))))
+        rb_memerror();
+    VALUE buffer;
+    pass.cursors = ALLOCV_N(CXCursor, buffer, set->count ? set->count : 1);
+
+    // Annotating is the bulk of the work and touches nothing but the unit, so the whole pass runs without the GVL
+    rb_tu_without_gvl(set->unit, semantic_pass_nogvl, &pass, NULL, NULL);
+    RB_GC_GUARD(self);
+    ALLOCV_END(buffer);
+
+    sem->count = pass.emitted;
+    return obj;
+}
+
+static VALUE semantic_size(VALUE self)
+{
+    return UINT2NUM(semantic_ptr(self)->count);
+}
+
+static VALUE semantic_data_ary(const uint32_t *data, long len)
+{
+    VALUE ary = rb_ary_new_capa(len);
+    for (long i = 0; i < len; i++)
+        rb_ary_store(ary, i, UINT2NUM(data[i]));
+    return ary;
+}
+
+static VALUE semantic_data(VALUE self)
+{
+    rb_semantic_tokens *sem = semantic_ptr(self);
+    return semantic_data_ary(sem->data, 5L * sem->count);
+}
+
+static VALUE semantic_pack(VALUE self)
+{
+    rb_semantic_tokens *sem = semantic_ptr(self);
+    return rb_str_new((const char *) sem->data, sizeof(uint32_t) * 5 * sem->count);
+}
+
+static VALUE semantic_edits(VALUE self, VALUE previous)
+{
+    rb_semantic_tokens *sem = semantic_ptr(self);
+    rb_semantic_tokens *prev = semantic_ptr(previous);
+    long len = 5L * sem->count, prev_len = 5L * prev->count;
+
+    // A single edit replacing whatever lies between the common prefix and suffix, compared token by token
+    long head = 0;
+    while (head < len && head < prev_len && memcmp(&sem->data[head], &prev->data[head], sizeof(uint32_t) * 5) == 0)
+        head += 5;
+
+    long tail = 0;
+    while (tail < len - head && tail < prev_len - head &&
+           memcmp(&sem->data[len - tail - 5], &prev->data[prev_len - tail - 5], sizeof(uint32_t) * 5) == 0)
+        tail += 5;
+
+    VALUE edits = rb_ary_new();
+    if (head + tail == len && head + tail == prev_len)
+        return edits;
+
+    VALUE edit = rb_hash_new();
+    rb_hash_aset(edit, STR2SYM("start"), LONG2NUM(head));
+    rb_hash_aset(edit, STR2SYM("deleteCount"), LONG2NUM(prev_len - head - tail));
+    rb_hash_aset(edit, STR2SYM("data"), semantic_data_ary(&sem->data[head], len - head - tail));
+    rb_ary_push(edits, edit);
+    return edits;
+}
+
+static VALUE semantic_legend(const char **names, int count)
+{
+    VALUE ary = rb_ary_new_capa(count);
+    for (int i = 0; i < count; i++)
+        rb_ary_store(ary, i, rb_obj_freeze(rb_str_new_cstr(names[i])));
+    return rb_obj_freeze(ary);
+}
+
+void Init_clang_semantic_tokens(void)
+{
+    rb_define_methodm1(rb_cCXTokenSet, "semantic_tokens", tokenset_semantic_tokens, -1);
+
+    rb_undef_alloc_func(rb_cCXSemanticTokens);
+    rb_define_const(rb_cCXSemanticTokens, "TOKEN_TYPES", semantic_legend(sem_type_names, SEM_NUM_TYPES));
+    rb_define_const(rb_cCXSemanticTokens, "TOKEN_MODIFIERS", semantic_legend(sem_modifier_names, SEM_NUM_MODIFIERS));
+    rb_define_method0(rb_cCXSemanticTokens, "size", semantic_size, 0);
+    rb_define_method0(rb_cCXSemanticTokens, "data", semantic_data, 0);
+    rb_define_method0(rb_cCXSemanticTokens, "pack", semantic_pack, 0);
+    rb_define_method1(rb_cCXSemanticTokens, "edits", semantic_edits, 1);
+    rb_define_alias(rb_cCXSemanticTokens, "length", "size");
+}
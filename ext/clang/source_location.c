@@ -4,12 +4,11 @@ ID id_presumed;
 ID id_expanded;
 ID id_spelling;
 ID id_file;
+ID id_expansion;
 
 static VALUE location_null(VALUE klass)
 {
-    CXSourceLocation *loc = ALLOC(CXSourceLocation);
-    *loc = clang_getNullLocation();
-    return Data_Wrap_Struct(klass, NULL, RUBY_DEFAULT_FREE, loc);
+    return rb_location_wrap(klass, clang_getNullLocation(), Qnil);
 }
 
 static VALUE location_equals(VALUE self, VALUE other)
@@ -17,7 +16,7 @@ static VALUE location_equals(VALUE self, VALUE other)
     if (CLASS_OF(self) != CLASS_OF(other))
         return Qfalse;
 
-    CXSourceLocation *loc1 = DATA_PTR(self), *loc2 = DATA_PTR(other);
+    CXSourceLocation *loc1 = &rb_location_record(self)->value, *loc2 = &rb_location_record(other)->value;
     return RB_BOOL(clang_equalLocations(*loc1, *loc2));
 }
 
@@ -26,14 +25,11 @@ static VALUE location_initialize(int argc, VALUE *argv, VALUE self)
     VALUE tu, file, line, column;
     rb_scan_args(argc, argv, "31", &tu, &file, &line, &column);
 
-    if (!rb_obj_is_kind_of(tu, rb_cCXTranslationUnit) != Qtrue)
-        rb_raise(rb_eTypeError, "");
-
     rb_assert_type(tu, rb_cCXTranslationUnit);
     rb_assert_type(file, rb_cCXFile);
 
-    CXTranslationUnit unit = DATA_PTR(tu);
-    CXFile f = DATA_PTR(file);
+    CXTranslationUnit unit = rb_tu_unit(tu);
+    CXFile f = *rb_file_ptr(file);
 
     CXSourceLocation location;
     // Offset
@@ -47,156 +43,155 @@ static VALUE location_initialize(int argc, VALUE *argv, VALUE self)
         location = clang_getLocation(unit, f, NUM2UINT(line), NUM2UINT(column));
     }
 
-    memcpy(DATA_PTR(self), &location, sizeof(CXSourceLocation));
+    rb_location *loc = rb_location_record(self);
+    loc->value = location;
+    loc->unit = tu;
+    loc->decoded = Qnil;
     return self;
 }
 
 static VALUE location_is_system(VALUE self)
 {
-    CXSourceLocation *loc = DATA_PTR(self);
+    CXSourceLocation *loc = rb_location_ptr(self);
     return RB_BOOL(clang_Location_isInSystemHeader(*loc));
 }
 
 static VALUE location_is_main_file(VALUE self)
 {
-    CXSourceLocation *loc = DATA_PTR(self);
+    CXSourceLocation *loc = rb_location_ptr(self);
     return RB_BOOL(clang_Location_isFromMainFile(*loc));
 }
 
-static VALUE location_file(int argc, VALUE *argv, VALUE self)
+enum
 {
-    VALUE type;
-    rb_scan_args(argc, argv, "01", &type);
-    CXSourceLocation *loc = DATA_PTR(self);
+    LOCATION_FILE,
+    LOCATION_EXPANDED,
+    LOCATION_SPELLING,
+    LOCATION_PRESUMED,
+    LOCATION_KINDS
+};
+
+static int location_kind(VALUE type)
+{
+    ID id = SYMBOL_P(type) ? SYM2ID(type) : id_file;
+    if (id == id_file)
+        return LOCATION_FILE;
+    if (id == id_expanded || id == id_expansion)
+        return LOCATION_EXPANDED;
+    if (id == id_spelling)
+        return LOCATION_SPELLING;
+    if (id == id_presumed)
+        return LOCATION_PRESUMED;
+
+    rb_raise(rb_eArgError, "invalid type argument specified");
+    return -1;
+}
+
+// Every component of a location is retrieved with a single call, and the result is kept for the lifetime of the
+// location, as it can never change
+static VALUE location_decode_kind(VALUE self, int kind)
+{
+    rb_location *loc = rb_location_record(self);
+    rb_tu_check(loc->unit);
+
+    if (!RTEST(loc->decoded))
+        loc->decoded = rb_ary_new_capa(LOCATION_KINDS);
+    VALUE decoded = rb_ary_entry(loc->decoded, kind);
+    if (!NIL_P(decoded))
+        return decoded;
 
     CXFile file;
-    ID id = SYMBOL_P(type) ? SYM2ID(type) : id_file;
+    unsigned int line, column, offset;
+    VALUE name, path, off;
 
-    if (id == id_file)
-    {
-        clang_getFileLocation(*loc, &file, NULL, NULL, NULL);
-    }
-    else if (id == id_expanded)
-    {
-        clang_getExpansionLocation(*loc, &file, NULL, NULL, NULL);
-    }
-    else if (id == id_presumed)
+    // A presumed location is only known by the name a #line directive gave it, so it has a path but no file
+    if (kind == LOCATION_PRESUMED)
     {
         CXString str;
-        clang_getPresumedLocation(*loc, &str, NULL, NULL);
-        return RUBYSTR(str);
-    }
-    else if (id == id_spelling)
-    {
-        clang_getSpellingLocation(*loc, &file, NULL, NULL, NULL);
+        clang_getPresumedLocation(loc->value, &str, &line, &column);
+        name = Qnil;
+        path = rb_str_freeze(RUBYSTR(str));
+        off = Qnil;
     }
-    else 
+    else
     {
-        rb_raise(rb_eArgError, "invalid type argument specified");
-    }
-    
-    return Data_Wrap_Struct(rb_cCXFile, NULL, RUBY_NEVER_FREE, file);
+        if (kind == LOCATION_FILE)
+            clang_getFileLocation(loc->value, &file, &line, &column, &offset);
+        else if (kind == LOCATION_EXPANDED)
+            clang_getExpansionLocation(loc->value, &file, &line, &column, &offset);
+        else
+            clang_getSpellingLocation(loc->value, &file, &line, &column, &offset);
+        name = file ? rb_file_wrap(rb_cCXFile, file, loc->unit) : Qnil;
+        path = file ? rb_str_freeze(RUBYSTR(clang_getFileName(file))) : Qnil;
+        off = UINT2NUM(offset);
+    }
+
+    decoded = rb_struct_new(rb_cCXDecodedLocation, name, UINT2NUM(line), UINT2NUM(column), off, path);
+    rb_obj_freeze(decoded);
+    rb_ary_store(loc->decoded, kind, decoded);
+    return decoded;
 }
 
-static VALUE location_line(int argc, VALUE *argv, VALUE self)
+static VALUE location_decode(int argc, VALUE *argv, VALUE self)
 {
     VALUE type;
     rb_scan_args(argc, argv, "01", &type);
-    CXSourceLocation *loc = DATA_PTR(self);
-    unsigned int value;
+    return location_decode_kind(self, location_kind(type));
+}
 
-    ID id = SYMBOL_P(type) ? SYM2ID(type) : id_file;
-    if (id == id_file)
-    {
-        clang_getFileLocation(*loc, NULL, &value, NULL, NULL);
-    }
-    else if (id == id_expanded)
-    {
-        clang_getExpansionLocation(*loc, NULL, &value, NULL, NULL);
-    }
-    else if (id == id_presumed)
-    {
-        clang_getPresumedLocation(*loc, NULL, &value, NULL);
-    }
-    else if (id == id_spelling)
-    {
-        clang_getSpellingLocation(*loc, NULL, &value, NULL, NULL);
-    }
-    else 
+static VALUE location_decode_all(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE locations, type;
+    rb_scan_args(argc, argv, "11", &locations, &type);
+    Check_Type(locations, T_ARRAY);
+    int kind = location_kind(type);
+
+    long count = RARRAY_LEN(locations);
+    VALUE ary = rb_ary_new_capa(count);
+    for (long i = 0; i < count; i++)
     {
-        rb_raise(rb_eArgError, "invalid type argument specified");
+        VALUE location = RARRAY_AREF(locations, i);
+        rb_assert_type(location, rb_cCXSourceLocation);
+        rb_ary_store(ary, i, location_decode_kind(location, kind));
     }
-
-    return UINT2NUM(value);
+    return ary;
 }
 
-static VALUE location_column(int argc, VALUE *argv, VALUE self)
+static VALUE location_file(int argc, VALUE *argv, VALUE self)
 {
-    VALUE type;
-    rb_scan_args(argc, argv, "01", &type);
-    CXSourceLocation *loc = DATA_PTR(self);
-    unsigned int value;
+    VALUE type = argc > 0 ? argv[0] : Qnil;
+    VALUE decoded = location_decode(argc, argv, self);
+    return RSTRUCT_GET(decoded, location_kind(type) == LOCATION_PRESUMED ? 4 : 0);
+}
 
-    ID id = SYMBOL_P(type) ? SYM2ID(type) : id_file;
-    if (id == id_file)
-    {
-        clang_getFileLocation(*loc, NULL, NULL, &value, NULL);
-    }
-    else if (id == id_expanded)
-    {
-        clang_getExpansionLocation(*loc, NULL, NULL, &value, NULL);
-    }
-    else if (id == id_presumed)
-    {
-        clang_getPresumedLocation(*loc, NULL, NULL, &value);
-    }
-    else if (id == id_spelling)
-    {
-        clang_getSpellingLocation(*loc, NULL, NULL, &value, NULL);
-    }
-    else 
-    {
-        rb_raise(rb_eArgError, "invalid type argument specified");
-    }
+static VALUE location_line(int argc, VALUE *argv, VALUE self)
+{
+    return RSTRUCT_GET(location_decode(argc, argv, self), 1);
+}
 
-    return UINT2NUM(value);
+static VALUE location_column(int argc, VALUE *argv, VALUE self)
+{
+    return RSTRUCT_GET(location_decode(argc, argv, self), 2);
 }
 
 static VALUE location_offset(int argc, VALUE *argv, VALUE self)
 {
-    VALUE type;
-    rb_scan_args(argc, argv, "01", &type);
-    CXSourceLocation *loc = DATA_PTR(self);
-    unsigned int value;
-
-    ID id = SYMBOL_P(type) ? SYM2ID(type) : id_file;
-    if (id == id_file)
-    {
-        clang_getFileLocation(*loc, NULL, NULL, NULL, &value);
-    }
-    else if (id == id_expanded)
-    {
-        clang_getExpansionLocation(*loc, NULL, NULL, NULL, &value);
-    }
-    else if (id == id_spelling)
-    {
-        clang_getSpellingLocation(*loc, NULL, NULL, NULL, &value);
-    }
-    else 
-    {
+    VALUE offset = RSTRUCT_GET(location_decode(argc, argv, self), 3);
+    if (NIL_P(offset))
         rb_raise(rb_eArgError, "invalid type argument specified");
-    }
-    return UINT2NUM(value);
+    return offset;
 }
 
 void Init_clang_source_location(void)
 {
     rb_define_singleton_method0(rb_cCXSourceLocation, "null", location_null, 0);
+    rb_define_singleton_methodm1(rb_cCXSourceLocation, "decode", location_decode_all, -1);
 
     rb_define_methodm1(rb_cCXSourceLocation, "initialize", location_initialize, -1);
     rb_define_method0(rb_cCXSourceLocation, "system_header?", location_is_system, 0);
     rb_define_method0(rb_cCXSourceLocation, "main_file?", location_is_main_file, 0);
 
+    rb_define_methodm1(rb_cCXSourceLocation, "decode", location_decode, -1);
     rb_define_methodm1(rb_cCXSourceLocation, "file", location_file, -1);
     rb_define_methodm1(rb_cCXSourceLocation, "line", location_line, -1);
     rb_define_methodm1(rb_cCXSourceLocation, "column", location_column, -1);
@@ -208,5 +203,9 @@ void Init_clang_source_location(void)
     id_spelling = rb_intern("spelling");
     id_expanded = rb_intern("expanded");
     id_presumed = rb_intern("presumed");
+    id_expansion = rb_intern("expansion");
     id_file = rb_intern("file");
+
+    rb_cCXDecodedLocation =
+        rb_struct_define_under(rb_cCXSourceLocation, "Decoded", "file", "line", "column", "offset", "path", NULL);
 }
\ No newline at end of file
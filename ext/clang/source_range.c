@@ -2,14 +2,12 @@
 
 static VALUE range_null(VALUE klass)
 {
-    CXSourceRange *range = ALLOC(CXSourceRange);
-    *range = clang_getNullRange();
-    return Data_Wrap_Struct(klass, NULL, RUBY_DEFAULT_FREE, range);
+    return rb_range_wrap(klass, clang_getNullRange(), Qnil);
 }
 
 static VALUE range_is_null(VALUE self)
 {
-    CXSourceRange *range = DATA_PTR(self);
+    CXSourceRange *range = rb_range_ptr(self);
     return RB_BOOL(clang_Range_isNull(*range));
 }
 
@@ -18,7 +16,7 @@ static VALUE range_equal(VALUE self, VALUE other)
     if (CLASS_OF(self) != CLASS_OF(other))
         return Qfalse;
 
-    CXSourceRange *range1 = DATA_PTR(self), *range2 = DATA_PTR(other);
+    CXSourceRange *range1 = &rb_range_record(self)->value, *range2 = &rb_range_record(other)->value;
     return RB_BOOL(clang_equalRanges(*range1, *range2));
 }
 
@@ -27,28 +25,23 @@ static VALUE range_initialize(VALUE self, VALUE start, VALUE end)
     rb_assert_type(start, rb_cCXSourceLocation);
     rb_assert_type(end, rb_cCXSourceLocation);
 
-    CXSourceLocation *loc1 = DATA_PTR(start), *loc2 = DATA_PTR(end);
-    CXSourceRange range = clang_getRange(*loc1, *loc2);
-    memcpy(DATA_PTR(self), &range, sizeof(CXSourceRange));
+    CXSourceLocation *loc1 = rb_location_ptr(start), *loc2 = rb_location_ptr(end);
+    rb_range *range = rb_range_record(self);
+    range->value = clang_getRange(*loc1, *loc2);
+    range->unit = rb_location_unit(start);
     return self;
 }   
 
 static VALUE range_begin(VALUE self)
 {
-    CXSourceLocation *loc = ALLOC(CXSourceLocation);
-    CXSourceRange *range = DATA_PTR(self);
-
-    *loc = clang_getRangeStart(*range);
-    return Data_Wrap_Struct(rb_cCXSourceLocation, NULL, RUBY_DEFAULT_FREE, loc);
+    CXSourceRange *range = rb_range_ptr(self);
+    return rb_location_wrap(rb_cCXSourceLocation, clang_getRangeStart(*range), rb_range_unit(self));
 }
 
 static VALUE range_end(VALUE self)
 {
-    CXSourceLocation *loc = ALLOC(CXSourceLocation);
-    CXSourceRange *range = DATA_PTR(self);
-
-    *loc = clang_getRangeEnd(*range);
-    return Data_Wrap_Struct(rb_cCXSourceLocation, NULL, RUBY_DEFAULT_FREE, loc);
+    CXSourceRange *range = rb_range_ptr(self);
+    return rb_location_wrap(rb_cCXSourceLocation, clang_getRangeEnd(*range), rb_range_unit(self));
 }
 
 void Init_clang_source_range(void)
@@ -0,0 +1,103 @@
+#include "clang.h"
+#include "uthash.h"
+
+// Entries are allocated with malloc rather than the Ruby allocator, so strings may be interned without the GVL
+struct rb_strtab_entry
+{
+    unsigned int id;
+    size_t len;
+    UT_hash_handle hh;
+    char str[];
+};
+
+int rb_strtab_init(rb_strtab *tab)
+{
+    unsigned int id;
+    memset(tab, 0, sizeof(rb_strtab));
+    return rb_strtab_intern(tab, "", 0, &id);
+}
+
+void rb_strtab_free(rb_strtab *tab)
+{
+    rb_strtab_entry *e, *temp;
+    HASH_ITER(hh, tab->head, e, temp)
+    {
+        HASH_DEL(tab->head, e);
+        free(e);
+    }
+    free(tab->entries);
+    memset(tab, 0, sizeof(rb_strtab));
+}
+
+int rb_strtab_find(rb_strtab *tab, const char *str, size_t len, unsigned int *id)
+{
+    rb_strtab_entry *e;
+    HASH_FIND(hh, tab->head, str, len, e);
+    if (!e)
+        return 0;
+    *id = e->id;
+    return 1;
+}
+
+int rb_strtab_intern(rb_strtab *tab, const char *str, size_t len, unsigned int *id)
+{
+    if (rb_strtab_find(tab, str, len, id))
+        return 1;
+
+    if (tab->count == tab->capa)
+    {
+        unsigned int capa = tab->capa ? tab->capa * 2 : 256;
+        rb_strtab_entry **entries = realloc(tab->entries, sizeof(rb_strtab_entry *) * capa);
+        if (!entries)
+            return 0;
+        tab->entries = entries;
+        tab->capa = capa;
+    }
+
+    rb_strtab_entry *e = malloc(sizeof(rb_strtab_entry) + len + 1);
+    if (!e)
+        return 0;
+    e->id = tab->count;
+    e->len = len;
+    memcpy(e->str, str, len);
+    e->str[len] = '\0';
+
+    HASH_ADD_KEYPTR(hh, tab->head, e->str, len, e);
+    tab->entries[tab->count++] = e;
+    *id = e->id;
+    return 1;
+}
+
+const char *rb_strtab_get(const rb_strtab *tab, unsigned int id, size_t *len)
+{
+    if (id >= tab->count)
+        return NULL;
+    if (len)
+        *len = tab->entries[id]->len;
+    return tab->entries[id]->str;
+}
+
+size_t rb_strtab_memsize(const rb_strtab *tab)
+{
+    size_t size = sizeof(rb_strtab_entry *) * tab->capa;
+    for (unsigned int i = 0; i < tab->count; i++)
+        size += sizeof(rb_strtab_entry) + tab->entries[i]->len + 1;
+    return size + HASH_OVERHEAD(hh, tab->head);
+}
+
+VALUE rb_strtab_str(const rb_strtab *tab, unsigned int id)
+{
+    size_t len;
+    const char *str = rb_strtab_get(tab, id, &len);
+    if (!str)
+        return Qnil;
+    return rb_obj_freeze(rb_utf8_str_new(str, len));
+}
+
+VALUE rb_strtab_ary(const rb_strtab *tab)
+{
+    VALUE ary = rb_ary_new_capa(tab->count);
+    for (unsigned int i = 0; i < tab->count; i++)
+        rb_ary_store(ary, i, rb_strtab_str(tab, i));
+    return ary;
+}
@@ -0,0 +1,1152 @@
+#include "clang.h"
+#include "uthash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ruby/thread.h>
+
+#define SYMIDX_NONE UINT32_MAX
+#define SYMIDX_MAGIC "CXSYMIDX"
+#define SYMIDX_VERSION 1
+
+enum
+{
+    SYMIDX_DECLARATION,
+    SYMIDX_DEFINITION,
+    SYMIDX_REFERENCE
+};
+
+// On-disk layout: the header, then the files sorted by path, the symbols sorted by USR, the records of each symbol
+// in turn, and finally the NUL-terminated strings that the other sections refer to by byte offset.
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t string_size;
+    uint32_t num_files;
+    uint32_t num_symbols;
+    uint32_t num_records;
+    uint32_t reserved;
+} symidx_header;
+
+typedef struct
+{
+    uint32_t path;
+    uint32_t reserved;
+    int64_t mtime;
+} symidx_file;
+
+typedef struct
+{
+    uint32_t usr;
+    uint32_t first;
+    uint32_t count;
+} symidx_symbol;
+
+typedef struct
+{
+    uint32_t file;
+    uint32_t offset;
+    uint32_t line;
+    uint32_t column;
+    uint32_t kind;
+} symidx_record;
+
+// The saved index, mapped read-only, where files that have since been reindexed or removed are marked dead
+typedef struct
+{
+    void *base;
+    size_t size;
+    const symidx_header *header;
+    const symidx_file *files;
+    const symidx_symbol *symbols;
+    const symidx_record *records;
+    const char *strings;
+    uint8_t *dead;
+} symidx_map;
+
+typedef struct
+{
+    uint32_t path;
+    int live;
+    int64_t mtime;
+} overlay_file;
+
+typedef struct
+{
+    uint32_t usr;
+    uint32_t file;
+    uint32_t offset;
+    uint32_t line;
+    uint32_t column;
+    uint32_t kind;
+    uint32_t next;
+} overlay_record;
+
+// Files indexed since the map was last saved, which take precedence over the map, with records chained by USR
+typedef struct
+{
+    rb_strtab strings;
+    overlay_file *files;
+    uint32_t num_files;
+    uint32_t capa_files;
+    uint32_t *file_of;
+    uint32_t file_of_capa;
+    overlay_record *records;
+    uint32_t num_records;
+    uint32_t capa_records;
+    uint32_t *usr_first;
+    uint32_t *usr_last;
+    uint32_t usr_capa;
+} symidx_overlay;
+
+typedef struct
+{
+    VALUE path;
+    int busy;
+    symidx_map map;
+    symidx_overlay overlay;
+} rb_symbol_index;
+
+// State of a file during a single pass over a translation unit
+typedef struct
+{
+    CXFile file;
+    uint32_t path;
+    int64_t mtime;
+    int record;
+    UT_hash_handle hh;
+} pass_file;
+
+typedef struct
+{
+    uint32_t usr;
+    pass_file *file;
+    uint32_t offset;
+    uint32_t line;
+    uint32_t column;
+    uint32_t kind;
+} pass_record;
+
+typedef struct
+{
+    const rb_symbol_index *index;
+    CXTranslationUnit unit;
+    VALUE tu;
+    rb_strtab strings;
+    pass_file *files;
+    pass_file *last;
+    pass_record *records;
+    uint32_t num_records;
+    uint32_t capa_records;
+    int failed;
+    volatile int interrupted;
+} symidx_pass;
+
+static int symidx_reserve(void **ptr, uint32_t *capa, uint32_t count, size_t size)
+{
+    if (count < *capa)
+        return 1;
+
+    uint32_t n = *capa ? *capa * 2 : 256;
+    void *grown = realloc(*ptr, size * n);
+    if (!grown)
+        return 0;
+    *ptr = grown;
+    *capa = n;
+    return 1;
+}
+
+static int symidx_fill(uint32_t **ary, uint32_t *capa, uint32_t count)
+{
+    while (count >= *capa)
+    {
+        uint32_t old = *capa;
+        if (!symidx_reserve((void **) ary, capa, old, sizeof(uint32_t)))
+            return 0;
+        for (uint32_t i = old; i < *capa; i++)
+            (*ary)[i] = SYMIDX_NONE;
+    }
+    return 1;
+}
+
+static void map_release(symidx_map *map)
+{
+    if (map->base)
+        munmap(map->base, map->size);
+    free(map->dead);
+    memset(map, 0, sizeof(symidx_map));
+}
+
+static void overlay_release(symidx_overlay *overlay)
+{
+    rb_strtab_free(&overlay->strings);
+    free(overlay->files);
+    free(overlay->file_of);
+    free(overlay->records);
+    free(overlay->usr_first);
+    free(overlay->usr_last);
+    memset(overlay, 0, sizeof(symidx_overlay));
+}
+
+static void symidx_mark(void *data)
+{
+    rb_symbol_index *index = data;
+    rb_gc_mark(index->path);
+}
+
+static void symidx_free(void *data)
+{
+    rb_symbol_index *index = data;
+    map_release(&index->map);
+    overlay_release(&index->overlay);
+    xfree(index);
+}
+
+static size_t symidx_memsize(const void *data)
+{
+    const rb_symbol_index *index = data;
+    const symidx_overlay *o = &index->overlay;
+    size_t size = sizeof(rb_symbol_index) + rb_strtab_memsize(&o->strings);
+    size += sizeof(overlay_file) * o->capa_files + sizeof(overlay_record) * o->capa_records;
+    size += sizeof(uint32_t) * (o->file_of_capa + 2 * o->usr_capa);
+    return size + (index->map.header ? index->map.header->num_files : 0);
+}
+
+static const rb_data_type_t symidx_type = {
+    "Clang::SymbolIndex",
+    {symidx_mark, symidx_free, symidx_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_symbol_index *symidx_ptr(VALUE self, int modify)
+{
+    rb_symbol_index *index = rb_check_typeddata(self, &symidx_type);
+    if (modify && index->busy)
+        rb_raise(rb_eRuntimeError, "symbol index is being updated by another thread");
+    return index;
+}
+
+static void symidx_corrupt(const char *path)
+{
+    rb_raise(rb_eIOError, "%s is not a valid symbol index", path);
+}
+
+static void map_open(symidx_map *map, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        rb_sys_fail(path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        int e = errno;
+        close(fd);
+        rb_syserr_fail(e, path);
+    }
+
+    size_t size = (size_t) st.st_size;
+    void *base = size >= sizeof(symidx_header) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+        symidx_corrupt(path);
+
+    // Every section is bounds-checked once here, so queries can trust the offsets within them
+    const symidx_header *h = base;
+    size_t expected = sizeof(symidx_header) + sizeof(symidx_file) * (size_t) h->num_files +
+                      sizeof(symidx_symbol) * (size_t) h->num_symbols +
+                      sizeof(symidx_record) * (size_t) h->num_records + h->string_size;
+    if (memcmp(h->magic, SYMIDX_MAGIC, 8) != 0 || h->version != SYMIDX_VERSION || expected != size ||
+        (h->string_size && ((const char *) base)[size - 1] != '\0'))
+    {
+        munmap(base, size);
+        symidx_corrupt(path);
+    }
+
+    map->base = base;
+    map->size = size;
+    map->header = h;
+    map->files = (const symidx_file *) (h + 1);
+    map->symbols = (const symidx_symbol *) (map->files + h->num_files);
+    map->records = (const symidx_record *) (map->symbols + h->num_symbols);
+    map->strings = (const char *) (map->records + h->num_records);
+    for (uint32_t i = 0; i < h->num_symbols; i++)
+    {
+        if (map->symbols[i].first > h->num_records || map->symbols[i].count > h->num_records - map->symbols[i].first)
+        {
+            munmap(base, size);
+            memset(map, 0, sizeof(symidx_map));
+            symidx_corrupt(path);
+        }
+    }
+    for (uint32_t i = 0; i < h->num_records; i++)
+    {
+        if (map->records[i].file >= h->num_files)
+        {
+            munmap(base, size);
+            memset(map, 0, sizeof(symidx_map));
+            symidx_corrupt(path);
+        }
+    }
+
+    map->dead = calloc(h->num_files ? h->num_files : 1, 1);
+    if (!map->dead)
+    {
+        map_release(map);
+        rb_memerror();
+    }
+}
+
+static const char *map_str(const symidx_map *map, uint32_t offset)
+{
+    return offset < map->header->string_size ? map->strings + offset : "";
+}
+
+static uint32_t map_find_file(const symidx_map *map, const char *path)
+{
+    if (!map->header)
+        return SYMIDX_NONE;
+
+    uint32_t lo = 0, hi = map->header->num_files;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(map_str(map, map->files[mid].path), path);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return SYMIDX_NONE;
+}
+
+static const symidx_symbol *map_find_symbol(const symidx_map *map, const char *usr, size_t len)
+{
+    if (!map->header)
+        return NULL;
+
+    uint32_t lo = 0, hi = map->header->num_symbols;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char *str = map_str(map, map->symbols[mid].usr);
+        int cmp = strncmp(str, usr, len);
+        if (cmp == 0)
+            cmp = str[len] ? 1 : 0;
+        if (cmp == 0)
+            return &map->symbols[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static uint32_t overlay_find_file(const symidx_overlay *overlay, const char *path, size_t len)
+{
+    unsigned int id;
+    if (!rb_strtab_find((rb_strtab *) &overlay->strings, path, len, &id) || id >= overlay->file_of_capa)
+        return SYMIDX_NONE;
+    return overlay->file_of[id];
+}
+
+// Determines whether a file has to be indexed again, reading the index without modifying it
+static int symidx_needs_record(const rb_symbol_index *index, const char *path, int64_t mtime)
+{
+    uint32_t f = overlay_find_file(&index->overlay, path, strlen(path));
+    if (f != SYMIDX_NONE)
+        return !index->overlay.files[f].live || index->overlay.files[f].mtime != mtime;
+
+    f = map_find_file(&index->map, path);
+    return f == SYMIDX_NONE || index->map.dead[f] || index->map.files[f].mtime != mtime;
+}
+
+static int pass_intern(symidx_pass *pass, CXString str, uint32_t *id)
+{
+    const char *cstr = clang_getCString(str);
+    unsigned int value = 0;
+    int result = !cstr || rb_strtab_intern(&pass->strings, cstr, strlen(cstr), &value);
+    clang_disposeString(str);
+    *id = value;
+    if (!result)
+        pass->failed = 1;
+    return result;
+}
+
+static pass_file *pass_file_of(symidx_pass *pass, CXFile file)
+{
+    // Consecutive cursors are almost always in the same file, so the last lookup is reused
+    if (pass->last && pass->last->file == file)
+        return pass->last;
+
+    pass_file *f;
+    HASH_FIND_PTR(pass->files, &file, f);
+    if (!f)
+    {
+        if (!(f = calloc(1, sizeof(pass_file))))
+        {
+            pass->failed = 1;
+            return NULL;
+        }
+        f->file = file;
+        f->mtime = (int64_t) clang_getFileTime(file);
+        if (!pass_intern(pass, clang_getFileName(file), &f->path))
+        {
+            free(f);
+            return NULL;
+        }
+
+        size_t len;
+        const char *path = rb_strtab_get(&pass->strings, f->path, &len);
+        f->record = len && symidx_needs_record(pass->index, path, f->mtime);
+        HASH_ADD_PTR(pass->files, file, f);
+    }
+    return pass->last = f;
+}
+
+static void pass_add(symidx_pass *pass, CXCursor cursor, CXString usr, uint32_t kind)
+{
+    CXFile file;
+    unsigned int line, column, offset;
+    clang_getFileLocation(clang_getCursorLocation(cursor), &file, &line, &column, &offset);
+
+    pass_file *f = file ? pass_file_of(pass, file) : NULL;
+    if (!f || !f->record || !symidx_reserve((void **) &pass->records, &pass->capa_records, pass->num_records,
+                                            sizeof(pass_record)))
+    {
+        if (f && f->record)
+            pass->failed = 1;
+        clang_disposeString(usr);
+        return;
+    }
+
+    pass_record *record = &pass->records[pass->num_records];
+    if (!pass_intern(pass, usr, &record->usr) || !record->usr)
+        return;
+
+    record->file = f;
+    record->offset = offset;
+    record->line = line;
+    record->column = column;
+    record->kind = kind;
+    pass->num_records++;
+}
+
+static int is_reference(enum CXCursorKind kind)
+{
+    switch (kind)
+    {
+        case CXCursor_DeclRefExpr:
+        case CXCursor_MemberRefExpr:
+        case CXCursor_ObjCMessageExpr:
+        case CXCursor_MacroExpansion:
+            return 1;
+        default:
+            return clang_isReference(kind);
+    }
+}
+
+static enum CXChildVisitResult pass_visitor(CXCursor cursor, CXCursor parent, CXClientData data)
+{
+    symidx_pass *pass = data;
+    if (pass->failed || pass->interrupted)
+        return CXChildVisit_Break;
+
+    if (clang_isDeclaration(cursor.kind))
+    {
+        uint32_t kind = clang_isCursorDefinition(cursor) ? SYMIDX_DEFINITION : SYMIDX_DECLARATION;
+        pass_add(pass, cursor, clang_getCursorUSR(cursor), kind);
+    }
+    else if (is_reference(cursor.kind))
+    {
+        CXCursor referenced = clang_getCursorReferenced(cursor);
+        if (!clang_Cursor_isNull(referenced))
+            pass_add(pass, cursor, clang_getCursorUSR(referenced), SYMIDX_REFERENCE);
+    }
+
+    return CXChildVisit_Recurse;
+}
+
+static void *pass_nogvl(void *data)
+{
+    symidx_pass *pass = data;
+    clang_visitChildren(clang_getTranslationUnitCursor(pass->unit), pass_visitor, pass);
+    return NULL;
+}
+
+static void pass_ubf(void *data)
+{
+    ((symidx_pass *) data)->interrupted = 1;
+}
+
+static void pass_release(symidx_pass *pass)
+{
+    pass_file *f, *temp;
+    HASH_ITER(hh, pass->files, f, temp)
+    {
+        HASH_DEL(pass->files, f);
+        free(f);
+    }
+    free(pass->records);
+    rb_strtab_free(&pass->strings);
+}
+
+static uint32_t overlay_intern(symidx_overlay *overlay, const char *str, size_t len)
+{
+    unsigned int id;
+    if (!rb_strtab_intern(&overlay->strings, str, len, &id))
+        rb_memerror();
+    return id;
+}
+
+// Replaces whatever was recorded for a file with a new, empty entry
+static uint32_t overlay_add_file(rb_symbol_index *index, const char *path, size_t len, int64_t mtime, int live)
+{
+    symidx_overlay *o = &index->overlay;
+    uint32_t id = overlay_intern(o, path, len);
+    if (!symidx_fill(&o->file_of, &o->file_of_capa, id) ||
+        !symidx_reserve((void **) &o->files, &o->capa_files, o->num_files, sizeof(overlay_file)))
+        rb_memerror();
+
+    if (o->file_of[id] != SYMIDX_NONE)
+        o->files[o->file_of[id]].live = 0;
+
+    uint32_t mapped = map_find_file(&index->map, path);
+    if (mapped != SYMIDX_NONE)
+        index->map.dead[mapped] = 1;
+
+    uint32_t f = o->num_files++;
+    o->files[f].path = id;
+    o->files[f].mtime = mtime;
+    o->files[f].live = live;
+    o->file_of[id] = f;
+    return f;
+}
+
+static void overlay_add_record(symidx_overlay *o, const char *usr, size_t len, const overlay_record *src)
+{
+    uint32_t id = overlay_intern(o, usr, len);
+    if (!symidx_reserve((void **) &o->records, &o->capa_records, o->num_records, sizeof(overlay_record)))
+        rb_memerror();
+
+    while (id >= o->usr_capa)
+    {
+        uint32_t capa = o->usr_capa;
+        if (!symidx_fill(&o->usr_first, &capa, id) || !symidx_fill(&o->usr_last, &o->usr_capa, id))
+            rb_memerror();
+    }
+
+    uint32_t r = o->num_records++;
+    o->records[r] = *src;
+    o->records[r].usr = id;
+    o->records[r].next = SYMIDX_NONE;
+    if (o->usr_last[id] == SYMIDX_NONE)
+        o->usr_first[id] = r;
+    else
+        o->records[o->usr_last[id]].next = r;
+    o->usr_last[id] = r;
+}
+
+static VALUE symidx_merge(VALUE data)
+{
+    symidx_pass *pass = (symidx_pass *) data;
+    rb_symbol_index *index = (rb_symbol_index *) pass->index;
+
+    rb_thread_check_ints();
+    if (pass->failed)
+        rb_memerror();
+
+    // An interrupt that was handled without raising still cut the visit short, and merging the partial records would
+    // store their files as up to date, so nothing is recorded and they are visited again by the next add
+    if (pass->interrupted)
+        return rb_ary_new();
+
+    // Each file that changed replaces its previous entry, whichever translation unit that came from
+    VALUE paths = rb_ary_new();
+    uint32_t *file_ids = malloc(sizeof(uint32_t) * (pass->strings.count ? pass->strings.count : 1));
+    if (!file_ids)
+        rb_memerror();
+
+    pass_file *f, *temp;
+    HASH_ITER(hh, pass->files, f, temp)
+    {
+        if (!f->record)
+            continue;
+
+        size_t len;
+        const char *path = rb_strtab_get(&pass->strings, f->path, &len);
+        file_ids[f->path] = overlay_add_file(index, path, len, f->mtime, 1);
+        rb_ary_push(paths, rb_strtab_str(&pass->strings, f->path));
+    }
+
+    for (uint32_t i = 0; i < pass->num_records; i++)
+    {
+        pass_record *r = &pass->records[i];
+        overlay_record record = {0, file_ids[r->file->path], r->offset, r->line, r->column, r->kind};
+
+        size_t len;
+        const char *usr = rb_strtab_get(&pass->strings, r->usr, &len);
+        overlay_add_record(&index->overlay, usr, len, &record);
+    }
+
+    free(file_ids);
+    return paths;
+}
+
+static VALUE symidx_finish(VALUE data)
+{
+    symidx_pass *pass = (symidx_pass *) data;
+    ((rb_symbol_index *) pass->index)->busy = 0;
+    pass_release(pass);
+    return Qnil;
+}
+
+static VALUE symidx_run(VALUE data)
+{
+    symidx_pass *pass = (symidx_pass *) data;
+    if (!rb_strtab_init(&pass->strings))
+        rb_memerror();
+
+    // The pass only reads the index, which other threads may query but not modify until it is merged
+    rb_tu_without_gvl(pass->tu, pass_nogvl, pass, pass_ubf, pass);
+    return symidx_merge(data);
+}
+
+static VALUE symidx_add(VALUE self, VALUE unit)
+{
+    rb_symbol_index *index = symidx_ptr(self, 1);
+    symidx_pass pass = {index, rb_tu_unit(unit), unit};
+
+    index->busy = 1;
+    VALUE paths = rb_ensure(symidx_run, (VALUE) &pass, symidx_finish, (VALUE) &pass);
+    RB_GC_GUARD(unit);
+    return paths;
+}
+
+static VALUE symidx_remove(VALUE self, VALUE path)
+{
+    rb_symbol_index *index = symidx_ptr(self, 1);
+    StringValueCStr(path);
+
+    int known = overlay_find_file(&index->overlay, RSTRING_PTR(path), RSTRING_LEN(path)) != SYMIDX_NONE;
+    uint32_t mapped = map_find_file(&index->map, RSTRING_PTR(path));
+    if (!known && (mapped == SYMIDX_NONE || index->map.dead[mapped]))
+        return Qfalse;
+
+    overlay_add_file(index, RSTRING_PTR(path), RSTRING_LEN(path), 0, 0);
+    return Qtrue;
+}
+
+static VALUE symidx_record_hash(VALUE path, uint32_t line, uint32_t column, uint32_t offset, uint32_t kind)
+{
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, STR2SYM("file"), path);
+    rb_hash_aset(hash, STR2SYM("line"), UINT2NUM(line));
+    rb_hash_aset(hash, STR2SYM("column"), UINT2NUM(column));
+    rb_hash_aset(hash, STR2SYM("offset"), UINT2NUM(offset));
+    if (kind != SYMIDX_REFERENCE)
+        rb_hash_aset(hash, STR2SYM("definition"), RB_BOOL(kind == SYMIDX_DEFINITION));
+    return hash;
+}
+
+static int kind_matches(uint32_t kind, uint32_t want)
+{
+    return want == SYMIDX_DECLARATION ? kind != SYMIDX_REFERENCE : kind == want;
+}
+
+static VALUE symidx_lookup(VALUE self, VALUE usr, uint32_t want)
+{
+    rb_symbol_index *index = symidx_ptr(self, 0);
+    StringValue(usr);
+    const char *str = RSTRING_PTR(usr);
+    size_t len = RSTRING_LEN(usr);
+    VALUE ary = rb_ary_new();
+
+    const symidx_map *map = &index->map;
+    const symidx_symbol *symbol = map_find_symbol(map, str, len);
+    for (uint32_t i = 0; symbol && i < symbol->count; i++)
+    {
+        const symidx_record *r = &map->records[symbol->first + i];
+        if (!map->dead[r->file] && kind_matches(r->kind, want))
+        {
+            VALUE path = rb_utf8_str_new_cstr(map_str(map, map->files[r->file].path));
+            rb_ary_push(ary, symidx_record_hash(path, r->line, r->column, r->offset, r->kind));
+        }
+    }
+
+    const symidx_overlay *o = &index->overlay;
+    unsigned int id;
+    if (rb_strtab_find((rb_strtab *) &o->strings, str, len, &id) && id < o->usr_capa)
+    {
+        for (uint32_t i = o->usr_first[id]; i != SYMIDX_NONE; i = o->records[i].next)
+        {
+            const overlay_record *r = &o->records[i];
+            const overlay_file *f = &o->files[r->file];
+            if (f->live && kind_matches(r->kind, want))
+            {
+                VALUE path = rb_strtab_str(&o->strings, f->path);
+                rb_ary_push(ary, symidx_record_hash(path, r->line, r->column, r->offset, r->kind));
+            }
+        }
+    }
+
+    return ary;
+}
+
+static VALUE symidx_declarations(VALUE self, VALUE usr)
+{
+    return symidx_lookup(self, usr, SYMIDX_DECLARATION);
+}
+
+static VALUE symidx_definitions(VALUE self, VALUE usr)
+{
+    return symidx_lookup(self, usr, SYMIDX_DEFINITION);
+}
+
+static VALUE symidx_references(VALUE self, VALUE usr)
+{
+    return symidx_lookup(self, usr, SYMIDX_REFERENCE);
+}
+
+typedef void (*symidx_file_func)(const char *path, int64_t mtime, void *data);
+
+static void symidx_each_file(const rb_symbol_index *index, symidx_file_func func, void *data)
+{
+    const symidx_map *map = &index->map;
+    for (uint32_t i = 0; map->header && i < map->header->num_files; i++)
+    {
+        if (!map->dead[i])
+            func(map_str(map, map->files[i].path), map->files[i].mtime, data);
+    }
+
+    const symidx_overlay *o = &index->overlay;
+    for (uint32_t i = 0; i < o->num_files; i++)
+    {
+        if (o->files[i].live)
+            func(rb_strtab_get(&o->strings, o->files[i].path, NULL), o->files[i].mtime, data);
+    }
+}
+
+static void collect_file(const char *path, int64_t mtime, void *data)
+{
+    rb_ary_push(*(VALUE *) data, rb_utf8_str_new_cstr(path));
+}
+
+static void collect_stale(const char *path, int64_t mtime, void *data)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || (int64_t) st.st_mtime != mtime)
+        rb_ary_push(*(VALUE *) data, rb_utf8_str_new_cstr(path));
+}
+
+static VALUE symidx_files(VALUE self)
+{
+    VALUE ary = rb_ary_new();
+    symidx_each_file(symidx_ptr(self, 0), collect_file, &ary);
+    return ary;
+}
+
+static VALUE symidx_stale_files(VALUE self)
+{
+    VALUE ary = rb_ary_new();
+    symidx_each_file(symidx_ptr(self, 0), collect_stale, &ary);
+    return ary;
+}
+
+
+// A record of the merged index, identified by the rank of its USR once the strings are sorted
+typedef struct
+{
+    uint32_t usr;
+    uint32_t file;
+    uint32_t offset;
+    uint32_t line;
+    uint32_t column;
+    uint32_t kind;
+} save_record;
+
+typedef struct
+{
+    const char *str;
+    uint32_t id;
+} save_string;
+
+typedef struct
+{
+    const rb_symbol_index *index;
+    const char *path;
+    const char *tmp;
+    FILE *io;
+    rb_strtab strings;
+    uint32_t num_files;
+    uint32_t *file_paths;
+    int64_t *file_times;
+    uint32_t *file_ids;
+    uint32_t *file_order;
+    save_string *sorted;
+    uint32_t *offsets;
+    save_record *records;
+    uint32_t num_records;
+    uint32_t capa_records;
+} symidx_save;
+
+static int sort_strings(const void *a, const void *b)
+{
+    return strcmp(((const save_string *) a)->str, ((const save_string *) b)->str);
+}
+
+static int sort_records(const void *a, const void *b)
+{
+    const save_record *x = a, *y = b;
+    if (x->usr != y->usr)
+        return x->usr < y->usr ? -1 : 1;
+    if (x->file != y->file)
+        return x->file < y->file ? -1 : 1;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->kind < y->kind ? -1 : x->kind > y->kind;
+}
+
+static void *save_alloc(size_t size, size_t count)
+{
+    void *ptr = malloc(size * (count ? count : 1));
+    if (!ptr)
+        rb_memerror();
+    return ptr;
+}
+
+static uint32_t save_intern(symidx_save *save, const char *str)
+{
+    unsigned int id;
+    if (!rb_strtab_intern(&save->strings, str, strlen(str), &id))
+        rb_memerror();
+    return id;
+}
+
+static void save_file(const char *path, int64_t mtime, void *data)
+{
+    symidx_save *save = data;
+    save->file_paths[save->num_files] = save_intern(save, path);
+    save->file_times[save->num_files++] = mtime;
+}
+
+static void save_add(symidx_save *save, const char *usr, uint32_t file, uint32_t offset, uint32_t line,
+                     uint32_t column, uint32_t kind)
+{
+    if (!symidx_reserve((void **) &save->records, &save->capa_records, save->num_records, sizeof(save_record)))
+        rb_memerror();
+    save_record r = {save_intern(save, usr), file, offset, line, column, kind};
+    save->records[save->num_records++] = r;
+}
+
+// Merges the live files of the map and the overlay, sorting files by path and symbols by USR
+static void save_collect(symidx_save *save)
+{
+    const symidx_map *map = &save->index->map;
+    const symidx_overlay *o = &save->index->overlay;
+    uint32_t num_mapped = map->header ? map->header->num_files : 0;
+    uint32_t capa = num_mapped + o->num_files;
+
+    save->file_paths = save_alloc(sizeof(uint32_t), capa);
+    save->file_times = save_alloc(sizeof(int64_t), capa);
+    save->file_ids = save_alloc(sizeof(uint32_t), capa);
+    symidx_each_file(save->index, save_file, save);
+
+    save->sorted = save_alloc(sizeof(save_string), save->num_files);
+    for (uint32_t i = 0; i < save->num_files; i++)
+    {
+        save->sorted[i].str = rb_strtab_get(&save->strings, save->file_paths[i], NULL);
+        save->sorted[i].id = i;
+    }
+    qsort(save->sorted, save->num_files, sizeof(save_string), sort_strings);
+
+    // Files were visited mapped first, then from the overlay, which is the order their new ids are assigned in
+    uint32_t *position = save->offsets = save_alloc(sizeof(uint32_t), save->num_files);
+    save->file_order = save_alloc(sizeof(uint32_t), save->num_files);
+    for (uint32_t i = 0; i < save->num_files; i++)
+    {
+        position[save->sorted[i].id] = i;
+        save->file_order[i] = save->sorted[i].id;
+    }
+
+    uint32_t live = 0;
+    for (uint32_t i = 0; i < num_mapped; i++)
+        save->file_ids[i] = map->dead[i] ? SYMIDX_NONE : position[live++];
+    for (uint32_t i = 0; i < o->num_files; i++)
+        save->file_ids[num_mapped + i] = o->files[i].live ? position[live++] : SYMIDX_NONE;
+
+    for (uint32_t i = 0; map->header && i < map->header->num_symbols; i++)
+    {
+        const symidx_symbol *s = &map->symbols[i];
+        for (uint32_t j = 0; j < s->count; j++)
+        {
+            const symidx_record *r = &map->records[s->first + j];
+            if (save->file_ids[r->file] != SYMIDX_NONE)
+                save_add(save, map_str(map, s->usr), save->file_ids[r->file], r->offset, r->line, r->column,
+                         r->kind);
+        }
+    }
+
+    for (uint32_t i = 0; i < o->num_records; i++)
+    {
+        const overlay_record *r = &o->records[i];
+        uint32_t file = save->file_ids[num_mapped + r->file];
+        if (file != SYMIDX_NONE)
+            save_add(save, rb_strtab_get(&o->strings, r->usr, NULL), file, r->offset, r->line, r->column, r->kind);
+    }
+
+    // Each USR is replaced by its rank among all strings, so sorting records by it also sorts the symbols
+    uint32_t count = save->strings.count;
+    free(save->sorted);
+    save->sorted = save_alloc(sizeof(save_string), count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        save->sorted[i].str = rb_strtab_get(&save->strings, i, NULL);
+        save->sorted[i].id = i;
+    }
+    qsort(save->sorted, count, sizeof(save_string), sort_strings);
+
+    uint32_t *rank = save_alloc(sizeof(uint32_t), count);
+    for (uint32_t i = 0; i < count; i++)
+        rank[save->sorted[i].id] = i;
+    for (uint32_t i = 0; i < save->num_records; i++)
+        save->records[i].usr = rank[save->records[i].usr];
+    free(rank);
+    qsort(save->records, save->num_records, sizeof(save_record), sort_records);
+
+    free(save->offsets);
+    save->offsets = save_alloc(sizeof(uint32_t), count);
+    for (uint32_t i = 0, offset = 0; i < count; i++)
+    {
+        size_t len;
+        rb_strtab_get(&save->strings, i, &len);
+        save->offsets[i] = offset;
+        offset += (uint32_t) len + 1;
+    }
+}
+
+static void save_write(symidx_save *save, const void *data, size_t size, size_t count)
+{
+    if (count && fwrite(data, size, count, save->io) != count)
+        rb_sys_fail(save->tmp);
+}
+
+static VALUE save_run(VALUE data)
+{
+    symidx_save *save = (symidx_save *) data;
+    if (!rb_strtab_init(&save->strings))
+        rb_memerror();
+    save_collect(save);
+
+    size_t len;
+    uint32_t last = save->strings.count - 1;
+    rb_strtab_get(&save->strings, last, &len);
+    symidx_header header = {SYMIDX_MAGIC, SYMIDX_VERSION, save->offsets[last] + (uint32_t) len + 1,
+                            save->num_files, 0, save->num_records, 0};
+    for (uint32_t i = 0; i < save->num_records; i++)
+    {
+        if (i == 0 || save->records[i].usr != save->records[i - 1].usr)
+            header.num_symbols++;
+    }
+
+    if (!(save->io = fopen(save->tmp, "wb")))
+        rb_sys_fail(save->tmp);
+
+    save_write(save, &header, sizeof(symidx_header), 1);
+    for (uint32_t i = 0; i < save->num_files; i++)
+    {
+        uint32_t f = save->file_order[i];
+        symidx_file file = {save->offsets[save->file_paths[f]], 0, save->file_times[f]};
+        save_write(save, &file, sizeof(symidx_file), 1);
+    }
+
+    for (uint32_t i = 0, first = 0; i < save->num_records; i++)
+    {
+        if (i + 1 < save->num_records && save->records[i + 1].usr == save->records[i].usr)
+            continue;
+
+        symidx_symbol symbol = {save->offsets[save->sorted[save->records[i].usr].id], first, i + 1 - first};
+        save_write(save, &symbol, sizeof(symidx_symbol), 1);
+        first = i + 1;
+    }
+
+    for (uint32_t i = 0; i < save->num_records; i++)
+    {
+        const save_record *r = &save->records[i];
+        symidx_record record = {r->file, r->offset, r->line, r->column, r->kind};
+        save_write(save, &record, sizeof(symidx_record), 1);
+    }
+
+    for (uint32_t i = 0; i <= last; i++)
+    {
+        const char *str = rb_strtab_get(&save->strings, i, &len);
+        save_write(save, str, 1, len + 1);
+    }
+
+    // The new index only replaces the old one once it is completely on disk
+    FILE *io = save->io;
+    save->io = NULL;
+    int failed = fflush(io) != 0 || fsync(fileno(io)) != 0;
+    failed |= fclose(io) != 0;
+    if (failed || rename(save->tmp, save->path) != 0)
+    {
+        int e = errno;
+        unlink(save->tmp);
+        rb_syserr_fail(e, save->path);
+    }
+    return Qnil;
+}
+
+static VALUE save_cleanup(VALUE data)
+{
+    symidx_save *save = (symidx_save *) data;
+    if (save->io)
+    {
+        fclose(save->io);
+        unlink(save->tmp);
+    }
+
+    ((rb_symbol_index *) save->index)->busy = 0;
+    rb_strtab_free(&save->strings);
+    free(save->file_paths);
+    free(save->file_times);
+    free(save->file_ids);
+    free(save->file_order);
+    free(save->sorted);
+    free(save->offsets);
+    free(save->records);
+    return Qnil;
+}
+
+static VALUE symidx_save_file(int argc, VALUE *argv, VALUE self)
+{
+    rb_symbol_index *index = symidx_ptr(self, 1);
+    VALUE path = rb_check_arity(argc, 0, 1) ? argv[0] : index->path;
+    if (NIL_P(path))
+        rb_raise(rb_eArgError, "no path given for an index that was not loaded from a file");
+
+    path = rb_str_new_frozen(rb_get_path(path));
+    VALUE tmp = rb_sprintf("%" PRIsVALUE ".%d.tmp", path, (int) getpid());
+    symidx_save save = {index, StringValueCStr(path), StringValueCStr(tmp)};
+
+    index->busy = 1;
+    rb_ensure(save_run, (VALUE) &save, save_cleanup, (VALUE) &save);
+
+    // Everything indexed is now in the saved file, which replaces the old map and the overlay
+    symidx_map map = {0};
+    map_open(&map, save.path);
+    symidx_overlay overlay = {0};
+    if (!rb_strtab_init(&overlay.strings))
+    {
+        map_release(&map);
+        rb_memerror();
+    }
+
+    map_release(&index->map);
+    overlay_release(&index->overlay);
+    index->map = map;
+    index->overlay = overlay;
+    RB_OBJ_WRITE(self, &index->path, path);
+
+    RB_GC_GUARD(tmp);
+    return self;
+}
+
+static VALUE symidx_alloc(VALUE klass)
+{
+    rb_symbol_index *index;
+    VALUE obj = TypedData_Make_Struct(klass, rb_symbol_index, &symidx_type, index);
+    index->path = Qnil;
+    if (!rb_strtab_init(&index->overlay.strings))
+        rb_memerror();
+    return obj;
+}
+
+static VALUE symidx_initialize(int argc, VALUE *argv, VALUE self)
+{
+    rb_symbol_index *index = symidx_ptr(self, 1);
+    if (!rb_check_arity(argc, 0, 1) || NIL_P(argv[0]))
+        return Qnil;
+
+    VALUE path = rb_str_new_frozen(rb_get_path(argv[0]));
+    RB_OBJ_WRITE(self, &index->path, path);
+    if (access(StringValueCStr(path), F_OK) == 0)
+        map_open(&index->map, RSTRING_PTR(path));
+    return Qnil;
+}
+
+static VALUE symidx_path(VALUE self)
+{
+    return symidx_ptr(self, 0)->path;
+}
+
+static VALUE symidx_symbol_count(VALUE self)
+{
+    rb_symbol_index *index = symidx_ptr(self, 0);
+    const symidx_map *map = &index->map;
+    uint32_t count = 0;
+
+    // Symbols of the overlay that also appear in the map are only counted once
+    for (uint32_t i = 0; map->header && i < map->header->num_symbols; i++)
+    {
+        const symidx_symbol *s = &map->symbols[i];
+        for (uint32_t j = 0; j < s->count; j++)
+        {
+            if (!map->dead[map->records[s->first + j].file])
+            {
+                count++;
+                break;
+            }
+        }
+    }
+
+    const symidx_overlay *o = &index->overlay;
+    for (uint32_t id = 1; id < o->usr_capa; id++)
+    {
+        uint32_t live = SYMIDX_NONE;
+        for (uint32_t i = o->usr_first[id]; i != SYMIDX_NONE && live == SYMIDX_NONE; i = o->records[i].next)
+        {
+            if (o->files[o->records[i].file].live)
+                live = i;
+        }
+        if (live == SYMIDX_NONE)
+            continue;
+
+        size_t len;
+        const char *usr = rb_strtab_get(&o->strings, id, &len);
+        const symidx_symbol *s = map_find_symbol(map, usr, len);
+        int mapped = 0;
+        for (uint32_t j = 0; s && j < s->count && !mapped; j++)
+            mapped = !map->dead[map->records[s->first + j].file];
+        if (!mapped)
+            count++;
+    }
+
+    return UINT2NUM(count);
+}
+
+void Init_clang_symbol_index(void)
+{
+    rb_define_alloc_func(rb_cCXSymbolIndex, symidx_alloc);
+    rb_define_methodm1(rb_cCXSymbolIndex, "initialize", symidx_initialize, -1);
+    rb_define_method0(rb_cCXSymbolIndex, "path", symidx_path, 0);
+    rb_define_method0(rb_cCXSymbolIndex, "size", symidx_symbol_count, 0);
+    rb_define_method1(rb_cCXSymbolIndex, "add", symidx_add, 1);
+    rb_define_method1(rb_cCXSymbolIndex, "remove", symidx_remove, 1);
+    rb_define_method1(rb_cCXSymbolIndex, "declarations", symidx_declarations, 1);
+    rb_define_method1(rb_cCXSymbolIndex, "definitions", symidx_definitions, 1);
+    rb_define_method1(rb_cCXSymbolIndex, "references", symidx_references, 1);
+    rb_define_method0(rb_cCXSymbolIndex, "files", symidx_files, 0);
+    rb_define_method0(rb_cCXSymbolIndex, "stale_files", symidx_stale_files, 0);
+    rb_define_methodm1(rb_cCXSymbolIndex, "save", symidx_save_file, -1);
+    rb_define_alias(rb_cCXSymbolIndex, "update", "add");
+}
@@ -1,10 +1,6 @@
 #include "clang.h"
-
-typedef struct {
-    unsigned int count;
-    CXToken *tokens;
-    VALUE unit;
-} rb_tokenset;
+#include <stdint.h>
+#include <ruby/thread.h>
 
 typedef struct {
     CXToken token;
@@ -23,13 +19,13 @@ static void token_mark(void *data)
     rb_gc_mark(set->unit);
 }
 
-static void token_free(void *data)
-{
-    rb_token *t = data;
-    if (!NIL_P(t->unit))
-        clang_disposeTokens(DATA_PTR(t->unit), &t->token, 1);
-    xfree(data);
-}
+// Tokens are plain values within the set they were lexed in, which is kept alive by the unit it belongs to
+static const rb_data_type_t token_type = {
+    "Clang::Token",
+    {token_mark, RUBY_TYPED_DEFAULT_FREE, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY | RB_CLANG_EMBEDDABLE};
 
 static void tokenset_free(void *data)
 {
@@ -38,16 +34,29 @@ static void tokenset_free(void *data)
 
     rb_tokenset *set = data;
     if (!NIL_P(set->unit))
-        clang_disposeTokens(DATA_PTR(set->unit), set->tokens, set->count);
+        clang_disposeTokens(NULL, set->tokens, set->count);
     xfree(set);
 }
 
+static VALUE token_wrap(VALUE klass, CXToken token, VALUE unit)
+{
+    rb_token *t;
+    VALUE self = TypedData_Make_Struct(klass, rb_token, &token_type, t);
+    t->token = token;
+    t->unit = unit;
+    return self;
+}
+
+static rb_token *token_ptr(VALUE self)
+{
+    return RTYPEDDATA_GET_DATA(self);
+}
+
 static VALUE token_alloc(VALUE klass)
 {
-    rb_token *t = ALLOC(rb_token);
-    memset(t, 0, sizeof(rb_token));
-    t->unit = Qnil;
-    return Data_Wrap_Struct(klass, token_mark, RUBY_DEFAULT_FREE, t);
+    CXToken token;
+    memset(&token, 0, sizeof(CXToken));
+    return token_wrap(klass, token, Qnil);
 }
 
 static VALUE tokenset_alloc(VALUE klass)
@@ -66,8 +75,8 @@ static VALUE tokenset_initialize(VALUE self, VALUE unit, VALUE range)
     rb_tokenset *set = DATA_PTR(self);
     set->unit = unit;
 
-    CXSourceRange *r = DATA_PTR(range);
-    clang_tokenize(DATA_PTR(unit), *r, &set->tokens, &set->count);
+    CXSourceRange *r = rb_range_ptr(range);
+    clang_tokenize(rb_tu_unit(unit), *r, &set->tokens, &set->count);
     return self;
 }
 
@@ -78,11 +87,7 @@ static VALUE tokenset_get(VALUE self, VALUE index)
     if (i >= set->count)
         return Qnil;
 
-    rb_token *t = ALLOC(rb_token);
-    t->unit = set->unit;
-    t->token = set->tokens[i];
-
-    return Data_Wrap_Struct(rb_cCXToken, token_mark, RUBY_DEFAULT_FREE, t);
+    return token_wrap(rb_cCXToken, set->tokens[i], set->unit);
 }
 
 static VALUE tokenset_each(VALUE self)
@@ -91,12 +96,7 @@ static VALUE tokenset_each(VALUE self)
     rb_tokenset *set = DATA_PTR(self);
 
     for (unsigned i = 0; i < set->count; i++)
-    {
-        rb_token *t = ALLOC(rb_token);
-        t->unit = set->unit;
-        t->token = set->tokens[i]; 
-        rb_yield(Data_Wrap_Struct(rb_cCXToken, token_mark, RUBY_DEFAULT_FREE, t));
-    }
+        rb_yield(token_wrap(rb_cCXToken, set->tokens[i], set->unit));
     return self;
 }
 
@@ -112,7 +112,7 @@ static VALUE tokenset_unit(VALUE self)
 
 static VALUE token_unit(VALUE self)
 {
-    return ((rb_token*)DATA_PTR(self))->unit;
+    return token_ptr(self)->unit;
 }
 
 static VALUE token_initialize(VALUE self, VALUE unit, VALUE location)
@@ -120,45 +120,45 @@ static VALUE token_initialize(VALUE self, VALUE unit, VALUE location)
     rb_assert_type(unit, rb_cCXTranslationUnit);
     rb_assert_type(location, rb_cCXSourceLocation);
 
-    CXToken *token = clang_getToken(DATA_PTR(unit), *(CXSourceLocation*) DATA_PTR(location));
+    CXTranslationUnit tu = rb_tu_unit(unit);
+    CXToken *token = clang_getToken(tu, *rb_location_ptr(location));
     if (!token)
         rb_raise(rb_eRuntimeError, "failed to create Token from specified location");
 
-    rb_token *t = DATA_PTR(self);
+    // The token is a value that remains valid with its unit, so the copy returned by libclang is released at once
+    rb_token *t = token_ptr(self);
     t->token = *token;
     t->unit = unit;
-    RDATA(self)->dfree = token_free;
+    clang_disposeTokens(tu, token, 1);
 
     return self;
 }
 
 static VALUE token_kind(VALUE self)
 {
-    rb_token *t = DATA_PTR(self);
+    rb_token *t = token_ptr(self);
     enum CXTokenKind kind = clang_getTokenKind(t->token);
     return rb_enum_symbol(rb_TokenKind, kind);
 }
 
 static VALUE token_location(VALUE self)
 {
-    CXSourceLocation *location = ALLOC(CXSourceLocation);
-    rb_token *t = DATA_PTR(self);
-    *location = clang_getTokenLocation(DATA_PTR(t->unit), t->token);
-    return Data_Wrap_Struct(rb_cCXSourceLocation, NULL, RUBY_DEFAULT_FREE, location);
+    rb_token *t = token_ptr(self);
+    CXSourceLocation location = clang_getTokenLocation(rb_tu_unit(t->unit), t->token);
+    return rb_location_wrap(rb_cCXSourceLocation, location, t->unit);
 }
 
 static VALUE token_spelling(VALUE self)
 {
-    rb_token *t = DATA_PTR(self);
-    return RUBYSTR(clang_getTokenSpelling(DATA_PTR(t->unit), t->token));
+    rb_token *t = token_ptr(self);
+    return RUBYSTR(clang_getTokenSpelling(rb_tu_unit(t->unit), t->token));
 }
 
 static VALUE token_extent(VALUE self)
 {
-    CXSourceRange *range = ALLOC(CXSourceRange);
-    rb_token *t = DATA_PTR(self);
-    *range = clang_getTokenExtent(DATA_PTR(t->unit), t->token);
-    return Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range);
+    rb_token *t = token_ptr(self);
+    CXSourceRange range = clang_getTokenExtent(rb_tu_unit(t->unit), t->token);
+    return rb_range_wrap(rb_cCXSourceRange, range, t->unit);
 }
 
 static VALUE tu_tokenize(VALUE self, VALUE range)
@@ -166,7 +166,7 @@ static VALUE tu_tokenize(VALUE self, VALUE range)
     rb_assert_type(range, rb_cCXSourceRange);
     rb_tokenset *set = ALLOC(rb_tokenset);
     set->unit = self;
-    clang_tokenize(DATA_PTR(self), *(CXSourceRange*) DATA_PTR(range), &set->tokens, &set->count);
+    clang_tokenize(rb_tu_unit(self), *rb_range_ptr(range), &set->tokens, &set->count);
     return Data_Wrap_Struct(rb_cCXTokenSet, tokenset_mark, tokenset_free, set);
 }
 
@@ -174,15 +174,11 @@ static VALUE tokenset_cursors(VALUE self)
 {
     rb_tokenset *set = DATA_PTR(self);
     CXCursor cursors[set->count];
-    clang_annotateTokens(DATA_PTR(set->unit), set->tokens, set->count, cursors);
+    clang_annotateTokens(rb_tu_unit(set->unit), set->tokens, set->count, cursors);
 
     VALUE ary = rb_ary_new_capa(set->count);
     for (unsigned i = 0; i < set->count; i++)
-    {
-        CXCursor *cursor = ALLOC(CXCursor);
-        *cursor = cursors[i];
-        rb_ary_store(ary, i, Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, cursor));
-    }
+        rb_ary_store(ary, i, rb_cursor_wrap(rb_cCXCursor, cursors[i], set->unit));
     return ary;
 }
 
@@ -191,22 +187,123 @@ static VALUE tokenset_annotate(VALUE self)
     rb_need_block();
     rb_tokenset *set = DATA_PTR(self);
     CXCursor cursors[set->count];
-    clang_annotateTokens(DATA_PTR(set->unit), set->tokens, set->count, cursors);
+    clang_annotateTokens(rb_tu_unit(set->unit), set->tokens, set->count, cursors);
 
-    rb_token t;
-    t.unit = set->unit;
     VALUE args = rb_ary_new_capa(2);
     for (unsigned i = 0; i < set->count; i++)
     {
-        t.token = set->tokens[i];
-        rb_ary_store(args, 0, Data_Wrap_Struct(rb_cCXToken, NULL, RUBY_NEVER_FREE, &t));
-        rb_ary_store(args, 1, Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_NEVER_FREE, &cursors[i]));
+        rb_ary_store(args, 0, token_wrap(rb_cCXToken, set->tokens[i], set->unit));
+        rb_ary_store(args, 1, rb_cursor_wrap(rb_cCXCursor, cursors[i], set->unit));
         rb_yield(args);
     }
 
     return Qnil;
 }
 
+#define TOKEN_NO_OFFSET UINT32_MAX
+
+typedef struct
+{
+    CXTranslationUnit unit;
+    rb_tokenset *set;
+    CXFile file;
+    uint32_t *kinds;
+    uint32_t *starts;
+    uint32_t *ends;
+} token_pack;
+
+static void *tokenset_pack_nogvl(void *data)
+{
+    token_pack *pack = data;
+    for (unsigned int i = 0; i < pack->set->count; i++)
+    {
+        CXToken token = pack->set->tokens[i];
+        CXSourceRange extent = clang_getTokenExtent(pack->unit, token);
+
+        CXFile file, end_file;
+        unsigned int start, end;
+        clang_getFileLocation(clang_getRangeStart(extent), &file, NULL, NULL, &start);
+        clang_getFileLocation(clang_getRangeEnd(extent), &end_file, NULL, NULL, &end);
+
+        // Tokens are lexed from a single file, the buffer of which is taken from the first token
+        if (i == 0)
+            pack->file = file;
+
+        int same = file && file == pack->file && end_file == file;
+        pack->kinds[i] = clang_getTokenKind(token);
+        pack->starts[i] = same ? start : TOKEN_NO_OFFSET;
+        pack->ends[i] = same ? end : TOKEN_NO_OFFSET;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    token_pack pack;
+    VALUE unit;
+    int spellings;
+} token_pack_call;
+
+// Measures the tokens and builds the result with the unit locked, so the contents are not released while they are viewed
+static VALUE tokenset_pack_run(VALUE data)
+{
+    token_pack_call *call = (token_pack_call *) data;
+    token_pack *pack = &call->pack;
+    rb_tu_without_gvl(call->unit, tokenset_pack_nogvl, pack, NULL, NULL);
+
+    unsigned int count = pack->set->count;
+    size_t size = sizeof(uint32_t) * count;
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, STR2SYM("kinds"), rb_str_new((const char *) pack->kinds, size));
+    rb_hash_aset(hash, STR2SYM("starts"), rb_str_new((const char *) pack->starts, size));
+    rb_hash_aset(hash, STR2SYM("ends"), rb_str_new((const char *) pack->ends, size));
+    rb_hash_aset(hash, STR2SYM("file"), pack->file ? RUBYSTR(clang_getFileName(pack->file)) : Qnil);
+
+    // Neither the file nor the spellings are copied, each spelling being a view of its token within the file
+    VALUE source = pack->file ? rb_file_buffer_wrap(call->unit, pack->file) : Qnil;
+    rb_hash_aset(hash, STR2SYM("source"), source);
+    if (call->spellings)
+    {
+        size_t length = 0;
+        if (!NIL_P(source))
+            clang_getFileContents(pack->unit, pack->file, &length);
+        VALUE ary = rb_ary_new_capa(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            uint32_t start = pack->starts[i], end = pack->ends[i];
+            int valid = !NIL_P(source) && start != TOKEN_NO_OFFSET && start <= end && end <= length;
+            rb_ary_store(ary, i, valid ? rb_file_buffer_slice(source, start, end - start) : Qnil);
+        }
+        rb_hash_aset(hash, STR2SYM("spellings"), ary);
+    }
+    return hash;
+}
+
+static VALUE tokenset_to_packed(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[1] = {rb_intern("spellings")};
+    VALUE spellings;
+    rb_get_kwargs(kwargs, keys, 0, 1, &spellings);
+
+    rb_tokenset *set = DATA_PTR(self);
+    token_pack_call call = {{rb_tu_unit(set->unit), set}, set->unit, spellings == Qundef || RTEST(spellings)};
+
+    // Released by the GC should building the result raise
+    VALUE buffer;
+    unsigned int n = set->count ? set->count : 1;
+    call.pack.kinds = ALLOCV_N(uint32_t, buffer, 3 * (size_t) n);
+    call.pack.starts = call.pack.kinds + n;
+    call.pack.ends = call.pack.starts + n;
+
+    VALUE hash = rb_tu_locked(set->unit, tokenset_pack_run, (VALUE) &call);
+    ALLOCV_END(buffer);
+    RB_GC_GUARD(self);
+    return hash;
+}
+
 void Init_clang_token(void)
 {
     rb_define_method1(rb_cCXTranslationUnit, "tokenize", tu_tokenize, 1);
@@ -221,8 +318,10 @@ void Init_clang_token(void)
     rb_define_method0(rb_cCXTokenSet, "cursors", tokenset_cursors, 0);
     rb_define_method0(rb_cCXTokenSet, "annotate", tokenset_annotate, 0);
     rb_define_method1(rb_cCXTokenSet, "[]", tokenset_get, 1);
+    rb_define_methodm1(rb_cCXTokenSet, "to_packed", tokenset_to_packed, -1);
     rb_define_alias(rb_cCXTokenSet, "length", "size");
 
+    rb_define_alloc_func(rb_cCXToken, token_alloc);
     rb_define_method2(rb_cCXToken, "initialize", token_initialize, 2);
     rb_define_method0(rb_cCXToken, "translation_unit", token_unit, 0);
     rb_define_method0(rb_cCXToken, "kind", token_kind, 0);
@@ -1,25 +1,461 @@
 #include "clang.h"
+#include <ruby/thread.h>
 
-void clang_dset_free(void *data);
-void clang_diagnostic_free(void *data);
+ID id_index;
 
+typedef struct
+{
+    CXIndex index;
+    CXTranslationUnit unit;
+    rb_tu_args args;
+    unsigned int options;
+    const char *path;
+    unsigned int line;
+    unsigned int column;
+    CXCodeCompleteResults *results;
+    int result;
+} tu_call;
+
+VALUE rb_tu_error(int code)
+{
+    switch (code)
+    {
+        case CXError_Success: return Qnil;
+        case CXError_Crashed: return rb_exc_new_cstr(rb_eFatal, "native library crashed");
+        case CXError_InvalidArguments: return rb_exc_new_cstr(rb_eArgError, "invalid Clang arguments specified");
+        case CXError_ASTReadError: return rb_exc_new_cstr(rb_eLoadError, "an AST deserialization error has occurred");
+        default: return rb_exc_new_cstr(rb_eRuntimeError, "failed to create translation unit");
+    }
+}
 
 static inline void tu_check_error(enum CXErrorCode code)
 {
-    switch (code)
+    VALUE error = rb_tu_error(code);
+    if (!NIL_P(error))
+        rb_exc_raise(error);
+}
+
+size_t rb_tu_native_memsize(CXTranslationUnit unit)
+{
+    CXTUResourceUsage usage = clang_getCXTUResourceUsage(unit);
+    size_t size = 0;
+    for (unsigned i = 0; i < usage.numEntries; i++)
     {
-        case CXError_Success: return;
-        case CXError_Crashed: rb_raise(rb_eFatal, "native library crashed");
-        case CXError_InvalidArguments: rb_raise(rb_eArgError, "invalid Clang arguments specified");
-        case CXError_ASTReadError: rb_raise(rb_eLoadError, "an AST deserialization error has occurred");
-        default: rb_raise(rb_eRuntimeError, "failed to create translation unit");
+        // Memory-mapped buffers are backed by the page cache rather than the heap
+        switch (usage.entries[i].kind)
+        {
+            case CXTUResourceUsage_SourceManager_Membuffer_MMap:
+            case CXTUResourceUsage_ExternalASTSource_Membuffer_MMap: break;
+            default: size += usage.entries[i].amount;
+        }
     }
+    clang_disposeCXTUResourceUsage(usage);
+    return size;
+}
+
+static void tu_release(rb_tu *tu)
+{
+    if (!tu->unit)
+        return;
+
+    // A unit with a worker is disposed by it, once any request that is in progress has completed
+    rb_gc_adjust_memory_usage(-(ssize_t) tu->memsize);
+    if (tu->worker)
+        rb_tu_worker_release(tu->worker, tu->unit);
+    else
+        clang_disposeTranslationUnit(tu->unit);
+
+    tu->unit = NULL;
+    tu->worker = NULL;
+    tu->memsize = 0;
+}
+
+static void tu_mark(void *data)
+{
+    rb_tu *tu = data;
+    rb_gc_mark(tu->lock);
+    rb_gc_mark(tu->owner);
 }
 
 static void tu_free(void *data)
 {
-    if (data)
-        clang_disposeTranslationUnit(data);
+    tu_release(data);
+    xfree(data);
+}
+
+static size_t tu_memsize(const void *data)
+{
+    const rb_tu *tu = data;
+    return sizeof(rb_tu) + tu->memsize;
+}
+
+const rb_data_type_t rb_tu_type = {
+    "Clang::TranslationUnit",
+    {tu_mark, tu_free, tu_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+// Units owned by libclang elsewhere (i.e. the unit of a cursor) are wrapped without being disposed or accounted
+static const rb_data_type_t tu_borrowed_type = {
+    "Clang::TranslationUnit(borrowed)",
+    {tu_mark, RUBY_TYPED_DEFAULT_FREE, NULL},
+    &rb_tu_type,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static VALUE tu_alloc(VALUE klass)
+{
+    rb_tu *tu;
+    VALUE self = TypedData_Make_Struct(klass, rb_tu, &rb_tu_type, tu);
+    tu->lock = Qnil;
+    tu->owner = Qnil;
+    return self;
+}
+
+// Waits for the unit to be usable by the calling thread, which holds the GVL until it has finished with it, so that
+// neither another thread nor the worker can start using it in the meantime
+static void tu_ready(rb_tu *tu)
+{
+    int owned = !NIL_P(tu->owner) && tu->owner == rb_thread_current();
+    if (!NIL_P(tu->owner) && !owned)
+    {
+        rb_mutex_lock(tu->lock);
+        rb_mutex_unlock(tu->lock);
+    }
+
+    if (!tu->unit || tu->disposing)
+        rb_raise(rb_eRuntimeError, "translation unit has been disposed");
+
+    // The worker does not start a request while the unit is locked, so its owner has nothing to wait for
+    if (tu->worker && !owned)
+        rb_tu_worker_wait(tu->worker);
+}
+
+CXTranslationUnit rb_tu_unit(VALUE self)
+{
+    rb_tu *tu = rb_check_typeddata(self, &rb_tu_type);
+    tu_ready(tu);
+    return tu->unit;
+}
+
+void rb_tu_check(VALUE self)
+{
+    // Called on every access to a dependent value, so the owning unit is trusted to be one
+    if (NIL_P(self))
+        return;
+
+    rb_tu *tu = RTYPEDDATA_DATA(self);
+    if (NIL_P(tu->owner) && tu->unit && !tu->worker)
+        return;
+    tu_ready(tu);
+}
+
+CXTranslationUnit rb_tu_lock(VALUE self)
+{
+    rb_tu *tu = rb_check_typeddata(self, &rb_tu_type);
+    VALUE thread = rb_thread_current();
+    if (tu->owner == thread)
+    {
+        if (tu->disposing)
+            rb_raise(rb_eRuntimeError, "translation unit has been disposed");
+        tu->depth++;
+        return tu->unit;
+    }
+
+    if (NIL_P(tu->lock))
+        tu->lock = rb_mutex_new();
+
+    // Requests already queued for the worker are completed first, and as nothing can be queued without the GVL, the
+    // worker is known to be idle once the lock is taken without it being busy
+    for (;;)
+    {
+        if (tu->worker)
+            rb_tu_worker_wait(tu->worker);
+        rb_mutex_lock(tu->lock);
+        if (!tu->worker || !rb_tu_worker_busy(tu->worker))
+            break;
+        rb_mutex_unlock(tu->lock);
+    }
+
+    if (!tu->unit)
+    {
+        rb_mutex_unlock(tu->lock);
+        rb_raise(rb_eRuntimeError, "translation unit has been disposed");
+    }
+
+    tu->owner = thread;
+    tu->depth = 1;
+    if (tu->worker)
+        rb_tu_worker_hold(tu->worker, 1);
+    return tu->unit;
+}
+
+CXTranslationUnit rb_tu_lock_exclusive(VALUE self)
+{
+    // Reparsing or saving from within a traversal would invalidate the cursors that are being visited
+    rb_tu *tu = rb_check_typeddata(self, &rb_tu_type);
+    if (!NIL_P(tu->owner) && tu->owner == rb_thread_current())
+        rb_raise(rb_eRuntimeError, "translation unit cannot be changed while it is in use");
+    return rb_tu_lock(self);
+}
+
+VALUE rb_tu_unlock(VALUE self)
+{
+    rb_tu *tu = RTYPEDDATA_DATA(self);
+    if (--tu->depth)
+        return Qnil;
+
+    if (tu->worker)
+        rb_tu_worker_hold(tu->worker, 0);
+    tu->owner = Qnil;
+    if (tu->disposing)
+    {
+        tu->disposing = 0;
+        tu_release(tu);
+    }
+    rb_mutex_unlock(tu->lock);
+    return Qnil;
+}
+
+typedef struct
+{
+    void *(*func)(void *);
+    void *data;
+    rb_unblock_function_t *ubf;
+    void *ubf_data;
+} tu_nogvl_call;
+
+static VALUE tu_nogvl_run(VALUE arg)
+{
+    tu_nogvl_call *call = (tu_nogvl_call *) arg;
+    rb_thread_call_without_gvl(call->func, call->data, call->ubf, call->ubf_data);
+    return Qnil;
+}
+
+// Calls a function while holding the lock of a unit, if there is one, as is done around traversals that yield
+VALUE rb_tu_locked(VALUE tu, VALUE (*func)(VALUE), VALUE arg)
+{
+    if (NIL_P(tu))
+        return func(arg);
+
+    rb_tu_lock(tu);
+    return rb_ensure(func, arg, rb_tu_unlock, tu);
+}
+
+// Runs a function without the GVL while holding the lock of the unit it reads, if there is one
+void rb_tu_without_gvl(VALUE tu, void *(*func)(void *), void *data, rb_unblock_function_t *ubf, void *ubf_data)
+{
+    tu_nogvl_call call = {func, data, ubf, ubf_data};
+    rb_tu_locked(tu, tu_nogvl_run, (VALUE) &call);
+}
+
+void rb_tu_update_memsize(VALUE self)
+{
+    if (RTYPEDDATA_TYPE(self) != &rb_tu_type)
+        return;
+
+    rb_tu *tu = RTYPEDDATA_DATA(self);
+    if (!tu->unit)
+        return;
+
+    rb_tu_set_memsize(self, rb_tu_native_memsize(tu->unit));
+}
+
+void rb_tu_invalidate(VALUE self)
+{
+    ((rb_tu *) RTYPEDDATA_DATA(self))->generation++;
+}
+
+unsigned long rb_tu_generation(VALUE self)
+{
+    return ((rb_tu *) RTYPEDDATA_DATA(self))->generation;
+}
+
+void rb_tu_set_memsize(VALUE self, size_t size)
+{
+    if (RTYPEDDATA_TYPE(self) != &rb_tu_type)
+        return;
+
+    rb_tu *tu = RTYPEDDATA_DATA(self);
+    if (!tu->unit)
+        return;
+
+    rb_gc_adjust_memory_usage((ssize_t) size - (ssize_t) tu->memsize);
+    tu->memsize = size;
+}
+
+VALUE rb_tu_wrap(VALUE klass, CXTranslationUnit unit, VALUE index)
+{
+    // The index must outlive every translation unit that was created within it
+    VALUE self = tu_alloc(klass);
+    ((rb_tu *) RTYPEDDATA_DATA(self))->unit = unit;
+    rb_tu_update_memsize(self);
+    rb_ivar_set(self, id_index, index);
+    return self;
+}
+
+VALUE rb_tu_borrow(CXTranslationUnit unit)
+{
+    rb_tu *tu;
+    VALUE self = TypedData_Make_Struct(rb_cCXTranslationUnit, rb_tu, &tu_borrowed_type, tu);
+    tu->unit = unit;
+    return self;
+}
+
+char *rb_tu_strndup(const char *str, size_t len)
+{
+    char *copy = ALLOC_N(char, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+
+void rb_tu_args_free(rb_tu_args *args)
+{
+    for (int i = 0; i < args->argc; i++)
+        xfree(args->argv[i]);
+    xfree(args->argv);
+    if (!args->shared_files)
+        xfree(args->files);
+    xfree(args->source);
+    memset(args, 0, sizeof(rb_tu_args));
+}
+
+void rb_tu_args_init(rb_tu_args *args, VALUE source, VALUE command_args, VALUE unsaved)
+{
+    memset(args, 0, sizeof(rb_tu_args));
+    int num_cmds = RTEST(command_args) ? rb_array_len(command_args) : 0;
+    int shared = RTEST(unsaved) && rb_typeddata_is_kind_of(unsaved, &rb_unsaved_set_type);
+
+    // A copy of the array, so that its files are kept alive however the original is changed while parsing
+    if (RTEST(unsaved) && !shared)
+        unsaved = rb_ary_dup(rb_Array(unsaved));
+    int num_file = shared ? 0 : RTEST(unsaved) ? rb_array_len(unsaved) : 0;
+
+    // Validate everything first, nothing is allocated yet if any argument raises
+    if (RTEST(source))
+        StringValueCStr(source);
+    for (int i = 0; i < num_cmds; i++)
+    {
+        VALUE s = rb_ary_entry(command_args, i);
+        StringValueCStr(s);
+    }
+    for (int i = 0; i < num_file; i++)
+        rb_check_typeddata(rb_ary_entry(unsaved, i), &rb_unsaved_type);
+
+    if (RTEST(source))
+        args->source = rb_tu_strdup(StringValueCStr(source));
+
+    args->argv = ALLOC_N(char*, num_cmds);
+    for (; args->argc < num_cmds; args->argc++)
+    {
+        VALUE s = rb_ary_entry(command_args, args->argc);
+        args->argv[args->argc] = rb_tu_strdup(StringValueCStr(s));
+    }
+
+    args->owner = unsaved;
+    if (shared)
+    {
+        rb_unsaved_set *set = RTYPEDDATA_DATA(unsaved);
+        args->files = set->files;
+        args->num_files = set->count;
+        args->shared_files = 1;
+        return;
+    }
+
+    args->files = ALLOC_N(struct CXUnsavedFile, num_file);
+    for (; args->num_files < (unsigned) num_file; args->num_files++)
+        args->files[args->num_files] = *(struct CXUnsavedFile *) DATA_PTR(rb_ary_entry(unsaved, args->num_files));
+}
+
+static void *tu_parse_nogvl(void *data)
+{
+    tu_call *call = data;
+    rb_tu_args *a = &call->args;
+    call->result = clang_parseTranslationUnit2(call->index, a->source, (const char *const *) a->argv, a->argc, a->files,
+                                               a->num_files, call->options, &call->unit);
+    return NULL;
+}
+
+static void *tu_from_source_nogvl(void *data)
+{
+    tu_call *call = data;
+    rb_tu_args *a = &call->args;
+    call->unit = clang_createTranslationUnitFromSourceFile(call->index, a->source, a->argc, (const char *const *) a->argv,
+                                                           a->num_files, a->files);
+    return NULL;
+}
+
+static void *tu_load_nogvl(void *data)
+{
+    tu_call *call = data;
+    call->result = clang_createTranslationUnit2(call->index, call->path, &call->unit);
+    return NULL;
+}
+
+static void *tu_save_nogvl(void *data)
+{
+    tu_call *call = data;
+    call->result = clang_saveTranslationUnit(call->unit, call->path, call->options);
+    return NULL;
+}
+
+static void *tu_reparse_nogvl(void *data)
+{
+    tu_call *call = data;
+    call->result = clang_reparseTranslationUnit(call->unit, call->args.num_files, call->args.files, call->options);
+    return NULL;
+}
+
+static void *tu_code_complete_nogvl(void *data)
+{
+    tu_call *call = data;
+    rb_tu_args *a = &call->args;
+    call->results = clang_codeCompleteAt(call->unit, call->path, call->line, call->column, a->files, a->num_files,
+                                         call->options);
+    return NULL;
+}
+
+static inline void tu_call_nogvl(void *(*func)(void *), tu_call *call)
+{
+    rb_thread_call_without_gvl(func, call, NULL, NULL);
+}
+
+typedef struct
+{
+    VALUE self;
+    void *(*func)(void *);
+    tu_call *call;
+    int invalidates;
+} tu_locked_call;
+
+static VALUE tu_locked_run(VALUE arg)
+{
+    tu_locked_call *locked = (tu_locked_call *) arg;
+    locked->call->unit = rb_tu_lock_exclusive(locked->self);
+    if (locked->invalidates)
+        rb_tu_invalidate(locked->self);
+    tu_call_nogvl(locked->func, locked->call);
+    return Qnil;
+}
+
+static VALUE tu_locked_free(VALUE arg)
+{
+    tu_locked_call *locked = (tu_locked_call *) arg;
+    if (locked->call->unit)
+        rb_tu_unlock(locked->self);
+    rb_tu_args_free(&locked->call->args);
+    return Qnil;
+}
+
+// Requests that change the unit hold its lock throughout, so that no other thread can use or dispose of it meanwhile,
+// and own the native copies of their arguments
+static void tu_call_locked(VALUE self, void *(*func)(void *), tu_call *call, int invalidates)
+{
+    tu_locked_call locked = {self, func, call, invalidates};
+    rb_ensure(tu_locked_run, (VALUE) &locked, tu_locked_free, (VALUE) &locked);
 }
 
 static VALUE tu_skipped_ranges(int argc, VALUE *argv, VALUE self)
@@ -27,13 +463,13 @@ static VALUE tu_skipped_ranges(int argc, VALUE *argv, VALUE self)
     VALUE file;
     rb_scan_args(argc, argv, "01", &file);
 
-    CXTranslationUnit unit = DATA_PTR(self);
+    CXTranslationUnit unit = rb_tu_unit(self);
     CXSourceRangeList *list;
 
     if (RTEST(file))
     {
         rb_assert_type(file, rb_cCXFile);
-        list = clang_getSkippedRanges(unit, DATA_PTR(file));
+        list = clang_getSkippedRanges(unit, *rb_file_ptr(file));
     }
     else
     {
@@ -46,9 +482,7 @@ static VALUE tu_skipped_ranges(int argc, VALUE *argv, VALUE self)
 
     for (unsigned i = 0; i < list->count; i++)
     {
-        CXSourceRange *range = ALLOC(CXSourceRange);
-        *range = list->ranges[i];
-        rb_ary_store(ary, i, Data_Wrap_Struct(rb_cCXSourceRange, NULL, RUBY_DEFAULT_FREE, range));
+        rb_ary_store(ary, i, rb_range_wrap(rb_cCXSourceRange, list->ranges[i], self));
     }
 
     clang_disposeSourceRangeList(list);
@@ -59,68 +493,90 @@ static VALUE tu_each_diagnostic(VALUE self)
 {
     RETURN_ENUMERATOR(self, 0, NULL);
 
-    CXTranslationUnit unit = DATA_PTR(self);
+    CXTranslationUnit unit = rb_tu_unit(self);
     unsigned int n = clang_getNumDiagnostics(unit);
     for (unsigned i = 0; i < n; i++)
     {
         CXDiagnostic d = clang_getDiagnostic(unit, i);
-        rb_yield(Data_Wrap_Struct(rb_cCXDiagnostic, NULL, clang_diagnostic_free, d));
+        rb_yield(rb_diagnostic_wrap(d, self, self, 0));
     }
     return self;
 }
 
 static VALUE tu_diagnostics(VALUE self)
 {
-    CXTranslationUnit unit = DATA_PTR(self);
+    CXTranslationUnit unit = rb_tu_unit(self);
     CXDiagnosticSet set = clang_getDiagnosticSetFromTU(unit);
-    return set ? Data_Wrap_Struct(rb_cCXDiagnosticSet, NULL, clang_dset_free, set) : Qnil;
+    return set ? rb_dset_wrap(set, self, self) : Qnil;
 }
 
 static VALUE tu_diagnostic_count(VALUE self)
 {
-    CXTranslationUnit unit = DATA_PTR(self);
+    CXTranslationUnit unit = rb_tu_unit(self);
     return UINT2NUM(clang_getNumDiagnostics(unit));
 }
 
 static VALUE tu_spelling(VALUE self)
 {
-    CXString str = clang_getTranslationUnitSpelling(DATA_PTR(self));
+    CXString str = clang_getTranslationUnitSpelling(rb_tu_unit(self));
     return RUBYSTR(str);
 }
 
-static VALUE tu_parse(int argc, VALUE *argv, VALUE klass)
+static VALUE tu_dispose(VALUE self)
 {
-    VALUE index, source, args, unsaved, opts;
-    rb_scan_args(argc, argv, "13*", &index, &source, &args, &unsaved, &opts);
-
-    rb_assert_type(index, rb_cCXIndex);
-    CXIndex idx = DATA_PTR(index);
+    rb_tu *tu = rb_check_typeddata(self, &rb_tu_type);
+    if (RTYPEDDATA_TYPE(self) != &rb_tu_type)
+        rb_raise(rb_eRuntimeError, "cannot dispose a translation unit that is owned elsewhere");
 
-    const char *src = RTEST(source) ? StringValueCStr(source) : NULL;
-    int num_cmds = RTEST(args) ? rb_array_len(args) : 0;
-    int num_file = RTEST(unsaved) ? rb_array_len(unsaved) : 0;
-
-    const char *cmds[num_cmds];
-    for (int i = 0; i < num_cmds; i++)
+    // The unit is still being read further up the stack of its owner, so it is released once that has returned
+    if (!NIL_P(tu->owner) && tu->owner == rb_thread_current())
     {
-        VALUE s = rb_ary_entry(args, i);
-        cmds[i] = StringValueCStr(s);
+        tu->disposing = tu->unit != NULL;
+        return Qnil;
     }
 
-    struct CXUnsavedFile files[num_file];
-    for (int i = 0; i < num_file; i++)
+    if (NIL_P(tu->owner))
     {
-        VALUE s = rb_ary_entry(unsaved, i);
-        rb_assert_type(s, rb_cCXUnsavedFile);
-        files[i] = *(struct CXUnsavedFile*) DATA_PTR(s);
+        tu_release(tu);
+        return Qnil;
     }
 
+    rb_mutex_lock(tu->lock);
+    tu_release(tu);
+    rb_mutex_unlock(tu->lock);
+    return Qnil;
+}
+
+static VALUE tu_is_disposed(VALUE self)
+{
+    rb_check_typeddata(self, &rb_tu_type);
+    return RB_BOOL(rb_tu_is_disposed(self));
+}
+
+static VALUE tu_scoped(VALUE self)
+{
+    // With a block, the unit only lives for the duration of it, and its result is returned instead
+    if (!rb_block_given_p())
+        return self;
+    return rb_ensure(rb_yield, self, tu_dispose, self);
+}
+
+static VALUE tu_parse(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE index, source, args, unsaved, opts;
+    rb_scan_args(argc, argv, "13*", &index, &source, &args, &unsaved, &opts);
+
+    rb_assert_type(index, rb_cCXIndex);
     unsigned int mask = rb_enum_mask(rb_TranslationUnitFlags, opts);
-    CXTranslationUnit unit;
-    enum CXErrorCode err = clang_parseTranslationUnit2(idx, src, cmds, num_cmds, files, num_file, mask, &unit);
-    tu_check_error(err);
 
-    return Data_Wrap_Struct(klass, NULL, tu_free, unit);
+    tu_call call = {.index = DATA_PTR(index), .options = mask};
+    rb_tu_args_init(&call.args, source, args, unsaved);
+    tu_call_nogvl(tu_parse_nogvl, &call);
+    rb_tu_args_free(&call.args);
+    RB_GC_GUARD(index);
+
+    tu_check_error(call.result);
+    return tu_scoped(rb_tu_wrap(klass, call.unit, index));
 }
 
 static VALUE tu_from_source(int argc, VALUE *argv, VALUE klass)
@@ -129,32 +585,17 @@ static VALUE tu_from_source(int argc, VALUE *argv, VALUE klass)
     rb_scan_args(argc, argv, "13", &index, &source, &args, &unsaved);
 
     rb_assert_type(index, rb_cCXIndex);
-    CXIndex idx = DATA_PTR(index);
-
-    const char *src = RTEST(source) ? StringValueCStr(source) : NULL;
-    int num_cmds = RTEST(args) ? rb_array_len(args) : 0;
-    int num_file = RTEST(unsaved) ? rb_array_len(unsaved) : 0;
-
-    const char *cmds[num_cmds];
-    for (int i = 0; i < num_cmds; i++)
-    {
-        VALUE s = rb_ary_entry(args, i);
-        cmds[i] = StringValueCStr(s);
-    }
 
-    struct CXUnsavedFile files[num_file];
-    for (int i = 0; i < num_file; i++)
-    {
-        VALUE s = rb_ary_entry(unsaved, i);
-        rb_assert_type(s, rb_cCXUnsavedFile);
-        files[i] = *(struct CXUnsavedFile*) DATA_PTR(s);
-    }
+    tu_call call = {.index = DATA_PTR(index)};
+    rb_tu_args_init(&call.args, source, args, unsaved);
+    tu_call_nogvl(tu_from_source_nogvl, &call);
+    rb_tu_args_free(&call.args);
+    RB_GC_GUARD(index);
 
-    CXTranslationUnit unit = clang_createTranslationUnitFromSourceFile(idx, src, num_cmds, cmds, num_file, files);
-    if (!unit)
+    if (!call.unit)
         rb_raise(rb_eRuntimeError, "failed to create translation unit");
 
-    return Data_Wrap_Struct(klass, NULL, tu_free, unit);
+    return tu_scoped(rb_tu_wrap(klass, call.unit, index));
 }
 
 static VALUE tu_default_options(VALUE klass)
@@ -165,26 +606,37 @@ static VALUE tu_default_options(VALUE klass)
 
 static VALUE tu_default_reparse_options(VALUE self)
 {
-    int mask = clang_defaultReparseOptions(DATA_PTR(self));
+    int mask = clang_defaultReparseOptions(rb_tu_unit(self));
     return rb_enum_unmask(rb_ReparseFlags, mask);
 }
 
 static VALUE tu_default_save_options(VALUE self)
 {
-    int mask = clang_defaultSaveOptions(DATA_PTR(self));
+    int mask = clang_defaultSaveOptions(rb_tu_unit(self));
     return rb_enum_unmask(rb_SaveTranslationUnitFlags, mask);
 }
 
 static VALUE tu_initialize(VALUE self, VALUE index, VALUE ast_path)
 {
     rb_assert_type(index, rb_cCXIndex);
-    CXIndex idx = DATA_PTR(index);
-    const char *ast = StringValueCStr(ast_path);
 
-    enum CXErrorCode err = clang_createTranslationUnit2(idx, ast, DATA_PTR(self));
-    tu_check_error(err);
+    tu_call call = {.index = DATA_PTR(index)};
+    call.path = rb_tu_strdup(StringValueCStr(ast_path));
+    tu_call_nogvl(tu_load_nogvl, &call);
+    xfree((void*) call.path);
+    RB_GC_GUARD(index);
+
+    tu_check_error(call.result);
 
-    RDATA(self)->dfree = tu_free;
+    rb_tu *tu = rb_check_typeddata(self, &rb_tu_type);
+    if (tu->unit)
+    {
+        clang_disposeTranslationUnit(call.unit);
+        rb_raise(rb_eRuntimeError, "translation unit already initialized");
+    }
+    tu->unit = call.unit;
+    rb_tu_update_memsize(self);
+    rb_ivar_set(self, id_index, index);
     return self;
 }
 
@@ -194,9 +646,13 @@ static VALUE tu_save(int argc, VALUE *argv, VALUE self)
     rb_scan_args(argc, argv, "1*", &filename, &options);
 
     unsigned int mask = RTEST(options) ? rb_enum_mask(rb_SaveTranslationUnitFlags, options) : CXSaveTranslationUnit_None;
-    enum CXSaveError err = clang_saveTranslationUnit(DATA_PTR(self), StringValueCStr(filename), mask);
 
-    switch (err)
+    tu_call call = {.options = mask};
+    rb_tu_args_init(&call.args, filename, Qnil, Qnil);
+    call.path = call.args.source;
+    tu_call_locked(self, tu_save_nogvl, &call, 0);
+
+    switch (call.result)
     {
         case CXSaveError_None: return self;
         case CXSaveError_Unknown: rb_raise(rb_eRuntimeError, "failed to save translation unit");
@@ -208,7 +664,11 @@ static VALUE tu_save(int argc, VALUE *argv, VALUE self)
 
 static VALUE tu_suspend(VALUE self)
 {
-    return RB_BOOL(clang_suspendTranslationUnit(DATA_PTR(self)));
+    unsigned int result = clang_suspendTranslationUnit(rb_tu_lock_exclusive(self));
+    rb_tu_invalidate(self);
+    rb_tu_update_memsize(self);
+    rb_tu_unlock(self);
+    return RB_BOOL(result);
 }
 
 static VALUE tu_reparse(int argc, VALUE *argv, VALUE self)
@@ -216,37 +676,31 @@ static VALUE tu_reparse(int argc, VALUE *argv, VALUE self)
     VALUE unsaved, options;
     rb_scan_args(argc, argv, "01*", &unsaved, &options);
     unsigned int mask = rb_enum_mask(rb_ReparseFlags, options);
-    
-    int num_file = RTEST(unsaved) ? rb_array_len(unsaved) : 0;
-    struct CXUnsavedFile files[num_file];
-    for (int i = 0; i < num_file; i++)
-    {
-        VALUE s = rb_ary_entry(unsaved, i);
-        rb_assert_type(s, rb_cCXUnsavedFile);
-        files[i] = *(struct CXUnsavedFile*) DATA_PTR(s);
-    }
 
-    enum CXErrorCode err = clang_reparseTranslationUnit(DATA_PTR(self), num_file, files, mask);
-    tu_check_error(err);
+    tu_call call = {.options = mask};
+    rb_tu_args_init(&call.args, Qnil, Qnil, unsaved);
+    tu_call_locked(self, tu_reparse_nogvl, &call, 1);
+
+    tu_check_error(call.result);
+    rb_tu_update_memsize(self);
     return self;
 }
 
 static VALUE tu_cursor(VALUE self)
 {
-    CXCursor *cursor = ALLOC(CXCursor);
-    *cursor = clang_getTranslationUnitCursor(DATA_PTR(self));
-    return Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, cursor);
+    CXCursor cursor = clang_getTranslationUnitCursor(rb_tu_unit(self));
+    return rb_cursor_wrap(rb_cCXCursor, cursor, self);
 }
 
 static VALUE tu_include_guarded(VALUE self, VALUE file)
 {
     rb_assert_type(file, rb_cCXFile);
-    return RB_BOOL(clang_isFileMultipleIncludeGuarded(DATA_PTR(self), DATA_PTR(file)));
+    return RB_BOOL(clang_isFileMultipleIncludeGuarded(rb_tu_unit(self), *rb_file_ptr(file)));
 }
 
 static VALUE tu_resource_usage(VALUE self)
 {
-    CXTUResourceUsage usage = clang_getCXTUResourceUsage(DATA_PTR(self));
+    CXTUResourceUsage usage = clang_getCXTUResourceUsage(rb_tu_unit(self));
     VALUE key, value, hash = rb_hash_new();
     for (unsigned i = 0; i < usage.numEntries; i++)
     {
@@ -260,7 +714,7 @@ static VALUE tu_resource_usage(VALUE self)
 
 static VALUE tu_target_info(VALUE self)
 {
-    CXTargetInfo info = clang_getTranslationUnitTargetInfo(DATA_PTR(self));
+    CXTargetInfo info = clang_getTranslationUnitTargetInfo(rb_tu_unit(self));
     VALUE hash = rb_hash_new();
 
     rb_hash_aset(hash, STR2SYM("platform"), RUBYSTR(clang_TargetInfo_getTriple(info)));
@@ -275,59 +729,60 @@ static VALUE tu_code_complete(int argc, VALUE *argv, VALUE self)
     VALUE filename, line, column, unsaved, options;
     rb_scan_args(argc, argv, "4*", &filename, &line, &column, &unsaved, &options);
 
-    const char *path = StringValueCStr(filename);
-    unsigned int l = NUM2UINT(line), c = UINT2NUM(column); 
-    unsigned int num_unsaved = RTEST(unsaved) ? rb_array_len(unsaved) : 0;
-    struct CXUnsavedFile files[num_unsaved];
-    for (unsigned i = 0; i < num_unsaved; i++)
-    {
-        VALUE f = rb_ary_entry(unsaved, i);
-        rb_assert_type(f, rb_cCXUnsavedFile);
-        files[i] = *(struct CXUnsavedFile*)DATA_PTR(f);
-    }
-
-    unsigned int opts;
+    tu_call call = {.line = NUM2UINT(line), .column = NUM2UINT(column)};
     if (NIL_P(options) || rb_array_len(options) == 0)
-        opts = clang_defaultCodeCompleteOptions();
+        call.options = clang_defaultCodeCompleteOptions();
     else
-        opts = rb_enum_mask(rb_CodeCompleteFlags, options);
+        call.options = rb_enum_mask(rb_CodeCompleteFlags, options);
 
-    CXCodeCompleteResults *results = clang_codeCompleteAt(DATA_PTR(self), path, l, c, files, num_unsaved, opts);
-    return results ? Data_Wrap_Struct(rb_cCXCodeCompleteResults, NULL, (RUBY_DATA_FUNC) clang_disposeCodeCompleteResults, results) : Qnil;
+    // The filename and unsaved files are copied, as their strings may change while the GVL is released
+    rb_tu_args_init(&call.args, filename, Qnil, unsaved);
+    call.path = call.args.source;
+    tu_call_locked(self, tu_code_complete_nogvl, &call, 0);
+
+    rb_tu_update_memsize(self);
+    return call.results ? rb_results_wrap(call.results) : Qnil;
 }
 
 static void tu_inclusion_visitor(CXFile included_file, CXSourceLocation *inclusion_stack, unsigned include_len, CXClientData client_data)
 {
-    VALUE proc = *(VALUE*)client_data;
+    VALUE proc = ((VALUE*)client_data)[0], unit = ((VALUE*)client_data)[1];
 
     VALUE stack = rb_ary_new_capa(include_len);
     for (unsigned i = 0; i < include_len; i++)
-    {
-        CXSourceLocation *location = ALLOC(CXSourceLocation);
-        *location = inclusion_stack[i];
-        rb_ary_store(stack, i, Data_Wrap_Struct(rb_cCXSourceLocation, NULL, RUBY_DEFAULT_FREE, location));
-    }
+        rb_ary_store(stack, i, rb_location_wrap(rb_cCXSourceLocation, inclusion_stack[i], unit));
 
-    VALUE file = Data_Wrap_Struct(rb_cCXFile, NULL, RUBY_NEVER_FREE, included_file);
+    VALUE file = rb_file_wrap(rb_cCXFile, included_file, unit);
     rb_proc_call(proc, rb_ary_new_from_args(2, file, stack));
 }
 
+static VALUE tu_inclusions_run(VALUE data)
+{
+    VALUE *context = (VALUE *) data;
+    clang_getInclusions(rb_tu_unit(context[1]), tu_inclusion_visitor, context);
+    return Qnil;
+}
+
 static VALUE tu_inclusions(VALUE self)
 {
     rb_need_block();
-    VALUE proc = rb_block_proc();
-    clang_getInclusions(DATA_PTR(self), tu_inclusion_visitor, &proc);
-    return Qnil;
+    VALUE context[2] = {rb_block_proc(), self};
+    return rb_tu_locked(self, tu_inclusions_run, (VALUE) context);
 }
 
 
 void Init_clang_translation_unit(void)
 {
+    id_index = rb_intern("@index");
+    rb_define_alloc_func(rb_cCXTranslationUnit, tu_alloc);
+
     rb_define_singleton_methodm1(rb_cCXTranslationUnit, "parse", tu_parse, -1);
     rb_define_singleton_methodm1(rb_cCXTranslationUnit, "from_source", tu_from_source, -1);
     rb_define_singleton_method0(rb_cCXTranslationUnit, "default_options", tu_default_options, 0);
 
     rb_define_method2(rb_cCXTranslationUnit, "initialize", tu_initialize, 2);
+    rb_define_method0(rb_cCXTranslationUnit, "dispose", tu_dispose, 0);
+    rb_define_method0(rb_cCXTranslationUnit, "disposed?", tu_is_disposed, 0);
     rb_define_method0(rb_cCXTranslationUnit, "default_save_options", tu_default_save_options, 0);
     rb_define_method0(rb_cCXTranslationUnit, "default_reparse_options", tu_default_reparse_options, 0);
     rb_define_methodm1(rb_cCXTranslationUnit, "save", tu_save, -1);
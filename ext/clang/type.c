@@ -1,8 +1,14 @@
 #include "clang.h"
 
+// Types derived from another share its translation unit, where an invalid type is returned as nil
+static inline VALUE type_derive(VALUE self, CXType type)
+{
+    return type.kind == CXType_Invalid ? Qnil : rb_type_wrap(CLASS_OF(self), type, rb_type_unit(self));
+}
+
 static VALUE type_spelling(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     CXString str = clang_getTypeSpelling(*type);
     return RUBYSTR(str);
 }
@@ -12,172 +18,141 @@ static VALUE type_equal(VALUE self, VALUE other)
     if (CLASS_OF(self) != CLASS_OF(other))
         return Qfalse;
 
-    CXType *t1 = DATA_PTR(self), *t2 = DATA_PTR(other);
+    CXType *t1 = &rb_type_record(self)->value, *t2 = &rb_type_record(other)->value;
     return RB_BOOL(clang_equalTypes(*t1, *t2));
 }
 
 static VALUE type_canonical(VALUE self)
 {
-    CXType *t = DATA_PTR(self), *canonical = ALLOC(CXType);
-    *canonical = clang_getCanonicalType(*t);
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, canonical);
+    CXType *t = rb_type_ptr(self);
+    return rb_type_wrap(CLASS_OF(self), clang_getCanonicalType(*t), rb_type_unit(self));
 }
 
 static VALUE type_is_const(VALUE self)
 {
-    CXType *t = DATA_PTR(self);
+    CXType *t = rb_type_ptr(self);
     return RB_BOOL(clang_isConstQualifiedType(*t));
 }
 
 static VALUE type_is_volatile(VALUE self)
 {
-    CXType *t = DATA_PTR(self);
+    CXType *t = rb_type_ptr(self);
     return RB_BOOL(clang_isVolatileQualifiedType(*t));
 }
 
 static VALUE type_is_restrict(VALUE self)
 {
-    CXType *t = DATA_PTR(self);
+    CXType *t = rb_type_ptr(self);
     return RB_BOOL(clang_isRestrictQualifiedType(*t));
 }
 
 static VALUE type_typedef_name(VALUE self)
 {
-    CXType *t = DATA_PTR(self);
+    CXType *t = rb_type_ptr(self);
     return RUBYSTR(clang_getTypedefName(*t));
 }
 
 static VALUE type_pointee(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *pointee = ALLOC(CXType);
-    *pointee = clang_getPointeeType(*type);
-    if (pointee->kind == CXType_Invalid)
-    {
-        xfree(pointee);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, pointee);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_getPointeeType(*type));
 }
 
 static VALUE type_declaration(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
-    CXCursor *cursor = ALLOC(CXCursor);
-    *cursor = clang_getTypeDeclaration(*type);
-    return Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, cursor);
+    CXType *type = rb_type_ptr(self);
+    return rb_cursor_wrap(rb_cCXCursor, clang_getTypeDeclaration(*type), rb_type_unit(self));
 }
 
 static VALUE type_kind_spelling(VALUE self)
 {
-    CXString str = clang_getTypeKindSpelling(((CXType*)DATA_PTR(self))->kind);
+    CXString str = clang_getTypeKindSpelling(rb_type_ptr(self)->kind);
     return RUBYSTR(str);
 }
 
 static VALUE type_calling_conv(VALUE self)
 {
-    enum CXCallingConv conv = clang_getFunctionTypeCallingConv(*((CXType*)DATA_PTR(self)));
+    enum CXCallingConv conv = clang_getFunctionTypeCallingConv(*rb_type_ptr(self));
     return rb_enum_symbol(rb_CallingConv, conv);
 }
 
 static VALUE type_result_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *result = ALLOC(CXType);
-    *result = clang_getResultType(*type);
-    if (result->kind == CXType_Invalid)
-    {
-        xfree(result);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, result);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_getResultType(*type));
 }
 
 static VALUE type_arg_count(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return INT2NUM(clang_getNumArgTypes(*type));
 }
 
 static VALUE type_arg_types(VALUE self)
 {
-    CXType type = *(CXType*) DATA_PTR(self);
+    CXType type = *rb_type_ptr(self);
     int n = clang_getNumArgTypes(type);
     if (n <= 0)
         return rb_ary_new_capa(0);
 
     VALUE ary = rb_ary_new_capa(n);
     for (int i = 0; i < n; i++)
-    {
-        CXType *arg = ALLOC(CXType);
-        *arg = clang_getArgType(type, i);
-        rb_ary_store(ary, i, Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, arg));
-    }
+        rb_ary_store(ary, i, rb_type_wrap(CLASS_OF(self), clang_getArgType(type, i), rb_type_unit(self)));
     return ary;
 }
 
 static VALUE type_is_variadic_args(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return RB_BOOL(clang_isFunctionTypeVariadic(*type));
 }
 
 static VALUE type_is_pod(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return RB_BOOL(clang_isPODType(*type));
 }
 
 static VALUE type_element_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *element = ALLOC(CXType);
-    *element = clang_getElementType(*type);
-    if (element->kind == CXType_Invalid)
-    {
-        xfree(element);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, element);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_getElementType(*type));
 }
 
 static VALUE type_element_count(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return LL2NUM(clang_getNumElements(*type));
 }
 
 static VALUE type_array_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *element = ALLOC(CXType);
-    *element = clang_getArrayElementType(*type);
-    if (element->kind == CXType_Invalid)
-    {
-        xfree(element);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, element);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_getArrayElementType(*type));
 }
 
 static VALUE type_array_size(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return LL2NUM(clang_getArraySize(*type));
 }
 
 static VALUE type_nullability(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     enum CXTypeNullabilityKind kind = clang_Type_getNullability(*type);
     return rb_enum_symbol(rb_TypeNullabilityKind, kind);
 }
 
 static VALUE type_sizeof(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return LL2NUM(clang_Type_getSizeOf(*type));
 }
 
 static VALUE type_alignof(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return LL2NUM(clang_Type_getAlignOf(*type));
 }
 
@@ -187,103 +162,84 @@ static VALUE type_offsetof(VALUE self, VALUE field)
         rb_raise(rb_eArgError, "field name cannot be nil");
 
     const char *name = StringValueCStr(field);
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     return LL2NUM(clang_Type_getOffsetOf(*type, name));
 }
 
 static VALUE type_modified_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *result = ALLOC(CXType);
-    *result = clang_Type_getModifiedType(*type);
-    if (result->kind == CXType_Invalid)
-    {
-        xfree(result);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, result);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_Type_getModifiedType(*type));
 }
 
 static VALUE type_value_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *result = ALLOC(CXType);
-    *result = clang_Type_getValueType(*type);
-    if (result->kind == CXType_Invalid)
-    {
-        xfree(result);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, result);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_Type_getValueType(*type));
 }
 
 static VALUE type_class_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *result = ALLOC(CXType);
-    *result = clang_Type_getClassType(*type);
-    if (result->kind == CXType_Invalid)
-    {
-        xfree(result);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, result);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_Type_getClassType(*type));
 }
 
 static VALUE type_address_space(VALUE self)
 {
-    return UINT2NUM(clang_getAddressSpace(*(CXType*)DATA_PTR(self)));
+    return UINT2NUM(clang_getAddressSpace(*rb_type_ptr(self)));
 }
 
 static VALUE type_named_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *named = ALLOC(CXType);
-    *named = clang_Type_getNamedType(*type);
-    if (named->kind == CXType_Invalid)
-    {
-        xfree(named);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, named);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_Type_getNamedType(*type));
 }
 
 static VALUE type_ref_qualifier(VALUE self)
 {
-    enum CXRefQualifierKind kind = clang_Type_getCXXRefQualifier(*(CXType*)DATA_PTR(self));
+    enum CXRefQualifierKind kind = clang_Type_getCXXRefQualifier(*rb_type_ptr(self));
     return rb_enum_symbol(rb_RefQualifierKind, kind);
 }
 
 static VALUE type_is_transparent(VALUE self)
 {
-    return RB_BOOL(clang_Type_isTransparentTagTypedef(*(CXType*)DATA_PTR(self)));
+    return RB_BOOL(clang_Type_isTransparentTagTypedef(*rb_type_ptr(self)));
 }
 
 static VALUE type_obj_c_encoding(VALUE self)
 {
-    return RUBYSTR(clang_Type_getObjCEncoding(*(CXType*)DATA_PTR(self)));
+    return RUBYSTR(clang_Type_getObjCEncoding(*rb_type_ptr(self)));
 }
 
 static enum CXVisitorResult type_field_visitor(CXCursor cursor, CXClientData client_data)
 {
-    VALUE proc = *(VALUE*)client_data;
-
-    CXCursor *c = ALLOC(CXCursor);
-    *c = cursor;
-    VALUE result = rb_proc_call(proc, Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, c));
+    VALUE proc = ((VALUE*)client_data)[0], unit = ((VALUE*)client_data)[1];
+    VALUE result = rb_proc_call(proc, rb_cursor_wrap(rb_cCXCursor, cursor, unit));
 
+    if (rb_tu_is_disposed(unit))
+        return CXVisit_Break;
     if (SYMBOL_P(result))
         return SYM2ID(result) == rb_intern("break") ? CXVisit_Break : CXVisit_Continue;
     return CXVisit_Continue;
 }
 
+static VALUE type_visit_fields_run(VALUE data)
+{
+    VALUE *context = (VALUE *) data;
+    clang_Type_visitFields(*rb_type_ptr(context[2]), type_field_visitor, context);
+    return Qnil;
+}
+
 static VALUE type_visit_fields(VALUE self)
 {
     rb_need_block();
-    VALUE proc = rb_block_proc();
-    clang_Type_visitFields(*(CXType*)DATA_PTR(self), type_field_visitor, &proc);
-    return Qnil;
+    VALUE context[3] = {rb_block_proc(), rb_type_unit(self), self};
+    return rb_tu_locked(context[1], type_visit_fields_run, (VALUE) context);
 }
 
 static VALUE type_exception_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self);
+    CXType *type = rb_type_ptr(self);
     enum CXCursor_ExceptionSpecificationKind kind = clang_getExceptionSpecificationType(*type);
     if (kind < 0)
         return STR2SYM("invalid");
@@ -292,42 +248,28 @@ static VALUE type_exception_type(VALUE self)
 
 static VALUE type_obj_c_base_type(VALUE self)
 {
-    CXType *type = DATA_PTR(self), *base_type = ALLOC(CXType);
-    *base_type = clang_Type_getObjCObjectBaseType(*type);
-    if (base_type->kind == CXType_Invalid)
-    {
-        xfree(base_type);
-        return Qnil;
-    }
-    return Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, base_type);
+    CXType *type = rb_type_ptr(self);
+    return type_derive(self, clang_Type_getObjCObjectBaseType(*type));
 }
 
 static VALUE type_each_obj_c_arg(VALUE self)
 {
-    CXType type = *(CXType*)DATA_PTR(self);
+    CXType type = *rb_type_ptr(self);
     unsigned int n = clang_Type_getNumObjCTypeArgs(type);
 
     for (unsigned i = 0; i < n; i++)
-    {
-        CXType *arg = ALLOC(CXType);
-        *arg = clang_Type_getObjCTypeArg(type, i);
-        rb_yield(Data_Wrap_Struct(CLASS_OF(self), NULL, RUBY_DEFAULT_FREE, arg));
-    }
+        rb_yield(rb_type_wrap(CLASS_OF(self), clang_Type_getObjCTypeArg(type, i), rb_type_unit(self)));
 
     return self;
 }
 
 static VALUE type_each_obj_c_protocol(VALUE self)
 {
-    CXType type = *(CXType*)DATA_PTR(self);
+    CXType type = *rb_type_ptr(self);
     unsigned int n = clang_Type_getNumObjCProtocolRefs(type);
 
     for (unsigned i = 0; i < n; i++)
-    {
-        CXCursor *arg = ALLOC(CXCursor);
-        *arg = clang_Type_getObjCProtocolDecl(type, i);
-        rb_yield(Data_Wrap_Struct(rb_cCXCursor, NULL, RUBY_DEFAULT_FREE, arg));
-    }
+        rb_yield(rb_cursor_wrap(rb_cCXCursor, clang_Type_getObjCProtocolDecl(type, i), rb_type_unit(self)));
 
     return self;
 }
@@ -369,7 +311,7 @@ void Init_clang_type(void)
     rb_define_method0(rb_cCXType, "restrict?", type_is_restrict, 0);
     rb_define_method0(rb_cCXType, "pod?", type_is_pod, 0);
     rb_define_method0(rb_cCXType, "transparent?", type_is_transparent, 0);
-    rb_define_method0(rb_cCXCursor, "exception_type", type_exception_type, 0);
+    rb_define_method0(rb_cCXType, "exception_type", type_exception_type, 0);
 
     rb_define_method0(rb_cCXType, "typedef_name", type_typedef_name, 0);
     rb_define_method1(rb_cCXType, "==", type_equal, 1);
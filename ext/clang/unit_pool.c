@@ -0,0 +1,396 @@
+#include "clang.h"
+
+// Units are kept in a Hash in order of use, least recent first, which is the order they are suspended and disposed in.
+// The unsaved files a unit was stored with are kept alongside it, to resume it with the same contents.
+typedef struct
+{
+    VALUE units;
+    VALUE suspended;
+    VALUE unsaved;
+    size_t budget;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long suspends;
+    unsigned long long resumes;
+    unsigned long long evictions;
+} rb_unit_pool;
+
+static void pool_mark(void *data)
+{
+    rb_unit_pool *pool = data;
+    rb_gc_mark(pool->units);
+    rb_gc_mark(pool->suspended);
+    rb_gc_mark(pool->unsaved);
+}
+
+static const rb_data_type_t pool_type = {
+    "Clang::UnitPool",
+    {pool_mark, RUBY_TYPED_DEFAULT_FREE, NULL},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_unit_pool *pool_ptr(VALUE self)
+{
+    rb_unit_pool *pool = rb_check_typeddata(self, &pool_type);
+    if (NIL_P(pool->units))
+        rb_raise(rb_eRuntimeError, "unit pool is not initialized");
+    return pool;
+}
+
+static size_t pool_unit_memsize(VALUE unit)
+{
+    return ((rb_tu *) RTYPEDDATA_DATA(unit))->memsize;
+}
+
+static int pool_collect_i(VALUE key, VALUE unit, VALUE ary)
+{
+    rb_ary_push(ary, rb_assoc_new(key, unit));
+    return ST_CONTINUE;
+}
+
+// A snapshot of the entries, least recently used first, so that the pool can be modified while walking it
+static VALUE pool_entries(const rb_unit_pool *pool)
+{
+    VALUE ary = rb_ary_new_capa(RHASH_SIZE(pool->units));
+    rb_hash_foreach(pool->units, pool_collect_i, ary);
+    return ary;
+}
+
+static size_t pool_total(const rb_unit_pool *pool, VALUE entries)
+{
+    size_t total = 0;
+    for (long i = 0; i < RARRAY_LEN(entries); i++)
+    {
+        VALUE unit = rb_ary_entry(rb_ary_entry(entries, i), 1);
+        if (!rb_tu_is_disposed(unit))
+            total += pool_unit_memsize(unit);
+    }
+    return total;
+}
+
+static void pool_remove(rb_unit_pool *pool, VALUE key)
+{
+    rb_hash_delete(pool->units, key);
+    rb_hash_delete(pool->suspended, key);
+    rb_hash_delete(pool->unsaved, key);
+}
+
+static void pool_dispose(VALUE unit)
+{
+    if (!rb_tu_is_disposed(unit))
+        rb_funcall(unit, rb_intern("dispose"), 0);
+}
+
+// Suspends the least recently used units until the pool fits its budget, then disposes the coldest suspended ones
+static void pool_trim(rb_unit_pool *pool, VALUE keep)
+{
+    if (!pool->budget)
+        return;
+
+    VALUE entries = pool_entries(pool);
+    size_t total = pool_total(pool, entries);
+    long count = RARRAY_LEN(entries);
+
+    for (long i = 0; i < count && total > pool->budget; i++)
+    {
+        VALUE key = rb_ary_entry(rb_ary_entry(entries, i), 0);
+        VALUE unit = rb_ary_entry(rb_ary_entry(entries, i), 1);
+        if (unit == keep || rb_tu_is_disposed(unit) || RTEST(rb_hash_lookup(pool->suspended, key)))
+            continue;
+
+        // A unit that is in use, such as one being traversed, is left for a later trim rather than waited for
+        if (rb_tu_is_locked(unit))
+            continue;
+
+        size_t before = pool_unit_memsize(unit);
+        if (RTEST(rb_funcall(unit, rb_intern("suspend"), 0)))
+        {
+            total -= before - pool_unit_memsize(unit);
+            rb_hash_aset(pool->suspended, key, Qtrue);
+            pool->suspends++;
+        }
+    }
+
+    for (long i = 0; i < count && total > pool->budget; i++)
+    {
+        VALUE key = rb_ary_entry(rb_ary_entry(entries, i), 0);
+        VALUE unit = rb_ary_entry(rb_ary_entry(entries, i), 1);
+        if (unit == keep)
+            continue;
+        if (rb_tu_is_disposed(unit))
+        {
+            pool_remove(pool, key);
+            continue;
+        }
+
+        // Only units the first pass could suspend are disposed, never one that is in use
+        if (!RTEST(rb_hash_lookup(pool->suspended, key)) || rb_tu_is_locked(unit))
+            continue;
+
+        total -= pool_unit_memsize(unit);
+        pool_remove(pool, key);
+        pool_dispose(unit);
+        pool->evictions++;
+    }
+
+    RB_GC_GUARD(entries);
+}
+
+static size_t pool_budget(VALUE budget)
+{
+    if (NIL_P(budget))
+        return 0;
+
+    long long n = NUM2LL(budget);
+    if (n <= 0)
+        rb_raise(rb_eArgError, "budget must be greater than 0");
+    return (size_t) n;
+}
+
+static VALUE pool_alloc(VALUE klass)
+{
+    rb_unit_pool *pool;
+    VALUE obj = TypedData_Make_Struct(klass, rb_unit_pool, &pool_type, pool);
+    pool->units = Qnil;
+    pool->suspended = Qnil;
+    pool->unsaved = Qnil;
+    return obj;
+}
+
+static VALUE pool_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE kwargs;
+    rb_scan_args(argc, argv, ":", &kwargs);
+
+    ID keys[1] = {rb_intern("budget")};
+    VALUE budget;
+    rb_get_kwargs(kwargs, keys, 0, 1, &budget);
+
+    rb_unit_pool *pool = rb_check_typeddata(self, &pool_type);
+    pool->budget = pool_budget(budget == Qundef ? Qnil : budget);
+    RB_OBJ_WRITE(self, &pool->units, rb_hash_new());
+    RB_OBJ_WRITE(self, &pool->suspended, rb_hash_new());
+    RB_OBJ_WRITE(self, &pool->unsaved, rb_hash_new());
+    return self;
+}
+
+// Moves a unit to the most recently used end of the pool, resuming it first if it was suspended
+static VALUE pool_touch(rb_unit_pool *pool, VALUE key, VALUE unit)
+{
+    int suspended = RTEST(rb_hash_lookup(pool->suspended, key));
+    VALUE unsaved = rb_hash_lookup(pool->unsaved, key);
+    pool_remove(pool, key);
+    if (rb_tu_is_disposed(unit))
+        return Qnil;
+
+    rb_hash_aset(pool->units, key, unit);
+    if (!NIL_P(unsaved))
+        rb_hash_aset(pool->unsaved, key, unsaved);
+    if (suspended)
+    {
+        rb_funcall(unit, rb_intern("reparse"), 1, unsaved);
+        pool->resumes++;
+    }
+    return unit;
+}
+
+static VALUE pool_get(VALUE self, VALUE key)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    VALUE unit = rb_hash_lookup2(pool->units, key, Qundef);
+    if (unit != Qundef && !NIL_P(unit = pool_touch(pool, key, unit)))
+    {
+        pool->hits++;
+        pool_trim(pool, unit);
+        return unit;
+    }
+
+    pool->misses++;
+    return Qnil;
+}
+
+static VALUE pool_add(VALUE self, VALUE key, VALUE unit, VALUE unsaved)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    rb_check_typeddata(unit, &rb_tu_type);
+    rb_tu_unit(unit);
+
+    // The pool owns its units, so one that is replaced by another is disposed
+    VALUE previous = rb_hash_lookup2(pool->units, key, Qundef);
+    pool_remove(pool, key);
+    if (previous != Qundef && previous != unit)
+        pool_dispose(previous);
+
+    rb_hash_aset(pool->units, key, unit);
+    if (!NIL_P(unsaved))
+        rb_hash_aset(pool->unsaved, key, unsaved);
+    pool_trim(pool, unit);
+    return unit;
+}
+
+static VALUE pool_unsaved_option(VALUE kwargs)
+{
+    ID keys[1] = {rb_intern("unsaved")};
+    VALUE unsaved;
+    rb_get_kwargs(kwargs, keys, 0, 1, &unsaved);
+    return unsaved == Qundef ? Qnil : unsaved;
+}
+
+static VALUE pool_aset(VALUE self, VALUE key, VALUE unit)
+{
+    return pool_add(self, key, unit, Qnil);
+}
+
+static VALUE pool_store(int argc, VALUE *argv, VALUE self)
+{
+    VALUE key, unit, kwargs;
+    rb_scan_args(argc, argv, "2:", &key, &unit, &kwargs);
+    return pool_add(self, key, unit, pool_unsaved_option(kwargs));
+}
+
+static VALUE pool_fetch(int argc, VALUE *argv, VALUE self)
+{
+    VALUE key, kwargs;
+    rb_scan_args(argc, argv, "1:", &key, &kwargs);
+    VALUE unsaved = pool_unsaved_option(kwargs);
+
+    VALUE unit = pool_get(self, key);
+    if (!NIL_P(unit))
+        return unit;
+
+    if (!rb_block_given_p())
+        rb_raise(rb_eKeyError, "key not found: %" PRIsVALUE, rb_inspect(key));
+    return pool_add(self, key, rb_yield(key), unsaved);
+}
+
+static VALUE pool_delete(VALUE self, VALUE key)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    VALUE unit = rb_hash_lookup(pool->units, key);
+    pool_remove(pool, key);
+    return unit;
+}
+
+static VALUE pool_evict(VALUE self, VALUE key)
+{
+    VALUE unit = pool_delete(self, key);
+    if (NIL_P(unit))
+        return Qfalse;
+
+    pool_dispose(unit);
+    pool_ptr(self)->evictions++;
+    return Qtrue;
+}
+
+static VALUE pool_include(VALUE self, VALUE key)
+{
+    return RB_BOOL(rb_hash_lookup2(pool_ptr(self)->units, key, Qundef) != Qundef);
+}
+
+static VALUE pool_is_suspended(VALUE self, VALUE key)
+{
+    return RB_BOOL(RTEST(rb_hash_lookup(pool_ptr(self)->suspended, key)));
+}
+
+static VALUE pool_size(VALUE self)
+{
+    return SIZET2NUM(RHASH_SIZE(pool_ptr(self)->units));
+}
+
+static VALUE pool_keys(VALUE self)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    VALUE entries = pool_entries(pool);
+    for (long i = 0; i < RARRAY_LEN(entries); i++)
+        rb_ary_store(entries, i, rb_ary_entry(rb_ary_entry(entries, i), 0));
+    return entries;
+}
+
+static VALUE pool_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    VALUE entries = pool_entries(pool_ptr(self));
+    for (long i = 0; i < RARRAY_LEN(entries); i++)
+        rb_yield(rb_ary_entry(entries, i));
+    return self;
+}
+
+static VALUE pool_memsize(VALUE self)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    return SIZET2NUM(pool_total(pool, pool_entries(pool)));
+}
+
+static VALUE pool_get_budget(VALUE self)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    return pool->budget ? SIZET2NUM(pool->budget) : Qnil;
+}
+
+static VALUE pool_set_budget(VALUE self, VALUE budget)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    pool->budget = pool_budget(budget);
+    pool_trim(pool, Qundef);
+    return budget;
+}
+
+static VALUE pool_trim_m(VALUE self)
+{
+    pool_trim(pool_ptr(self), Qundef);
+    return self;
+}
+
+static VALUE pool_clear(VALUE self)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    VALUE entries = pool_entries(pool);
+    rb_hash_clear(pool->units);
+    rb_hash_clear(pool->suspended);
+    rb_hash_clear(pool->unsaved);
+    for (long i = 0; i < RARRAY_LEN(entries); i++)
+        pool_dispose(rb_ary_entry(rb_ary_entry(entries, i), 1));
+    return self;
+}
+
+static VALUE pool_stats(VALUE self)
+{
+    rb_unit_pool *pool = pool_ptr(self);
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, STR2SYM("hits"), ULL2NUM(pool->hits));
+    rb_hash_aset(hash, STR2SYM("misses"), ULL2NUM(pool->misses));
+    rb_hash_aset(hash, STR2SYM("suspends"), ULL2NUM(pool->suspends));
+    rb_hash_aset(hash, STR2SYM("resumes"), ULL2NUM(pool->resumes));
+    rb_hash_aset(hash, STR2SYM("evictions"), ULL2NUM(pool->evictions));
+    rb_hash_aset(hash, STR2SYM("units"), SIZET2NUM(RHASH_SIZE(pool->units)));
+    rb_hash_aset(hash, STR2SYM("suspended"), SIZET2NUM(RHASH_SIZE(pool->suspended)));
+    rb_hash_aset(hash, STR2SYM("memsize"), SIZET2NUM(pool_total(pool, pool_entries(pool))));
+    return hash;
+}
+
+void Init_clang_unit_pool(void)
+{
+    rb_define_alloc_func(rb_cCXUnitPool, pool_alloc);
+    rb_include_module(rb_cCXUnitPool, rb_mEnumerable);
+    rb_define_methodm1(rb_cCXUnitPool, "initialize", pool_initialize, -1);
+    rb_define_method1(rb_cCXUnitPool, "[]", pool_get, 1);
+    rb_define_method2(rb_cCXUnitPool, "[]=", pool_aset, 2);
+    rb_define_methodm1(rb_cCXUnitPool, "store", pool_store, -1);
+    rb_define_methodm1(rb_cCXUnitPool, "fetch", pool_fetch, -1);
+    rb_define_method1(rb_cCXUnitPool, "delete", pool_delete, 1);
+    rb_define_method1(rb_cCXUnitPool, "evict", pool_evict, 1);
+    rb_define_method1(rb_cCXUnitPool, "include?", pool_include, 1);
+    rb_define_method1(rb_cCXUnitPool, "suspended?", pool_is_suspended, 1);
+    rb_define_method0(rb_cCXUnitPool, "size", pool_size, 0);
+    rb_define_method0(rb_cCXUnitPool, "keys", pool_keys, 0);
+    rb_define_method0(rb_cCXUnitPool, "each", pool_each, 0);
+    rb_define_method0(rb_cCXUnitPool, "memsize", pool_memsize, 0);
+    rb_define_method0(rb_cCXUnitPool, "budget", pool_get_budget, 0);
+    rb_define_method1(rb_cCXUnitPool, "budget=", pool_set_budget, 1);
+    rb_define_method0(rb_cCXUnitPool, "trim", pool_trim_m, 0);
+    rb_define_method0(rb_cCXUnitPool, "clear", pool_clear, 0);
+    rb_define_method0(rb_cCXUnitPool, "stats", pool_stats, 0);
+    rb_define_alias(rb_cCXUnitPool, "length", "size");
+}
@@ -0,0 +1,197 @@
+#include "clang.h"
+
+static void set_mark(void *data)
+{
+    rb_gc_mark(((rb_unsaved_set *) data)->entries);
+}
+
+static void set_free(void *data)
+{
+    rb_unsaved_set *set = data;
+    xfree(set->files);
+    xfree(set);
+}
+
+static size_t set_memsize(const void *data)
+{
+    const rb_unsaved_set *set = data;
+    return sizeof(rb_unsaved_set) + sizeof(struct CXUnsavedFile) * set->count;
+}
+
+const rb_data_type_t rb_unsaved_set_type = {
+    "Clang::UnsavedFileSet",
+    {set_mark, set_free, set_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static rb_unsaved_set *set_ptr(VALUE self)
+{
+    return rb_check_typeddata(self, &rb_unsaved_set_type);
+}
+
+VALUE rb_unsaved_ary(VALUE unsaved)
+{
+    if (!RTEST(unsaved))
+        return rb_ary_new();
+    if (rb_typeddata_is_kind_of(unsaved, &rb_unsaved_set_type))
+        return set_ptr(unsaved)->entries;
+    return rb_Array(unsaved);
+}
+
+static const rb_unsaved *set_entry(VALUE file)
+{
+    const rb_unsaved *unsaved = rb_check_typeddata(file, &rb_unsaved_type);
+    if (!unsaved->file.Filename)
+        rb_raise(rb_eArgError, "unsaved file is not initialized");
+    return unsaved;
+}
+
+static VALUE set_alloc(VALUE klass)
+{
+    rb_unsaved_set *set;
+    VALUE obj = TypedData_Make_Struct(klass, rb_unsaved_set, &rb_unsaved_set_type, set);
+    set->entries = rb_ary_freeze(rb_ary_new());
+    return obj;
+}
+
+// The files are copied once, pointing at contents that never move, and the set is frozen so that they can be handed
+// to libclang without holding the GVL
+static VALUE set_build(VALUE self, VALUE entries)
+{
+    rb_unsaved_set *set = set_ptr(self);
+    if (set->files)
+        rb_raise(rb_eRuntimeError, "unsaved file set is already initialized");
+
+    entries = rb_ary_dup(entries);
+    long count = RARRAY_LEN(entries);
+    for (long i = 0; i < count; i++)
+        set_entry(RARRAY_AREF(entries, i));
+
+    set->files = ALLOC_N(struct CXUnsavedFile, count ? count : 1);
+    for (long i = 0; i < count; i++)
+        set->files[i] = *(struct CXUnsavedFile *) RTYPEDDATA_DATA(RARRAY_AREF(entries, i));
+    set->count = (unsigned int) count;
+
+    RB_OBJ_WRITE(self, &set->entries, rb_ary_freeze(entries));
+    return rb_obj_freeze(self);
+}
+
+static VALUE set_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE files;
+    rb_scan_args(argc, argv, "01", &files);
+    return set_build(self, NIL_P(files) ? rb_ary_new() : rb_Array(files));
+}
+
+static int set_find(VALUE entries, const char *filename)
+{
+    for (long i = 0; i < RARRAY_LEN(entries); i++)
+    {
+        const rb_unsaved *unsaved = RTYPEDDATA_DATA(RARRAY_AREF(entries, i));
+        if (strcmp(unsaved->file.Filename, filename) == 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+static VALUE set_merge(int argc, VALUE *argv, VALUE self)
+{
+    rb_unsaved_set *set = set_ptr(self);
+    VALUE entries = rb_ary_dup(set->entries);
+
+    for (int i = 0; i < argc; i++)
+    {
+        VALUE files = rb_typeddata_is_kind_of(argv[i], &rb_unsaved_set_type) ? set_ptr(argv[i])->entries
+                                                                              : rb_Array(argv[i]);
+        for (long j = 0; j < RARRAY_LEN(files); j++)
+        {
+            VALUE file = RARRAY_AREF(files, j);
+            int index = set_find(entries, set_entry(file)->file.Filename);
+            if (index < 0)
+                rb_ary_push(entries, file);
+            else
+                rb_ary_store(entries, index, file);
+        }
+    }
+
+    return set_build(set_alloc(CLASS_OF(self)), entries);
+}
+
+static VALUE set_except(int argc, VALUE *argv, VALUE self)
+{
+    rb_unsaved_set *set = set_ptr(self);
+    VALUE entries = rb_ary_dup(set->entries);
+
+    for (int i = 0; i < argc; i++)
+    {
+        VALUE path = rb_get_path(argv[i]);
+        int index = set_find(entries, StringValueCStr(path));
+        if (index >= 0)
+            rb_ary_delete_at(entries, index);
+    }
+
+    return set_build(set_alloc(CLASS_OF(self)), entries);
+}
+
+static VALUE set_get(VALUE self, VALUE key)
+{
+    rb_unsaved_set *set = set_ptr(self);
+    if (FIXNUM_P(key))
+        return rb_ary_entry(set->entries, FIX2LONG(key));
+
+    VALUE path = rb_get_path(key);
+    int index = set_find(set->entries, StringValueCStr(path));
+    return index < 0 ? Qnil : RARRAY_AREF(set->entries, index);
+}
+
+static VALUE set_include(VALUE self, VALUE filename)
+{
+    VALUE path = rb_get_path(filename);
+    return RB_BOOL(set_find(set_ptr(self)->entries, StringValueCStr(path)) >= 0);
+}
+
+static VALUE set_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    VALUE entries = set_ptr(self)->entries;
+    for (long i = 0; i < RARRAY_LEN(entries); i++)
+        rb_yield(RARRAY_AREF(entries, i));
+    return self;
+}
+
+static VALUE set_to_a(VALUE self)
+{
+    return rb_ary_dup(set_ptr(self)->entries);
+}
+
+static VALUE set_size(VALUE self)
+{
+    return UINT2NUM(set_ptr(self)->count);
+}
+
+static VALUE set_bytesize(VALUE self)
+{
+    rb_unsaved_set *set = set_ptr(self);
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < set->count; i++)
+        total += set->files[i].Length;
+    return ULL2NUM(total);
+}
+
+void Init_clang_unsaved_file_set(void)
+{
+    rb_define_alloc_func(rb_cCXUnsavedFileSet, set_alloc);
+    rb_include_module(rb_cCXUnsavedFileSet, rb_mEnumerable);
+    rb_define_methodm1(rb_cCXUnsavedFileSet, "initialize", set_initialize, -1);
+    rb_define_methodm1(rb_cCXUnsavedFileSet, "merge", set_merge, -1);
+    rb_define_methodm1(rb_cCXUnsavedFileSet, "except", set_except, -1);
+    rb_define_method1(rb_cCXUnsavedFileSet, "[]", set_get, 1);
+    rb_define_method1(rb_cCXUnsavedFileSet, "include?", set_include, 1);
+    rb_define_method0(rb_cCXUnsavedFileSet, "each", set_each, 0);
+    rb_define_method0(rb_cCXUnsavedFileSet, "to_a", set_to_a, 0);
+    rb_define_method0(rb_cCXUnsavedFileSet, "size", set_size, 0);
+    rb_define_method0(rb_cCXUnsavedFileSet, "bytesize", set_bytesize, 0);
+    rb_define_alias(rb_cCXUnsavedFileSet, "length", "size");
+}
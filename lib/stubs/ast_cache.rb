@@ -0,0 +1,95 @@
+module Clang
+
+  ##
+  # A directory of serialized ASTs that lets unchanged sources be loaded instead of parsed again.
+  #
+  # Entries are keyed by a hash of the source, command-line arguments, unsaved files, parse options and Clang version.
+  # Each entry records the modification time (see {File#time}) and size of every file the source included, and is only
+  # used while all of them are unchanged.
+  #
+  # Files are written under temporary names and renamed into place, so several processes may share a directory. Once
+  # written, an AST is never modified. It is removed when a changed dependency replaces it with a new one, and the least
+  # recently used entries are removed when the cache grows beyond {#max_bytes}.
+  #
+  # @example Reuse ASTs across runs
+  #   cache = Clang::ASTCache.new(index, '.cache/ast', max_bytes: 512 * 1024 * 1024)
+  #   unit = cache.fetch('main.c', %w[-std=c17 -Iinclude])
+  class ASTCache
+
+    ##
+    # Creates a new cache, creating its directory if it does not exist.
+    #
+    # @param index [Index] The index units are parsed and loaded with.
+    # @param directory [String] The directory the ASTs are stored in.
+    # @param max_bytes [Integer?] The size the cache is pruned to after each store, or `nil` for no limit.
+    def initialize(index, directory, max_bytes: nil)
+    end
+
+    ##
+    # @return [Index] the index units are parsed and loaded with.
+    def index
+    end
+
+    ##
+    # @return [String] the directory the ASTs are stored in.
+    def directory
+    end
+
+    ##
+    # @return [Integer?] the size the cache is pruned to, or `nil` for no limit.
+    attr_accessor :max_bytes
+
+    ##
+    # Loads the translation unit of a source from the cache, or parses and caches it.
+    #
+    # @param source [String?] The name of the source file to parse.
+    # @param command_args [Array<String>?] The command-line arguments that would be passed to the `clang` executable.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk.
+    # @param options [Symbol,Array<Symbol>] A set of options that affects parsing.
+    #
+    # @return [TranslationUnit] the translation unit.
+    # @note A unit that cannot be saved, such as one with errors, is returned without being cached, and an AST that cannot
+    #   be loaded is parsed again. Exceptions raised meanwhile, such as an `Interrupt`, propagate.
+    # @see TranslationUnit.parse
+    def fetch(source, command_args = nil, unsaved = nil, *options)
+    end
+
+    ##
+    # @param source [String?] The name of the source file.
+    # @param command_args [Array<String>?] The command-line arguments that would be passed to the `clang` executable.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk.
+    # @param options [Symbol,Array<Symbol>] A set of options that affects parsing.
+    #
+    # @return [Boolean] `true` if {#fetch} would load the unit without parsing, otherwise `false`.
+    def cached?(source, command_args = nil, unsaved = nil, *options)
+    end
+
+    ##
+    # Removes the least recently used entries until the cache is no larger than a given size. An entry is removed
+    # whole, with its dependency manifest and every AST stored for it.
+    #
+    # @param max_bytes [Integer?] The size to prune to, or `nil` to use {#max_bytes}.
+    #
+    # @return [Integer] the number of entries that were removed.
+    def prune(max_bytes = nil)
+    end
+
+    ##
+    # Removes every entry of the cache.
+    #
+    # @return [self]
+    def clear
+    end
+
+    ##
+    # @return [Integer] the size of the cache on disk, in bytes.
+    def bytesize
+    end
+
+    ##
+    # @return [Hash{Symbol=>Integer}] the number of `:hits`, `:misses`, `:stores` and `:evictions` since the cache was
+    #   created.
+    def stats
+    end
+  end
+end
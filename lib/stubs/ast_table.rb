@@ -0,0 +1,96 @@
+module Clang
+
+  ##
+  # A columnar snapshot of the abstract syntax tree of a {TranslationUnit}, created with
+  # {TranslationUnit#ast_table}.
+  #
+  # Each row describes one cursor, in pre-order, with the following columns.
+  #
+  # Column | Value
+  # --- | ---
+  # `:kind` | The kind of the cursor, see {CursorKind}.
+  # `:parent` | The row of the parent cursor, or `nil` for top-level cursors.
+  # `:file` | The file the cursor is located in, or an empty String if it has no file.
+  # `:line` | The line of the cursor location.
+  # `:column` | The column of the cursor location.
+  # `:offset` | The byte offset of the cursor location within its file.
+  # `:spelling` | The spelling of the cursor.
+  # `:usr` | The USR of a declaration, otherwise an empty String.
+  #
+  # The table holds no reference to the translation unit, and remains valid after it has been disposed.
+  class ASTTable
+
+    include Enumerable
+
+    ##
+    # @return [Integer] the number of rows in the table.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Array<String>] the interned file names, indexed by the ids in the `:file` column.
+    def files
+    end
+
+    ##
+    # @return [Array<String>] the interned spellings and USRs, indexed by the ids in the `:spelling` and `:usr`
+    #   columns.
+    def strings
+    end
+
+    ##
+    # Retrieves a single row of the table.
+    #
+    # @param row [Integer] The index of the row, which may be negative to count from the end.
+    # @return [Hash{Symbol => Object}] the decoded columns of the row.
+    # @raise [IndexError] when the row is out of range.
+    def [](row)
+    end
+
+    ##
+    # @overload each(&block)
+    #   Yields each row of the table as a Hash of decoded columns.
+    #   @yieldparam row [Hash{Symbol => Object}] The current row.
+    #   @return [self]
+    #
+    # @overload each
+    #   @return [Enumerator]
+    def each
+    end
+
+    ##
+    # Retrieves the decoded values of a single column.
+    #
+    # @param name [Symbol] The name of the column.
+    # @return [Array] the value of the column for every row.
+    def column(name)
+    end
+
+    ##
+    # Exports a single column as a packed binary String of unsigned 32-bit integers in native byte order, which can be
+    # read with `unpack('L*')`.
+    #
+    # The `:file` column is packed as ids into {#files}, the `:spelling` and `:usr` columns as ids into {#strings}, the
+    # `:kind` column as raw {CursorKind} values, and top-level cursors have a `:parent` of `0xFFFFFFFF`.
+    #
+    # @param name [Symbol] The name of the column.
+    # @return [String] the packed column.
+    def pack(name)
+    end
+
+    ##
+    # Finds the rows matching all of the given criteria.
+    #
+    # @param kind [Symbol,Array<Symbol>?] The kinds of cursor to match.
+    # @param file [String,Array<String>?] The names of the files to match.
+    # @param parent [Integer?] The row of the parent to match, or `nil` to match top-level cursors. When omitted, the
+    #   parent is not considered.
+    #
+    # @return [Array<Integer>] the indices of the matching rows.
+    def where(kind: nil, file: nil, **parent)
+    end
+
+  end
+end
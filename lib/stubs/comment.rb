@@ -49,7 +49,8 @@ module Clang
     end
 
     ##
-    # Retrieves the {TranslationUnit} the comment is a child of.
+    # Retrieves the {TranslationUnit} the comment is a child of. This is the unit of the cursor the comment was taken
+    # from, which the comment keeps alive, and cannot be used once that unit is disposed.
     # @return [TranslationUnit] the parent translation unit.
     def translation_unit
     end
@@ -0,0 +1,88 @@
+module Clang
+
+  ##
+  # A compilation database holding all information used to compile files in a project, as described by the
+  # `compile_commands.json` file of a build directory.
+  class CompilationDatabase
+
+    ##
+    # Creates a new instance of the {CompilationDatabase} class.
+    #
+    # @param build_dir [String] The directory containing the `compile_commands.json` file.
+    #
+    # @raise [LoadError] when the database cannot be loaded from the directory.
+    # @raise [RuntimeError] when the instance was already initialized.
+    # @note The GVL is released while the database is read and parsed.
+    def initialize(build_dir)
+    end
+
+    ##
+    # @return [Integer] the total number of compile commands in the database.
+    def size
+    end
+
+    ##
+    # Retrieves the compile commands of the database.
+    #
+    # @param filename [String?] The complete path of a file to retrieve the commands of, or `nil` for all commands.
+    #
+    # @return [Array<Hash>] the commands, each with `:directory`, `:filename` and `:arguments` keys.
+    def commands(filename = nil)
+    end
+
+    ##
+    # Retrieves the working directory of each compile command.
+    #
+    # @param filename [String?] The complete path of a file to retrieve the directories of, or `nil` for all commands.
+    #
+    # @return [Array<String>] the working directories.
+    def directories(filename = nil)
+    end
+
+    ##
+    # Retrieves the source file of every compile command, relative paths being resolved against the command's
+    # working directory.
+    #
+    # @return [Array<String>] the source files.
+    def filenames
+    end
+
+    ##
+    # Retrieves the command line arguments of each compile command, including the compiler executable.
+    #
+    # @param filename [String?] The complete path of a file to retrieve the arguments of, or `nil` for all commands.
+    #
+    # @return [Array<Array<String>>] the arguments.
+    def arguments(filename = nil)
+    end
+
+    ##
+    # Parses the compile commands of the database on a pool of native threads, yielding each result as soon as it
+    # completes.
+    #
+    # Each command line is copied into native memory once, and parsed in its own working directory. Every worker
+    # thread parses with its own {Index}, which is shared by the translation units it creates. Results are yielded
+    # from the calling thread as described in {TranslationUnit.parse_all}.
+    #
+    # @overload parse_project(*options, files: nil, threads: nil, exclude_pch: false, display: false, &block)
+    #   @yieldparam filename [String] The source file that was parsed.
+    #   @yieldparam result [TranslationUnit,Exception] The translation unit, or the error that prevented its creation.
+    #   @return [self]
+    #
+    # @overload parse_project(*options, files: nil, threads: nil, exclude_pch: false, display: false)
+    #   When called without a block, returns an Enumerator for the results.
+    #   @return [Enumerator]
+    #
+    # @param options [Symbol,Array<Symbol>] A set of options that affects how the translation units are managed.
+    # @param files [Array<String>?] The complete paths of the files to parse, or `nil` to parse every command.
+    # @param threads [Integer?] The number of worker threads, which defaults to the number of online processors.
+    # @param exclude_pch [Boolean] Passed to each worker's {Index}, see {Index.create}.
+    # @param display [Boolean] Passed to each worker's {Index}, see {Index.create}.
+    #
+    # @see TranslationUnit.parse_all
+    # @see TranslationUnitFlags
+    def parse_project(*options, files: nil, threads: nil, exclude_pch: false, display: false)
+    end
+
+  end
+end
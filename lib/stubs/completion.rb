@@ -0,0 +1,99 @@
+module Clang
+
+  class CodeCompleteResults
+
+    ##
+    # Fuzzy matches the results against the text typed so far, ranking them natively.
+    #
+    # Each result is matched on its typed text, which must contain the prefix as a case-insensitive subsequence. Matches
+    # that are a prefix of the text, continue a run of matched characters, or start a word rank higher, and ties are
+    # broken by the length of the text and the priority Clang assigned to the result. An empty prefix matches every
+    # result, ordered by priority. Only the typed text and priority of each result are read, so no Ruby
+    # objects are created for results that do not make the cut.
+    #
+    # @param prefix [String] The text typed since the code-completion location.
+    # @param limit [Integer?] The maximum number of matches to return, or `nil` to return every match.
+    #
+    # @return [CompletionMatches] the matching results, best first.
+    # @see CompletionMatches#refine
+    def filter(prefix, limit: nil)
+    end
+  end
+
+  ##
+  # The results of a {CodeCompleteResults} that match a prefix, best first, created with
+  # {CodeCompleteResults#filter}.
+  #
+  # Every match is retained, not only the top `limit`, so that typing further characters can be handled with {#refine}
+  # without completing again or rescanning results that already failed to match.
+  class CompletionMatches
+
+    include Enumerable
+
+    ##
+    # Matches a new prefix. When it extends the current prefix only the current matches are rescored, otherwise all of
+    # the code completion results are filtered again.
+    #
+    # @param prefix [String] The text typed since the code-completion location.
+    # @param limit [Integer?] The maximum number of matches to return, or `nil` to return every match.
+    #
+    # @return [CompletionMatches] the matching results, best first.
+    def refine(prefix, limit: nil)
+    end
+
+    ##
+    # @return [Integer] the number of matches returned, at most the limit.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Integer] the number of results that matched the prefix, regardless of the limit.
+    def total
+    end
+
+    ##
+    # @return [String] the prefix that was matched.
+    def prefix
+    end
+
+    ##
+    # @return [CodeCompleteResults] the results the matches were taken from.
+    def results
+    end
+
+    ##
+    # @overload each(&block)
+    #   Yields each match, best first.
+    #   @yieldparam result [CompletionResult] A matching result.
+    #   @return [self]
+    #
+    # @overload each
+    #   @return [Enumerator]
+    def each
+    end
+
+    ##
+    # @param index [Integer] The rank of the match.
+    # @return [CompletionResult?] the match at the given rank, or `nil` if out of range.
+    def [](index)
+    end
+
+    ##
+    # @return [Array<String>] the typed text of each match, best first.
+    def texts
+    end
+
+    ##
+    # @return [Array<Integer>] the index of each match within {#results} at the time of filtering, best first.
+    def indices
+    end
+
+    ##
+    # @return [Array<Integer>] the score of each match, higher is better, best first. Scores only rank the matches
+    #   against each other and may be negative.
+    def scores
+    end
+  end
+end
@@ -198,7 +198,8 @@ module Clang
     end
 
     ##
-    # Returns the translation unit that a cursor originated from.
+    # Returns the translation unit that a cursor originated from, which is the same object the cursor was obtained
+    # from whenever it is known.
     # @return [TranslationUnit?] the parent translation unit this cursor is found within, or `nil` if cursor is invalid.
     def translation_unit
     end
@@ -563,6 +564,59 @@ module Clang
     def visit_children(&block)
     end
 
+    ##
+    # Retrieves the direct children of the cursor.
+    #
+    # The children are gathered natively before any object is created, which is considerably cheaper than collecting
+    # them with {#visit_children}.
+    #
+    # @return [Array<Cursor>] the children of the cursor, in order.
+    # @see descendants
+    def children
+    end
+
+    ##
+    # Retrieves the descendants of the cursor, in pre-order.
+    #
+    # @param depth [Integer?] The number of levels to descend, where `1` retrieves only the children, or `nil` for no
+    #   limit.
+    # @return [Array<Cursor>] the descendants of the cursor.
+    # @see each_descendant
+    def descendants(depth: nil)
+    end
+
+    ##
+    # Recursively visits the descendants of the cursor, yielding only those that match the given filters.
+    #
+    # The traversal and filtering are performed natively, so no objects are created for cursors that do not match.
+    # A descendant located outside the `files` is not yielded, but its own descendants are still visited, as a file may
+    # be included within a declaration of another, such as a namespace or `extern "C"` block. A descendant excluded by
+    # the `main_file_only` or `system_headers` filters is skipped along with all of its own descendants, so that the
+    # contents of headers are never walked. Matching cursors are yielded in pre-order once the traversal completes.
+    #
+    # @overload each_descendant(kinds: nil, files: nil, main_file_only: false, system_headers: true, &block)
+    #   @yieldparam cursor [Cursor] A descendant matching the filters.
+    #   @return [self]
+    #
+    # @overload each_descendant(kinds: nil, files: nil, main_file_only: false, system_headers: true)
+    #   When called without a block, returns an Enumerator for the matching descendants.
+    #   @return [Enumerator]
+    #
+    # @param kinds [Symbol,Array<Symbol>?] The kinds of cursor to yield, or `nil` to yield every kind.
+    # @param files [File,String,Array<File,String>?] The files the descendants must be located in, or `nil` for any.
+    # @param main_file_only [Boolean] `true` to only visit descendants located in the main file.
+    # @param system_headers [Boolean] `false` to skip descendants located in system headers.
+    #
+    # @example Print All Function Declarations
+    #   unit.cursor.each_descendant(kinds: :function_decl, main_file_only: true) do |func|
+    #     puts func.spelling
+    #   end
+    #
+    # @see CursorKind
+    # @see visit_children
+    def each_descendant(kinds: nil, files: nil, main_file_only: false, system_headers: true)
+    end
+
     ##
     # Given a cursor pointing to a C++ method call or an Objective-C
     # message, returns `true` if the method/message is "dynamic", meaning:
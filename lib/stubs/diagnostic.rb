@@ -47,6 +47,9 @@ module Clang
 
   ##
   # A single diagnostic, containing the information about severity, location, text, source ranges, and fix-it hints.
+  #
+  # A diagnostic keeps the set or translation unit it was taken from alive, and cannot be used once that unit is
+  # disposed.
   class Diagnostic
 
     ##
@@ -0,0 +1,118 @@
+module Clang
+
+  ##
+  # Collects the diagnostics of many translation units or serialized diagnostic sets, keeping a single exemplar of
+  # each unique diagnostic and counting its occurrences.
+  #
+  # When many translation units include the same header, a warning in that header is reported once for each of them.
+  # Diagnostics are considered the same when they share a file, offset, category and enabling option. Diagnostics
+  # without an option, such as errors, must also have the same text.
+  #
+  # Only top-level diagnostics are aggregated, and their child diagnostics, such as notes, are not kept. Each source
+  # is decoded without the GVL, and memory is bounded by {#max_unique}: once that many unique diagnostics have been
+  # seen, occurrences of those are still counted, but new ones are dropped.
+  #
+  # @example Report each header warning only once
+  #   aggregator = Clang::DiagnosticAggregator.new
+  #   Dir.glob('build/**/*.dia') { |path| aggregator.add(path) }
+  #
+  #   aggregator.sort_by { |d| -d[:count] }.each do |d|
+  #     puts "#{d[:file]}:#{d[:line]}:#{d[:column]}: #{d[:spelling]} (#{d[:count]}x in #{d[:sources]} units)"
+  #   end
+  class DiagnosticAggregator
+
+    include Enumerable
+
+    ##
+    # Creates a new, empty aggregator.
+    #
+    # @param max_unique [Integer] The maximum number of unique diagnostics to keep.
+    def initialize(max_unique: 65536)
+    end
+
+    ##
+    # Adds the top-level diagnostics of a source to the aggregator.
+    #
+    # @param source [TranslationUnit, DiagnosticSet, String] A translation unit, a diagnostic set, or the path to a
+    #   serialized diagnostics file, such as those written with `-serialize-diagnostics`.
+    # @return [Integer] the number of unique diagnostics added from the source.
+    # @raise [IOError] when the diagnostics file cannot be loaded.
+    # @note The GVL is released while the diagnostics are decoded.
+    def add(source)
+    end
+
+    ##
+    # Retrieves the exemplar of a unique diagnostic, in the order they were first seen.
+    #
+    # The exemplar is a Hash with the following keys:
+    #
+    # Key | Value
+    # --- | ---
+    # `:severity` | The highest severity of any occurrence, see {DiagnosticSeverity}.
+    # `:file` | The file the diagnostic is located in, or an empty String if it has no file.
+    # `:line` | The line of the diagnostic location.
+    # `:column` | The column of the diagnostic location.
+    # `:offset` | The byte offset of the diagnostic location within its file.
+    # `:spelling` | The text of the first occurrence.
+    # `:category` | The number of the category of the diagnostic.
+    # `:category_name` | The name of the category of the diagnostic.
+    # `:option` | The command-line option that enables the diagnostic, such as `-Wunused`.
+    # `:count` | The number of occurrences.
+    # `:sources` | The number of added sources it occurred in.
+    #
+    # @param index [Integer] The index of the diagnostic, which may be negative to count from the end.
+    # @return [Hash{Symbol => Object}, nil] the exemplar, or `nil` when the index is out of range.
+    def [](index)
+    end
+
+    ##
+    # @overload each(&block)
+    #   Yields the exemplar of each unique diagnostic, in the order they were first seen.
+    #   @yieldparam diagnostic [Hash{Symbol => Object}] The current exemplar, see {#[]}.
+    #   @return [self]
+    #
+    # @overload each
+    #   @return [Enumerator]
+    def each
+    end
+
+    ##
+    # @return [Integer] the number of unique diagnostics.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Integer] the number of diagnostics added, duplicates and dropped diagnostics included.
+    def total
+    end
+
+    ##
+    # @return [Integer] the number of diagnostics that were dropped because the aggregator was full.
+    def dropped
+    end
+
+    ##
+    # @return [Integer] the number of sources that have been added.
+    def sources
+    end
+
+    ##
+    # @return [Integer] the maximum number of unique diagnostics that are kept.
+    def max_unique
+    end
+
+    ##
+    # @return [Boolean] `true` if new unique diagnostics are being dropped, otherwise `false`.
+    def full?
+    end
+
+    ##
+    # Removes every diagnostic and resets the counters.
+    #
+    # @return [self]
+    def clear
+    end
+  end
+end
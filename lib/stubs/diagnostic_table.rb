@@ -0,0 +1,141 @@
+module Clang
+
+  ##
+  # A columnar snapshot of diagnostics, created with {TranslationUnit#diagnostics_table} or
+  # {DiagnosticSet#to_records}.
+  #
+  # Every diagnostic is decoded in a single native pass without the GVL, with each child diagnostic, such as a note,
+  # in its own row directly after its parent. Each row has the following columns.
+  #
+  # Column | Value
+  # --- | ---
+  # `:severity` | The severity of the diagnostic, see {DiagnosticSeverity}.
+  # `:parent` | The row of the parent diagnostic, or `nil` for top-level diagnostics.
+  # `:file` | The file the diagnostic is located in, or an empty String if it has no file.
+  # `:line` | The line of the diagnostic location.
+  # `:column` | The column of the diagnostic location.
+  # `:offset` | The byte offset of the diagnostic location within its file.
+  # `:spelling` | The text of the diagnostic.
+  # `:category` | The number of the category of the diagnostic.
+  # `:category_name` | The name of the category of the diagnostic.
+  # `:option` | The command-line option that enables the diagnostic, such as `-Wunused`.
+  # `:disable_option` | The command-line option that disables the diagnostic, such as `-Wno-unused`.
+  #
+  # Rows retrieved with {#[]} or {#each} also have `:ranges` and `:fixits` keys. Each range is a Hash with the `:file`,
+  # `:start_line`, `:start_column`, `:start_offset`, `:end_line`, `:end_column` and `:end_offset` keys, and each
+  # fix-it is a range with the `:replacement` text.
+  #
+  # The table holds no reference to the translation unit or set, and remains valid after either has been disposed.
+  class DiagnosticTable
+
+    include Enumerable
+
+    ##
+    # @return [Integer] the number of rows in the table.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Array<String>] the interned file names, indexed by the ids in the `:file` column.
+    def files
+    end
+
+    ##
+    # @return [Array<String>] the interned messages, category names, options and replacements, indexed by the ids in
+    #   the columns that hold them.
+    def strings
+    end
+
+    ##
+    # Retrieves a single row of the table.
+    #
+    # @param row [Integer] The index of the row, which may be negative to count from the end.
+    # @return [Hash{Symbol => Object}] the decoded columns of the row, with its ranges and fix-its.
+    # @raise [IndexError] when the row is out of range.
+    def [](row)
+    end
+
+    ##
+    # @overload each(&block)
+    #   Yields each row of the table as a Hash of decoded columns.
+    #   @yieldparam row [Hash{Symbol => Object}] The current row.
+    #   @return [self]
+    #
+    # @overload each
+    #   @return [Enumerator]
+    def each
+    end
+
+    ##
+    # Retrieves the decoded values of a single column.
+    #
+    # @param name [Symbol] The name of the column.
+    # @return [Array] the value of the column for every row.
+    def column(name)
+    end
+
+    ##
+    # Exports a single column as a packed binary String of unsigned 32-bit integers in native byte order, which can be
+    # read with `unpack('L*')`.
+    #
+    # String columns are packed as ids into {#files} or {#strings}, the `:severity` column as raw {DiagnosticSeverity}
+    # values, and top-level diagnostics have a `:parent` of `0xFFFFFFFF`.
+    #
+    # @param name [Symbol] The name of the column.
+    # @return [String] the packed column.
+    def pack(name)
+    end
+
+    ##
+    # @param row [Integer] The index of the row.
+    # @return [Array<Hash{Symbol => Object}>] the source ranges of the diagnostic.
+    def ranges(row)
+    end
+
+    ##
+    # @param row [Integer] The index of the row.
+    # @return [Array<Hash{Symbol => Object}>] the fix-its of the diagnostic.
+    def fixits(row)
+    end
+
+    ##
+    # Exports every source range as packed unsigned 32-bit integers, nine per range: the row, the file id, the start
+    # line, column and offset, the end line, column and offset, and an unused `0`.
+    #
+    # @return [String] the packed ranges.
+    def pack_ranges
+    end
+
+    ##
+    # Exports every fix-it as packed unsigned 32-bit integers, laid out as in {#pack_ranges} with the id of the
+    # replacement text into {#strings} last.
+    #
+    # @return [String] the packed fix-its.
+    def pack_fixits
+    end
+  end
+
+  class TranslationUnit
+
+    ##
+    # Decodes every diagnostic of the translation unit, children included, in a single native pass.
+    #
+    # @return [DiagnosticTable] the diagnostics.
+    # @note The GVL is released while the diagnostics are decoded.
+    def diagnostics_table
+    end
+  end
+
+  class DiagnosticSet
+
+    ##
+    # Decodes every diagnostic of the set, children included, in a single native pass.
+    #
+    # @return [DiagnosticTable] the diagnostics.
+    # @note The GVL is released while the diagnostics are decoded.
+    def to_records
+    end
+  end
+end
@@ -56,6 +56,7 @@ module Clang
     #
     # @param integer [Integer] A set of flags OR'ed toegether. 
     # @return [Array<Symbol>] The array of Symbol objects containing the names of the set flags.
+    # @note The returned array is frozen, and is shared by subsequent calls with the same value.
     def unmask(integer)
     end
 
@@ -6,17 +6,60 @@ module Clang
   # system along with the current contents of that file that have not
   # yet been saved to disk.
   class UnsavedFile
+
+    ##
+    # Creates an unsaved file whose contents are a read-only mapping of another file, such as the buffer an editor has
+    # written to a temporary file, without reading it into memory.
+    #
+    # @param filename [String] The file whose contents have not yet been saved.
+    # @param path [String] The file to map, which is the file itself when omitted.
+    # @return [UnsavedFile] the new instance.
+    # @raise [SystemCallError] when the file cannot be opened or mapped.
+    #
+    # @note **The mapping is not a snapshot.** Writes to the mapped file show through, so libclang may parse a mix of
+    #   old and new contents, and truncating it while a parse, reparse or completion reads it crashes the process with
+    #   SIGBUS instead of raising an error. Never rewrite the file in place while the instance may be in use: write the
+    #   new contents to a new file and map that instead, or use {#initialize} with a String for contents that can
+    #   change.
+    def self.map(filename, path = filename)
+    end
+
     ##
     # Creates a new instance of the {UnsavedFile} class.
     #
+    # The contents are not copied: a frozen String is used as is, and any other is frozen in a way that leaves the
+    # original mutable, so that later changes to it are not seen by the unsaved file.
+    #
     # @param path [String] The file whose contents have not yet been saved, which must already exist in the file system.
     # @param contents [String] The unsaved contents of this file.
     def initialize(path, contents)
     end
+
+    ##
+    # @return [String] the name of the file.
+    def filename
+    end
+
+    ##
+    # @return [String, nil] the unsaved contents, which are copied out of the mapping for a mapped file.
+    def contents
+    end
+
+    ##
+    # @return [Integer] the size of the contents, in bytes.
+    def size
+    end
+
+    ##
+    # @return [Boolean] `true` if the contents are a mapped file, otherwise `false`.
+    def mapped?
+    end
   end
 
   ##
   # A particular source file that is part of a translation unit.
+  #
+  # A file keeps the translation unit it was found in alive, and cannot be used once that unit is disposed.
   class File
 
     ##
@@ -48,9 +91,19 @@ module Clang
 
     ##
     # Retrieve the string contents associated with the file.
+    #
+    # @see #buffer
     def contents
     end
 
+    ##
+    # Retrieves a view of the contents of the file, without copying them out of the memory of the translation unit.
+    #
+    # @param translation_unit [TranslationUnit] The translation unit the file belongs to.
+    # @return [FileBuffer, nil] a view of the whole file, or `nil` if the file is not part of the translation unit.
+    def buffer(translation_unit)
+    end
+
     ##
     # Determines if this instance is equal to another. If the other object is another {File} instance, determines
     # if both refer to the same file.
@@ -0,0 +1,104 @@
+module Clang
+
+  ##
+  # A frozen, read-only view of the contents of a file, created with {File#buffer}.
+  #
+  # The view points into the memory libclang already holds for the translation unit, which it keeps alive. Slicing a
+  # view creates another view of the same memory, so that the text of many tokens and cursors can be taken from a
+  # large file without copying it. Only {#to_s} and {#byteslice} copy bytes into a String.
+  #
+  # The memory is released when the translation unit is disposed, reparsed or suspended. After that, reading a view
+  # raises a `RuntimeError`. While a view is read, its translation unit is locked as in {Cursor#visit_children}, so
+  # other threads wait to reparse or dispose it.
+  #
+  # @example Slice the text of every function declaration out of a header
+  #   buffer = file.buffer(unit)
+  #   unit.cursor.each do |cursor|
+  #     next unless cursor.kind == :FUNCTION_DECL && cursor.location.file == file
+  #     puts buffer[cursor.extent]
+  #   end
+  class FileBuffer
+
+    ##
+    # @return [Integer] the number of bytes in the view.
+    def size
+    end
+
+    alias_method :bytesize, :size
+    alias_method :length, :size
+
+    ##
+    # @return [Integer] the byte offset of the view within its file.
+    def offset
+    end
+
+    ##
+    # @return [TranslationUnit] the translation unit that holds the memory of the view.
+    def translation_unit
+    end
+
+    ##
+    # @return [Boolean] `true` if the memory of the view can still be read, otherwise `false`.
+    def valid?
+    end
+
+    ##
+    # Creates a view of part of this view, without copying.
+    #
+    # Like `String#byteslice`, the view is clamped to the end of this one, and `nil` is returned when it starts outside
+    # of it.
+    #
+    # @overload slice(start, length)
+    #   @param start [Integer] The byte offset within this view, which may be negative to count from the end.
+    #   @param length [Integer] The number of bytes.
+    #
+    # @overload slice(range)
+    #   @param range [Range] The range of byte offsets within this view.
+    #
+    # @overload slice(extent)
+    #   @param extent [SourceRange] A range of the file, such as the extent of a cursor or token. Its offsets are
+    #     within the file rather than this view, and `nil` is returned when it is a range of another file.
+    #
+    # @return [FileBuffer, nil] the view.
+    def slice
+    end
+
+    alias_method :[], :slice
+
+    ##
+    # Copies part of this view into a new String. Accepts the same arguments as {#slice}.
+    #
+    # @return [String, nil] the copied bytes.
+    def byteslice
+    end
+
+    ##
+    # @param index [Integer] The byte offset within this view.
+    # @return [Integer, nil] the byte at the offset, or `nil` when out of range.
+    def getbyte(index)
+    end
+
+    ##
+    # Searches the view for a string, without copying.
+    #
+    # @param str [String] The string to search for.
+    # @param offset [Integer] The byte offset to start searching at.
+    # @return [Integer, nil] the byte offset of the first occurrence within this view, or `nil` if not found.
+    def index(str, offset = 0)
+    end
+
+    ##
+    # @return [String] a copy of the bytes of the view.
+    def to_s
+    end
+
+    alias_method :to_str, :to_s
+
+    ##
+    # @param other [FileBuffer, String] The object to compare with. A view of another translation unit is copied
+    #   before comparing.
+    # @return [Boolean] `true` if the other object has the same bytes, otherwise `false`.
+    def ==(other)
+    end
+  end
+end
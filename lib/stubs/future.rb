@@ -0,0 +1,59 @@
+module Clang
+
+  ##
+  # The pending result of a request made with {TranslationUnit#reparse_async} or
+  # {TranslationUnit#code_complete_async}.
+  #
+  # The request runs on a native thread owned by the translation unit, without holding the GVL. A future that is
+  # garbage collected before its request has started cancels it.
+  class Future
+
+    ##
+    # Raised by {Future#value} when the request was cancelled, or superseded by a newer request of the same kind
+    # before it started.
+    class CancelledError < StandardError
+    end
+
+    ##
+    # Waits for the request to finish and returns its result.
+    #
+    # @return [TranslationUnit,CodeCompleteResults,nil] the reparsed translation unit, or the completion results.
+    # @raise [CancelledError] when the request was cancelled or superseded.
+    # @raise [RuntimeError] when reparsing failed, or another error describing the failure reported by Clang. Also raised
+    #   when the request has not started and the calling thread is traversing the translation unit, as requests only
+    #   run once the traversal has returned.
+    def value
+    end
+
+    ##
+    # Waits for the request to finish, without holding the GVL.
+    #
+    # @param timeout [Numeric?] The maximum number of seconds to wait, or `nil` to wait indefinitely.
+    #
+    # @return [Boolean] `true` if the request has finished or was cancelled, otherwise `false` if the timeout expired.
+    def wait(timeout = nil)
+    end
+
+    ##
+    # @return [Boolean] `true` if the request has finished or was cancelled, otherwise `false`.
+    def ready?
+    end
+
+    ##
+    # @return [Boolean] `true` if the request was cancelled or superseded, otherwise `false`.
+    def cancelled?
+    end
+
+    ##
+    # Cancels the request if it has not started yet. A request that is already running is allowed to finish.
+    #
+    # @return [Boolean] `true` if the request was cancelled, otherwise `false`.
+    def cancel
+    end
+
+    ##
+    # @return [TranslationUnit] the translation unit the request was made on.
+    def translation_unit
+    end
+  end
+end
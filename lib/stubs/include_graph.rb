@@ -0,0 +1,96 @@
+module Clang
+
+  ##
+  # The include relationships of the files of many translation units, for finding the units an edit affects.
+  #
+  # Each file is a node, interned once however many units include it, with one edge from each file to every file it
+  # includes directly. Inclusions are collected natively without the GVL, and edges are deduplicated as units are added.
+  #
+  # The graph is the union of the units added to it. Each edge is counted once for every unit that has it, so adding a
+  # unit again after it was reparsed replaces its edges, dropping those no other unit has, and removing a unit drops
+  # its edges the same way.
+  #
+  # @example Reparse only the units affected by a header edit
+  #   graph = Clang::IncludeGraph.new
+  #   units.each { |unit| graph.add(unit) }
+  #   graph.affected_units('include/config.h').each { |name| units_by_name[name].reparse }
+  class IncludeGraph
+
+    ##
+    # Adds the inclusions of a translation unit to the graph.
+    #
+    # Adding a unit under a name it was added with before replaces its edges.
+    #
+    # @param unit [TranslationUnit] The translation unit.
+    # @param name [String?] The name to refer to the unit by, or `nil` to use the path of its main file.
+    #
+    # @return [String?] the name of the unit, or `nil` if it has no main file.
+    def add(unit, name = nil)
+    end
+
+    ##
+    # Removes a unit from the graph, along with the edges no other unit has.
+    #
+    # @param name [String] The name the unit was added with.
+    #
+    # @return [Boolean] `true` if the unit was in the graph.
+    def remove(name)
+    end
+
+    ##
+    # @param path [String] The path of a file.
+    # @param transitive [Boolean] `true` to also list the files included indirectly.
+    #
+    # @return [Array<String>] the files the file includes.
+    def includes(path, transitive: false)
+    end
+
+    ##
+    # @param path [String] The path of a file.
+    # @param transitive [Boolean] `true` to also list the files that include it indirectly.
+    #
+    # @return [Array<String>] the files that include the file.
+    def includers(path, transitive: false)
+    end
+
+    ##
+    # Finds the units whose main file is, or transitively includes, any of the given files.
+    #
+    # @param paths [String,Array<String>] The paths of the files that changed.
+    #
+    # @return [Array<String>] the names of the affected units.
+    def affected_units(*paths)
+    end
+
+    ##
+    # @return [Array<String>] the paths of every file in the graph, that is with an edge or the main file of a unit.
+    def files
+    end
+
+    ##
+    # @return [Array<String>] the names of every unit that was added.
+    def units
+    end
+
+    ##
+    # @param name [String] The name of a unit.
+    # @return [String?] the path of the main file of the unit, or `nil` if no unit has the name.
+    def unit_file(name)
+    end
+
+    ##
+    # @return [Array<Array(String, String)>] every edge, as pairs of the including and the included file.
+    def edges
+    end
+
+    ##
+    # @return [Integer] the number of files in the graph.
+    def size
+    end
+
+    ##
+    # @return [Integer] the number of distinct edges in the graph.
+    def edge_count
+    end
+  end
+end
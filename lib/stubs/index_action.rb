@@ -0,0 +1,139 @@
+module Clang
+
+  ##
+  # Indexes source files with the libclang indexer, collecting every event natively.
+  #
+  # Declarations, references and inclusions are recorded in native buffers while Clang runs, without holding the GVL,
+  # and are returned together as an {IndexResult} keyed by USR. No Ruby code runs per event.
+  #
+  # An action may be reused for many files, which lets `:skip_parsed_bodies_in_session` skip bodies of headers that
+  # were already indexed with it.
+  class IndexAction
+
+    ##
+    # Creates a new index action.
+    #
+    # @param index [Index] The index the files are parsed with.
+    def initialize(index)
+    end
+
+    ##
+    # @return [Index] the index the action was created with.
+    def index
+    end
+
+    ##
+    # Parses and indexes a source file.
+    #
+    # @param source [String?] The name of the source file to index.
+    # @param command_args [Array<String>?] The command-line arguments that would be passed to the `clang` executable.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk.
+    # @param options [Symbol,Array<Symbol>] A set of options that affects indexing.
+    # @param unit_options [Symbol,Array<Symbol>?] The options the file is parsed with.
+    #
+    # @return [IndexResult] everything that was indexed.
+    # @note The GVL is released while indexing, and an interrupt such as `Thread#raise` stops the indexer early.
+    # @see IndexOptFlags
+    # @see TranslationUnitFlags
+    def index_source(source, command_args = nil, unsaved = nil, *options, unit_options: nil)
+    end
+
+    ##
+    # Indexes a translation unit that has already been parsed.
+    #
+    # @param unit [TranslationUnit] The translation unit to index.
+    # @param options [Symbol,Array<Symbol>] A set of options that affects indexing.
+    #
+    # @return [IndexResult] everything that was indexed.
+    # @note The GVL is released while indexing.
+    # @see IndexOptFlags
+    def index_translation_unit(unit, *options)
+    end
+  end
+
+  ##
+  # The entities found by an {IndexAction}, with their declarations and references, keyed by USR.
+  #
+  # Records are only converted to Ruby objects when queried. Each entity is a Hash with the `:usr`, `:name`, `:kind`
+  # ({IdxEntityKind}), `:language` ({IdxEntityLanguage}), `:declaration_count` and `:reference_count` keys.
+  class IndexResult
+
+    include Enumerable
+
+    ##
+    # @return [Integer] the number of distinct entities.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Integer] the total number of declarations.
+    def declaration_count
+    end
+
+    ##
+    # @return [Integer] the total number of references.
+    def reference_count
+    end
+
+    ##
+    # @return [Array<String>] the USR of every entity, in the order first seen.
+    def usrs
+    end
+
+    ##
+    # @overload each(&block)
+    #   Yields each entity, in the order first seen.
+    #   @yieldparam entity [Hash{Symbol => Object}] The entity.
+    #   @return [self]
+    #
+    # @overload each
+    #   @return [Enumerator]
+    def each
+    end
+
+    ##
+    # @param usr [String] The USR of an entity.
+    # @return [Hash{Symbol => Object}?] the entity, or `nil` if it was not indexed.
+    def entity(usr)
+    end
+
+    alias_method :[], :entity
+
+    ##
+    # Retrieves the declarations of an entity, in the order they were indexed.
+    #
+    # Each is a Hash with the `:file`, `:line`, `:column`, `:offset`, `:container` (the USR of the enclosing entity,
+    # or `nil`), `:definition`, `:redeclaration` and `:implicit` keys.
+    #
+    # @param usr [String] The USR of an entity.
+    # @return [Array<Hash{Symbol => Object}>] the declarations, empty if the entity was not indexed.
+    def declarations(usr)
+    end
+
+    ##
+    # Retrieves the references to an entity, in the order they were indexed.
+    #
+    # Each is a Hash with the `:file`, `:line`, `:column`, `:offset`, `:container` (the USR of the entity the
+    # reference occurs in, or `nil`) and `:implicit` keys.
+    #
+    # @param usr [String] The USR of an entity.
+    # @return [Array<Hash{Symbol => Object}>] the references, empty if the entity was not indexed.
+    def references(usr)
+    end
+
+    ##
+    # Retrieves every inclusion directive, each a Hash with the `:file`, `:line` and `:column` of the directive, the
+    # `:included` file name, and the `:angled`, `:import` and `:module` flags.
+    #
+    # @return [Array<Hash{Symbol => Object}>] the inclusions, in the order they were processed.
+    def includes
+    end
+
+    ##
+    # @return [String?] the name of the main file that was indexed.
+    def main_file
+    end
+  end
+end
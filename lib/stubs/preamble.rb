@@ -0,0 +1,106 @@
+module Clang
+
+  ##
+  # A precompiled header shared by sources that start with the same include directives.
+  #
+  # The headers are compiled once into a PCH, and each source that starts with them is parsed with `-include-pch`, so
+  # only what follows the shared prefix is parsed. A source includes the same headers again, which are skipped because
+  # they are include-guarded. A header that is not guarded, such as `<assert.h>`, ends the shared prefix.
+  #
+  # Sources must be parsed with the same arguments as the preamble. Creating the {Index} with `exclude_pch` leaves the
+  # declarations of the preamble out of cursor traversal.
+  #
+  # @example Share the headers of a directory
+  #   sources = Dir['src/*.c']
+  #   includes = Clang::Preamble.common(sources)
+  #   preamble = Clang::Preamble.new(index, 'build/common.pch', includes, args, directory: 'src')
+  #   units = sources.map { |source| preamble.parse(index, source, args, nil, :precompiled_preamble) }
+  class Preamble
+
+    ##
+    # Lists the include directives at the top of a source file, up to the first line that is not one.
+    #
+    # @param source [String] The path of the source file.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] Files whose contents are used instead of the files on disk.
+    #
+    # @return [Array<String>] the directives, such as `#include <stdio.h>`.
+    def self.scan(source, unsaved = nil)
+    end
+
+    ##
+    # Finds the include directives that every source starts with.
+    #
+    # @param sources [Array<String>] The paths of the source files.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] Files whose contents are used instead of the files on disk.
+    #
+    # @return [Array<String>] the longest prefix of directives common to all of the sources.
+    def self.common(sources, unsaved = nil)
+    end
+
+    ##
+    # Compiles the headers into a precompiled header.
+    #
+    # The directives are written to a header beside the PCH, with `.h` appended to its path. The PCH is written to a
+    # temporary file and renamed over the destination.
+    #
+    # @param index [Index] The index the header is parsed with.
+    # @param path [String] The path of the PCH to write.
+    # @param includes [Array<String>] The include directives, as returned by {.common}.
+    # @param command_args [Array<String>?] The command-line arguments the sources are parsed with.
+    # @param directory [String?] The directory quoted includes are resolved from, typically that of the sources.
+    # @param language [String?] The language of the sources, such as `"c++"`, or `nil` to detect it from the arguments.
+    #
+    # @raise [ArgumentError] when none of the headers are include-guarded.
+    def initialize(index, path, includes, command_args = nil, directory: nil, language: nil)
+    end
+
+    ##
+    # @return [String] the path of the precompiled header.
+    def path
+    end
+
+    ##
+    # @return [Array<String>] the include directives that were precompiled.
+    def includes
+    end
+
+    ##
+    # @return [Array<String>] the paths of every file the precompiled header depends on.
+    def dependencies
+    end
+
+    ##
+    # @param command_args [Array<String>?] The command-line arguments of a source.
+    # @return [Array<String>] the arguments with the precompiled header included.
+    def args(command_args = nil)
+    end
+
+    ##
+    # @param source [String] The path of the source file.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] Files whose contents are used instead of the files on disk.
+    #
+    # @return [Boolean] `true` if the source starts with every header of the preamble, otherwise `false`.
+    def covers?(source, unsaved = nil)
+    end
+
+    ##
+    # Parses a source, using the precompiled header when the source starts with its headers.
+    #
+    # @param index [Index] The index to parse the source with.
+    # @param source [String] The name of the source file to parse.
+    # @param command_args [Array<String>?] The command-line arguments that would be passed to the `clang` executable.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk.
+    # @param options [Symbol,Array<Symbol>] A set of options that affects parsing.
+    #
+    # @return [TranslationUnit] the translation unit.
+    # @see TranslationUnit.parse
+    def parse(index, source, command_args = nil, unsaved = nil, *options)
+    end
+
+    ##
+    # @return [Boolean] `true` if the precompiled header is missing or any of its dependencies changed, otherwise
+    #   `false`.
+    def stale?
+    end
+  end
+end
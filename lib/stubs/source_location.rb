@@ -3,6 +3,36 @@ module Clang
   # Identifies a specific source location within a translation unit.
   class SourceLocation
 
+    ##
+    # The file, line, column and offset of a {SourceLocation}, retrieved at once with {SourceLocation#decode}.
+    #
+    # Instances are frozen. {#file} is always a {File} and {#path} always a String. A `:presumed` location is only known
+    # by the file name given by a `#line` directive, so its {#path} is that name, while its {#file} and {#offset} are
+    # `nil`.
+    #
+    # @!attribute [r] file
+    #   @return [File, nil] the file the location resides in, or `nil` if it has none or is presumed.
+    # @!attribute [r] line
+    #   @return [Integer] the line number of the location.
+    # @!attribute [r] column
+    #   @return [Integer] the column number of the location.
+    # @!attribute [r] offset
+    #   @return [Integer, nil] the byte offset of the location within its file.
+    # @!attribute [r] path
+    #   @return [String, nil] the name of the file the location resides in, or `nil` if it has none.
+    class Decoded < Struct
+    end
+
+    ##
+    # Decodes many locations in a single call.
+    #
+    # @param locations [Array<SourceLocation>] The locations to decode.
+    # @param type [Symbol] A flag indicating the strategy used to determine the result in the case of macros, see
+    #   {#decode}.
+    # @return [Array<Decoded>] the decoded locations, in the same order.
+    def self.decode(locations, type = :file)
+    end
+
     ##
     # Retrieve a `NULL` (invalid) {SourceLocation} instance.
     # @return [SourceLocation] The new instance.
@@ -37,6 +67,23 @@ module Clang
     def main_file?
     end
 
+    ##
+    # Retrieves the file, line, column and offset of the location with a single call into libclang.
+    #
+    # The result is kept for each type, so that decoding the same location again, or calling {#file}, {#line},
+    # {#column} or {#offset}, does not call into libclang or allocate.
+    #
+    # @param type [Symbol] A flag indicating the strategy used to determine the result in the case of macros.
+    #   <ul>
+    #     <li><b>:file</b> If the location refers into a macro expansion, return where the macro was expanded or where the macro argument was written, if the location points at a macro argument.</li>
+    #     <li><b>:presumed</b> The location as described by a <code>#line</code> directive.</li>
+    #     <li><b>:spelling</b> If the location refers to a macro instantiation, return where the location was originally  spelled in the source file.</li>
+    #     <li><b>:expansion</b> If the location refers into a macro expansion, retrieves the location of the macro expansion.</li>
+    #   </ul>
+    # @return [Decoded] the decoded location.
+    def decode(type = :file)
+    end
+
     ##
     # Retrieves the file the location resides in.
     #
@@ -47,7 +94,8 @@ module Clang
     #     <li><b>:spelling</b> If the location refers to a macro instantiation, return where the location was originally  spelled in the source file.</li>
     #     <li><b>:expansion</b> If the location refers into a macro expansion, retrieves the location of the macro expansion.</li>
     #   </ul>
-    # @return [File] The source file for the location.
+    # @return [File, String, nil] The source file for the location, the file name for `:presumed`, or `nil` if it has
+    #   no file.
     def file(type = :file)
     end
 
@@ -0,0 +1,106 @@
+module Clang
+
+  ##
+  # A persistent index of the declarations, definitions and references of symbols across a project, keyed by USR.
+  #
+  # The saved index is memory-mapped, so it is queried without parsing anything or reading it into memory first. Files
+  # indexed since the last save are held in memory and take precedence over the saved records of the same files, until
+  # {#save} writes both out together.
+  #
+  # Each record is a Hash with the `:file`, `:line`, `:column` and `:offset` keys. Declarations also have a
+  # `:definition` key, which is `true` when the declaration is a definition.
+  #
+  # @example Find every reference to a function
+  #   index = Clang::SymbolIndex.new('project.idx')
+  #   index.add(unit)
+  #   index.save
+  #   index.references(Clang::USR.from_cursor(cursor))
+  class SymbolIndex
+
+    ##
+    # Creates a new symbol index, mapping the file at the given path if it exists.
+    #
+    # @param path [String?] The file the index is saved to and loaded from.
+    # @raise [IOError] when the file exists but is not a valid symbol index.
+    def initialize(path = nil)
+    end
+
+    ##
+    # @return [String?] the file the index is saved to.
+    def path
+    end
+
+    ##
+    # @return [Integer] the number of distinct symbols that are recorded.
+    def size
+    end
+
+    ##
+    # Records the symbols of every file in a translation unit that changed since it was last indexed.
+    #
+    # A file is indexed again only when its modification time (see {File#time}) differs from the one it was recorded
+    # with, so headers shared by many translation units are visited once.
+    #
+    # @param unit [TranslationUnit] The translation unit to index.
+    #
+    # @return [Array<String>] the paths of the files that were indexed, which is empty when the visit was interrupted by a
+    #   signal whose handler did not raise, in which case nothing is recorded.
+    # @note The GVL is released while the translation unit is visited.
+    def add(unit)
+    end
+
+    alias_method :update, :add
+
+    ##
+    # Removes the records of a file from the index.
+    #
+    # @param path [String] The path of the file.
+    #
+    # @return [Boolean] `true` if the file was in the index, otherwise `false`.
+    def remove(path)
+    end
+
+    ##
+    # @param usr [String] The USR of the symbol, as given by {USR.from_cursor}.
+    #
+    # @return [Array<Hash>] the declarations of the symbol, including its definitions.
+    def declarations(usr)
+    end
+
+    ##
+    # @param usr [String] The USR of the symbol, as given by {USR.from_cursor}.
+    #
+    # @return [Array<Hash>] the definitions of the symbol.
+    def definitions(usr)
+    end
+
+    ##
+    # @param usr [String] The USR of the symbol, as given by {USR.from_cursor}.
+    #
+    # @return [Array<Hash>] the references to the symbol.
+    def references(usr)
+    end
+
+    ##
+    # @return [Array<String>] the paths of every file in the index.
+    def files
+    end
+
+    ##
+    # @return [Array<String>] the paths of the files that were modified or deleted since they were indexed.
+    def stale_files
+    end
+
+    ##
+    # Writes the index to a file and maps it in place of the records held in memory.
+    #
+    # The index is written to a temporary file that is renamed over the destination, so readers never see a partial
+    # index.
+    #
+    # @param path [String?] The file to write, or `nil` to use {#path}.
+    #
+    # @return [self]
+    def save(path = nil)
+    end
+  end
+end
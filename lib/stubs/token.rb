@@ -0,0 +1,95 @@
+module Clang
+
+  class TokenSet
+
+    ##
+    # Extracts the whole token stream in a single native pass, without creating a {Token} per token.
+    #
+    # The returned Hash contains the following keys.
+    #
+    # Key | Value
+    # --- | ---
+    # `:kinds` | The {TokenKind} value of each token, packed as native 32-bit unsigned integers (`unpack("L*")`).
+    # `:starts` | The byte offset at which each token starts, packed the same way.
+    # `:ends` | The byte offset just past the end of each token, packed the same way.
+    # `:file` | The name of the file the tokens were lexed from, or `nil` if the set is empty.
+    # `:source` | A {FileBuffer} over the contents of that file, viewed in place rather than copied, or `nil`.
+    # `:spellings` | The spelling of each token, each a {FileBuffer} viewing its bytes within `:source`.
+    #
+    # A token whose extent lies outside the file of the first token has offsets of `0xFFFFFFFF` and a `nil` spelling.
+    #
+    # Like any {FileBuffer}, `:source` and the spellings can no longer be read once the unit is reparsed, suspended or
+    # disposed, so call {FileBuffer#to_s} on those that must outlive it. The packed arrays are independent copies.
+    #
+    # @param spellings [Boolean] `false` to omit the `:spellings` array when only the offsets are needed, which saves
+    #   creating an object per token.
+    #
+    # @return [Hash{Symbol => Object}] the packed token stream.
+    # @note The GVL is released while the tokens are measured.
+    def to_packed(spellings: true)
+    end
+
+    ##
+    # Classifies each token for semantic highlighting in a single native pass, without holding the GVL.
+    #
+    # Tokens are annotated with their cursors, and identifiers are classified by the declaration they refer to. The
+    # result is encoded as the Language Server Protocol expects, using the legend in {SemanticTokens::TOKEN_TYPES} and
+    # {SemanticTokens::TOKEN_MODIFIERS}. Punctuation, unresolved identifiers and tokens spanning several lines are
+    # omitted.
+    #
+    # @param encoding [Symbol] The position encoding negotiated with the client, one of `:utf16`, the default of the
+    #   protocol, `:utf8` or `:utf32`, in which columns and lengths are counted.
+    #
+    # @return [SemanticTokens] the encoded tokens.
+    # @raise [ArgumentError] when the encoding is not known.
+    def semantic_tokens(encoding: :utf16)
+    end
+  end
+
+  ##
+  # The semantic tokens of a {TokenSet}, created with {TokenSet#semantic_tokens}.
+  #
+  # Each token is five integers: the line delta, the start column (relative to the previous token when on the same
+  # line), the length, the index of the token type, and the modifier bitmask. Lines and columns are zero-based, and
+  # columns and lengths are counted in the position encoding the tokens were created with, UTF-16 code units unless
+  # another was given.
+  class SemanticTokens
+
+    ##
+    # The token types, indexed by the fourth integer of each token.
+    TOKEN_TYPES = []
+
+    ##
+    # The token modifiers, where the bit `1 << i` of the fifth integer of each token is set for the modifier at `i`.
+    TOKEN_MODIFIERS = []
+
+    ##
+    # @return [Integer] the number of tokens.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Array<Integer>] the encoded tokens, as sent in the `data` of a `textDocument/semanticTokens/full`
+    #   response.
+    def data
+    end
+
+    ##
+    # @return [String] the encoded tokens packed as native 32-bit unsigned integers (`unpack("L*")`).
+    def pack
+    end
+
+    ##
+    # Computes the edits that turn a previous result for the same file into this one, as sent in a
+    # `textDocument/semanticTokens/full/delta` response.
+    #
+    # @param previous [SemanticTokens] The result previously sent to the client.
+    #
+    # @return [Array<Hash{Symbol => Object}>] the edits, each with the `:start`, `:deleteCount` and `:data` keys, or
+    #   an empty Array when nothing changed.
+    def edits(previous)
+    end
+  end
+end
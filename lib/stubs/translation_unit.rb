@@ -1,6 +1,13 @@
 module Clang
   ##
   # A single translation unit, which resides in an {Index}.
+  #
+  # The native heap memory held by a translation unit, as reported by {#resource_usage}, is reported to the garbage
+  # collector and by `ObjectSpace.memsize_of`, so that unreferenced units are collected in proportion to their size.
+  # The amount is refreshed whenever the unit is reparsed, suspended or used for code completion.
+  #
+  # Cursors, types, source locations, source ranges and tokens obtained from a translation unit keep it alive, and
+  # raise a `RuntimeError` once it has been disposed with {#dispose} instead of reading freed memory.
   class TranslationUnit
 
     ##
@@ -54,13 +61,19 @@ module Clang
     # @param command_args [Array<String>?] The command-line arguments that would be passed to the `clang` executable if
     #   it were being invoked out-of-process. These command-line options will be parsed and will affect how the
     #   translation unit is parsed.
-    # @param unsaved [Array<UnsavedFile>?] The files that have not yet been saved to disk but may be required for code
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk but may be required for code
     #   completion, including the contents of those files.
     #
     # @note The 'source_file' argument is optional, though when `nil`, the name of the source file is expected to
     #   reside in the specified command line arguments.
     #
+    # @overload from_source(index, source_file = nil, command_args = nil, unsaved = nil, &block)
+    #   When called with a block, yields the translation unit and disposes of it once the block returns.
+    #   @yieldparam unit [TranslationUnit] The newly created translation unit.
+    #   @return [Object] the result of the block.
+    #
     # @return [TranslationUnit] the newly created translation unit.
+    # @note The GVL is released while the source is parsed.
     def self.from_source(index, source_file = nil, command_args = nil, unsaved = nil)
     end
 
@@ -79,7 +92,7 @@ module Clang
     # @param command_args [Array<String>?] The command-line arguments that would be passed to the `clang` executable if
     #   it were being invoked out-of-process. These command-line options will be parsed and will affect how the
     #   translation unit is parsed.
-    # @param unsaved [Array<UnsavedFile>?] The files that have not yet been saved to disk but may be required for code
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk but may be required for code
     #   completion, including the contents of those files.
     # @param options [Symbol,Array<Symbol>] A set of options that affects how the translation unit is managed but not
     #   its compilation.
@@ -87,19 +100,81 @@ module Clang
     # @note The 'source_file' argument is optional, though when `nil`, the name of the source file is expected to
     #   reside in the specified command line arguments.
     #
+    # @note The arguments are copied into native memory and the GVL is released while Clang parses, so other Ruby
+    #   threads continue to run, and several threads may parse different translation units concurrently.
+    #
+    # @overload parse(index, source_file = nil, command_args = nil, unsaved = nil, *options, &block)
+    #   When called with a block, yields the translation unit and disposes of it once the block returns, so that the
+    #   memory of the AST is released without waiting for the garbage collector.
+    #   @yieldparam unit [TranslationUnit] The newly created translation unit.
+    #   @return [Object] the result of the block.
+    #
     # @return [TranslationUnit] the newly created translation unit.
     # @see TranslationUnitFlags
     def self.parse(index, source_file = nil, command_args = nil, unsaved = nil, *options)
     end
 
+    ##
+    # Parses a set of source files on a pool of native threads, yielding each result as soon as it completes.
+    #
+    # Every source is parsed with the same command line arguments, unsaved files and options, exactly as {parse}
+    # would. The parses run without holding the GVL, and results are yielded in completion order from the calling
+    # thread. A source that fails to parse yields the exception that {parse} would have raised instead of raising it.
+    # Leaving the block early (i.e. `break` or an exception) cancels the sources that have not yet started, and
+    # disposes any translation units that were not yielded.
+    #
+    # libclang does not support concurrent parses within one index, so each worker thread creates its own {Index}. Each
+    # index copies the `exclude_pch` and `display` flags of `index` and its {Index#global_opts}, and units are associated
+    # with the index of the worker that parsed them.
+    #
+    # @overload parse_all(index, sources, command_args = nil, unsaved = nil, *options, threads: nil, &block)
+    #   @yieldparam source [String] The source file that was parsed.
+    #   @yieldparam result [TranslationUnit,Exception] The translation unit, or the error that prevented its creation.
+    #   @return [void]
+    #
+    # @overload parse_all(index, sources, command_args = nil, unsaved = nil, *options, threads: nil)
+    #   When called without a block, returns an Enumerator for the results.
+    #   @return [Enumerator]
+    #
+    # @param index [Index] The index whose flags and global options the indices of the workers are created with.
+    # @param sources [Array<String>] The source files to parse.
+    # @param command_args [Array<String>?] The command-line arguments used to parse each source.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk, shared by every source.
+    # @param options [Symbol,Array<Symbol>] A set of options that affects how the translation units are managed.
+    # @param threads [Integer?] The number of worker threads, which defaults to the number of online processors.
+    #
+    # @see parse
+    # @see TranslationUnitFlags
+    def self.parse_all(index, sources, command_args = nil, unsaved = nil, *options, threads: nil)
+    end
+
     ##
     # Creates a new instance of the {TranslationUnit} class from the specified AST file (`-emit-ast`).
     #
     # @param index [Index] The index object with which the translation unit will be associated.
     # @param ast_path [String] The path to an AST file.
+    # @note The GVL is released while the AST is loaded.
     def initialize(index, ast_path)
     end
 
+    ##
+    # Releases the translation unit immediately, rather than when it is garbage collected. Any further use of the unit,
+    # or of a cursor, type, location, range or token obtained from it, raises a `RuntimeError`.
+    #
+    # Disposing an already disposed unit has no effect. When another thread is using the unit, this waits for it to
+    # finish. When called from within a traversal of the unit, such as the block of {Cursor#visit_children}, the
+    # traversal stops and the unit is released once it returns.
+    #
+    # @return [void]
+    # @raise [RuntimeError] when the unit is owned elsewhere, such as the one returned by {Comment#translation_unit}.
+    def dispose
+    end
+
+    ##
+    # @return [Boolean] `true` if the translation unit has been released with {#dispose}, otherwise `false`.
+    def disposed?
+    end
+
     ##
     # Retrieve all ranges that were skipped by the preprocessor.
     #
@@ -120,7 +195,8 @@ module Clang
     end
 
     ##
-    # Retrieve the complete set of diagnostics associated with a translation unit.
+    # Retrieve the complete set of diagnostics associated with a translation unit. The set belongs to the unit, which it
+    # keeps alive, and cannot be used once the unit is disposed.
     # @return [DiagnosticSet?] a set of diagnostics, or `nil` if none exist.
     def diagnostics
     end
@@ -157,6 +233,9 @@ module Clang
     # @param options [Symbol,Array<Symbol>] A set options that affects how the translation unit is saved.
     #
     # @return [self]
+    # @note The GVL is released while the translation unit is written. Other threads that use the translation unit
+    #   meanwhile wait for this method to return.
+    # @raise [RuntimeError] when called from within a traversal of the unit.
     # @see default_save_options
     # @see SaveTranslationUnitFlags
     def save(path, *options)
@@ -174,16 +253,38 @@ module Clang
     # creating a new translation unit with the same command-line arguments. However, it may be more efficient to
     # reparse a translation unit using this routine.
     #
-    # @param unsaved [Array<UnsavedFile>?] The files that have not yet been saved to disk but may be required for
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk but may be required for
     #   parsing, including the contents of those files.
     # @param options [Symbol,Array<Symbol>] A set options that affects how the translation unit is saved.
     #
     # @return [self]
+    # @note The GVL is released while reparsing. Other threads that use the translation unit meanwhile wait for this
+    #   method to return.
+    # @raise [RuntimeError] when called from within a traversal of the unit, such as the block of
+    #   {Cursor#visit_children}.
     # @see default_reparse_options
     # @see ReparseFlags
     def reparse(unsaved = nil, *options)
     end
 
+    ##
+    # Reparses the translation unit on a background thread, returning immediately.
+    #
+    # Requests made with {#reparse_async} and {#code_complete_async} run one at a time, in order, on a native thread
+    # owned by the translation unit. A newer request supersedes any request of the same kind that has not started yet,
+    # so rapidly repeated edits only reparse the latest contents. Any other use of the translation unit, or of cursors,
+    # types and locations from it, first waits for the queued requests to finish.
+    #
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] The files that have not yet been saved to disk but may be required for
+    #   parsing, including the contents of those files. They are copied before this method returns.
+    # @param options [Symbol,Array<Symbol>] A set options that affects how the translation unit is reparsed.
+    #
+    # @return [Future] a future whose value is this translation unit once reparsed.
+    # @raise [RuntimeError] when the unit is owned elsewhere, such as the one returned by {Comment#translation_unit}.
+    # @see reparse
+    def reparse_async(unsaved = nil, *options)
+    end
+
     ##
     # Suspend a translation unit in order to free memory associated with it.
     #
@@ -191,6 +292,7 @@ module Clang
     # than {#reparse}.
     #
     # @return [Boolean] `true` if successfully suspended, otherwise `false` if the operation failed.
+    # @raise [RuntimeError] when called from within a traversal of the unit.
     # @see reparse
     def suspend
     end
@@ -226,6 +328,19 @@ module Clang
     def cursor
     end
 
+    ##
+    # Builds a columnar snapshot of the entire abstract syntax tree, with a row for every cursor.
+    #
+    # The tree is walked once natively, without holding the GVL, and no Ruby objects are created until the table is
+    # queried. File names, spellings and USRs are interned, so each distinct string is stored only once.
+    #
+    # @param usr [Boolean] `false` to skip computing the USR of declarations, which is the most expensive column.
+    #
+    # @return [ASTTable] the table of cursors, in pre-order.
+    # @see cursor
+    def ast_table(usr: true)
+    end
+
     ##
     # Visits each included file in the translation unit, invoking the given block each time a file is included.
     #
@@ -281,14 +396,36 @@ module Clang
     # @param line [Integer] The line at which code-completion should occur.
     # @param column [Integer] The column at which code-completion should occur. Note that the column should point just
     #   after the syntactic construct that initiated code completion, and not in the middle of a lexical token.
-    # @param unsaved [Array<UnsavedFile>?] An optional array of files that have not yet been saved to disk but may be
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] An optional array of files that have not yet been saved to disk but may be
     #   required for parsing or code completion.
     # @param options [Symbol,Array<Symbol>] Extra options that control the behavior of code completion.
     #
     # @return [CodeCompleteResults?] If successful, a new {CodeCompleteResults} structure containing code-completion
     #   results, otherwise `nil`.
+    # @note The GVL is released while completing. Other threads that use the translation unit meanwhile wait for this
+    #   method to return.
+    # @raise [RuntimeError] when called from within a traversal of the unit.
     # @see CodeCompleteFlags
+    # @see code_complete_async
     def code_complete(filename, line, column, unsaved, *options)
     end
+
+    ##
+    # Performs code completion on a background thread, returning immediately.
+    #
+    # The request is queued behind any other asynchronous request on this translation unit, and supersedes a
+    # completion that has not started yet. See {#reparse_async} for how requests are run.
+    #
+    # @param filename [String] The name of the source file where code completion should be performed.
+    # @param line [Integer] The line at which code-completion should occur.
+    # @param column [Integer] The column at which code-completion should occur.
+    # @param unsaved [Array<UnsavedFile>, UnsavedFileSet, nil] An optional array of files that have not yet been saved to disk but may be
+    #   required for parsing or code completion. They are copied before this method returns.
+    # @param options [Symbol,Array<Symbol>] Extra options that control the behavior of code completion.
+    #
+    # @return [Future] a future whose value is a {CodeCompleteResults}, or `nil` if completion failed.
+    # @see code_complete
+    def code_complete_async(filename, line, column, unsaved, *options)
+    end
   end
 end
\ No newline at end of file
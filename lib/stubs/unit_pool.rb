@@ -0,0 +1,154 @@
+module Clang
+
+  ##
+  # A set of translation units kept within a memory budget, such as the open documents of a language server.
+  #
+  # Units are ordered by use. When the native memory of the pool exceeds its budget, the least recently used units are
+  # suspended with {TranslationUnit#suspend}, and if that is not enough, the coldest suspended ones are disposed and
+  # removed. A suspended unit is resumed with {TranslationUnit#reparse} the next time it is retrieved, using the
+  # unsaved files it was stored with. A unit that is in use by another thread or a traversal is neither suspended nor
+  # disposed, so the pool may stay over its budget until a later trim.
+  #
+  # Memory is measured as in {TranslationUnit#resource_usage}, excluding memory-mapped buffers.
+  #
+  # @example
+  #   pool = Clang::UnitPool.new(budget: 2 * 1024 * 1024 * 1024)
+  #   unit = pool.fetch(path, unsaved: files) { TranslationUnit.parse(index, path, args, files) }
+  class UnitPool
+
+    include Enumerable
+
+    ##
+    # Creates a new pool.
+    #
+    # @param budget [Integer?] The number of bytes of native memory the units may use, or `nil` for no limit.
+    def initialize(budget: nil)
+    end
+
+    ##
+    # Retrieves a unit, marking it as the most recently used and resuming it if it was suspended.
+    #
+    # @param key [Object] The key the unit was stored with, typically the path of its source file.
+    #
+    # @return [TranslationUnit?] the unit, or `nil` if the pool has no unit for the key.
+    def [](key)
+    end
+
+    ##
+    # Retrieves a unit as with {#[]}, creating it with the block when the pool has no unit for the key.
+    #
+    # @param key [Object] The key the unit was stored with.
+    # @param unsaved [UnsavedFileSet,Array<UnsavedFile>?] The unsaved files to store a created unit with, as in {#store}.
+    # @yieldparam key [Object] The key that was not found.
+    # @yieldreturn [TranslationUnit] the unit to store.
+    #
+    # @return [TranslationUnit] the unit.
+    # @raise [KeyError] when the key is not found and no block is given.
+    def fetch(key, unsaved: nil)
+    end
+
+    ##
+    # Adds a unit to the pool, taking ownership of it. A different unit that was stored with the key is disposed.
+    #
+    # @param key [Object] The key to store the unit with.
+    # @param unit [TranslationUnit] The unit to store.
+    # @param unsaved [UnsavedFileSet,Array<UnsavedFile>?] The unsaved files the unit was parsed with, which it is
+    #   resumed with after being suspended. Store the unit again with the new files whenever they change.
+    #
+    # @return [TranslationUnit] the unit.
+    def store(key, unit, unsaved: nil)
+    end
+
+    ##
+    # Adds a unit to the pool as with {#store}, without unsaved files.
+    #
+    # @param key [Object] The key to store the unit with.
+    # @param unit [TranslationUnit] The unit to store.
+    #
+    # @return [TranslationUnit] the unit.
+    def []=(key, unit)
+    end
+
+    ##
+    # Removes a unit from the pool without disposing it, giving ownership back to the caller.
+    #
+    # @param key [Object] The key the unit was stored with.
+    #
+    # @return [TranslationUnit?] the unit that was removed, or `nil` if there was none.
+    def delete(key)
+    end
+
+    ##
+    # Removes and disposes a unit.
+    #
+    # @param key [Object] The key the unit was stored with.
+    #
+    # @return [Boolean] `true` if a unit was disposed, otherwise `false`.
+    def evict(key)
+    end
+
+    ##
+    # @param key [Object] The key a unit was stored with.
+    # @return [Boolean] `true` if the pool has a unit for the key, otherwise `false`.
+    def include?(key)
+    end
+
+    ##
+    # @param key [Object] The key a unit was stored with.
+    # @return [Boolean] `true` if the unit was suspended by the pool, otherwise `false`.
+    def suspended?(key)
+    end
+
+    ##
+    # @return [Integer] the number of units in the pool.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Array<Object>] the keys of the units, least recently used first.
+    def keys
+    end
+
+    ##
+    # Enumerates the units, least recently used first, without changing their order.
+    #
+    # @yieldparam key [Object] The key the unit was stored with.
+    # @yieldparam unit [TranslationUnit] The unit.
+    #
+    # @return [self, Enumerator]
+    def each
+    end
+
+    ##
+    # @return [Integer] the number of bytes of native memory used by the units.
+    def memsize
+    end
+
+    ##
+    # @return [Integer?] the number of bytes of native memory the units may use, or `nil` for no limit.
+    # @note Setting a lower budget trims the pool immediately.
+    attr_accessor :budget
+
+    ##
+    # Suspends and disposes units until the pool is within its budget.
+    #
+    # @return [self]
+    def trim
+    end
+
+    ##
+    # Disposes every unit and empties the pool.
+    #
+    # @return [self]
+    def clear
+    end
+
+    ##
+    # @return [Hash{Symbol=>Integer}] the number of `:hits`, `:misses`, `:suspends`, `:resumes` and `:evictions`
+    #   since the pool was created, with the current number of `:units` and `:suspended` units and their `:memsize`.
+    def stats
+    end
+  end
+end
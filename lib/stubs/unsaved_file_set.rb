@@ -0,0 +1,88 @@
+module Clang
+
+  ##
+  # A frozen set of unsaved files, prepared once for libclang and accepted anywhere an array of {UnsavedFile} is.
+  #
+  # When an array is given, the files are validated and collected again for every call. A set is passed to libclang as
+  # is, which keeps repeated reparses and code completions with many open buffers cheap. Neither copies the contents.
+  #
+  # A set cannot be changed, instead {#merge} and {#except} return a new set that shares the files of this one.
+  #
+  # @example Reparse as the user types
+  #   buffers = Clang::UnsavedFileSet.new(open_files.map { |path, text| Clang::UnsavedFile.new(path, text.freeze) })
+  #   unit.reparse(buffers)
+  #
+  #   buffers = buffers.merge(Clang::UnsavedFile.new(path, edited_text.freeze))
+  #   unit.reparse(buffers)
+  #   unit.code_complete(path, line, column, buffers)
+  #
+  # @note Futures created with {TranslationUnit#reparse_async} or {TranslationUnit#code_complete_async} still copy the
+  #   contents, as their requests may outlive the set.
+  class UnsavedFileSet
+
+    include Enumerable
+
+    ##
+    # Creates a new set of unsaved files.
+    #
+    # @param files [Array<UnsavedFile>] The unsaved files.
+    def initialize(files = [])
+    end
+
+    ##
+    # Creates a new set with the given files added, replacing those of this set that have the same name.
+    #
+    # @param files [Array<UnsavedFile>, UnsavedFile, UnsavedFileSet] The files to add.
+    # @return [UnsavedFileSet] the new set.
+    def merge(*files)
+    end
+
+    ##
+    # Creates a new set without the files that have the given names.
+    #
+    # @param filenames [Array<String>] The names of the files to leave out.
+    # @return [UnsavedFileSet] the new set.
+    def except(*filenames)
+    end
+
+    ##
+    # @param key [Integer, String] The index of a file, or its name.
+    # @return [UnsavedFile, nil] the file, or `nil` if there is none.
+    def [](key)
+    end
+
+    ##
+    # @param filename [String] The name of a file.
+    # @return [Boolean] `true` if the set contains a file with the name, otherwise `false`.
+    def include?(filename)
+    end
+
+    ##
+    # @overload each(&block)
+    #   Yields each file of the set.
+    #   @yieldparam file [UnsavedFile] The current file.
+    #   @return [self]
+    #
+    # @overload each
+    #   @return [Enumerator]
+    def each
+    end
+
+    ##
+    # @return [Array<UnsavedFile>] the files of the set.
+    def to_a
+    end
+
+    ##
+    # @return [Integer] the number of files in the set.
+    def size
+    end
+
+    alias_method :length, :size
+
+    ##
+    # @return [Integer] the total size of the contents of every file, in bytes.
+    def bytesize
+    end
+  end
+end